@@ -19,8 +19,8 @@ option(BUILD_SERVICE_EXE "Build service executable" OFF)
 # Defines how many threads to use for the query system.
 option(BUILD_MAX_QUERY_THREADS "Build max query threads" 4)
 
-# Defines how many threads to use for the job system.
-option(BUILD_MAX_JOB_THREADS "Build max job threads" 4)
+# Defines the maximum number of threads to use for the job system (0 uses a thread per hardware thread).
+option(BUILD_MAX_JOB_THREADS "Build max job threads" 0)
 
 # Set the build tests option to OFF by default.
 option(BUILD_ENABLE_TESTS "Build tests" ON)
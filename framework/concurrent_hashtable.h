@@ -0,0 +1,438 @@
+/*
+ * Copyright 2022-2023 - All rights reserved.
+ * License: https://wiimag.com/LICENSE
+ */
+
+#pragma once
+
+#include <framework/memory.h>
+
+#include <foundation/atomic.h>
+
+#include "shared_mutex.h"
+
+/*! Concurrent open-addressing hash table mapping non-zero 64-bit keys to non-zero 64-bit values.
+ *
+ *  Lookups are lock-free and never wait for writers. Writers are serialized by a lock.
+ *
+ *  The table is rehashed online: once it gets half full, a new table is allocated and the entries
+ *  of the previous table are migrated a few slots at a time by the following writes. The new table
+ *  is sized for the entries still in the table, so it is twice as large when the table is growing
+ *  and the same size or smaller when most entries were removed.
+ *  Lookups check the new table first and then the previous one until the migration completes.
+ *
+ *  Removed entries keep their key with a zero value until the next migration, like #hashtable64_t.
+ *
+ *  @remark Lock-free readers might still use replaced tables, so writers release them with epochs: 
+ *          lookups register in the reader slot of their thread for the current epoch, and tables replaced 
+ *          during an epoch are released once the lookups registered for that epoch are done.
+ */
+class concurrent_hashtable64
+{
+    struct slot_t
+    {
+        atomic64_t key;
+        atomic64_t value;
+    };
+
+    struct table_t
+    {
+        uint64_t capacity;
+        uint32_t shift;
+
+        /*! Number of slots with a key, including removed entries. */
+        uint64_t used;
+
+        /*! Next table in the list of tables allocated by the hash table. */
+        table_t* next;
+
+        /*! Epoch during which the table got replaced, or -1 if it can still be used by new lookups. */
+        int64_t retired_epoch;
+
+        slot_t slots[1];
+    };
+
+    /*! Lookups in flight for the even and odd epochs, each thread uses one of the slots. */
+    struct reader_slot_t
+    {
+        alignas(64) atomic32_t count[2];
+    };
+
+    /*! Minimum number of slots of the previous table migrated by each write. */
+    static constexpr uint64_t MIGRATION_STEP = 16;
+
+    /*! Number of reader slots, so lookups of different threads rarely share a counter. */
+    static constexpr uint32_t READER_SLOTS = 16;
+
+public:
+
+    FOUNDATION_FORCEINLINE concurrent_hashtable64(uint64_t capacity = 16)
+    {
+        uint32_t shift = 64;
+        uint64_t table_capacity = 1;
+        while (table_capacity < capacity || table_capacity < 4)
+        {
+            table_capacity <<= 1;
+            shift--;
+        }
+
+        tables = table_allocate(table_capacity, shift);
+        atomic_store_ptr(&current, tables, memory_order_relaxed);
+        atomic_store_ptr(&previous, nullptr, memory_order_relaxed);
+        for (uint32_t i = 0; i < READER_SLOTS; ++i)
+        {
+            atomic_store32(&readers[i].count[0], 0, memory_order_relaxed);
+            atomic_store32(&readers[i].count[1], 0, memory_order_relaxed);
+        }
+        atomic_store64(&epoch, 0, memory_order_relaxed);
+        atomic_store64(&count, 0, memory_order_release);
+    }
+
+    FOUNDATION_FORCEINLINE ~concurrent_hashtable64()
+    {
+        while (tables)
+        {
+            table_t* next = tables->next;
+            memory_deallocate(tables);
+            tables = next;
+        }
+    }
+
+    /*! Returns the value of #key, or 0 if the key is not in the table. */
+    FOUNDATION_FORCEINLINE uint64_t get(uint64_t key) const
+    {
+        // Registered readers keep writers from releasing the tables they might be using.
+        // The registration only counts if the epoch did not change in the meantime.
+        reader_slot_t& slot = readers[reader_slot()];
+        int64_t reader_epoch = 0;
+        for (;;)
+        {
+            reader_epoch = atomic_load64(&epoch, memory_order_seq_cst);
+            atomic_incr32(&slot.count[reader_epoch & 1], memory_order_seq_cst);
+            if (atomic_load64(&epoch, memory_order_seq_cst) == reader_epoch)
+                break;
+            atomic_decr32(&slot.count[reader_epoch & 1], memory_order_release);
+        }
+
+        uint64_t value = 0;
+        for (;;)
+        {
+            // The previous table is loaded before looking into the current one, so entries
+            // migrated in the meantime are still found in the previous table.
+            const table_t* table = (const table_t*)atomic_load_ptr(&current, memory_order_seq_cst);
+            const table_t* migrating = (const table_t*)atomic_load_ptr(&previous, memory_order_seq_cst);
+            value = table_get(table, key);
+            if (value == 0 && migrating != nullptr && migrating != table)
+                value = table_get(migrating, key);
+
+            // A miss is only reliable if the table was not replaced during the lookup.
+            if (value != 0 || atomic_load_ptr(&current, memory_order_seq_cst) == table)
+                break;
+        }
+
+        atomic_decr32(&slot.count[reader_epoch & 1], memory_order_release);
+        return value;
+    }
+
+    FOUNDATION_FORCEINLINE bool contains(uint64_t key) const
+    {
+        return get(key) != 0;
+    }
+
+    /*! Sets the value of #key, whether it is already in the table or not. */
+    bool set(uint64_t key, uint64_t value)
+    {
+        return write(key, value, false);
+    }
+
+    /*! Adds #key to the table, only if it is not already in the table.
+     *
+     *  @return True if the key was added.
+     */
+    bool insert(uint64_t key, uint64_t value)
+    {
+        return write(key, value, true);
+    }
+
+    /*! Removes #key from the table.
+     *
+     *  @return True if the key was in the table.
+     */
+    bool erase(uint64_t key)
+    {
+        FOUNDATION_ASSERT(key);
+
+        SHARED_WRITE_LOCK(lock);
+        if (get(key) == 0)
+            return false;
+
+        // Clear the key in every table, so lookups falling back to the previous table do not find it.
+        for (table_t* table = tables; table; table = table->next)
+        {
+            slot_t* slot = table_find(table, key);
+            if (slot && (uint64_t)atomic_load64(&slot->key, memory_order_relaxed) == key)
+                atomic_store64(&slot->value, 0, memory_order_release);
+        }
+
+        atomic_decr64(&count, memory_order_release);
+        release_tables();
+        return true;
+    }
+
+    /*! Removes all the entries, the table capacity is preserved. */
+    void clear()
+    {
+        SHARED_WRITE_LOCK(lock);
+        table_t* table = (table_t*)atomic_load_ptr(&current, memory_order_relaxed);
+        for (table_t* t = tables; t; t = t->next)
+        {
+            // Clear values before keys, so concurrent lookups never see a key with a stale value.
+            for (uint64_t i = 0; i < t->capacity; ++i)
+                atomic_store64(&t->slots[i].value, 0, memory_order_release);
+        }
+
+        for (uint64_t i = 0; i < table->capacity; ++i)
+            atomic_store64(&table->slots[i].key, 0, memory_order_release);
+        table->used = 0;
+
+        atomic_store_ptr(&previous, nullptr, memory_order_seq_cst);
+        atomic_store64(&count, 0, memory_order_release);
+        release_tables();
+    }
+
+    /*! Returns the number of entries in the table. */
+    FOUNDATION_FORCEINLINE uint64_t size() const
+    {
+        return (uint64_t)atomic_load64(&count, memory_order_acquire);
+    }
+
+    /*! Returns the number of slots of the current table. */
+    FOUNDATION_FORCEINLINE uint64_t capacity() const
+    {
+        const table_t* table = (const table_t*)atomic_load_ptr(&current, memory_order_acquire);
+        return table->capacity;
+    }
+
+private:
+
+    FOUNDATION_FORCEINLINE static uint64_t table_hash(const table_t* table, uint64_t key)
+    {
+        // Fibonacci hashing, keys are often already hashed but some are small sequential integers.
+        return (key * 11400714819323198485ULL) >> table->shift;
+    }
+
+    FOUNDATION_FORCEINLINE static uint64_t table_get(const table_t* table, uint64_t key)
+    {
+        FOUNDATION_ASSERT(key);
+
+        const uint64_t mask = table->capacity - 1;
+        for (uint64_t i = table_hash(table, key), probe = 0; probe < table->capacity; i = (i + 1) & mask, ++probe)
+        {
+            const slot_t* slot = &table->slots[i];
+            const uint64_t slot_key = (uint64_t)atomic_load64(&slot->key, memory_order_acquire);
+            if (slot_key == key)
+                return (uint64_t)atomic_load64(&slot->value, memory_order_acquire);
+
+            if (slot_key == 0)
+                break;
+        }
+
+        return 0;
+    }
+
+    /*! Returns the slot of #key, or the empty slot where it would be inserted. */
+    static slot_t* table_find(table_t* table, uint64_t key)
+    {
+        const uint64_t mask = table->capacity - 1;
+        for (uint64_t i = table_hash(table, key), probe = 0; probe < table->capacity; i = (i + 1) & mask, ++probe)
+        {
+            slot_t* slot = &table->slots[i];
+            const uint64_t slot_key = (uint64_t)atomic_load64(&slot->key, memory_order_relaxed);
+            if (slot_key == key || slot_key == 0)
+                return slot;
+        }
+
+        return nullptr;
+    }
+
+    static void table_set(table_t* table, uint64_t key, uint64_t value)
+    {
+        slot_t* slot = table_find(table, key);
+        FOUNDATION_ASSERT(slot);
+
+        // Publish the value before the key, so lookups finding the key always see its value.
+        atomic_store64(&slot->value, (int64_t)value, memory_order_release);
+        if (atomic_load64(&slot->key, memory_order_relaxed) == 0)
+        {
+            atomic_store64(&slot->key, (int64_t)key, memory_order_release);
+            table->used++;
+        }
+    }
+
+    static table_t* table_allocate(uint64_t capacity, uint32_t shift)
+    {
+        const size_t size = sizeof(table_t) + sizeof(slot_t) * (capacity - 1);
+        table_t* table = (table_t*)memory_allocate(0, size, 64, MEMORY_PERSISTENT | MEMORY_ZERO_INITIALIZED);
+        table->capacity = capacity;
+        table->shift = shift;
+        table->used = 0;
+        table->next = nullptr;
+        table->retired_epoch = -1;
+        return table;
+    }
+
+    /*! Returns the reader slot of the calling thread, threads get the slots in turn. */
+    FOUNDATION_FORCEINLINE static uint32_t reader_slot()
+    {
+        static atomic32_t next_slot;
+        static thread_local uint32_t slot = (uint32_t)atomic_incr32(&next_slot, memory_order_relaxed) % READER_SLOTS;
+        return slot;
+    }
+
+    /*! Release the tables replaced before the current epoch once their lookups are done, called by writers only.
+     *
+     *  Lookups registered for the previous epoch might still use the tables replaced before the current epoch.
+     *  Once they are done, these tables are released, and the epoch is advanced if other tables got replaced since, 
+     *  so lookups starting afterward register for the other epoch and cannot delay their release.
+     */
+    void release_tables()
+    {
+        if (tables->next == nullptr)
+            return;
+
+        const int64_t current_epoch = atomic_load64(&epoch, memory_order_relaxed);
+        for (uint32_t i = 0; i < READER_SLOTS; ++i)
+        {
+            if (atomic_load32(&readers[i].count[(current_epoch + 1) & 1], memory_order_seq_cst) != 0)
+                return;
+        }
+
+        bool retired = false;
+        const table_t* table = (const table_t*)atomic_load_ptr(&current, memory_order_relaxed);
+        const table_t* migrating = (const table_t*)atomic_load_ptr(&previous, memory_order_relaxed);
+        for (table_t** link = &tables; *link;)
+        {
+            table_t* t = *link;
+            if (t == table || t == migrating)
+            {
+                link = &t->next;
+                continue;
+            }
+
+            if (t->retired_epoch < 0)
+                t->retired_epoch = current_epoch;
+
+            if (t->retired_epoch < current_epoch)
+            {
+                *link = t->next;
+                memory_deallocate(t);
+                continue;
+            }
+
+            retired = true;
+            link = &t->next;
+        }
+
+        if (retired)
+            atomic_store64(&epoch, current_epoch + 1, memory_order_seq_cst);
+    }
+
+    /*! Migrate a few slots of the previous table, called by writers only. */
+    void migrate(table_t* table, uint64_t steps)
+    {
+        table_t* migrating = (table_t*)atomic_load_ptr(&previous, memory_order_relaxed);
+        if (migrating == nullptr)
+            return;
+
+        const uint64_t end = steps < migrating->capacity - migrate_index ? migrate_index + steps : migrating->capacity;
+        for (; migrate_index < end; ++migrate_index)
+        {
+            const slot_t* slot = &migrating->slots[migrate_index];
+            const uint64_t key = (uint64_t)atomic_load64(&slot->key, memory_order_relaxed);
+            const uint64_t value = (uint64_t)atomic_load64(&slot->value, memory_order_relaxed);
+
+            // Entries written since the migration started are already in the new table.
+            if (key != 0 && value != 0 && table_get(table, key) == 0)
+                table_set(table, key, value);
+        }
+
+        if (migrate_index == migrating->capacity)
+            atomic_store_ptr(&previous, nullptr, memory_order_seq_cst);
+    }
+
+    /*! Replace the current table once it is half full.
+     *
+     *  The new table is sized so the live entries fill at most a quarter of it, which doubles the capacity
+     *  of a growing table, but keeps or reduces it when the half full table mostly holds removed entries.
+     */
+    table_t* grow(table_t* table)
+    {
+        // Complete any pending migration before starting a new one.
+        migrate(table, UINT64_MAX);
+
+        const uint64_t live = (uint64_t)atomic_load64(&count, memory_order_relaxed) + 1;
+        uint32_t shift = 62;
+        uint64_t capacity = 4;
+        while (capacity < live * 4)
+        {
+            capacity <<= 1;
+            shift--;
+        }
+
+        table_t* rehashed = table_allocate(capacity, shift);
+        rehashed->next = tables;
+        tables = rehashed;
+
+        // Migrate fast enough to complete before the new table gets half full, 
+        // so a smaller table never has to hold more than its live entries.
+        migrate_index = 0;
+        migrate_step = table->capacity * 4 / capacity;
+        if (migrate_step < MIGRATION_STEP)
+            migrate_step = MIGRATION_STEP;
+        atomic_store_ptr(&previous, table, memory_order_seq_cst);
+        atomic_store_ptr(&current, rehashed, memory_order_seq_cst);
+        return rehashed;
+    }
+
+    bool write(uint64_t key, uint64_t value, bool only_if_absent)
+    {
+        FOUNDATION_ASSERT(key);
+        FOUNDATION_ASSERT(value);
+
+        SHARED_WRITE_LOCK(lock);
+
+        const bool exists = get(key) != 0;
+        if (exists && only_if_absent)
+            return false;
+
+        table_t* table = (table_t*)atomic_load_ptr(&current, memory_order_relaxed);
+        migrate(table, migrate_step);
+
+        if ((table->used + 1) * 2 > table->capacity)
+            table = grow(table);
+
+        table_set(table, key, value);
+        if (!exists)
+            atomic_incr64(&count, memory_order_release);
+        release_tables();
+        return true;
+    }
+
+    /*! Table used for new entries. */
+    atomicptr_t current;
+
+    /*! Table being migrated to the current table, if any. */
+    atomicptr_t previous;
+
+    /*! All tables allocated by the hash table, the current one first. */
+    table_t* tables{ nullptr };
+
+    /*! Number of lookups in flight for each epoch, see #release_tables. */
+    mutable reader_slot_t readers[READER_SLOTS];
+    atomic64_t epoch;
+
+    uint64_t migrate_index{ 0 };
+    uint64_t migrate_step{ MIGRATION_STEP };
+    atomic64_t count;
+    shared_mutex lock;
+};
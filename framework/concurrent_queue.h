@@ -6,39 +6,86 @@
 #pragma once
 
 #include <framework/array.h>
+#include <framework/memory.h>
 
-#include <foundation/mutex.h>
+#include <foundation/atomic.h>
 #include <foundation/beacon.h>
+#include <foundation/thread.h>
 
 #include "shared_mutex.h"
 
-template<typename T>
+/*! Multi-producer multi-consumer FIFO queue.
+ *
+ *  Elements are pushed and popped from a bounded lock-free ring buffer of #Capacity cells.
+ *  When the ring buffer is full, elements are pushed to an unbounded overflow list
+ *  protected by a lock until consumers drain the queue.
+ *
+ *  Consumers waiting in #try_pop are only signaled when they are actually sleeping.
+ *
+ *  @type T        The element type, which must be copy-constructible and move-assignable.
+ *  @type Capacity The ring buffer capacity, which must be a power of two.
+ */
+template<typename T, size_t Capacity = 256>
 class concurrent_queue
 {
-public: 
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "concurrent_queue capacity must be a power of two");
+
+    struct cell_t
+    {
+        atomic64_t sequence;
+        alignas(T) uint8_t storage[sizeof(T)];
+    };
+
+public:
     void create()
     {
         FOUNDATION_ASSERT(wait_event == nullptr);
         wait_event = beacon_allocate();
+
+        cells = (cell_t*)memory_allocate(0, sizeof(cell_t) * Capacity, 64, MEMORY_PERSISTENT);
+        for (size_t i = 0; i < Capacity; ++i)
+            atomic_store64(&cells[i].sequence, (int64_t)i, memory_order_relaxed);
+        atomic_store64(&enqueue_pos, 0, memory_order_relaxed);
+        atomic_store64(&dequeue_pos, 0, memory_order_relaxed);
+        atomic_store32(&overflow_count, 0, memory_order_relaxed);
+        atomic_store32(&sleeping_count, 0, memory_order_release);
     }
 
     void destroy()
     {
         FOUNDATION_ASSERT(wait_event);
 
-        array_deallocate(elements);
+        // Release the remaining elements in place, the queue must not be used by other threads anymore.
+        const int64_t tail = atomic_load64(&enqueue_pos, memory_order_acquire);
+        for (int64_t pos = atomic_load64(&dequeue_pos, memory_order_acquire); pos < tail; ++pos)
+        {
+            cell_t* cell = &cells[pos & (Capacity - 1)];
+            if (atomic_load64(&cell->sequence, memory_order_acquire) == pos + 1)
+                ((T*)cell->storage)->~T();
+        }
+
+        for (uint32_t i = overflow_head, end = array_size(overflow); i < end; ++i)
+        {
+            T* element = overflow[i];
+            element->~T();
+            memory_deallocate(element);
+        }
+        overflow_head = 0;
+        atomic_store32(&overflow_count, 0, memory_order_release);
+
+        array_deallocate(overflow);
+        memory_deallocate(cells);
+        cells = nullptr;
         beacon_deallocate(wait_event);
+        wait_event = nullptr;
     }
 
     size_t size() const
     {
-        size_t count = 0;
-        if (lock.shared_lock())
-        {
-            count = array_size(elements);
-            lock.shared_unlock();
-        }
-        return count;
+        const int64_t head = atomic_load64(&dequeue_pos, memory_order_acquire);
+        const int64_t tail = atomic_load64(&enqueue_pos, memory_order_acquire);
+        const size_t count = tail > head ? (size_t)(tail - head) : 0;
+        return count + (size_t)atomic_load32(&overflow_count, memory_order_acquire);
     }
 
     bool empty() const
@@ -50,10 +97,16 @@ public:
     {
         FOUNDATION_ASSERT(wait_event);
 
-        if (!lock.exclusive_lock())
-            return false;
-        array_push_memcpy(elements, &e);
-        if (lock.exclusive_unlock())
+        // Once elements overflow, keep pushing to the overflow list to preserve the FIFO order.
+        if (atomic_load32(&overflow_count, memory_order_acquire) > 0 || !ring_push(e))
+        {
+            if (!overflow_push(e))
+                return false;
+        }
+
+        // Only wake up consumers that are waiting for new elements
+        atomic_thread_fence_sequentially_consistent();
+        if (atomic_load32(&sleeping_count, memory_order_relaxed) > 0)
             beacon_fire(wait_event);
         return true;
     }
@@ -62,21 +115,24 @@ public:
     {
         FOUNDATION_ASSERT(wait_event);
 
-        beacon_try_wait(wait_event, milliseconds);
-        if (!lock.exclusive_lock())
+        if (pop(e))
+            return true;
+
+        if (milliseconds == 0)
             return false;
 
-        bool poped = false;
-        if (array_size(elements) > 0)
+        // Register as sleeping before checking again so a concurrent push does not miss us.
+        atomic_incr32(&sleeping_count, memory_order_relaxed);
+        atomic_thread_fence_sequentially_consistent();
+        if (!pop(e))
         {
-            e = std::move(*array_last(elements));
-            array_pop_safe(elements);
-            poped = true;
+            beacon_try_wait(wait_event, milliseconds);
+            atomic_decr32(&sleeping_count, memory_order_relaxed);
+            return pop(e);
         }
 
-        if (!lock.exclusive_unlock())
-            return false;
-        return poped;
+        atomic_decr32(&sleeping_count, memory_order_relaxed);
+        return true;
     }
 
     void signal()
@@ -87,7 +143,134 @@ public:
 
 private:
 
-    T* elements{ nullptr };
+    bool ring_push(const T& e)
+    {
+        cell_t* cell = nullptr;
+        int64_t pos = atomic_load64(&enqueue_pos, memory_order_relaxed);
+        for (;;)
+        {
+            cell = &cells[pos & (Capacity - 1)];
+            const int64_t sequence = atomic_load64(&cell->sequence, memory_order_acquire);
+            const int64_t diff = sequence - pos;
+            if (diff == 0)
+            {
+                if (atomic_cas64(&enqueue_pos, pos + 1, pos, memory_order_relaxed, memory_order_relaxed))
+                    break;
+                pos = atomic_load64(&enqueue_pos, memory_order_relaxed);
+            }
+            else if (diff < 0)
+            {
+                // The ring buffer is full
+                return false;
+            }
+            else
+            {
+                pos = atomic_load64(&enqueue_pos, memory_order_relaxed);
+            }
+        }
+
+        new (cell->storage) T(e);
+        atomic_store64(&cell->sequence, pos + 1, memory_order_release);
+        return true;
+    }
+
+    bool ring_pop(T& e)
+    {
+        cell_t* cell = nullptr;
+        int64_t pos = atomic_load64(&dequeue_pos, memory_order_relaxed);
+        for (;;)
+        {
+            cell = &cells[pos & (Capacity - 1)];
+            const int64_t sequence = atomic_load64(&cell->sequence, memory_order_acquire);
+            const int64_t diff = sequence - (pos + 1);
+            if (diff == 0)
+            {
+                if (atomic_cas64(&dequeue_pos, pos + 1, pos, memory_order_relaxed, memory_order_relaxed))
+                    break;
+                pos = atomic_load64(&dequeue_pos, memory_order_relaxed);
+            }
+            else if (diff < 0)
+            {
+                // The ring buffer is empty
+                if (atomic_load64(&enqueue_pos, memory_order_acquire) == pos)
+                    return false;
+
+                // A producer is still writing the next element, wait for it to keep the FIFO order.
+                thread_yield();
+                pos = atomic_load64(&dequeue_pos, memory_order_relaxed);
+            }
+            else
+            {
+                pos = atomic_load64(&dequeue_pos, memory_order_relaxed);
+            }
+        }
+
+        T* element = (T*)cell->storage;
+        e = std::move(*element);
+        element->~T();
+        atomic_store64(&cell->sequence, pos + (int64_t)Capacity, memory_order_release);
+        return true;
+    }
+
+    bool overflow_push(const T& e)
+    {
+        if (!lock.exclusive_lock())
+            return false;
+
+        T* element = MEM_NEW(0, T, e);
+        array_push(overflow, element);
+        atomic_incr32(&overflow_count, memory_order_release);
+
+        return lock.exclusive_unlock();
+    }
+
+    bool overflow_pop(T& e)
+    {
+        if (atomic_load32(&overflow_count, memory_order_acquire) == 0)
+            return false;
+
+        if (!lock.exclusive_lock())
+            return false;
+
+        bool poped = false;
+        if (overflow_head < array_size(overflow))
+        {
+            T* element = overflow[overflow_head++];
+            e = std::move(*element);
+            element->~T();
+            memory_deallocate(element);
+            poped = true;
+
+            if (overflow_head == array_size(overflow))
+            {
+                array_clear(overflow);
+                overflow_head = 0;
+            }
+
+            atomic_decr32(&overflow_count, memory_order_release);
+        }
+
+        lock.exclusive_unlock();
+        return poped;
+    }
+
+    bool pop(T& e)
+    {
+        // Elements in the ring buffer were always pushed before the overflowing ones.
+        if (ring_pop(e))
+            return true;
+        return overflow_pop(e);
+    }
+
+    cell_t* cells{ nullptr };
+    alignas(64) atomic64_t enqueue_pos{};
+    alignas(64) atomic64_t dequeue_pos{};
+    alignas(64) atomic32_t sleeping_count{};
+    atomic32_t overflow_count{};
+
     beacon_t* wait_event{ nullptr };
+
+    T** overflow{ nullptr };
+    uint32_t overflow_head{ 0 };
     shared_mutex lock;
 };
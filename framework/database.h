@@ -7,10 +7,10 @@
 
 #include <framework/function.h>
 #include <framework/shared_mutex.h>
+#include <framework/concurrent_hashtable.h>
 
 #include <foundation/hash.h>
 #include <foundation/array.h>
-#include <foundation/hashtable.h>
 
 template<typename T>
 hash_t hash(const T& value)
@@ -20,53 +20,139 @@ hash_t hash(const T& value)
 
 constexpr const hash_t INVALID_KEY{ 0 };
 
+/*! Thread safe collection of elements indexed by their hash.
+ * 
+ *  Element indexes are stored in a #concurrent_hashtable64 that grows online, so key lookups 
+ *  (i.e. #contains or missing keys) never take the lock. Elements are accessed under the lock.
+ * 
+ *  By default elements are stored in a single array, which is reallocated as it grows and compacted 
+ *  when elements are removed. When #CHUNK_SIZE is not 0, elements are stored in chunks of #CHUNK_SIZE 
+ *  elements instead: inserting never moves existing elements and removed slots are reused by later inserts,
+ *  so element pointers (i.e. returned by #lock) stay valid until the element is removed.
+ * 
+ *  @type T          Element type, copied with memcpy like foundation arrays
+ *  @type HASHER     Returns the key of an element
+ *  @type CHUNK_SIZE Number of elements per chunk, 0 stores elements in a single array
+ */
 template<typename T, 
-    hash_t(*HASHER)(const T& v) = [](const T& v) { return hash(v); }>
+    hash_t(*HASHER)(const T& v) = [](const T& v) { return hash(v); },
+    size_t CHUNK_SIZE = 0>
 struct database
 {
+    /*! Chunk of elements, the key of free slots is #INVALID_KEY. */
+    struct chunk_t
+    {
+        hash_t keys[CHUNK_SIZE ? CHUNK_SIZE : 1];
+        T values[CHUNK_SIZE ? CHUNK_SIZE : 1];
+    };
+
+    /*! Element array, only used if #CHUNK_SIZE is 0. */
     T* elements;
+
+    /*! Element chunks, only used if #CHUNK_SIZE is not 0. */
+    chunk_t** chunks;
+    uint32_t* free_slots;
+    uint64_t used_slots;
+
     size_t capacity;
-    hashtable64_t* hashes;
+    concurrent_hashtable64 hashes;
     mutable shared_mutex mutex;
 
     database()
         : elements(nullptr)
+        , chunks(nullptr)
+        , free_slots(nullptr)
+        , used_slots(0)
         , capacity(16)
-        , hashes(nullptr)
+        , hashes(16)
     {
-        hashes = hashtable64_allocate(capacity);
     }
 
     ~database()
     {
         array_deallocate(elements);
-        hashtable64_deallocate(hashes);
+        for (unsigned i = 0, end = array_size(chunks); i < end; ++i)
+            memory_deallocate(chunks[i]);
+        array_deallocate(chunks);
+        array_deallocate(free_slots);
     }
 
-    void grow()
+    /*! Returns the number of element slots, including free slots of chunked storage. */
+    FOUNDATION_FORCEINLINE uint64_t slot_count() const
     {
-        hashtable64_t* old_table = hashes;
-        capacity *= size_t(2);
-        hashtable64_t* new_hash_table = hashtable64_allocate(capacity);
-        for (unsigned i = 0, end = array_size(elements); i < end; ++i)
-            hashtable64_set(new_hash_table, HASHER(elements[i]), (uint64_t)(i + 1)); // 1 based
-
-        hashes = new_hash_table;
-        hashtable64_deallocate(old_table);
+        if constexpr (CHUNK_SIZE == 0)
+            return array_size(elements);
+        else
+            return used_slots;
     }
 
-    hash_t insert(const T& value)
+    /*! Returns the element at a 0 based slot index, the database must be locked. */
+    FOUNDATION_FORCEINLINE T& element_at(uint64_t index) const
     {
-        const hash_t key = HASHER(value);
+        FOUNDATION_ASSERT(index < slot_count());
+        if constexpr (CHUNK_SIZE == 0)
+            return elements[index];
+        else
+            return chunks[index / CHUNK_SIZE]->values[index % CHUNK_SIZE];
+    }
 
-        if (!mutex.shared_lock())
+    /*! Checks if a slot holds an element, only free slots of chunked storage are empty. */
+    FOUNDATION_FORCEINLINE bool slot_used(uint64_t index) const
+    {
+        if constexpr (CHUNK_SIZE == 0)
+            return index < array_size(elements);
+        else
+            return index < used_slots && chunks[index / CHUNK_SIZE]->keys[index % CHUNK_SIZE] != INVALID_KEY;
+    }
+
+    /*! Returns the 0 based slot index where the next element will be stored. */
+    uint64_t slot_next() const
+    {
+        if constexpr (CHUNK_SIZE == 0)
+            return array_size(elements);
+        else
+            return array_size(free_slots) > 0 ? free_slots[array_size(free_slots) - 1] : used_slots;
+    }
+
+    /*! Store an element in the slot returned by #slot_next. */
+    void slot_store(hash_t key, const T& value)
+    {
+        if constexpr (CHUNK_SIZE == 0)
         {
-            FOUNDATION_ASSERT_FAIL("Failed to get shared lock");
-            return INVALID_KEY;
+            FOUNDATION_UNUSED(key);
+            array_push(elements, value);
         }
-            
-        const uint64_t index = hashtable64_get(hashes, key);
-        if (!mutex.shared_unlock() || index != 0)
+        else
+        {
+            uint64_t index;
+            if (array_size(free_slots) > 0)
+            {
+                index = free_slots[array_size(free_slots) - 1];
+                array_pop(free_slots);
+            }
+            else
+            {
+                index = used_slots++;
+                if (index / CHUNK_SIZE >= array_size(chunks))
+                {
+                    // Chunks are never moved, so existing elements keep their address.
+                    chunk_t* chunk = (chunk_t*)memory_allocate(0, sizeof(chunk_t), 0, MEMORY_PERSISTENT | MEMORY_ZERO_INITIALIZED);
+                    array_push(chunks, chunk);
+                }
+            }
+
+            chunk_t* chunk = chunks[index / CHUNK_SIZE];
+            chunk->keys[index % CHUNK_SIZE] = key;
+            chunk->values[index % CHUNK_SIZE] = value;
+        }
+    }
+
+    hash_t insert(const T& value)
+    {
+        const hash_t key = HASHER(value);
+
+        // Reject existing elements without taking the lock
+        if (hashes.contains(key))
             return INVALID_KEY;
         
         if (!mutex.exclusive_lock())
@@ -74,13 +160,17 @@ struct database
             FOUNDATION_ASSERT_FAIL("Failed to get exclusive lock");
             return INVALID_KEY;
         }
-            
-        unsigned int element_index = array_size(elements) + 1; // 1 based
 
-        while (!hashtable64_set(hashes, key, element_index))
-            grow();
+        // The element could have been inserted by another thread in the meantime.
+        const uint64_t element_index = slot_next() + 1; // 1 based
+        if (!hashes.insert(key, element_index))
+        {
+            mutex.exclusive_unlock();
+            return INVALID_KEY;
+        }
 
-        array_push(elements, value);
+        slot_store(key, value);
+        capacity = hashes.capacity();
         if (!mutex.exclusive_unlock())
         {
             FOUNDATION_ASSERT_FAIL("Failed to release exclusive lock");
@@ -99,7 +189,7 @@ struct database
             return INVALID_KEY;
         }
 
-        const uint64_t index = hashtable64_get(hashes, key);
+        const uint64_t index = hashes.get(key);
         if (index == 0)
         {
             if (!mutex.shared_unlock())
@@ -109,7 +199,7 @@ struct database
             return INVALID_KEY;
         }
 
-        elements[index - 1] = value;
+        element_at(index - 1) = value;
         if (!mutex.shared_unlock())
         {
             FOUNDATION_ASSERT_FAIL("Failed to release shared lock");
@@ -122,11 +212,15 @@ struct database
     hash_t put(const T& value)
     {
         const hash_t key = HASHER(value);
-        const uint64_t index = hashtable64_get(hashes, key);
-        if (index != 0)
-            return update(value);
-            
-        return insert(value);
+        if (!hashes.contains(key))
+        {
+            const hash_t inserted_key = insert(value);
+            if (inserted_key != INVALID_KEY)
+                return inserted_key;
+        }
+        
+        // The element already exists or was just inserted by another thread.
+        return update(value);
     }
 
     struct AutoLock
@@ -197,17 +291,17 @@ struct database
     {          
         AutoLock locked_value(&mutex);
         
-        const uint64_t index = hashtable64_get(hashes, key);
+        const uint64_t index = hashes.get(key);
         if (index == 0)
             return locked_value;
             
-        if (index > array_size(elements))
+        if (index > slot_count())
         {
             FOUNDATION_ASSERT_FAIL("Index is out of bound");
             return locked_value;
         }
 
-        locked_value.value = &elements[index - 1];
+        locked_value.value = &element_at(index - 1);
         if (HASHER(*locked_value.value) != key)
         { 
             FOUNDATION_ASSERT_FAIL("Element has been invalidated");
@@ -226,7 +320,11 @@ struct database
         }
 
         array_clear(elements);
-        hashtable64_clear(hashes);
+        array_clear(free_slots);
+        for (unsigned i = 0, end = array_size(chunks); i < end; ++i)
+            memset(chunks[i]->keys, 0, sizeof(chunks[i]->keys));
+        used_slots = 0;
+        hashes.clear();
         if (!mutex.exclusive_unlock())
         {
             FOUNDATION_ASSERT_FAIL("Failed to release exclusive lock");
@@ -235,7 +333,7 @@ struct database
 
     bool contains(hash_t key) const
     {
-        return hashtable64_get(hashes, key) != 0;
+        return hashes.contains(key);
     }
 
     bool contains(const T& value) const
@@ -246,22 +344,21 @@ struct database
 
     const T& get(hash_t key) const
     {
-        const uint64_t index = hashtable64_get(hashes, key);
-        if (index == 0)
-        {
-            static thread_local T NULL_VALUE{};
+        static thread_local T NULL_VALUE{};
+        if (!hashes.contains(key))
             return NULL_VALUE;
-        }
 
         SHARED_READ_LOCK(mutex);
-        FOUNDATION_ASSERT_MSG(index <= array_size(elements), "Index is out of bound");
-        return elements[index - 1];
+        const uint64_t index = hashes.get(key);
+        if (index == 0)
+            return NULL_VALUE;
+        FOUNDATION_ASSERT_MSG(index <= slot_count(), "Index is out of bound");
+        return element_at(index - 1);
     }
 
     bool select(hash_t key, T& value) const
     {
-        const uint64_t index = hashtable64_get(hashes, key);
-        if (index == 0)
+        if (!hashes.contains(key))
             return false;
         
         if (!mutex.shared_lock())
@@ -270,14 +367,22 @@ struct database
             return false;
         }
 
-        if (index > array_size(elements))
+        // Look up the index again under the lock, since elements can move when others get removed.
+        const uint64_t index = hashes.get(key);
+        if (index == 0)
+        {
+            mutex.shared_unlock();
+            return false;
+        }
+
+        if (index > slot_count())
         {
             FOUNDATION_ASSERT_FAIL("Index is out of bound");
             mutex.shared_unlock();
             return false;
         }
 
-        value = elements[index - 1];
+        value = element_at(index - 1);
         if (HASHER(value) != key)
         {
             FOUNDATION_ASSERT_FAIL("Element has been invalidated");
@@ -290,8 +395,7 @@ struct database
 
     bool select(hash_t key, const function<void(const T& value)>& selector) const
     {
-        const uint64_t index = hashtable64_get(hashes, key);
-        if (index == 0)
+        if (!hashes.contains(key))
             return false;
 
         if (!mutex.shared_lock())
@@ -300,21 +404,27 @@ struct database
             return false;
         }
 
-        if (index > array_size(elements))
+        const uint64_t index = hashes.get(key);
+        if (index == 0)
+        {
+            mutex.shared_unlock();
+            return false;
+        }
+
+        if (index > slot_count())
         {
             FOUNDATION_ASSERT_FAIL("Index is out of bound");
             mutex.shared_unlock();
             return false;
         }
         
-        selector.invoke(elements[index - 1]);
+        selector.invoke(element_at(index - 1));
         return mutex.shared_unlock();
     }
 
     bool update(hash_t key, const function<void(T& value)>& selector, bool quick_and_unsafe = false) const
     {
-        const uint64_t index = hashtable64_get(hashes, key);
-        if (index == 0)
+        if (!hashes.contains(key))
             return false;
 
         if (!mutex.shared_lock())
@@ -323,14 +433,21 @@ struct database
             return false;
         }
 
-        if (index > array_size(elements))
+        const uint64_t index = hashes.get(key);
+        if (index == 0)
+        {
+            mutex.shared_unlock();
+            return false;
+        }
+
+        if (index > slot_count())
         {
             FOUNDATION_ASSERT_FAIL("Index is out of bound");
             mutex.shared_unlock();
             return false;
         }
         
-        T& value = elements[index - 1];
+        T& value = element_at(index - 1);
         if (!quick_and_unsafe && HASHER(value) != key)
         {
             FOUNDATION_ASSERT_FAIL("Element has been invalidated");
@@ -345,8 +462,7 @@ struct database
 
     bool remove(hash_t key, T* out_value = nullptr)
     {
-        const uint64_t index = hashtable64_get(hashes, key);
-        if (index == 0)
+        if (!hashes.contains(key))
             return false;
 
         if (!mutex.exclusive_lock())
@@ -355,14 +471,21 @@ struct database
             return false;
         }
 
-        if (index > array_size(elements))
+        const uint64_t index = hashes.get(key);
+        if (index == 0)
+        {
+            mutex.exclusive_unlock();
+            return false;
+        }
+
+        if (index > slot_count())
         {
             FOUNDATION_ASSERT_FAIL("Index is out of bound");
             mutex.exclusive_unlock();
             return false;
         }
 
-        const T& value = elements[index - 1];
+        const T& value = element_at(index - 1);
         if (HASHER(value) != key)
         {
             FOUNDATION_ASSERT_FAIL("Element has been invalidated");
@@ -373,15 +496,28 @@ struct database
         if (out_value)
             *out_value = value;
 
-        hashtable64_erase(hashes, key);
-        array_erase_memcpy_safe(elements, index - 1);
+        hashes.erase(key);
+        if constexpr (CHUNK_SIZE == 0)
+        {
+            array_erase_memcpy_safe(elements, index - 1);
+
+            // The last element was moved to the removed element slot
+            if (index - 1 < array_size(elements))
+                hashes.set(HASHER(elements[index - 1]), index);
+        }
+        else
+        {
+            // Other elements are not moved, the slot is reused by the next insert.
+            chunks[(index - 1) / CHUNK_SIZE]->keys[(index - 1) % CHUNK_SIZE] = INVALID_KEY;
+            array_push(free_slots, (uint32_t)(index - 1));
+        }
 
         return mutex.exclusive_unlock();
     }
 
     size_t size() const
     {
-        return hashtable64_size(hashes);
+        return hashes.size();
     }
 
     bool empty() const
@@ -415,7 +551,7 @@ struct database
             , m(mutex)
             , exclusive_lock(exclusive_lock)
         {
-            FOUNDATION_ASSERT(index <= db.size());
+            FOUNDATION_ASSERT(index <= db.slot_count());
             
             if (exclusive_lock)
             {
@@ -430,6 +566,8 @@ struct database
                 FOUNDATION_ASSERT_FAIL("Failed to get shared lock");
                 m = nullptr;
             }
+
+            skip_free_slots();
         }
 
         FOUNDATION_FORCEINLINE ~iterator()
@@ -472,31 +610,42 @@ struct database
         FOUNDATION_FORCEINLINE iterator& operator++()
         {
             index++;
+            skip_free_slots();
             return *this;
         }
 
+        FOUNDATION_FORCEINLINE void skip_free_slots()
+        {
+            if constexpr (CHUNK_SIZE != 0)
+            {
+                const uint64_t end = db.slot_count();
+                while (index < end && !db.slot_used(index))
+                    index++;
+            }
+        }
+
         FOUNDATION_FORCEINLINE const T& operator*() const
         {
-            FOUNDATION_ASSERT(index < array_size(db.elements));
-            return db.elements[index];
+            FOUNDATION_ASSERT(db.slot_used(index));
+            return db.element_at(index);
         }
 
         FOUNDATION_FORCEINLINE T& operator*()
         {
-            FOUNDATION_ASSERT(index < array_size(db.elements));
-            return db.elements[index];
+            FOUNDATION_ASSERT(db.slot_used(index));
+            return db.element_at(index);
         }
 
         FOUNDATION_FORCEINLINE T* operator->()
         {
-            FOUNDATION_ASSERT(index < array_size(db.elements));
-            return &db.elements[index];
+            FOUNDATION_ASSERT(db.slot_used(index));
+            return &db.element_at(index);
         }
 
         FOUNDATION_FORCEINLINE const T* operator->() const
         {
-            FOUNDATION_ASSERT(index < array_size(db.elements));
-            return &db.elements[index];
+            FOUNDATION_ASSERT(db.slot_used(index));
+            return &db.element_at(index);
         }
     };
 
@@ -507,7 +656,7 @@ struct database
 
     FOUNDATION_FORCEINLINE iterator end() const
     {
-        return iterator{ *this, this->size(), nullptr, false };
+        return iterator{ *this, this->slot_count(), nullptr, false };
     }
 
     FOUNDATION_FORCEINLINE iterator begin_exclusive_lock()
@@ -517,6 +666,6 @@ struct database
 
     FOUNDATION_FORCEINLINE iterator end_exclusive_lock()
     {
-        return iterator{ *this,  this->size(), nullptr, false };
+        return iterator{ *this, this->slot_count(), nullptr, false };
     }
 };
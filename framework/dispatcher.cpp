@@ -11,19 +11,42 @@
 #include <framework/shared_mutex.h>
 #include <framework/profiler.h>
 #include <framework/array.h>
+#include <framework/jobs.h>
 
 #include <foundation/mutex.h>
 #include <foundation/event.h>
 #include <foundation/hashstrings.h>
 #include <foundation/objectmap.h>
+#include <foundation/hashtable.h>
+#include <foundation/semaphore.h>
 
+#include <algorithm>
+
+/*! Maximum number of pooled threads executing the functions of #dispatch_thread, once reached functions are queued. */
+#ifndef MAX_DISPATCHER_THREADS
+#define MAX_DISPATCHER_THREADS 16
+#endif
+
+/*! Function dispatched with #dispatch_thread and executed by a pooled thread.
+ * 
+ *  The function owns the object map reference set by #dispatch_thread, which is released once it completes.
+ */
 struct dispatcher_thread_t
 {
-    thread_t* thread{ nullptr };    
+    dispatcher_thread_handle_t handle{ 0 };
     void* payload{ nullptr };
-    bool completed{ false };
+
+    /*! Set by the first thread completing the function, see #dispatch_thread_complete. */
+    atomic32_t completed{};
+
+    /*! Thread executing the function and stop request, both guarded by #_dispatcher_pool_lock. */
+    thread_t* thread{ nullptr };
+    bool signaled{ false };
+
     function<void* (void*)> thread_fn;
     function<void(void)> completed_fn;
+    char name[32]{ 0 };
+    size_t name_length{ 0 };
 };
 
 struct dispatcher_event_listener_t
@@ -35,6 +58,24 @@ struct dispatcher_event_listener_t
     void*                          user_data;
 };
 
+/*! Immutable list of the listeners registered for an event.
+ * 
+ *  Lists are copied and replaced when listeners are registered or unregistered (copy-on-write), 
+ *  so listeners can be invoked without holding any lock while the list gets replaced.
+ */
+struct dispatcher_event_listeners_t
+{
+    atomic32_t                   refs;
+    dispatcher_event_listener_t* listeners{ nullptr };
+};
+
+/*! Event listeners registered for a given event name. */
+struct dispatcher_event_bucket_t
+{
+    dispatcher_event_name_t        event_name;
+    dispatcher_event_listeners_t*  listeners;
+};
+
 struct dispatcher_event_t
 {
     dispatcher_event_name_t event_name;
@@ -44,39 +85,289 @@ struct dispatcher_event_t
     size_t data_size{ 0 };
 };
 
+/*! Posted event shared by the listeners invoked by job threads (see #DISPATCHER_EVENT_OPTION_WORKER_THREAD). 
+ *  The event data is released by the last listener.
+ */
+struct dispatcher_shared_event_t
+{
+    atomic32_t         refs;
+    dispatcher_event_t event;
+};
+
 typedef enum DispatcherEventId : int32_t {
     DISPATCHER_NOEVENT = 0,
     DISPATCHER_POST_EVENT,
 } dispatcher_event_id_t;
 
-struct dispatcher_handler_t
+/*! Dispatched call scheduled with #dispatch or #dispatch_timer. 
+ *  
+ *  Timers are stored in slots that get reused once the timer is completed or cancelled. 
+ *  The slot serial is used to validate timer handles and heap entries of reused slots.
+ */
+struct dispatcher_timer_t
 {
-    tick_t              trigger_at{ 0 };
+    uint32_t            serial{ 0 };
+    tick_t              interval{ 0 };
     function<void()>    handler{ nullptr };
+    bool                running{ false };
+    bool                cancelled{ false };
+
+    /*! Set once the heap entry of the timer was taken by #dispatcher_update, so it is not in the heap anymore. */
+    bool                due{ false };
+};
+
+/*! Timer heap entry, the next timer to trigger is on top of the heap. */
+struct dispatcher_timer_entry_t
+{
+    tick_t   trigger_at;
+    uint32_t slot;
+    uint32_t serial;
 };
 
 static int _wait_frame_throttling = 0;
 static event_handle _wait_active_signal;
 
 static mutex_t* _dispatcher_lock = nullptr;
-static dispatcher_handler_t* _dispatcher_actions = nullptr;
+static uint32_t _dispatcher_timer_serial = 0;
+static dispatcher_timer_t* _dispatcher_timers = nullptr;
+static uint32_t* _dispatcher_free_timers = nullptr;
+static dispatcher_timer_entry_t* _dispatcher_timer_heap = nullptr;
+static dispatcher_timer_entry_t* _dispatcher_due_timers = nullptr;
+static uint32_t _dispatcher_cancelled_timer_entries = 0;
 
 static dispatcher_event_listener_id_t _next_listener_id = 1;
 static event_stream_t* _event_stream = nullptr;
-static dispatcher_event_listener_t* _event_listeners = nullptr;
+
+/*! Event listeners bucketed by event name, the hash table maps event names to their (1-based) bucket index. */
+static shared_mutex _event_listeners_lock("Dispatcher Events");
+static hashtable64_t* _event_listeners_table = nullptr;
+static dispatcher_event_bucket_t* _event_buckets = nullptr;
 static objectmap_t* _dispatcher_threads = nullptr;
 
+/*! Pool of threads executing the dispatched thread functions in FIFO order. */
+static mutex_t* _dispatcher_pool_lock = nullptr;
+static semaphore_t _dispatcher_pool_semaphore;
+static thread_t** _dispatcher_pool_threads = nullptr;
+static dispatcher_thread_t** _dispatcher_pool_queue = nullptr;
+static dispatcher_thread_t** _dispatcher_pool_running = nullptr;
+static volatile bool _dispatcher_pool_exiting = false;
+
 //
 // # PRIVATE
 //
 
+FOUNDATION_FORCEINLINE bool dispatcher_timer_entry_later(const dispatcher_timer_entry_t& a, const dispatcher_timer_entry_t& b)
+{
+    if (a.trigger_at != b.trigger_at)
+        return a.trigger_at > b.trigger_at;
+    return a.serial > b.serial;
+}
+
+FOUNDATION_STATIC void dispatcher_timer_push(tick_t trigger_at, uint32_t slot, uint32_t serial)
+{
+    dispatcher_timer_entry_t entry{ trigger_at, slot, serial };
+    array_push(_dispatcher_timer_heap, entry);
+    std::push_heap(_dispatcher_timer_heap, _dispatcher_timer_heap + array_size(_dispatcher_timer_heap), dispatcher_timer_entry_later);
+}
+
+FOUNDATION_STATIC void dispatcher_timer_free(uint32_t slot)
+{
+    dispatcher_timer_t& timer = _dispatcher_timers[slot];
+    timer.serial = 0;
+    timer.handler = nullptr;
+    timer.running = false;
+    timer.cancelled = false;
+    timer.due = false;
+    array_push(_dispatcher_free_timers, slot);
+}
+
+FOUNDATION_STATIC dispatcher_timer_handle_t dispatcher_timer_schedule(const function<void()>& callback, tick_t delay, tick_t interval)
+{
+    uint32_t slot;
+    if (array_size(_dispatcher_free_timers) > 0)
+    {
+        slot = *array_last(_dispatcher_free_timers);
+        array_pop(_dispatcher_free_timers);
+    }
+    else
+    {
+        slot = array_size(_dispatcher_timers);
+        if (slot == array_capacity(_dispatcher_timers))
+            array_reserve(_dispatcher_timers, max(16U, slot * 2));
+        array_resize(_dispatcher_timers, slot + 1);
+        new (&_dispatcher_timers[slot]) dispatcher_timer_t();
+    }
+
+    if (++_dispatcher_timer_serial == 0)
+        _dispatcher_timer_serial = 1;
+
+    dispatcher_timer_t& timer = _dispatcher_timers[slot];
+    timer.serial = _dispatcher_timer_serial;
+    timer.interval = interval;
+    timer.handler = callback;
+    dispatcher_timer_push(time_current() + delay, slot, timer.serial);
+
+    return ((dispatcher_timer_handle_t)timer.serial << 32) | slot;
+}
+
+FOUNDATION_STATIC void dispatcher_event_listeners_release(dispatcher_event_listeners_t* list)
+{
+    if (list == nullptr || atomic_decr32(&list->refs, memory_order_acq_rel) > 0)
+        return;
+
+    foreach(e, list->listeners)
+        e->callback.~function();
+    array_deallocate(list->listeners);
+    memory_deallocate(list);
+}
+
+/*! Returns the listeners of an event with a new reference that must be released with #dispatcher_event_listeners_release. */
+FOUNDATION_STATIC dispatcher_event_listeners_t* dispatcher_event_listeners_acquire(dispatcher_event_name_t event_name)
+{
+    SHARED_READ_LOCK(_event_listeners_lock);
+    if (_event_listeners_table == nullptr)
+        return nullptr;
+
+    const uint64_t bucket_index = hashtable64_get(_event_listeners_table, event_name);
+    if (bucket_index == 0)
+        return nullptr;
+
+    dispatcher_event_listeners_t* list = _event_buckets[bucket_index - 1].listeners;
+    if (list)
+        atomic_incr32(&list->refs, memory_order_relaxed);
+    return list;
+}
+
+/*! Copy the listeners of #list to a new list, skipping #skip_listener_id. 
+ *  
+ *  @return The new list, or null if the new list would be empty and #extra_listeners is zero.
+ */
+FOUNDATION_STATIC dispatcher_event_listeners_t* dispatcher_event_listeners_copy(
+    const dispatcher_event_listeners_t* list, dispatcher_event_listener_id_t skip_listener_id, unsigned extra_listeners)
+{
+    const unsigned count = list ? array_size(list->listeners) : 0;
+    const unsigned skip_count = skip_listener_id != INVALID_DISPATCHER_EVENT_LISTENER_ID ? 1 : 0;
+    if (count + extra_listeners <= skip_count)
+        return nullptr;
+
+    dispatcher_event_listeners_t* copy = MEM_NEW(HASH_EVENT, dispatcher_event_listeners_t);
+    atomic_store32(&copy->refs, 1, memory_order_relaxed);
+    array_reserve(copy->listeners, count + extra_listeners - skip_count);
+    for (unsigned i = 0; i < count; ++i)
+    {
+        const dispatcher_event_listener_t& e = list->listeners[i];
+        if (e.id == skip_listener_id)
+            continue;
+
+        const unsigned index = array_size(copy->listeners);
+        array_resize(copy->listeners, index + 1);
+        new (&copy->listeners[index]) dispatcher_event_listener_t(e);
+    }
+
+    return copy;
+}
+
+/*! Returns the bucket of an event name, adding it if needed. The listeners lock must be held exclusively. */
+FOUNDATION_STATIC dispatcher_event_bucket_t* dispatcher_event_bucket_get_or_add(dispatcher_event_name_t event_name)
+{
+    if (_event_listeners_table)
+    {
+        const uint64_t bucket_index = hashtable64_get(_event_listeners_table, event_name);
+        if (bucket_index > 0)
+            return &_event_buckets[bucket_index - 1];
+    }
+
+    // Keep the hash table at most half full, event names are never removed.
+    const unsigned bucket_count = array_size(_event_buckets);
+    if (_event_listeners_table == nullptr || (bucket_count + 1) * 2 > hashtable64_size(_event_listeners_table))
+    {
+        hashtable64_deallocate(_event_listeners_table);
+        _event_listeners_table = hashtable64_allocate(max(64U, (bucket_count + 1) * 4));
+        for (unsigned i = 0; i < bucket_count; ++i)
+            hashtable64_set(_event_listeners_table, _event_buckets[i].event_name, i + 1);
+    }
+
+    dispatcher_event_bucket_t bucket{ event_name, nullptr };
+    array_push(_event_buckets, bucket);
+    hashtable64_set(_event_listeners_table, event_name, bucket_count + 1);
+    return array_last(_event_buckets);
+}
+
+FOUNDATION_STATIC void dispatcher_event_free_data(const dispatcher_event_t& de)
+{
+    if (de.options & DISPATCHER_EVENT_OPTION_CONFIG_DATA)
+    {
+        config_handle_t& cv = *(config_handle_t*)de.data;
+        config_deallocate(cv);
+    }
+
+    if (de.options & DISPATCHER_EVENT_OPTION_COPY_DATA)
+    {
+        memory_deallocate(de.data);
+    }
+}
+
+FOUNDATION_STATIC void dispatcher_shared_event_release(dispatcher_shared_event_t* shared_event)
+{
+    if (atomic_decr32(&shared_event->refs, memory_order_acq_rel) > 0)
+        return;
+
+    dispatcher_event_free_data(shared_event->event);
+    memory_deallocate(shared_event);
+}
+
+/*! Listener invoked by a job thread, captured by its job.
+ * 
+ *  Each copy holds a reference on the listener list and the shared event, released with the job handler, 
+ *  so jobs discarded without being executed (i.e. at shutdown) release them as well.
+ */
+struct dispatcher_worker_listener_t
+{
+    dispatcher_event_listeners_t* list;
+    unsigned                      index;
+    dispatcher_shared_event_t*    shared_event;
+
+    dispatcher_worker_listener_t(dispatcher_event_listeners_t* list, unsigned index, dispatcher_shared_event_t* shared_event)
+        : list(list)
+        , index(index)
+        , shared_event(shared_event)
+    {
+        atomic_incr32(&list->refs, memory_order_relaxed);
+        atomic_incr32(&shared_event->refs, memory_order_relaxed);
+    }
+
+    dispatcher_worker_listener_t(const dispatcher_worker_listener_t& o)
+        : dispatcher_worker_listener_t(o.list, o.index, o.shared_event)
+    {
+    }
+
+    dispatcher_worker_listener_t& operator=(const dispatcher_worker_listener_t&) = delete;
+
+    ~dispatcher_worker_listener_t()
+    {
+        dispatcher_shared_event_release(shared_event);
+        dispatcher_event_listeners_release(list);
+    }
+};
+
+FOUNDATION_STATIC void dispatcher_event_invoke(
+    const dispatcher_event_listener_t& listener, const dispatcher_event_t& de)
+{
+    dispatcher_event_args_t args{};
+    args.data = (uint8_t*)de.data;
+    args.size = de.data_size;
+    args.options = de.options;
+    args.user_data = listener.user_data;
+    listener.callback.invoke(args);
+}
+
 FOUNDATION_EXTERN bool dispatcher_process_events()
 {
     PERFORMANCE_TRACKER("dispatcher_process_events");
 
     event_block_t* eb = event_stream_process(_event_stream);
     event_t* ev = eb ? event_next(eb, nullptr) : nullptr;
-    if (ev == nullptr || !mutex_lock(_dispatcher_lock))
+    if (ev == nullptr)
         return false;
     
     while (ev)
@@ -85,35 +376,45 @@ FOUNDATION_EXTERN bool dispatcher_process_events()
         {
             FOUNDATION_ASSERT(ev->size >= sizeof(dispatcher_event_t));
             dispatcher_event_t* de = (dispatcher_event_t*)ev->payload;
-            foreach(e, _event_listeners)
+            dispatcher_shared_event_t* shared_event = nullptr;
+
+            // Listeners are invoked without holding any lock, so they can (un)register listeners.
+            dispatcher_event_listeners_t* list = dispatcher_event_listeners_acquire(de->event_name);
+            for (unsigned i = 0, count = list ? array_size(list->listeners) : 0; i < count; ++i)
             {
-                if (e->event_name == de->event_name)
+                const dispatcher_event_listener_t& listener = list->listeners[i];
+                if ((listener.options & DISPATCHER_EVENT_OPTION_WORKER_THREAD) == 0)
                 {
-                    dispatcher_event_args_t args{};
-                    args.data = (uint8_t*)de->data;
-                    args.size = de->data_size;
-                    args.options = de->options;
-                    args.user_data = e->user_data;
-                    e->callback.invoke(args);
+                    dispatcher_event_invoke(listener, *de);
+                    continue;
                 }
-            }
 
-            if (de->options & DISPATCHER_EVENT_OPTION_CONFIG_DATA)
-            {
-                config_handle_t& cv = *(config_handle_t*)de->data;
-                config_deallocate(cv);
-            }
+                if (shared_event == nullptr)
+                {
+                    shared_event = (dispatcher_shared_event_t*)memory_allocate(HASH_EVENT, sizeof(dispatcher_shared_event_t), 0, MEMORY_PERSISTENT);
+                    atomic_store32(&shared_event->refs, 1, memory_order_relaxed);
+                    shared_event->event = *de;
+                }
 
-            if (de->options & DISPATCHER_EVENT_OPTION_COPY_DATA)
-            {
-                memory_deallocate(de->data);
+                // The job keeps a reference on the listener list and the event until it is executed or discarded.
+                const dispatcher_worker_listener_t worker_listener{ list, i, shared_event };
+                job_submit([worker_listener](payload_t*)
+                {
+                    dispatcher_event_invoke(worker_listener.list->listeners[worker_listener.index], worker_listener.shared_event->event);
+                    return 0;
+                });
             }
+            dispatcher_event_listeners_release(list);
+
+            if (shared_event)
+                dispatcher_shared_event_release(shared_event);
+            else
+                dispatcher_event_free_data(*de);
         }
 
         ev = event_next(eb, ev);
     }
 
-    mutex_unlock(_dispatcher_lock);
     return true;
 }
 
@@ -151,21 +452,76 @@ void dispatcher_poll(GLFWwindow* window)
 }
 
 bool dispatch(const function<void()>& callback, uint32_t delay_milliseconds /*= 0*/)
+{
+    return dispatch_timer(callback, delay_milliseconds) != INVALID_DISPATCHER_TIMER_HANDLE;
+}
+
+dispatcher_timer_handle_t dispatch_timer(const function<void()>& callback, uint32_t delay_milliseconds, uint32_t interval_milliseconds /*= 0*/)
 {
     static const tick_t ticks_per_milliseconds = time_ticks_per_second() / 1000LL;
 
     if (!mutex_lock(_dispatcher_lock))
     {
         log_errorf(0, ERROR_SYSTEM_CALL_FAIL, STRING_CONST("Failed to lock dispatcher mutex"));
-        return false;
+        return INVALID_DISPATCHER_TIMER_HANDLE;
     }
-        
-    dispatcher_handler_t d{};
-    d.handler = callback;
-    d.trigger_at = time_current() + ticks_per_milliseconds * delay_milliseconds;
-    array_push_memcpy(_dispatcher_actions, &d);
+
+    dispatcher_timer_handle_t handle = dispatcher_timer_schedule(callback, 
+        ticks_per_milliseconds * delay_milliseconds, ticks_per_milliseconds * interval_milliseconds);
     dispatcher_wakeup_main_thread();
-    return mutex_unlock(_dispatcher_lock);
+    if (!mutex_unlock(_dispatcher_lock))
+        return INVALID_DISPATCHER_TIMER_HANDLE;
+    return handle;
+}
+
+bool dispatcher_cancel_timer(dispatcher_timer_handle_t timer_handle)
+{
+    const uint32_t slot = (uint32_t)(timer_handle & 0xFFFFFFFFULL);
+    const uint32_t serial = (uint32_t)(timer_handle >> 32);
+    if (serial == 0 || !mutex_lock(_dispatcher_lock))
+        return false;
+
+    bool cancelled = false;
+    if (slot < array_size(_dispatcher_timers))
+    {
+        dispatcher_timer_t& timer = _dispatcher_timers[slot];
+        // A one-shot timer that is running was already executed, only a repeating one can still be cancelled.
+        if (timer.serial == serial && !timer.cancelled && (!timer.running || timer.interval > 0))
+        {
+            // The heap entry of the timer is skipped once it reaches the top of the heap.
+            if (timer.running)
+            {
+                timer.cancelled = true;
+            }
+            else
+            {
+                // Timers taken from the heap by #dispatcher_update do not leave a cancelled entry in it.
+                if (!timer.due)
+                    _dispatcher_cancelled_timer_entries++;
+                dispatcher_timer_free(slot);
+            }
+            cancelled = true;
+
+            // Rebuild the heap once it is mostly made of cancelled timers, i.e. long delayed retries that got cancelled.
+            const uint32_t entry_count = array_size(_dispatcher_timer_heap);
+            if (entry_count >= 64 && _dispatcher_cancelled_timer_entries > entry_count / 2)
+            {
+                uint32_t kept_count = 0;
+                for (uint32_t i = 0; i < entry_count; ++i)
+                {
+                    const dispatcher_timer_entry_t& entry = _dispatcher_timer_heap[i];
+                    if (_dispatcher_timers[entry.slot].serial == entry.serial)
+                        _dispatcher_timer_heap[kept_count++] = entry;
+                }
+                array_resize(_dispatcher_timer_heap, kept_count);
+                std::make_heap(_dispatcher_timer_heap, _dispatcher_timer_heap + kept_count, dispatcher_timer_entry_later);
+                _dispatcher_cancelled_timer_entries = 0;
+            }
+        }
+    }
+
+    mutex_unlock(_dispatcher_lock);
+    return cancelled;
 }
 
 void dispatcher_update()
@@ -173,24 +529,56 @@ void dispatcher_update()
     PERFORMANCE_TRACKER("dispatcher_update");
     if (!mutex_try_lock(_dispatcher_lock))
         return;
+
+    // Take all the timers that are due first, so calls dispatched by the handlers are executed next frame.
     const tick_t now = time_current();
-    const unsigned count = array_size(_dispatcher_actions);
-    for (unsigned i = 0; i < count; ++i)
+    array_clear(_dispatcher_due_timers);
+    while (array_size(_dispatcher_timer_heap) > 0 && _dispatcher_timer_heap[0].trigger_at <= now)
     {
-        if (_dispatcher_actions[i].trigger_at <= now)
+        std::pop_heap(_dispatcher_timer_heap, _dispatcher_timer_heap + array_size(_dispatcher_timer_heap), dispatcher_timer_entry_later);
+        const dispatcher_timer_entry_t entry = *array_last(_dispatcher_timer_heap);
+        array_pop(_dispatcher_timer_heap);
+
+        // Skip timers that were cancelled
+        if (_dispatcher_timers[entry.slot].serial == entry.serial)
         {
-            _dispatcher_actions[i].handler.invoke();
-            _dispatcher_actions[i].handler.~function();
+            _dispatcher_timers[entry.slot].due = true;
+            array_push(_dispatcher_due_timers, entry);
+        }
+        else if (_dispatcher_cancelled_timer_entries > 0)
+            _dispatcher_cancelled_timer_entries--;
+    }
+
+    for (unsigned i = 0, count = array_size(_dispatcher_due_timers); i < count; ++i)
+    {
+        const dispatcher_timer_entry_t entry = _dispatcher_due_timers[i];
+        dispatcher_timer_t* timer = &_dispatcher_timers[entry.slot];
+        if (timer->serial != entry.serial || timer->cancelled)
+            continue;
+
+        // The timers can be reallocated by handlers dispatching new calls,
+        // so the handler is moved out of the timer while it is running.
+        function<void()> handler(std::move(timer->handler));
+        timer->running = true;
+        handler.invoke();
+
+        timer = &_dispatcher_timers[entry.slot];
+        timer->running = false;
+        if (timer->interval > 0 && !timer->cancelled)
+        {
+            timer->due = false;
+            timer->handler = std::move(handler);
+
+            // Do not try to catch up on missed intervals
+            const tick_t trigger_at = max(entry.trigger_at + timer->interval, now);
+            dispatcher_timer_push(trigger_at, entry.slot, entry.serial);
         }
         else
         {
-            array_push_memcpy(_dispatcher_actions, &_dispatcher_actions[i]);
+            dispatcher_timer_free(entry.slot);
         }
     }
 
-    // Delete all the actions that were executed this frame, 
-    // those that were postponed were copied at the end of the array.
-    array_erase_ordered_range_safe(_dispatcher_actions, 0, count);
     mutex_unlock(_dispatcher_lock);
 }
 
@@ -233,25 +621,32 @@ dispatcher_event_listener_id_t dispatcher_register_event_listener(
 {
     FOUNDATION_ASSERT(name != HASH_EMPTY_STRING);
 
-    if (!mutex_lock(_dispatcher_lock))
+    if (!_event_listeners_lock.exclusive_lock())
     {
         log_errorf(0, ERROR_EXCEPTION, STRING_CONST("Failed to register event listener for %llu (0x%08x)"), name, options);
         return INVALID_DISPATCHER_EVENT_LISTENER_ID;
     }
+
+    dispatcher_event_bucket_t* bucket = dispatcher_event_bucket_get_or_add(name);
+    dispatcher_event_listeners_t* old_list = bucket->listeners;
+    dispatcher_event_listeners_t* new_list = dispatcher_event_listeners_copy(old_list, INVALID_DISPATCHER_EVENT_LISTENER_ID, 1);
     
     dispatcher_event_listener_t elistener;
     elistener.id = _next_listener_id++;
     elistener.event_name = name;
+    elistener.callback = callback;
     elistener.options = options;
     elistener.user_data = user_data;
-    array_push_memcpy(_event_listeners, &elistener);
 
-    /// The callback is assigned here, because we do not want the copy to be destroyed 
-    /// with event_listener_t{} getting out of scope since we inserted the listener 
-    //  using #array_push_memcpy
-    array_last(_event_listeners)->callback = callback;
+    const unsigned index = array_size(new_list->listeners);
+    array_resize(new_list->listeners, index + 1);
+    new (&new_list->listeners[index]) dispatcher_event_listener_t(elistener);
 
-    mutex_unlock(_dispatcher_lock);
+    bucket->listeners = new_list;
+    _event_listeners_lock.exclusive_unlock();
+
+    // Events being dispatched to the old list keep it alive until they are done.
+    dispatcher_event_listeners_release(old_list);
     return elistener.id;
 }
 
@@ -264,31 +659,49 @@ dispatcher_event_listener_id_t dispatcher_register_event_listener(
     return dispatcher_register_event_listener(string_hash(event_name, event_name_length), callback, options, user_data);
 }
 
+/*! Remove a listener from the bucket list. The listeners lock must be held exclusively.
+ * 
+ *  @return The replaced list that must be released once the lock is released.
+ */
+FOUNDATION_STATIC dispatcher_event_listeners_t* dispatcher_event_bucket_remove_listener(dispatcher_event_bucket_t* bucket, dispatcher_event_listener_id_t listener_id)
+{
+    dispatcher_event_listeners_t* old_list = bucket->listeners;
+    bucket->listeners = dispatcher_event_listeners_copy(old_list, listener_id, 0);
+    return old_list;
+}
+
 bool dispatcher_unregister_event_listener(dispatcher_event_listener_id_t event_listener_id)
 {
-    bool unregistered = false;
-    if (mutex_lock(_dispatcher_lock))
+    if (!_event_listeners_lock.exclusive_lock())
     {
-        foreach(e, _event_listeners)
+        log_errorf(0, ERROR_SYSTEM_CALL_FAIL, 
+            STRING_CONST("Failed to lock dispatcher and unregister event listener %u"), event_listener_id);
+        return false;
+    }
+
+    dispatcher_event_listeners_t* old_list = nullptr;
+    foreach(bucket, _event_buckets)
+    {
+        const dispatcher_event_listeners_t* list = bucket->listeners;
+        for (unsigned j = 0, count = list ? array_size(list->listeners) : 0; j < count; ++j)
         {
-            if (e->id == event_listener_id)
+            if (list->listeners[j].id == event_listener_id)
             {
-                e->callback.~function();
-                array_erase_memcpy_safe(_event_listeners, i);
-                unregistered = true;
+                old_list = dispatcher_event_bucket_remove_listener(bucket, event_listener_id);
                 break;
             }
         }
 
-        mutex_unlock(_dispatcher_lock);
-    }
-    else
-    {
-        log_errorf(0, ERROR_SYSTEM_CALL_FAIL, 
-            STRING_CONST("Failed to lock dispatcher and unregister event listener %u"), event_listener_id);
+        if (old_list)
+            break;
     }
 
-    return unregistered;
+    _event_listeners_lock.exclusive_unlock();
+
+    if (old_list == nullptr)
+        return false;
+    dispatcher_event_listeners_release(old_list);
+    return true;
 }
 
 bool dispatcher_unregister_event_listener(
@@ -297,24 +710,31 @@ bool dispatcher_unregister_event_listener(
 {
     FOUNDATION_ASSERT(name != HASH_EMPTY_STRING);
 
-    bool unregistered = false;
-    if (mutex_lock(_dispatcher_lock))
+    if (!_event_listeners_lock.exclusive_lock())
+        return false;
+
+    dispatcher_event_listeners_t* old_list = nullptr;
+    const uint64_t bucket_index = _event_listeners_table ? hashtable64_get(_event_listeners_table, name) : 0;
+    if (bucket_index > 0)
     {
-        foreach(e, _event_listeners)
+        dispatcher_event_bucket_t* bucket = &_event_buckets[bucket_index - 1];
+        const dispatcher_event_listeners_t* list = bucket->listeners;
+        for (unsigned i = 0, count = list ? array_size(list->listeners) : 0; i < count; ++i)
         {
-            if (e->event_name == name && (void*)e->callback.handler == callback)
+            if ((void*)list->listeners[i].callback.handler == callback)
             {
-                e->callback.~function();
-                array_erase_memcpy_safe(_event_listeners, i);
-                unregistered = true;
+                old_list = dispatcher_event_bucket_remove_listener(bucket, list->listeners[i].id);
                 break;
             }
         }
-
-        mutex_unlock(_dispatcher_lock);
     }
 
-    return unregistered;
+    _event_listeners_lock.exclusive_unlock();
+
+    if (old_list == nullptr)
+        return false;
+    dispatcher_event_listeners_release(old_list);
+    return true;
 }
 
 bool dispatcher_unregister_event_listener(
@@ -336,27 +756,221 @@ bool dispatcher_wait_for_wakeup_main_thread(int timeout_ms)
     return _main_thread_wake_up_event.wait(timeout_ms) == 0;
 }
 
+/*! Invoked once the last reference to a dispatched thread function is released. */
 FOUNDATION_STATIC void dispatch_execute_thread_completed(void* obj)
 {
     dispatcher_thread_t* dt = (dispatcher_thread_t*)obj;
-    if (dt == nullptr || dt->completed)
+    if (dt == nullptr)
         return;
-        
-    FOUNDATION_ASSERT(dt->thread);
-    FOUNDATION_ASSERT(!dt->completed);
 
-    thread_signal(dt->thread);
-    dt->completed = true;
-    dt->thread_fn.~function();
-    
-    thread_t* thread = dt->thread;
-    dispatch(dt->completed_fn);
-    dispatch(L0(thread_deallocate(thread)));
-    dt->thread = nullptr;
-    
+    if (dt->completed_fn)
+        dispatch(dt->completed_fn);
+
+    dt->~dispatcher_thread_t();
     memory_deallocate(dt);
 }
 
+/*! Release the reference owned by a dispatched thread function once it is completed, cancelled or aborted. 
+ * 
+ *  @return False if the function was already completed by another thread, i.e. aborted by #dispatcher_thread_stop.
+ */
+FOUNDATION_STATIC bool dispatch_thread_complete(dispatcher_thread_t* dt)
+{
+    if (!atomic_cas32(&dt->completed, 1, 0, memory_order_acq_rel, memory_order_acquire))
+        return false;
+
+    // Signals sent after this point cannot reach the next function executed by the thread.
+    mutex_lock(_dispatcher_pool_lock);
+    dt->thread = nullptr;
+    for (unsigned i = 0, end = array_size(_dispatcher_pool_running); i < end; ++i)
+    {
+        if (_dispatcher_pool_running[i] == dt)
+        {
+            array_erase_memcpy(_dispatcher_pool_running, i);
+            break;
+        }
+    }
+    mutex_unlock(_dispatcher_pool_lock);
+
+    objectmap_release(_dispatcher_threads, dt->handle, dispatch_execute_thread_completed);
+    dispatcher_wakeup_main_thread();
+    return true;
+}
+
+/*! Request a dispatched function to stop, functions that are still queued get signaled once they start. */
+FOUNDATION_STATIC void dispatch_thread_signal(dispatcher_thread_t* dt)
+{
+    mutex_lock(_dispatcher_pool_lock);
+    dt->signaled = true;
+    if (dt->thread)
+        thread_signal(dt->thread);
+    mutex_unlock(_dispatcher_pool_lock);
+}
+
+/*! Returns the thread executing a dispatched function, or null if it is not running. */
+FOUNDATION_STATIC thread_t* dispatch_thread_current(dispatcher_thread_t* dt)
+{
+    mutex_lock(_dispatcher_pool_lock);
+    thread_t* thread = dt->thread;
+    mutex_unlock(_dispatcher_pool_lock);
+    return thread;
+}
+
+/*! Execute a dispatched function on the calling pooled thread.
+ * 
+ *  @return False if the function was aborted by #dispatcher_thread_stop, in which case the thread must exit.
+ */
+FOUNDATION_STATIC bool dispatch_thread_execute(dispatcher_thread_t* dt)
+{
+    // Clear any signal left by the previous function executed by this thread.
+    thread_try_wait(0);
+
+    thread_set_name(dt->name, dt->name_length);
+
+    mutex_lock(_dispatcher_pool_lock);
+    dt->thread = thread_self();
+    const bool signaled = dt->signaled;
+    mutex_unlock(_dispatcher_pool_lock);
+    if (signaled)
+        thread_signal(thread_self());
+
+    dt->thread_fn.invoke(dt->payload);
+
+    thread_set_name(STRING_CONST("Dispatcher Thread"));
+    return dispatch_thread_complete(dt);
+}
+
+FOUNDATION_STATIC void* dispatcher_pool_thread_fn(void*)
+{
+    while (!_dispatcher_pool_exiting)
+    {
+        semaphore_wait(&_dispatcher_pool_semaphore);
+
+        dispatcher_thread_t* dt = nullptr;
+        mutex_lock(_dispatcher_pool_lock);
+        if (array_size(_dispatcher_pool_queue) > 0)
+        {
+            dt = _dispatcher_pool_queue[0];
+            array_erase_ordered_safe(_dispatcher_pool_queue, 0);
+            array_push(_dispatcher_pool_running, dt);
+        }
+        mutex_unlock(_dispatcher_pool_lock);
+
+        if (dt == nullptr)
+            continue;
+        
+        // The thread was removed from the pool if its function got aborted.
+        if (!dispatch_thread_execute(dt))
+            break;
+    }
+
+    return nullptr;
+}
+
+/*! Queue a function to be executed by a pooled thread, a new thread is started if all of them are busy. */
+FOUNDATION_STATIC void dispatcher_pool_enqueue(dispatcher_thread_t* dt)
+{
+    mutex_lock(_dispatcher_pool_lock);
+    array_push(_dispatcher_pool_queue, dt);
+
+    const uint32_t thread_count = array_size(_dispatcher_pool_threads);
+    const uint32_t busy_count = array_size(_dispatcher_pool_running);
+    if (array_size(_dispatcher_pool_queue) > thread_count - min(busy_count, thread_count) && thread_count < MAX_DISPATCHER_THREADS)
+    {
+        thread_t* thread = thread_allocate(dispatcher_pool_thread_fn, nullptr, STRING_CONST("Dispatcher Thread"), THREAD_PRIORITY_NORMAL, 0);
+        array_push(_dispatcher_pool_threads, thread);
+        bool thread_started = thread_start(thread);
+        FOUNDATION_ASSERT(thread_started);
+    }
+    mutex_unlock(_dispatcher_pool_lock);
+
+    semaphore_post(&_dispatcher_pool_semaphore);
+}
+
+/*! Remove a function from the queue if it was not executed yet.
+ * 
+ *  @return True if the function was removed from the queue.
+ */
+FOUNDATION_STATIC bool dispatcher_pool_dequeue(dispatcher_thread_t* dt)
+{
+    bool dequeued = false;
+    mutex_lock(_dispatcher_pool_lock);
+    for (unsigned i = 0, end = array_size(_dispatcher_pool_queue); i < end; ++i)
+    {
+        if (_dispatcher_pool_queue[i] == dt)
+        {
+            array_erase_ordered_safe(_dispatcher_pool_queue, i);
+            dequeued = true;
+            break;
+        }
+    }
+    mutex_unlock(_dispatcher_pool_lock);
+    return dequeued;
+}
+
+/*! Remove a pooled thread that was aborted while executing a function. */
+FOUNDATION_STATIC void dispatcher_pool_remove_thread(thread_t* thread)
+{
+    mutex_lock(_dispatcher_pool_lock);
+    for (unsigned i = 0, end = array_size(_dispatcher_pool_threads); i < end; ++i)
+    {
+        if (_dispatcher_pool_threads[i] == thread)
+        {
+            array_erase_memcpy_safe(_dispatcher_pool_threads, i);
+            break;
+        }
+    }
+    mutex_unlock(_dispatcher_pool_lock);
+}
+
+FOUNDATION_STATIC void dispatcher_pool_shutdown()
+{
+    _dispatcher_pool_exiting = true;
+
+    mutex_lock(_dispatcher_pool_lock);
+    thread_t** threads = _dispatcher_pool_threads;
+    dispatcher_thread_t** queue = _dispatcher_pool_queue;
+    _dispatcher_pool_threads = nullptr;
+    _dispatcher_pool_queue = nullptr;
+    mutex_unlock(_dispatcher_pool_lock);
+
+    // Functions that were never executed are completed right away
+    foreach(dt, queue)
+        dispatch_thread_complete(*dt);
+    array_deallocate(queue);
+
+    // Request running functions to stop
+    for (unsigned i = 0, end = array_size(threads); i < end; ++i)
+        thread_signal(threads[i]);
+    semaphore_post_multiple(&_dispatcher_pool_semaphore, array_size(threads));
+
+    const tick_t timeout = time_current();
+    for (unsigned i = 0, end = array_size(threads); i < end; ++i)
+    {
+        thread_t* thread = threads[i];
+        bool joined = false;
+        while (!(joined = thread_try_join(thread, 100, nullptr)) && time_elapsed(timeout) < 5.0)
+            thread_sleep(10);
+        
+        if (!joined)
+        {
+            log_warnf(0, WARNING_DEADLOCK, STRING_CONST("Dispatcher thread %.*s did not stop in time, aborting..."), STRING_FORMAT(thread->name));
+            thread_kill(thread);
+        }
+        thread_deallocate(thread);
+    }
+    array_deallocate(threads);
+
+    // Functions of the threads that were aborted never completed
+    mutex_lock(_dispatcher_pool_lock);
+    dispatcher_thread_t** running = _dispatcher_pool_running;
+    _dispatcher_pool_running = nullptr;
+    mutex_unlock(_dispatcher_pool_lock);
+    for (unsigned i = 0, end = array_size(running); i < end; ++i)
+        dispatch_thread_complete(running[i]);
+    array_deallocate(running);
+}
+
 dispatcher_thread_handle_t dispatch_thread(
     const char* name, size_t name_length, 
     const function<void*(void*)>& thread_fn, 
@@ -372,50 +986,23 @@ dispatcher_thread_handle_t dispatch_thread(
         return 0;
     }
     
-    dispatcher_thread_t* dispatcher_thread = (dispatcher_thread_t*)memory_allocate(
-        0, sizeof(dispatcher_thread_t), 0, MEMORY_PERSISTENT | MEMORY_ZERO_INITIALIZED);
-
+    dispatcher_thread_t* dispatcher_thread = MEM_NEW(0, dispatcher_thread_t);
+    dispatcher_thread->handle = thread_handle;
     dispatcher_thread->payload = payload;
     dispatcher_thread->thread_fn = thread_fn;
     dispatcher_thread->completed_fn = completed_fn;
-    dispatcher_thread->completed = false;
+    atomic_store32(&dispatcher_thread->completed, 0, memory_order_release);
+    dispatcher_thread->name_length = string_copy(STRING_BUFFER(dispatcher_thread->name), name, name_length).length;
 
     if (!objectmap_set(_dispatcher_threads, thread_handle, dispatcher_thread))
     {
         log_errorf(0, ERROR_OUT_OF_MEMORY, STRING_CONST("Failed to store thread handle"));
-        memory_deallocate(dispatcher_thread);
+        MEM_DELETE(dispatcher_thread);
         objectmap_free(_dispatcher_threads, thread_handle);
         return 0;
     }
 
-    dispatcher_thread->thread = thread_allocate([](void* thread_data)->void*
-    {
-        dispatcher_thread_handle_t dispatcher_thread_handle = to_opaque<dispatcher_thread_handle_t>(thread_data);
-        dispatcher_thread_t* dt = (dispatcher_thread_t*)objectmap_acquire(_dispatcher_threads, dispatcher_thread_handle);
-        if (dt == nullptr)
-        {
-            log_errorf(0, ERROR_INVALID_VALUE, STRING_CONST("Invalid thread handle or thread was already stopped"));
-            return nullptr;
-        }
-        
-        void* result_ptr = dt->thread_fn.invoke(dt->payload);
-        
-        if (_dispatcher_threads && objectmap_release(_dispatcher_threads, dispatcher_thread_handle, dispatch_execute_thread_completed))
-        {
-            dispatcher_wakeup_main_thread();
-
-            if (objectmap_free(_dispatcher_threads, dispatcher_thread_handle))
-                dispatch_execute_thread_completed(dt);
-            else
-                log_errorf(0, ERROR_INVALID_VALUE, STRING_CONST("Failed to free thread handle"));
-        }
-
-        return result_ptr;        
-    }, to_ptr(thread_handle), name, name_length, THREAD_PRIORITY_NORMAL, 0);
-
-    bool thread_started = thread_start(dispatcher_thread->thread);
-    FOUNDATION_ASSERT(thread_started);
-    
+    dispatcher_pool_enqueue(dispatcher_thread);
     return thread_handle;
 }
 
@@ -425,13 +1012,8 @@ bool dispatcher_thread_is_running(dispatcher_thread_handle_t thread_handle)
     if (!dt)
         return false;
 
-    if (dt->completed)
-    {
-        objectmap_release(_dispatcher_threads, thread_handle, dispatch_execute_thread_completed);
-        return false;
-    }
-
-    bool running = thread_is_running(dt->thread);
+    // Queued functions are considered running until they complete
+    bool running = !atomic_load32(&dt->completed, memory_order_acquire);
     objectmap_release(_dispatcher_threads, thread_handle, dispatch_execute_thread_completed);
     return running;
 }
@@ -441,8 +1023,8 @@ bool dispatcher_thread_signal(dispatcher_thread_handle_t thread_handle)
     dispatcher_thread_t* dt = (dispatcher_thread_t*)objectmap_acquire(_dispatcher_threads, thread_handle);
     if (dt)
     {
-        thread_signal(dt->thread);
-        return objectmap_release(_dispatcher_threads, thread_handle, nullptr);
+        dispatch_thread_signal(dt);
+        return objectmap_release(_dispatcher_threads, thread_handle, dispatch_execute_thread_completed);
     }
     else
     {
@@ -460,25 +1042,35 @@ bool dispatcher_thread_stop(dispatcher_thread_handle_t thread_handle, double tim
     dispatcher_thread_t* dt = (dispatcher_thread_t*)objectmap_acquire(_dispatcher_threads, thread_handle);
     if (dt)
     {
-        TIME_TRACKER(2.0, "Stopping dispatcher thread %.*s", STRING_FORMAT(dt->thread->name));
-        
-        while (!dt->completed && !thread_try_join(dt->thread, 100, nullptr) && time_elapsed(timeout) < timeout_seconds)
-            dispatcher_wait_for_wakeup_main_thread(200);
-        
-        if (!dt->completed && thread_is_running(dt->thread))
-        {
-            log_warnf(0, WARNING_DEADLOCK, STRING_CONST("Thread %.*s did not stop in time (%.3lg), aborting..."),
-                STRING_FORMAT(dt->thread->name), time_elapsed(timeout));
+        TIME_TRACKER(2.0, "Stopping dispatcher thread %.*s", (int)dt->name_length, dt->name);
 
-            thread_aborted = thread_kill(dt->thread);
+        if (dispatcher_pool_dequeue(dt))
+        {
+            // The function was never executed
+            dispatch_thread_complete(dt);
         }
-
-        if (objectmap_release(_dispatcher_threads, thread_handle, dispatch_execute_thread_completed))
+        else
         {
-            dispatch_execute_thread_completed(dt);
-            if (!objectmap_free(_dispatcher_threads, thread_handle))
-                log_errorf(0, ERROR_INVALID_VALUE, STRING_CONST("Failed to free thread handle"));
+            dispatch_thread_signal(dt);
+            while (!atomic_load32(&dt->completed, memory_order_acquire) && time_elapsed(timeout) < timeout_seconds)
+                dispatcher_wait_for_wakeup_main_thread(100);
+        
+            // Completing the function first makes sure it did not complete in the meantime, 
+            // and lets the thread exit by itself if the function returns while being aborted.
+            thread_t* thread = dispatch_thread_current(dt);
+            if (thread && dispatch_thread_complete(dt))
+            {
+                log_warnf(0, WARNING_DEADLOCK, STRING_CONST("Thread %.*s did not stop in time (%.3lg), aborting..."),
+                    (int)dt->name_length, dt->name, time_elapsed(timeout));
+
+                // The pooled thread gets replaced by a new one if needed
+                thread_aborted = thread_kill(thread);
+                dispatcher_pool_remove_thread(thread);
+                thread_deallocate(thread);
+            }
         }
+
+        objectmap_release(_dispatcher_threads, thread_handle, dispatch_execute_thread_completed);
     }
     else
     {
@@ -496,14 +1088,28 @@ void dispatcher_initialize()
 {
     _event_stream = event_stream_allocate(256);
     _dispatcher_lock = mutex_allocate(STRING_CONST("Dispatcher"));
-    _dispatcher_threads = objectmap_allocate(32);
+    _dispatcher_threads = objectmap_allocate(4096);
+
+    _dispatcher_pool_exiting = false;
+    _dispatcher_pool_lock = mutex_allocate(STRING_CONST("DispatcherPool"));
+    semaphore_initialize(&_dispatcher_pool_semaphore, 0);
 }
 
 void dispatcher_shutdown()
 {
-    foreach(e, _event_listeners)
-        e->callback.~function();
-    array_deallocate(_event_listeners);
+    // Stop pooled threads first, completed functions still get dispatched below.
+    dispatcher_pool_shutdown();
+    semaphore_finalize(&_dispatcher_pool_semaphore);
+    mutex_deallocate(_dispatcher_pool_lock);
+    _dispatcher_pool_lock = nullptr;
+
+    _event_listeners_lock.exclusive_lock();
+    foreach(bucket, _event_buckets)
+        dispatcher_event_listeners_release(bucket->listeners);
+    array_deallocate(_event_buckets);
+    hashtable64_deallocate(_event_listeners_table);
+    _event_listeners_table = nullptr;
+    _event_listeners_lock.exclusive_unlock();
 
     // Empty event queue by processing all remaining messages 
     // making sure any allocated memory is freed.
@@ -514,9 +1120,15 @@ void dispatcher_shutdown()
     _event_stream = nullptr;
 
     mutex_deallocate(_dispatcher_lock);
-    array_deallocate(_dispatcher_actions);
     _dispatcher_lock = nullptr;
-    _dispatcher_actions = nullptr;
+
+    // Release the handlers of pending and repeating timers
+    foreach(t, _dispatcher_timers)
+        t->~dispatcher_timer_t();
+    array_deallocate(_dispatcher_timers);
+    array_deallocate(_dispatcher_free_timers);
+    array_deallocate(_dispatcher_timer_heap);
+    array_deallocate(_dispatcher_due_timers);
 
     objectmap_deallocate(_dispatcher_threads);
     _dispatcher_threads = nullptr;
@@ -23,6 +23,12 @@ typedef hash_t dispatcher_event_name_t;
 /*! Event listener id type. */
 typedef uint32_t dispatcher_event_listener_id_t;
 
+/*! Dispatcher timer handle type, see #dispatch_timer. */
+typedef uint64_t dispatcher_timer_handle_t;
+
+/*! Represents an invalid timer handle, usually returned by #dispatch_timer if something failed. */
+constexpr dispatcher_timer_handle_t INVALID_DISPATCHER_TIMER_HANDLE = (0ULL);
+
 /*! Dispatcher thread handle type. */
 typedef object_t dispatcher_thread_handle_t;
 
@@ -37,6 +43,11 @@ typedef enum DispatcherEventOption : uint32_t
 
     /*! The data payload is a config object. The memory is managed by the dispatcher. */
     DISPATCHER_EVENT_OPTION_CONFIG_DATA = 1 << 1,
+
+    /*! Invoke the event listener from a job thread instead of the main thread. 
+     *  Data payloads managed by the dispatcher (see #DISPATCHER_EVENT_OPTION_COPY_DATA and #DISPATCHER_EVENT_OPTION_CONFIG_DATA) 
+     *  remain valid until all the listeners are invoked, other payloads must be kept alive by the caller. */
+    DISPATCHER_EVENT_OPTION_WORKER_THREAD = 1 << 2,
 } dispatcher_event_option_t;
 typedef uint32_t dispatcher_event_options_t;
 
@@ -114,6 +125,26 @@ void dispatcher_shutdown();
  */
 bool dispatch(const function<void()>& callback, uint32_t delay_milliseconds = 0);
 
+/*! Dispatch a call to be executed on the main thread after a delay, and optionally repeated at a fixed interval.
+ * 
+ *  @param callback              Callback to be executed.
+ *  @param delay_milliseconds    Delay in milliseconds before executing the call the first time.
+ *  @param interval_milliseconds Interval in milliseconds between each repeated call, 0 executes the call only once.
+ * 
+ *  @return Handle used to cancel the timer with #dispatcher_cancel_timer, or #INVALID_DISPATCHER_TIMER_HANDLE if something failed.
+ */
+dispatcher_timer_handle_t dispatch_timer(const function<void()>& callback, uint32_t delay_milliseconds, uint32_t interval_milliseconds = 0);
+
+/*! Cancel a pending call dispatched with #dispatch_timer. 
+ * 
+ *  @remark A repeating timer can cancel itself from its callback, a one-shot timer is already executed once its callback runs.
+ * 
+ *  @param timer Handle of the timer to cancel.
+ * 
+ *  @return True if the timer was cancelled, false if it was already executed (or is executing), or cancelled.
+ */
+bool dispatcher_cancel_timer(dispatcher_timer_handle_t timer);
+
 /*! Dispatch a call to be executed on the main thread for a given object.
  * 
  *  @param self     Object to call the callback on.
@@ -393,6 +424,10 @@ bool dispatcher_wait_for_wakeup_main_thread(int timeout_ms = 100);
 /*! Creates a thread that will be managed by the dispatcher system and started immediately.
  *  The thread will be joined when the dispatcher is shut down.
  * 
+ *  The thread function is executed by a pool of long-lived threads, a new thread is only 
+ *  created if all the pooled threads are busy. Once #MAX_DISPATCHER_THREADS threads are busy, 
+ *  the thread function is queued until a pooled thread is available.
+ * 
  *  @remark The Thread can be stopped or aborted with a call to #dispatcher_thread_stop.
  *
  *  @param name         Name of the thread (Useful when displayed in a debugger)
@@ -17,8 +17,9 @@
 
 #include <foundation/random.h>
 #include <foundation/system.h>
+#include <foundation/thread.h>
  
-#include <numeric> /* for std::accumulate */
+#include <limits> /* for std::numeric_limits */
 #include <ctype.h> /* for isdigit, isspace */
 
 thread_local char EXPR_ERROR_MSG[256];
@@ -30,6 +31,77 @@ static thread_local const expr_result_t** _expr_lists = nullptr;
 static expr_func_t* _expr_user_funcs = nullptr;
 static string_t* _expr_user_funcs_names = nullptr;
 
+/*! Open addressing index of #_expr_user_funcs by name hash, storing the function index + 1 (0 is an empty slot). */
+static uint32_t* _expr_user_funcs_index = nullptr;
+
+/*! Size of the memory blocks storing expression variables, see #expr_var_allocate. */
+#ifndef EXPR_VAR_BLOCK_SIZE
+#define EXPR_VAR_BLOCK_SIZE 4096
+#endif
+
+/*! Maximum number of parsed expressions kept by #eval for each thread, 0 disables the cache. */
+#ifndef EXPR_CACHE_CAPACITY
+#define EXPR_CACHE_CAPACITY 512
+#endif
+
+/*! Compile parsed expressions to bytecode evaluated by a stack machine, instead of walking the expression tree. */
+#ifndef EXPR_ENABLE_BYTECODE
+#define EXPR_ENABLE_BYTECODE 1
+#endif
+
+/*! Number of values of the bytecode evaluation stack of each thread, shared by nested evaluations. */
+#ifndef EXPR_STACK_CAPACITY
+#define EXPR_STACK_CAPACITY 256
+#endif
+
+/*! Incremented each time the function set changes, since parsed expressions point to #_expr_user_funcs elements. */
+static atomic32_t _expr_user_funcs_generation{ 0 };
+
+struct expr_program_t
+{
+    /*! Expression text, owned by the program since expression tokens point into it. */
+    string_t text;
+    hash_t key;
+
+    /*! Parsed expression, or null if it failed to parse. */
+    expr_t* root;
+
+    /*! Bytecode of the #root nodes evaluated by #expr_eval. */
+    expr_code_t** codes;
+
+    /*! Function set generation #root was parsed with. */
+    int32_t generation;
+
+    /*! Number of evaluations in progress, the program cannot be released while running. */
+    uint32_t running;
+
+    /*! Neighbours in the cache list ordered from the most to the least recently used program, see #expr_cache_t. */
+    expr_program_t* more_recent;
+    expr_program_t* less_recent;
+
+    uint64_t thread;
+};
+
+FOUNDATION_STATIC void expr_cache_clear();
+
+/*! Expressions parsed by #eval on a thread, since programs can only be evaluated by the thread that parsed them. */
+struct expr_cache_t
+{
+    expr_program_t** programs{ nullptr };
+
+    /*! Open addressing index of #programs by expression key, storing the program index + 1 (0 is an empty slot). */
+    uint32_t* index{ nullptr };
+
+    /*! Most and least recently used programs, the least recently used program is replaced once the cache is full. */
+    expr_program_t* most_recent{ nullptr };
+    expr_program_t* least_recent{ nullptr };
+
+    /*! Release the programs of a thread when it exits, the cache of the main thread is released by #expr_shutdown. */
+    ~expr_cache_t() { expr_cache_clear(); }
+};
+
+static thread_local expr_cache_t _expr_cache;
+
 typedef struct {
     string_argument_type_t type; 
     union {
@@ -422,140 +494,664 @@ FOUNDATION_STATIC expr_result_t expr_eval_time_now(const expr_func_t* f, vec_exp
     return (double)time_now();
 }
 
-template<typename T> T min_range(const T* ptr, unsigned count)
+//
+// # AGGREGATE KERNELS
+//
+
+/*! Number of raw array values summed in a single block before the block sums get added pairwise. */
+#ifndef EXPR_AGGREGATE_BLOCK_SIZE
+#define EXPR_AGGREGATE_BLOCK_SIZE 1024
+#endif
+
+/*! Aggregate raw float and double arrays with SSE2 or AVX2 kernels selected at runtime. */
+#ifndef EXPR_ENABLE_SIMD
+#define EXPR_ENABLE_SIMD FOUNDATION_ARCH_X86_64
+#endif
+
+#if EXPR_ENABLE_SIMD
+    #include <immintrin.h>
+    #if FOUNDATION_COMPILER_MSVC
+        #include <intrin.h>
+        #define EXPR_TARGET_AVX2
+    #else
+        #define EXPR_TARGET_AVX2 __attribute__((target("avx2")))
+    #endif
+#endif
+
+/*! Aggregates of a set of values, NaN values are skipped. */
+struct expr_aggregate_t
+{
+    double count{ 0 };
+    double sum{ 0 };
+    double min{ DBL_MAX };
+    double max{ -DBL_MAX };
+
+    /*! Sum of squared deviations from the mean, only computed when requested. */
+    double m2{ 0 };
+};
+
+/*! Adds block sums pairwise, so rounding errors grow with the log of the number of blocks instead of the number of values.
+ *
+ *  @remark Unlike Kahan summation, this holds with fast floating point math enabled.
+ */
+struct expr_pairwise_sum_t
+{
+    double sums[32];
+    uint8_t levels[32];
+    unsigned size{ 0 };
+
+    FOUNDATION_FORCEINLINE void add(double block_sum)
+    {
+        uint8_t level = 0;
+        while (size > 0 && levels[size - 1] == level)
+        {
+            block_sum += sums[--size];
+            level++;
+        }
+
+        sums[size] = block_sum;
+        levels[size++] = level;
+    }
+
+    FOUNDATION_FORCEINLINE double total() const
+    {
+        double total = 0;
+        for (unsigned i = size; i > 0; --i)
+            total += sums[i - 1];
+        return total;
+    }
+};
+
+/*! Checks NaN values with their bits, since fast floating point math assumes values are never NaN. */
+FOUNDATION_FORCEINLINE bool expr_aggregate_is_nan(double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return (bits & INT64_MAX) > 0x7ff0000000000000ULL;
+}
+
+FOUNDATION_FORCEINLINE bool expr_aggregate_is_nan(float value)
 {
-    T m = std::numeric_limits<T>::max();
-    for (unsigned i = 0; i < count; ++i, ++ptr)
-        m = min(*ptr, m);
-    return m;
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return (bits & INT32_MAX) > 0x7f800000U;
 }
 
-template<typename T> T max_range(const T* ptr, unsigned count)
+template<typename T> FOUNDATION_FORCEINLINE bool expr_aggregate_is_nan(T value)
 {
-    T m = std::numeric_limits<T>::min();
-    for (unsigned i = 0; i < count; ++i, ++ptr)
-        m = max(*ptr, m);
-    return m;
+    return false;
 }
 
-FOUNDATION_STATIC expr_result_t expr_eval_raw_math_min(void* ptr, uint16_t element_size, uint32_t element_count, uint64_t flags)
+template<typename T>
+FOUNDATION_STATIC void expr_aggregate_scalar(const T* values, uint32_t count, expr_aggregate_t* a)
 {
-    if (element_size == 0)
-        return NIL;
+    expr_pairwise_sum_t sum;
+    T vmin = std::numeric_limits<T>::max();
+    T vmax = std::numeric_limits<T>::lowest();
+    uint32_t valid = 0;
+    for (uint32_t i = 0; i < count; )
+    {
+        double block_sum = 0;
+        for (const uint32_t end = min(count, i + EXPR_AGGREGATE_BLOCK_SIZE); i < end; ++i)
+        {
+            const T v = values[i];
+            if (expr_aggregate_is_nan(v))
+                continue;
+
+            block_sum += (double)v;
+            vmin = v < vmin ? v : vmin;
+            vmax = v > vmax ? v : vmax;
+            valid++;
+        }
+        sum.add(block_sum);
+    }
 
-    if ((flags & EXPR_POINTER_ARRAY_FLOAT))
+    if (valid == 0)
+        return;
+
+    a->count += valid;
+    a->sum += sum.total();
+    a->min = min(a->min, (double)vmin);
+    a->max = max(a->max, (double)vmax);
+}
+
+template<typename T>
+FOUNDATION_STATIC double expr_aggregate_deviations_scalar(const T* values, uint32_t count, double mean)
+{
+    expr_pairwise_sum_t sum;
+    for (uint32_t i = 0; i < count; )
     {
-        if (element_size == 4)
-            return (double)min_range((const float*)ptr, element_count);
+        double block_sum = 0;
+        for (const uint32_t end = min(count, i + EXPR_AGGREGATE_BLOCK_SIZE); i < end; ++i)
+        {
+            if (expr_aggregate_is_nan(values[i]))
+                continue;
 
-        FOUNDATION_ASSERT(element_size == 8);
-        return min_range((const double*)ptr, element_count);
+            const double d = (double)values[i] - mean;
+            block_sum += d * d;
+        }
+        sum.add(block_sum);
     }
+    return sum.total();
+}
 
-    if ((flags & EXPR_POINTER_ARRAY_INTEGER))
+#if EXPR_ENABLE_SIMD
+
+FOUNDATION_FORCEINLINE double expr_aggregate_hsum(__m128d v)
+{
+    return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+FOUNDATION_FORCEINLINE double expr_aggregate_hmin(__m128d v)
+{
+    return _mm_cvtsd_f64(_mm_min_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+FOUNDATION_FORCEINLINE double expr_aggregate_hmax(__m128d v)
+{
+    return _mm_cvtsd_f64(_mm_max_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+/*! Returns all bits set in the lanes holding a NaN, SSE2 has no 64-bit compare so the sign of `inf - |v|` is used. */
+FOUNDATION_FORCEINLINE __m128d expr_aggregate_nan_mask_sse2(__m128d v)
+{
+    const __m128i bits = _mm_and_si128(_mm_castpd_si128(v), _mm_set1_epi64x(INT64_MAX));
+    const __m128i diff = _mm_sub_epi64(_mm_set1_epi64x(0x7ff0000000000000LL), bits);
+    return _mm_castsi128_pd(_mm_srai_epi32(_mm_shuffle_epi32(diff, _MM_SHUFFLE(3, 3, 1, 1)), 31));
+}
+
+FOUNDATION_FORCEINLINE __m128 expr_aggregate_nan_mask_sse2(__m128 v)
+{
+    const __m128i bits = _mm_and_si128(_mm_castps_si128(v), _mm_set1_epi32(INT32_MAX));
+    return _mm_castsi128_ps(_mm_cmpgt_epi32(bits, _mm_set1_epi32(0x7f800000)));
+}
+
+FOUNDATION_FORCEINLINE __m128d expr_aggregate_select_sse2(__m128d mask, __m128d a, __m128d b)
+{
+    return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+}
+
+FOUNDATION_FORCEINLINE __m128 expr_aggregate_select_sse2(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+FOUNDATION_STATIC void expr_aggregate_sse2(const double* values, uint32_t count, expr_aggregate_t* a)
+{
+    const __m128d pinf = _mm_set1_pd(std::numeric_limits<double>::infinity()), ninf = _mm_set1_pd(-std::numeric_limits<double>::infinity());
+
+    expr_pairwise_sum_t sum;
+    __m128d vmin = pinf, vmax = ninf;
+    __m128i nans = _mm_setzero_si128();
+    const uint32_t vector_count = count & ~3U;
+    for (uint32_t i = 0; i < vector_count; )
     {
-        if ((flags & EXPR_POINTER_ARRAY_UNSIGNED) == EXPR_POINTER_ARRAY_UNSIGNED)
+        __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+        for (const uint32_t end = min(vector_count, i + EXPR_AGGREGATE_BLOCK_SIZE); i < end; i += 4)
         {
-            if (element_size == 1) return (double)min_range((const uint8_t*)ptr, element_count);
-            if (element_size == 2) return (double)min_range((const uint16_t*)ptr, element_count);
-            if (element_size == 4) return (double)min_range((const uint32_t*)ptr, element_count);
+            const __m128d v0 = _mm_loadu_pd(values + i), v1 = _mm_loadu_pd(values + i + 2);
+            const __m128d m0 = expr_aggregate_nan_mask_sse2(v0), m1 = expr_aggregate_nan_mask_sse2(v1);
+            s0 = _mm_add_pd(s0, _mm_andnot_pd(m0, v0));
+            s1 = _mm_add_pd(s1, _mm_andnot_pd(m1, v1));
+            vmin = _mm_min_pd(vmin, _mm_min_pd(expr_aggregate_select_sse2(m0, pinf, v0), expr_aggregate_select_sse2(m1, pinf, v1)));
+            vmax = _mm_max_pd(vmax, _mm_max_pd(expr_aggregate_select_sse2(m0, ninf, v0), expr_aggregate_select_sse2(m1, ninf, v1)));
+            nans = _mm_sub_epi64(nans, _mm_add_epi64(_mm_castpd_si128(m0), _mm_castpd_si128(m1)));
+        }
+        sum.add(expr_aggregate_hsum(_mm_add_pd(s0, s1)));
+    }
 
-            FOUNDATION_ASSERT(element_size == 8);
-            return (double)min_range((const uint64_t*)ptr, element_count);
+    const double valid = (double)vector_count - (double)(_mm_cvtsi128_si64(nans) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(nans, nans)));
+    if (valid > 0)
+    {
+        a->count += valid;
+        a->sum += sum.total();
+        a->min = min(a->min, expr_aggregate_hmin(vmin));
+        a->max = max(a->max, expr_aggregate_hmax(vmax));
+    }
+
+    expr_aggregate_scalar(values + vector_count, count - vector_count, a);
+}
+
+FOUNDATION_STATIC void expr_aggregate_sse2(const float* values, uint32_t count, expr_aggregate_t* a)
+{
+    const __m128 pinf = _mm_set1_ps(std::numeric_limits<float>::infinity()), ninf = _mm_set1_ps(-std::numeric_limits<float>::infinity());
+
+    expr_pairwise_sum_t sum;
+    __m128 vmin = pinf, vmax = ninf;
+    __m128i nans = _mm_setzero_si128();
+    const uint32_t vector_count = count & ~3U;
+    for (uint32_t i = 0; i < vector_count; )
+    {
+        __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+        for (const uint32_t end = min(vector_count, i + EXPR_AGGREGATE_BLOCK_SIZE); i < end; i += 4)
+        {
+            const __m128 v = _mm_loadu_ps(values + i);
+            const __m128 m = expr_aggregate_nan_mask_sse2(v);
+            const __m128 z = _mm_andnot_ps(m, v);
+            s0 = _mm_add_pd(s0, _mm_cvtps_pd(z));
+            s1 = _mm_add_pd(s1, _mm_cvtps_pd(_mm_movehl_ps(z, z)));
+            vmin = _mm_min_ps(vmin, expr_aggregate_select_sse2(m, pinf, v));
+            vmax = _mm_max_ps(vmax, expr_aggregate_select_sse2(m, ninf, v));
+            nans = _mm_sub_epi32(nans, _mm_castps_si128(m));
         }
+        sum.add(expr_aggregate_hsum(_mm_add_pd(s0, s1)));
+    }
 
-        if (element_size == 1) return (double)min_range((const int8_t*)ptr, element_count);
-        if (element_size == 2) return (double)min_range((const int16_t*)ptr, element_count);
-        if (element_size == 4) return (double)min_range((const int32_t*)ptr, element_count);
+    alignas(16) int32_t nan_counts[4];
+    alignas(16) float mins[4], maxs[4];
+    _mm_store_si128((__m128i*)nan_counts, nans);
+    _mm_store_ps(mins, vmin);
+    _mm_store_ps(maxs, vmax);
 
-        FOUNDATION_ASSERT(element_size == 8);
-        return (double)min_range((const int64_t*)ptr, element_count);
+    const double valid = (double)vector_count - (double)((int64_t)nan_counts[0] + nan_counts[1] + nan_counts[2] + nan_counts[3]);
+    if (valid > 0)
+    {
+        a->count += valid;
+        a->sum += sum.total();
+        a->min = min(a->min, (double)min(min(mins[0], mins[1]), min(mins[2], mins[3])));
+        a->max = max(a->max, (double)max(max(maxs[0], maxs[1]), max(maxs[2], maxs[3])));
     }
 
-    FOUNDATION_ASSERT_FAIL("Unsupported");
-    return NIL;
+    expr_aggregate_scalar(values + vector_count, count - vector_count, a);
 }
 
-FOUNDATION_STATIC expr_result_t expr_eval_raw_math_max(void* ptr, uint16_t element_size, uint32_t element_count, uint64_t flags)
+FOUNDATION_STATIC double expr_aggregate_deviations_sse2(const double* values, uint32_t count, double mean)
 {
-    if (element_size == 0)
-        return NIL;
+    const __m128d vmean = _mm_set1_pd(mean);
 
-    if ((flags & EXPR_POINTER_ARRAY_FLOAT))
+    expr_pairwise_sum_t sum;
+    const uint32_t vector_count = count & ~3U;
+    for (uint32_t i = 0; i < vector_count; )
     {
-        if (element_size == 4)
-            return (double)max_range((const float*)ptr, element_count);
+        __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+        for (const uint32_t end = min(vector_count, i + EXPR_AGGREGATE_BLOCK_SIZE); i < end; i += 4)
+        {
+            const __m128d v0 = _mm_loadu_pd(values + i), v1 = _mm_loadu_pd(values + i + 2);
+            const __m128d d0 = _mm_sub_pd(expr_aggregate_select_sse2(expr_aggregate_nan_mask_sse2(v0), vmean, v0), vmean);
+            const __m128d d1 = _mm_sub_pd(expr_aggregate_select_sse2(expr_aggregate_nan_mask_sse2(v1), vmean, v1), vmean);
+            s0 = _mm_add_pd(s0, _mm_mul_pd(d0, d0));
+            s1 = _mm_add_pd(s1, _mm_mul_pd(d1, d1));
+        }
+        sum.add(expr_aggregate_hsum(_mm_add_pd(s0, s1)));
+    }
 
-        FOUNDATION_ASSERT(element_size == 8);
-        return max_range((const double*)ptr, element_count);
+    return sum.total() + expr_aggregate_deviations_scalar(values + vector_count, count - vector_count, mean);
+}
+
+FOUNDATION_STATIC double expr_aggregate_deviations_sse2(const float* values, uint32_t count, double mean)
+{
+    const __m128d vmean = _mm_set1_pd(mean);
+
+    expr_pairwise_sum_t sum;
+    const uint32_t vector_count = count & ~3U;
+    for (uint32_t i = 0; i < vector_count; )
+    {
+        __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+        for (const uint32_t end = min(vector_count, i + EXPR_AGGREGATE_BLOCK_SIZE); i < end; i += 4)
+        {
+            const __m128 v = _mm_loadu_ps(values + i);
+            const __m128 m = expr_aggregate_nan_mask_sse2(v);
+            const __m128 z = _mm_andnot_ps(m, v);
+            const __m128 mz = _mm_movehl_ps(m, m), zz = _mm_movehl_ps(z, z);
+
+            // NaN lanes get the mean value, so they do not deviate.
+            const __m128d d0 = _mm_sub_pd(expr_aggregate_select_sse2(_mm_castsi128_pd(_mm_unpacklo_epi32(_mm_castps_si128(m), _mm_castps_si128(m))), vmean, _mm_cvtps_pd(z)), vmean);
+            const __m128d d1 = _mm_sub_pd(expr_aggregate_select_sse2(_mm_castsi128_pd(_mm_unpacklo_epi32(_mm_castps_si128(mz), _mm_castps_si128(mz))), vmean, _mm_cvtps_pd(zz)), vmean);
+            s0 = _mm_add_pd(s0, _mm_mul_pd(d0, d0));
+            s1 = _mm_add_pd(s1, _mm_mul_pd(d1, d1));
+        }
+        sum.add(expr_aggregate_hsum(_mm_add_pd(s0, s1)));
     }
 
-    if ((flags & EXPR_POINTER_ARRAY_INTEGER))
+    return sum.total() + expr_aggregate_deviations_scalar(values + vector_count, count - vector_count, mean);
+}
+
+EXPR_TARGET_AVX2 FOUNDATION_FORCEINLINE double expr_aggregate_hsum_avx2(__m256d v)
+{
+    return expr_aggregate_hsum(_mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1)));
+}
+
+EXPR_TARGET_AVX2 FOUNDATION_FORCEINLINE __m256d expr_aggregate_nan_mask_avx2(__m256d v)
+{
+    const __m256i bits = _mm256_and_si256(_mm256_castpd_si256(v), _mm256_set1_epi64x(INT64_MAX));
+    return _mm256_castsi256_pd(_mm256_cmpgt_epi64(bits, _mm256_set1_epi64x(0x7ff0000000000000LL)));
+}
+
+EXPR_TARGET_AVX2 FOUNDATION_FORCEINLINE __m256 expr_aggregate_nan_mask_avx2(__m256 v)
+{
+    const __m256i bits = _mm256_and_si256(_mm256_castps_si256(v), _mm256_set1_epi32(INT32_MAX));
+    return _mm256_castsi256_ps(_mm256_cmpgt_epi32(bits, _mm256_set1_epi32(0x7f800000)));
+}
+
+EXPR_TARGET_AVX2 FOUNDATION_STATIC void expr_aggregate_avx2(const double* values, uint32_t count, expr_aggregate_t* a)
+{
+    const __m256d pinf = _mm256_set1_pd(std::numeric_limits<double>::infinity()), ninf = _mm256_set1_pd(-std::numeric_limits<double>::infinity());
+
+    expr_pairwise_sum_t sum;
+    __m256d vmin = pinf, vmax = ninf;
+    __m256i nans = _mm256_setzero_si256();
+    const uint32_t vector_count = count & ~15U;
+    for (uint32_t i = 0; i < vector_count; )
     {
-        if ((flags & EXPR_POINTER_ARRAY_UNSIGNED) == EXPR_POINTER_ARRAY_UNSIGNED)
+        // Four accumulators hide the latency of the additions
+        __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd(), s2 = _mm256_setzero_pd(), s3 = _mm256_setzero_pd();
+        for (const uint32_t end = min(vector_count, i + EXPR_AGGREGATE_BLOCK_SIZE); i < end; i += 16)
         {
-            if (element_size == 1) return (double)max_range((const uint8_t*)ptr, element_count);
-            if (element_size == 2) return (double)max_range((const uint16_t*)ptr, element_count);
-            if (element_size == 4) return (double)max_range((const uint32_t*)ptr, element_count);
+            const __m256d v0 = _mm256_loadu_pd(values + i), v1 = _mm256_loadu_pd(values + i + 4);
+            const __m256d v2 = _mm256_loadu_pd(values + i + 8), v3 = _mm256_loadu_pd(values + i + 12);
+            const __m256d m0 = expr_aggregate_nan_mask_avx2(v0), m1 = expr_aggregate_nan_mask_avx2(v1);
+            const __m256d m2 = expr_aggregate_nan_mask_avx2(v2), m3 = expr_aggregate_nan_mask_avx2(v3);
+            s0 = _mm256_add_pd(s0, _mm256_andnot_pd(m0, v0));
+            s1 = _mm256_add_pd(s1, _mm256_andnot_pd(m1, v1));
+            s2 = _mm256_add_pd(s2, _mm256_andnot_pd(m2, v2));
+            s3 = _mm256_add_pd(s3, _mm256_andnot_pd(m3, v3));
+            vmin = _mm256_min_pd(vmin, _mm256_min_pd(
+                _mm256_min_pd(_mm256_blendv_pd(v0, pinf, m0), _mm256_blendv_pd(v1, pinf, m1)),
+                _mm256_min_pd(_mm256_blendv_pd(v2, pinf, m2), _mm256_blendv_pd(v3, pinf, m3))));
+            vmax = _mm256_max_pd(vmax, _mm256_max_pd(
+                _mm256_max_pd(_mm256_blendv_pd(v0, ninf, m0), _mm256_blendv_pd(v1, ninf, m1)),
+                _mm256_max_pd(_mm256_blendv_pd(v2, ninf, m2), _mm256_blendv_pd(v3, ninf, m3))));
+            nans = _mm256_sub_epi64(nans, _mm256_add_epi64(
+                _mm256_add_epi64(_mm256_castpd_si256(m0), _mm256_castpd_si256(m1)),
+                _mm256_add_epi64(_mm256_castpd_si256(m2), _mm256_castpd_si256(m3))));
+        }
+        sum.add(expr_aggregate_hsum_avx2(_mm256_add_pd(_mm256_add_pd(s0, s1), _mm256_add_pd(s2, s3))));
+    }
 
-            FOUNDATION_ASSERT(element_size == 8);
-            return (double)max_range((const uint64_t*)ptr, element_count);
+    alignas(32) int64_t nan_counts[4];
+    _mm256_store_si256((__m256i*)nan_counts, nans);
+
+    const double valid = (double)vector_count - (double)(nan_counts[0] + nan_counts[1] + nan_counts[2] + nan_counts[3]);
+    if (valid > 0)
+    {
+        a->count += valid;
+        a->sum += sum.total();
+        a->min = min(a->min, expr_aggregate_hmin(_mm_min_pd(_mm256_castpd256_pd128(vmin), _mm256_extractf128_pd(vmin, 1))));
+        a->max = max(a->max, expr_aggregate_hmax(_mm_max_pd(_mm256_castpd256_pd128(vmax), _mm256_extractf128_pd(vmax, 1))));
+    }
+
+    expr_aggregate_scalar(values + vector_count, count - vector_count, a);
+}
+
+EXPR_TARGET_AVX2 FOUNDATION_STATIC void expr_aggregate_avx2(const float* values, uint32_t count, expr_aggregate_t* a)
+{
+    const __m256 pinf = _mm256_set1_ps(std::numeric_limits<float>::infinity()), ninf = _mm256_set1_ps(-std::numeric_limits<float>::infinity());
+
+    expr_pairwise_sum_t sum;
+    __m256 vmin = pinf, vmax = ninf;
+    __m256i nans = _mm256_setzero_si256();
+    const uint32_t vector_count = count & ~15U;
+    for (uint32_t i = 0; i < vector_count; )
+    {
+        // Values are summed as doubles
+        __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd(), s2 = _mm256_setzero_pd(), s3 = _mm256_setzero_pd();
+        for (const uint32_t end = min(vector_count, i + EXPR_AGGREGATE_BLOCK_SIZE); i < end; i += 16)
+        {
+            const __m256 v0 = _mm256_loadu_ps(values + i), v1 = _mm256_loadu_ps(values + i + 8);
+            const __m256 m0 = expr_aggregate_nan_mask_avx2(v0), m1 = expr_aggregate_nan_mask_avx2(v1);
+            const __m256 z0 = _mm256_andnot_ps(m0, v0), z1 = _mm256_andnot_ps(m1, v1);
+            s0 = _mm256_add_pd(s0, _mm256_cvtps_pd(_mm256_castps256_ps128(z0)));
+            s1 = _mm256_add_pd(s1, _mm256_cvtps_pd(_mm256_extractf128_ps(z0, 1)));
+            s2 = _mm256_add_pd(s2, _mm256_cvtps_pd(_mm256_castps256_ps128(z1)));
+            s3 = _mm256_add_pd(s3, _mm256_cvtps_pd(_mm256_extractf128_ps(z1, 1)));
+            vmin = _mm256_min_ps(vmin, _mm256_min_ps(_mm256_blendv_ps(v0, pinf, m0), _mm256_blendv_ps(v1, pinf, m1)));
+            vmax = _mm256_max_ps(vmax, _mm256_max_ps(_mm256_blendv_ps(v0, ninf, m0), _mm256_blendv_ps(v1, ninf, m1)));
+            nans = _mm256_sub_epi32(nans, _mm256_add_epi32(_mm256_castps_si256(m0), _mm256_castps_si256(m1)));
         }
+        sum.add(expr_aggregate_hsum_avx2(_mm256_add_pd(_mm256_add_pd(s0, s1), _mm256_add_pd(s2, s3))));
+    }
 
-        if (element_size == 1) return (double)max_range((const int8_t*)ptr, element_count);
-        if (element_size == 2) return (double)max_range((const int16_t*)ptr, element_count);
-        if (element_size == 4) return (double)max_range((const int32_t*)ptr, element_count);
+    alignas(32) int32_t nan_counts[8];
+    alignas(32) float mins[8], maxs[8];
+    _mm256_store_si256((__m256i*)nan_counts, nans);
+    _mm256_store_ps(mins, vmin);
+    _mm256_store_ps(maxs, vmax);
 
-        FOUNDATION_ASSERT(element_size == 8);
-        return (double)max_range((const int64_t*)ptr, element_count);
+    int64_t nan_count = 0;
+    float fmin = mins[0], fmax = maxs[0];
+    for (unsigned i = 0; i < 8; ++i)
+    {
+        nan_count += nan_counts[i];
+        fmin = min(fmin, mins[i]);
+        fmax = max(fmax, maxs[i]);
     }
 
-    FOUNDATION_ASSERT_FAIL("Unsupported");
-    return NIL;
+    const double valid = (double)vector_count - (double)nan_count;
+    if (valid > 0)
+    {
+        a->count += valid;
+        a->sum += sum.total();
+        a->min = min(a->min, (double)fmin);
+        a->max = max(a->max, (double)fmax);
+    }
+
+    expr_aggregate_scalar(values + vector_count, count - vector_count, a);
 }
 
-FOUNDATION_STATIC expr_result_t expr_eval_raw_math_sum(void* ptr, uint16_t element_size, uint32_t element_count, uint64_t flags)
+EXPR_TARGET_AVX2 FOUNDATION_STATIC double expr_aggregate_deviations_avx2(const double* values, uint32_t count, double mean)
+{
+    const __m256d vmean = _mm256_set1_pd(mean);
+
+    expr_pairwise_sum_t sum;
+    const uint32_t vector_count = count & ~7U;
+    for (uint32_t i = 0; i < vector_count; )
+    {
+        __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+        for (const uint32_t end = min(vector_count, i + EXPR_AGGREGATE_BLOCK_SIZE); i < end; i += 8)
+        {
+            const __m256d v0 = _mm256_loadu_pd(values + i), v1 = _mm256_loadu_pd(values + i + 4);
+            const __m256d d0 = _mm256_sub_pd(_mm256_blendv_pd(v0, vmean, expr_aggregate_nan_mask_avx2(v0)), vmean);
+            const __m256d d1 = _mm256_sub_pd(_mm256_blendv_pd(v1, vmean, expr_aggregate_nan_mask_avx2(v1)), vmean);
+            s0 = _mm256_add_pd(s0, _mm256_mul_pd(d0, d0));
+            s1 = _mm256_add_pd(s1, _mm256_mul_pd(d1, d1));
+        }
+        sum.add(expr_aggregate_hsum_avx2(_mm256_add_pd(s0, s1)));
+    }
+
+    return sum.total() + expr_aggregate_deviations_scalar(values + vector_count, count - vector_count, mean);
+}
+
+EXPR_TARGET_AVX2 FOUNDATION_STATIC double expr_aggregate_deviations_avx2(const float* values, uint32_t count, double mean)
+{
+    const __m256d vmean = _mm256_set1_pd(mean);
+
+    expr_pairwise_sum_t sum;
+    const uint32_t vector_count = count & ~7U;
+    for (uint32_t i = 0; i < vector_count; )
+    {
+        __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+        for (const uint32_t end = min(vector_count, i + EXPR_AGGREGATE_BLOCK_SIZE); i < end; i += 8)
+        {
+            const __m256 v = _mm256_loadu_ps(values + i);
+            const __m256i m = _mm256_castps_si256(expr_aggregate_nan_mask_avx2(v));
+
+            // NaN lanes get the mean value, so they do not deviate.
+            const __m256d m0 = _mm256_castsi256_pd(_mm256_cvtepi32_epi64(_mm256_castsi256_si128(m)));
+            const __m256d m1 = _mm256_castsi256_pd(_mm256_cvtepi32_epi64(_mm256_extracti128_si256(m, 1)));
+            const __m256d d0 = _mm256_sub_pd(_mm256_blendv_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(v)), vmean, m0), vmean);
+            const __m256d d1 = _mm256_sub_pd(_mm256_blendv_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)), vmean, m1), vmean);
+            s0 = _mm256_add_pd(s0, _mm256_mul_pd(d0, d0));
+            s1 = _mm256_add_pd(s1, _mm256_mul_pd(d1, d1));
+        }
+        sum.add(expr_aggregate_hsum_avx2(_mm256_add_pd(s0, s1)));
+    }
+
+    return sum.total() + expr_aggregate_deviations_scalar(values + vector_count, count - vector_count, mean);
+}
+
+FOUNDATION_STATIC bool expr_aggregate_cpu_has_avx2()
+{
+    #if FOUNDATION_COMPILER_MSVC
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+
+    // AVX registers must also be saved by the OS
+    __cpuid(info, 1);
+    const bool avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28));
+    if (!avx || (_xgetbv(0) & 6) != 6)
+        return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+    #else
+    return __builtin_cpu_supports("avx2");
+    #endif
+}
+
+#endif // EXPR_ENABLE_SIMD
+
+/*! Kernels aggregating raw float and double arrays, selected by #expr_aggregate_select_kernels for the running CPU. */
+static struct {
+    void (*aggregate_f64)(const double* values, uint32_t count, expr_aggregate_t* a) = expr_aggregate_scalar<double>;
+    void (*aggregate_f32)(const float* values, uint32_t count, expr_aggregate_t* a) = expr_aggregate_scalar<float>;
+    double (*deviations_f64)(const double* values, uint32_t count, double mean) = expr_aggregate_deviations_scalar<double>;
+    double (*deviations_f32)(const float* values, uint32_t count, double mean) = expr_aggregate_deviations_scalar<float>;
+} _expr_aggregate_kernels;
+
+FOUNDATION_STATIC void expr_aggregate_select_kernels()
+{
+    #if EXPR_ENABLE_SIMD
+    if (expr_aggregate_cpu_has_avx2())
+    {
+        _expr_aggregate_kernels.aggregate_f64 = expr_aggregate_avx2;
+        _expr_aggregate_kernels.aggregate_f32 = expr_aggregate_avx2;
+        _expr_aggregate_kernels.deviations_f64 = expr_aggregate_deviations_avx2;
+        _expr_aggregate_kernels.deviations_f32 = expr_aggregate_deviations_avx2;
+    }
+    else
+    {
+        _expr_aggregate_kernels.aggregate_f64 = expr_aggregate_sse2;
+        _expr_aggregate_kernels.aggregate_f32 = expr_aggregate_sse2;
+        _expr_aggregate_kernels.deviations_f64 = expr_aggregate_deviations_sse2;
+        _expr_aggregate_kernels.deviations_f32 = expr_aggregate_deviations_sse2;
+    }
+    #endif
+}
+
+template<typename T>
+FOUNDATION_STATIC expr_aggregate_t expr_aggregate_array(const T* values, uint32_t count, bool deviations)
+{
+    expr_aggregate_t a;
+    expr_aggregate_scalar(values, count, &a);
+    if (deviations && a.count > 1)
+        a.m2 = expr_aggregate_deviations_scalar(values, count, a.sum / a.count);
+    return a;
+}
+
+template<>
+expr_aggregate_t expr_aggregate_array(const double* values, uint32_t count, bool deviations)
+{
+    expr_aggregate_t a;
+    _expr_aggregate_kernels.aggregate_f64(values, count, &a);
+    if (deviations && a.count > 1)
+        a.m2 = _expr_aggregate_kernels.deviations_f64(values, count, a.sum / a.count);
+    return a;
+}
+
+template<>
+expr_aggregate_t expr_aggregate_array(const float* values, uint32_t count, bool deviations)
+{
+    expr_aggregate_t a;
+    _expr_aggregate_kernels.aggregate_f32(values, count, &a);
+    if (deviations && a.count > 1)
+        a.m2 = _expr_aggregate_kernels.deviations_f32(values, count, a.sum / a.count);
+    return a;
+}
+
+/*! Merges aggregates of two sets of values, including their squared deviations (Chan et al.). */
+FOUNDATION_STATIC void expr_aggregate_merge(expr_aggregate_t& a, const expr_aggregate_t& b)
+{
+    if (b.count == 0)
+        return;
+
+    if (a.count == 0)
+    {
+        a = b;
+        return;
+    }
+
+    const double count = a.count + b.count;
+    const double delta = b.sum / b.count - a.sum / a.count;
+    a.m2 += b.m2 + delta * delta * a.count * b.count / count;
+    a.count = count;
+    a.sum += b.sum;
+    a.min = min(a.min, b.min);
+    a.max = max(a.max, b.max);
+}
+
+/*! Aggregates the values of a raw array, skipping NaN values.
+ *
+ *  @param deviations Also compute the sum of squared deviations from the mean, which takes another pass over the values.
+ */
+FOUNDATION_STATIC expr_aggregate_t expr_eval_raw_math_aggregate(void* ptr, uint16_t element_size, uint32_t element_count, uint64_t flags, bool deviations = false)
 {
     if (element_size == 0)
-        return NIL;
+        return expr_aggregate_t{};
 
     if ((flags & EXPR_POINTER_ARRAY_FLOAT))
     {
         if (element_size == 4)
-            return std::accumulate((const float*)ptr, (const float*)ptr + element_count, 0.0);
+            return expr_aggregate_array((const float*)ptr, element_count, deviations);
 
         FOUNDATION_ASSERT(element_size == 8);
-        return std::accumulate((const double*)ptr, (const double*)ptr + element_count, 0.0);
+        return expr_aggregate_array((const double*)ptr, element_count, deviations);
     }
 
     if ((flags & EXPR_POINTER_ARRAY_INTEGER))
     {
         if ((flags & EXPR_POINTER_ARRAY_UNSIGNED) == EXPR_POINTER_ARRAY_UNSIGNED)
         {
-            if (element_size == 1) return std::accumulate((const uint8_t*)ptr, (const uint8_t*)ptr + element_count, 0.0);
-            if (element_size == 2) return std::accumulate((const uint16_t*)ptr, (const uint16_t*)ptr + element_count, 0.0);
-            if (element_size == 4) return std::accumulate((const uint32_t*)ptr, (const uint32_t*)ptr + element_count, 0.0);
+            if (element_size == 1) return expr_aggregate_array((const uint8_t*)ptr, element_count, deviations);
+            if (element_size == 2) return expr_aggregate_array((const uint16_t*)ptr, element_count, deviations);
+            if (element_size == 4) return expr_aggregate_array((const uint32_t*)ptr, element_count, deviations);
 
             FOUNDATION_ASSERT(element_size == 8);
-            return std::accumulate((const uint64_t*)ptr, (const uint64_t*)ptr + element_count, 0.0);
+            return expr_aggregate_array((const uint64_t*)ptr, element_count, deviations);
         }
 
-        if (element_size == 1) return std::accumulate((const int8_t*)ptr, (const int8_t*)ptr + element_count, 0.0);
-        if (element_size == 2) return std::accumulate((const int16_t*)ptr, (const int16_t*)ptr + element_count, 0.0);
-        if (element_size == 4) return std::accumulate((const int32_t*)ptr, (const int32_t*)ptr + element_count, 0.0);
+        if (element_size == 1) return expr_aggregate_array((const int8_t*)ptr, element_count, deviations);
+        if (element_size == 2) return expr_aggregate_array((const int16_t*)ptr, element_count, deviations);
+        if (element_size == 4) return expr_aggregate_array((const int32_t*)ptr, element_count, deviations);
 
         FOUNDATION_ASSERT(element_size == 8);
-        return std::accumulate((const int64_t*)ptr, (const int64_t*)ptr + element_count, 0.0);
+        return expr_aggregate_array((const int64_t*)ptr, element_count, deviations);
     }
 
     FOUNDATION_ASSERT_FAIL("Unsupported");
-    return NIL;
+    return expr_aggregate_t{};
+}
+
+FOUNDATION_STATIC expr_result_t expr_eval_raw_math_min(void* ptr, uint16_t element_size, uint32_t element_count, uint64_t flags)
+{
+    const expr_aggregate_t a = expr_eval_raw_math_aggregate(ptr, element_size, element_count, flags);
+    if (a.count == 0)
+        return NIL;
+    return a.min;
+}
+
+FOUNDATION_STATIC expr_result_t expr_eval_raw_math_max(void* ptr, uint16_t element_size, uint32_t element_count, uint64_t flags)
+{
+    const expr_aggregate_t a = expr_eval_raw_math_aggregate(ptr, element_size, element_count, flags);
+    if (a.count == 0)
+        return NIL;
+    return a.max;
+}
+
+FOUNDATION_STATIC expr_result_t expr_eval_raw_math_sum(void* ptr, uint16_t element_size, uint32_t element_count, uint64_t flags)
+{
+    if (element_size == 0)
+        return NIL;
+    return expr_eval_raw_math_aggregate(ptr, element_size, element_count, flags).sum;
 }
 
 FOUNDATION_STATIC expr_result_t expr_eval_raw_math_avg(void* ptr, uint16_t element_size, uint32_t element_count, uint64_t flags)
 {
-    expr_result_t sum = expr_eval_raw_math_sum(ptr, element_size, element_count, flags);
-    return sum / (expr_result_t)(double)element_count;
+    const expr_aggregate_t a = expr_eval_raw_math_aggregate(ptr, element_size, element_count, flags);
+    if (a.count == 0)
+        return NIL;
+    return a.sum / a.count;
 }
 
 FOUNDATION_STATIC expr_result_t expr_eval_math_min(const expr_result_t* list)
@@ -672,7 +1268,7 @@ FOUNDATION_STATIC expr_result_t expr_eval_math_count(const expr_result_t* list)
         if (e.is_set() && e.index == NO_INDEX)
             element_count += expr_eval_math_count(e.list);
         else if (e.is_raw_array())
-            element_count += (expr_result_t)(double)e.element_count();
+            element_count += (expr_result_t)expr_eval_raw_math_aggregate(e.ptr, e.element_size(), e.element_count(), e.index).count;
         else
             element_count.value++;
     }
@@ -680,6 +1276,40 @@ FOUNDATION_STATIC expr_result_t expr_eval_math_count(const expr_result_t* list)
     return element_count;
 }
 
+FOUNDATION_STATIC void expr_eval_math_aggregate(const expr_result_t* list, expr_aggregate_t& a)
+{
+    for (size_t i = 0; i < array_size(list); ++i)
+    {
+        const expr_result_t& e = list[i];
+
+        if (e.is_set() && e.index == NO_INDEX)
+        {
+            expr_eval_math_aggregate(e.list, a);
+        }
+        else if (e.is_raw_array())
+        {
+            expr_aggregate_merge(a, expr_eval_raw_math_aggregate(e.ptr, e.element_size(), e.element_count(), e.index, true));
+        }
+        else if (!e.is_null(e.index))
+        {
+            const double value = e.as_number(NAN, e.index);
+            if (!expr_aggregate_is_nan(value))
+                expr_aggregate_merge(a, expr_aggregate_t{ 1.0, value, value, value, 0 });
+        }
+    }
+}
+
+FOUNDATION_STATIC expr_result_t expr_eval_math_variance(const expr_result_t* list)
+{
+    expr_aggregate_t a;
+    expr_eval_math_aggregate(list, a);
+    if (a.count < 2)
+        return NIL;
+
+    // Sample variance
+    return a.m2 / (a.count - 1.0);
+}
+
 FOUNDATION_STATIC const expr_result_t* expr_eval_expand_args(vec_expr_t* args)
 {
     FOUNDATION_ASSERT(args);
@@ -735,20 +1365,39 @@ FOUNDATION_STATIC expr_result_t expr_eval_math_avg(const expr_func_t* f, vec_exp
     return expr_eval_math_avg(expr_eval_expand_args(args));
 }
 
-FOUNDATION_STATIC expr_result_t expr_eval_math_count(const expr_func_t* f, vec_expr_t* args, void* c)
+FOUNDATION_STATIC expr_result_t expr_eval_math_variance(const expr_func_t* f, vec_expr_t* args, void* c)
 {
     if (args == nullptr || args->len == 0)
         return NIL;
 
-    return expr_eval_math_count(expr_eval_expand_args(args));
+    return expr_eval_math_variance(expr_eval_expand_args(args));
 }
 
-FOUNDATION_STATIC expr_result_t expr_eval_ceil(const expr_func_t* f, vec_expr_t* args, void* c)
+FOUNDATION_STATIC expr_result_t expr_eval_math_stddev(const expr_func_t* f, vec_expr_t* args, void* c)
 {
-    // Examples: CEIL(1.2345) == 2.0
+    if (args == nullptr || args->len == 0)
+        return NIL;
 
-    if (args == nullptr || args->len != 1)
-        throw ExprError(EXPR_ERROR_INVALID_ARGUMENT, "Invalid arguments");
+    const expr_result_t variance = expr_eval_math_variance(expr_eval_expand_args(args));
+    if (variance.is_null())
+        return NIL;
+    return math_sqrt(variance.as_number());
+}
+
+FOUNDATION_STATIC expr_result_t expr_eval_math_count(const expr_func_t* f, vec_expr_t* args, void* c)
+{
+    if (args == nullptr || args->len == 0)
+        return NIL;
+
+    return expr_eval_math_count(expr_eval_expand_args(args));
+}
+
+FOUNDATION_STATIC expr_result_t expr_eval_ceil(const expr_func_t* f, vec_expr_t* args, void* c)
+{
+    // Examples: CEIL(1.2345) == 2.0
+
+    if (args == nullptr || args->len != 1)
+        throw ExprError(EXPR_ERROR_INVALID_ARGUMENT, "Invalid arguments");
 
     return (double)math_ceil(expr_eval(&args->buf[0]).as_number());
 }
@@ -1003,19 +1652,120 @@ FOUNDATION_STATIC expr_result_t expr_eval_string_starts_with(const expr_func_t*
     return expr_result_t((bool)string_starts_with(value.str, value.length, prefix.str, prefix.length));
 }
 
+/*! Number of positional variables, from `$0` to `$99`, that iteration functions can bind. */
+#ifndef EXPR_POSITIONAL_VAR_COUNT
+#define EXPR_POSITIONAL_VAR_COUNT 100
+#endif
+
+/*! Values of the positional variables, resolved the first time they are used by this thread. */
+static thread_local expr_result_t* _expr_positional_vars[EXPR_POSITIONAL_VAR_COUNT];
+
+/*! Returns the value slot of the positional variable `$<index>`.
+ *
+ *  Parsed expressions reference the same global variable, so assigning the slot
+ *  is the same as setting the variable by name, without any name formatting or lookup.
+ */
+FOUNDATION_STATIC expr_result_t* expr_positional_var(unsigned index)
+{
+    FOUNDATION_ASSERT(index < EXPR_POSITIONAL_VAR_COUNT);
+
+    expr_result_t* value = _expr_positional_vars[index];
+    if (value == nullptr)
+    {
+        char name[8];
+        string_t var_name = string_format(STRING_BUFFER(name), STRING_CONST("$%u"), index);
+        value = _expr_positional_vars[index] = &expr_get_or_create_global_var(STRING_ARGS(var_name))->value;
+    }
+    return value;
+}
+
+/*! Frame of positional variables bound by iteration functions for each element they visit.
+ *
+ *  The members of a set element are bound to `$1` to `$N` and any other element to `$1`.
+ *  The previous values of the positional variables are saved the first time they get bound
+ *  and restored when the frame goes out of scope, so nested iterations see their own elements.
+ */
+struct expr_frame_t
+{
+    /*! Number of positional variables whose previous value is saved, starting at `$1`. */
+    unsigned saved_count{ 0 };
+    unsigned saved_capacity{ ARRAY_COUNT(inline_saved) };
+    expr_result_t* saved{ inline_saved };
+
+    /*! Most elements bind only a few members, more values are saved in an allocated buffer. */
+    expr_result_t inline_saved[4];
+
+    ~expr_frame_t()
+    {
+        for (unsigned i = 0; i < saved_count; ++i)
+            *expr_positional_var(i + 1) = saved[i];
+        if (saved != inline_saved)
+            memory_deallocate(saved);
+    }
+
+    /*! Binds #e to the positional variables, and its members if #expand_set is true. */
+    void bind(const expr_result_t& e, bool expand_set = true)
+    {
+        unsigned count = 0;
+        if (!expand_set || !e.is_set())
+        {
+            bind(count++, e);
+        }
+        else
+        {
+            for (auto m : e)
+            {
+                if (count == EXPR_POSITIONAL_VAR_COUNT - 1)
+                    throw ExprError(EXPR_ERROR_INVALID_ARGUMENT, "Set elements cannot have more than %d members", EXPR_POSITIONAL_VAR_COUNT - 1);
+                bind(count++, m);
+            }
+        }
+
+        // Variables bound by previous elements but not this one get their previous value back
+        for (unsigned i = count; i < saved_count; ++i)
+            *expr_positional_var(i + 1) = saved[i];
+    }
+
+private:
+
+    FOUNDATION_FORCEINLINE void bind(unsigned i, const expr_result_t& value)
+    {
+        expr_result_t* slot = expr_positional_var(i + 1);
+        if (i == saved_count)
+        {
+            if (saved_count == saved_capacity)
+                grow();
+            saved[saved_count++] = *slot;
+        }
+        *slot = value;
+    }
+
+    FOUNDATION_NOINLINE void grow()
+    {
+        const unsigned capacity = saved_capacity * 2;
+        expr_result_t* buffer = (expr_result_t*)memory_allocate(HASH_EXPR, sizeof(expr_result_t) * capacity, 0, MEMORY_TEMPORARY);
+        memcpy(buffer, saved, sizeof(expr_result_t) * saved_count);
+        if (saved != inline_saved)
+            memory_deallocate(saved);
+        saved = buffer;
+        saved_capacity = capacity;
+    }
+};
+
 FOUNDATION_STATIC expr_result_t expr_eval_while(const expr_func_t* f, vec_expr_t* args, void* c)
 {
     if (args->len != 2)
         throw ExprError(EXPR_ERROR_INVALID_ARGUMENT, "Invalid arguments");
 
-    expr_set_global_var("$0", expr_result_t(0.0));
+    expr_result_t* last_result = expr_positional_var(0);
+    *last_result = expr_result_t(0.0);
 
     expr_result_t result = NIL;
     expr_result_t condition = expr_eval(args->get(0));
     while (condition)
     {
         result = expr_eval(args->get(1));
-        expr_set_global_var("$0", result);
+        *last_result = result;
 
         condition = expr_eval(args->get(0));
     }
@@ -1146,13 +1896,12 @@ FOUNDATION_STATIC expr_result_t expr_eval_reduce(const expr_func_t* f, vec_expr_
         result = expr_eval(args->get(2));
 
     // Loop on all elements and invoke function
+    expr_frame_t frame;
+    expr_result_t* last_result = expr_positional_var(0);
     for (auto e : elements)
     {
-        expr_var_t* vr = expr_get_or_create_global_var(STRING_CONST("$0"));
-        vr->value = result;
-
-        expr_var_t* ve = expr_get_or_create_global_var(STRING_CONST("$1"));
-        ve->value = e;
+        *last_result = result;
+        frame.bind(e, false);
 
         if (args->buf[1].type == OP_FUNC)
         {
@@ -1204,9 +1953,9 @@ FOUNDATION_STATIC expr_result_t expr_eval_repeat(const expr_func_t* f, vec_expr_
     expr_var_t* v = expr_get_or_create_global_var(STRING_CONST("$count"));
     v->value = expr_result_t((double)repeat_count);
 
+    expr_var_t* vi = expr_get_or_create_global_var(STRING_CONST("$i"));
     for (int i = 0; i < repeat_count; ++i)
     {
-        expr_var_t* vi = expr_get_or_create_global_var(STRING_CONST("$i"));
         vi->value = expr_result_t((double)i);
 
         expr_result_t r = expr_eval(&args->buf[0]);
@@ -1273,40 +2022,15 @@ FOUNDATION_STATIC expr_result_t expr_eval_filter(const expr_func_t* f, vec_expr_
     if (!elements.is_set())
         throw ExprError(EXPR_ERROR_INVALID_ARGUMENT, "First argument must be a result set");
 
+    expr_frame_t frame;
     expr_result_t* results = nullptr;
     for (auto e : elements)
     {
-         expr_result_t* var_stack = nullptr;
-        if (!e.is_set())
-        {
-            array_push(var_stack, expr_get_global_var_value("$1"));
-            expr_set_or_create_global_var(STRING_CONST("$1"), e);
-        }
-        else
-        {
-            int i = 1;
-            char varname[4];
-            for (auto m : e)
-            {
-                string_t macro = string_format(STRING_BUFFER(varname), STRING_CONST("$%d"), i);
-                array_push(var_stack, expr_get_global_var_value(STRING_ARGS(macro)));
-                expr_set_or_create_global_var(STRING_ARGS(macro), m);
-                i++;
-            }
-        }
+        frame.bind(e);
 
         expr_result_t r = expr_eval(&args->buf[1]);
         if (r.type != EXPR_RESULT_FALSE && (r.type == EXPR_RESULT_TRUE || r.as_number() != 0))
             array_push_memcpy(results, &e);
-
-        // Restore global variables
-        for (unsigned i = 0, end = array_size(var_stack); i < end; ++i)
-        {
-            char varname[4];
-            string_t macro = string_format(STRING_BUFFER(varname), STRING_CONST("$%d"), i+1);
-            expr_set_or_create_global_var(STRING_ARGS(macro), var_stack[i]);
-        }
-        array_deallocate(var_stack);
     }
 
     return expr_eval_list(results);
@@ -1326,42 +2050,16 @@ FOUNDATION_STATIC expr_result_t expr_eval_map(const expr_func_t* f, vec_expr_t*
     if (!elements.is_set())
         throw ExprError(EXPR_ERROR_INVALID_ARGUMENT, "First argument must be a result set");
 
+    expr_frame_t frame;
     expr_result_t* results = nullptr;
-
     for (auto e : elements)
     {
-        expr_result_t* var_stack = nullptr;
-        if (!e.is_set())
-        {
-            array_push(var_stack, expr_get_global_var_value("$1"));
-            expr_set_or_create_global_var(STRING_CONST("$1"), e);
-        }
-        else
-        {
-            char varname[4];
-            int i = 1;
-            for (auto m : e)
-            {
-                string_t macro = string_format(STRING_BUFFER(varname), STRING_CONST("$%d"), i);
-                array_push(var_stack, expr_get_global_var_value(STRING_ARGS(macro)));
-                expr_set_or_create_global_var(STRING_ARGS(macro), m);
-                i++;
-            }
-        }
+        frame.bind(e);
 
         expr_result_t r = expr_eval(&args->buf[1]);
         if (r.is_set() && r.index == NO_INDEX)
             r.index = r.element_count() - 1;
         array_push_memcpy(results, &r);
-
-        // Restore global variables
-        for (unsigned i = 0, end = array_size(var_stack); i < end; ++i)
-        {
-            char varname[4];
-            string_t macro = string_format(STRING_BUFFER(varname), STRING_CONST("$%d"), i+1);
-            expr_set_or_create_global_var(STRING_ARGS(macro), var_stack[i]);
-        }
-        array_deallocate(var_stack);
     }
 
     return expr_eval_list(results);
@@ -1542,8 +2240,68 @@ FOUNDATION_STATIC double expr_parse_number(const char* s, size_t len)
     return (digits > 0 ? num : NAN);
 }
 
+/*! Case insensitive FNV-1a hash of a function or variable name. */
+FOUNDATION_STATIC hash_t expr_name_hash(const char* s, size_t len)
+{
+    hash_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; ++i)
+    {
+        h ^= (hash_t)tolower((unsigned char)s[i]);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+FOUNDATION_STATIC void expr_funcs_index_build()
+{
+    const uint32_t count = array_size(_expr_user_funcs);
+    uint32_t capacity = 16;
+    while (capacity < count * 2)
+        capacity <<= 1;
+
+    array_resize(_expr_user_funcs_index, capacity);
+    memset(_expr_user_funcs_index, 0, sizeof(uint32_t) * capacity);
+
+    const uint32_t mask = capacity - 1;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        const expr_func_t* f = &_expr_user_funcs[i];
+        if (f->name.str == nullptr)
+            continue;
+
+        for (uint32_t slot = (uint32_t)expr_name_hash(STRING_ARGS(f->name)) & mask;; slot = (slot + 1) & mask)
+        {
+            const uint32_t index = _expr_user_funcs_index[slot];
+            if (index == 0)
+            {
+                _expr_user_funcs_index[slot] = i + 1;
+                break;
+            }
+
+            // Functions registered first with the same name have precedence.
+            if (string_equal_nocase(STRING_ARGS(_expr_user_funcs[index - 1].name), STRING_ARGS(f->name)))
+                break;
+        }
+    }
+}
+
 FOUNDATION_STATIC expr_func_t* expr_func(expr_func_t* funcs, const char* s, size_t len)
 {
+    if (funcs == _expr_user_funcs && _expr_user_funcs_index)
+    {
+        const uint32_t mask = array_size(_expr_user_funcs_index) - 1;
+        for (uint32_t slot = (uint32_t)expr_name_hash(s, len) & mask;; slot = (slot + 1) & mask)
+        {
+            const uint32_t index = _expr_user_funcs_index[slot];
+            if (index == 0)
+                return NULL;
+
+            expr_func_t* f = &_expr_user_funcs[index - 1];
+            if (string_equal_nocase(STRING_ARGS(f->name), s, len))
+                return f;
+        }
+    }
+
     for (expr_func_t* f = funcs; f->name.str; f++)
     {
         if (string_equal_nocase(STRING_ARGS(f->name), s, len))
@@ -1552,37 +2310,97 @@ FOUNDATION_STATIC expr_func_t* expr_func(expr_func_t* funcs, const char* s, size
     return NULL;
 }
 
-FOUNDATION_STATIC expr_var_t* expr_var(expr_var_list_t* vars, const char* s, size_t len)
+/*! Returns the most recent variable with the given name. 
+ * 
+ *  @param ignore_case Variables are case sensitive in expressions, but not when accessed by name with #expr_find_global_var.
+ */
+FOUNDATION_STATIC expr_var_t* expr_var_find(const expr_var_list_t* vars, const char* s, size_t len, hash_t h, bool ignore_case)
 {
-    expr_var_t* v = NULL;
+    if (vars->bucket_count == 0)
+        return NULL;
 
-    if (len > 2 && ((*s == '"' && s[len - 1] == '"') || (*s == '\'' && s[len - 1] == '\'')))
+    for (expr_var_t* v = vars->buckets[h & (vars->bucket_count - 1)]; v; v = v->bucket_next)
     {
-        s++;
-        len -= 2;
-    }
-    else if (len == 0 || !isfirstvarchr(*s)) {
-        return NULL;
+        if (v->hash != h)
+            continue;
+
+        if (ignore_case ? string_equal_nocase(STRING_ARGS(v->name), s, len) : string_equal(STRING_ARGS(v->name), s, len))
+            return v;
     }
 
-    for (v = vars->head; v; v = v->next)
+    return NULL;
+}
+
+FOUNDATION_STATIC void expr_var_rehash(expr_var_list_t* vars, uint32_t bucket_count)
+{
+    memory_deallocate(vars->buckets);
+    vars->buckets = (expr_var_t**)memory_allocate(HASH_EXPR, sizeof(expr_var_t*) * bucket_count, 0, MEMORY_PERSISTENT | MEMORY_ZERO_INITIALIZED);
+    vars->bucket_count = bucket_count;
+
+    // The variable list is ordered from the most recent variable, which must stay first in its bucket.
+    for (expr_var_t* v = vars->head; v; v = v->next)
     {
-        if (string_equal(STRING_ARGS(v->name), s, len))
-            return v;
+        expr_var_t** link = &vars->buckets[v->hash & (bucket_count - 1)];
+        while (*link)
+            link = &(*link)->bucket_next;
+        v->bucket_next = nullptr;
+        *link = v;
     }
-    v = (expr_var_t*)memory_allocate(HASH_EXPR, sizeof(expr_var_t) + len + 1, 8, MEMORY_PERSISTENT);
+}
 
-    if (v == NULL)
+/*! Creates a new variable, variables are stored in blocks and only released with the variable list. */
+FOUNDATION_STATIC expr_var_t* expr_var_allocate(expr_var_list_t* vars, const char* s, size_t len, hash_t h)
+{
+    // Keep the next variable aligned
+    const size_t size = sizeof(expr_var_t) + ((len + 1 + 7) & ~(size_t)7);
+    if (array_size(vars->blocks) == 0 || vars->block_used + size > EXPR_VAR_BLOCK_SIZE)
     {
-        log_errorf(HASH_EXPR, ERROR_OUT_OF_MEMORY, STRING_CONST("Failed to allocate memory for var %.*s"), (int)len, s);
-        return NULL; /* allocation failed */
+        void* block = memory_allocate(HASH_EXPR, max(size, (size_t)EXPR_VAR_BLOCK_SIZE), 8, MEMORY_PERSISTENT);
+        array_push(vars->blocks, block);
+        vars->block_used = 0;
     }
 
-    memset(v, 0, sizeof(expr_var_t) + len + 1);
-    v->next = vars->head;
+    expr_var_t* v = (expr_var_t*)((uint8_t*)vars->blocks[array_size(vars->blocks) - 1] + vars->block_used);
+    vars->block_used += size;
+
+    memset(v, 0, sizeof(expr_var_t));
     v->name = string_copy((char*)v + sizeof(expr_var_t), len + 1, s, len);
-    v->value = expr_result_t(EXPR_RESULT_SYMBOL, string_table_encode(STRING_ARGS(v->name)), v->name.length);
+    v->hash = h;
+    v->next = vars->head;
     vars->head = v;
+
+    if (++vars->count > vars->bucket_count)
+    {
+        expr_var_rehash(vars, max(vars->bucket_count * 2, 64U));
+    }
+    else
+    {
+        expr_var_t** bucket = &vars->buckets[h & (vars->bucket_count - 1)];
+        v->bucket_next = *bucket;
+        *bucket = v;
+    }
+
+    return v;
+}
+
+FOUNDATION_STATIC expr_var_t* expr_var(expr_var_list_t* vars, const char* s, size_t len)
+{
+    if (len > 2 && ((*s == '"' && s[len - 1] == '"') || (*s == '\'' && s[len - 1] == '\'')))
+    {
+        s++;
+        len -= 2;
+    }
+    else if (len == 0 || !isfirstvarchr(*s)) {
+        return NULL;
+    }
+
+    const hash_t h = expr_name_hash(s, len);
+    expr_var_t* v = expr_var_find(vars, s, len, h, false);
+    if (v)
+        return v;
+
+    v = expr_var_allocate(vars, s, len, h);
+    v->value = expr_result_t(EXPR_RESULT_SYMBOL, string_table_encode(STRING_ARGS(v->name)), v->name.length);
     return v;
 }
 
@@ -1591,7 +2409,25 @@ expr_result_t expr_eval_var(expr_t* e)
     return *e->param.var.value;
 }
 
-expr_result_t expr_eval(expr_t* e)
+FOUNDATION_STATIC expr_result_t expr_eval_function(expr_t* e, expr_result_t* result)
+{
+    try
+    {
+        expr_result_t fn_result = e->param.func.f->handler(e->param.func.f, &e->args, e->param.func.context);
+        *result = fn_result;
+        return fn_result;
+    }
+    catch (ExprError err)
+    {
+        if (err.outer == EXPR_ERROR_EVAL_FUNCTION)
+            throw err;
+
+        throw ExprError(err.code, EXPR_ERROR_EVAL_FUNCTION, "Failed to evaluate function %.*s: %.*s", 
+            STRING_FORMAT(e->token), (int)err.message_length, err.message);
+    }
+}
+
+FOUNDATION_STATIC expr_result_t expr_eval_tree(expr_t* e)
 {
     expr_result_t n;
     switch (e->type)
@@ -1629,108 +2465,549 @@ expr_result_t expr_eval(expr_t* e)
     case OP_SHR:
         return expr_eval(&e->args.buf[0]) >> expr_eval(&e->args.buf[1]);
 
-    case OP_LT:
-        return expr_eval(&e->args.buf[0]) < expr_eval(&e->args.buf[1]);
+    case OP_LT:
+        return expr_eval(&e->args.buf[0]) < expr_eval(&e->args.buf[1]);
+
+    case OP_LE:
+        return expr_eval(&e->args.buf[0]) <= expr_eval(&e->args.buf[1]);
+
+    case OP_GT:
+        return expr_eval(&e->args.buf[0]) > expr_eval(&e->args.buf[1]);
+
+    case OP_GE:
+        return expr_eval(&e->args.buf[0]) >= expr_eval(&e->args.buf[1]);
+
+    case OP_EQ:
+        return expr_eval(&e->args.buf[0]) == expr_eval(&e->args.buf[1]);
+
+    case OP_NE:
+        return expr_eval(&e->args.buf[0]) != expr_eval(&e->args.buf[1]);
+
+    case OP_BITWISE_AND:
+        return expr_eval(&e->args.buf[0]) & expr_eval(&e->args.buf[1]);
+
+    case OP_BITWISE_OR:
+        return expr_eval(&e->args.buf[0]) | expr_eval(&e->args.buf[1]);
+
+    case OP_BITWISE_XOR:
+        return expr_eval(&e->args.buf[0]) ^ expr_eval(&e->args.buf[1]);
+
+    case OP_LOGICAL_AND:
+        n = expr_eval(&e->args.buf[0]);
+        if (!n)
+            return expr_result_t(false);
+        n = expr_eval(&e->args.buf[1]);
+        if (!n)
+            return expr_result_t(false);
+
+        if (n.type == EXPR_RESULT_NUMBER && n.as_number() != 0.0)
+            return n;
+        return expr_result_t(true);
+
+    case OP_LOGICAL_OR:
+        n = expr_eval(&e->args.buf[0]);
+        if (n) {
+            if (n.type == EXPR_RESULT_NUMBER)
+                return n;
+            return expr_result_t(true);
+        }
+        n = expr_eval(&e->args.buf[1]);
+        if (n) {
+            if (n.type == EXPR_RESULT_NUMBER)
+                return n;
+            return expr_result_t(true);
+        }
+
+        return expr_result_t(false);
+
+    case OP_ASSIGN:
+        n = expr_eval(&e->args.buf[1]);
+        if (vec_nth(&e->args, 0).type == OP_VAR) {
+            *e->args.buf[0].param.var.value = n;
+        }
+        return n;
+    case OP_COMMA:
+        n = expr_eval(&e->args.buf[0]);
+        // Exclude some patterns from returning a result set.
+        if (e->args.buf[0].type == OP_ASSIGN && (e->args.buf[0].token.length == 0 || e->args.buf[0].args.buf[0].type == OP_VAR))
+            return expr_eval(&e->args.buf[1]);
+        return expr_eval_merge(n, expr_eval(&e->args.buf[1]), false);
+    case OP_CONST:
+        return e->param.result.value;
+
+    case OP_VAR:
+        return expr_eval_var(e);
+
+    case OP_FUNC:
+        return expr_eval_function(e, expr_positional_var(0));
+
+    case OP_SET:
+        return expr_eval_set(e);
+
+    default:
+        expr_error(EXPR_ERROR_UNKNOWN_OPERATOR, e->token, nullptr, "Failed to evaluate operator %d", e->type);
+        break;
+    }
+
+    return NAN;
+}
+
+#if EXPR_ENABLE_BYTECODE
+
+typedef enum ExprOpcode : uint8_t
+{
+    EXPR_OPCODE_RETURN,
+    EXPR_OPCODE_CONST,          // Push constants[index]
+    EXPR_OPCODE_LOAD,           // Push the variable value
+    EXPR_OPCODE_STORE,          // Set the variable value to the top value
+    EXPR_OPCODE_POP,
+
+    EXPR_OPCODE_NEGATE,
+    EXPR_OPCODE_LOGICAL_NOT,
+    EXPR_OPCODE_BITWISE_NOT,
+
+    EXPR_OPCODE_POWER,
+    EXPR_OPCODE_DIVIDE,
+    EXPR_OPCODE_MULTIPLY,
+    EXPR_OPCODE_REMAINDER,
+    EXPR_OPCODE_PLUS,
+    EXPR_OPCODE_MINUS,
+    EXPR_OPCODE_SHL,
+    EXPR_OPCODE_SHR,
+    EXPR_OPCODE_LT,
+    EXPR_OPCODE_LE,
+    EXPR_OPCODE_GT,
+    EXPR_OPCODE_GE,
+    EXPR_OPCODE_EQ,
+    EXPR_OPCODE_NE,
+    EXPR_OPCODE_BITWISE_AND,
+    EXPR_OPCODE_BITWISE_OR,
+    EXPR_OPCODE_BITWISE_XOR,
+
+    EXPR_OPCODE_AND,            // Pop the left operand, if false push false and jump to index
+    EXPR_OPCODE_AND_RESULT,     // Replace the right operand by the result
+    EXPR_OPCODE_OR,             // If the left operand is true replace it by the result and jump to index, else pop it
+    EXPR_OPCODE_OR_RESULT,      // Replace the right operand by the result
+    EXPR_OPCODE_MERGE,          // Merge the two top values in a set
+
+    EXPR_OPCODE_CALL,           // Push the result of the node function
+    EXPR_OPCODE_EVAL,           // Push the result of the node evaluated by walking its tree
+} expr_opcode_t;
+
+struct expr_instruction_t
+{
+    expr_opcode_t opcode;
+
+    /*! Constant index or jump target. */
+    uint32_t index;
+
+    union {
+        expr_result_t* var;
+        expr_t* node;
+    };
+};
+
+struct expr_code_t
+{
+    /*! Compiled node, evaluated by walking its tree if the evaluation stack is full. */
+    expr_t* node;
+
+    expr_instruction_t* instructions;
+    expr_result_t* constants;
+
+    /*! Value of the `$0` variable set to the result of function calls. */
+    expr_result_t* function_result;
+
+    /*! Number of stack values used by the evaluation. */
+    uint32_t stack_size;
+};
+
+static thread_local expr_result_t _expr_stack[EXPR_STACK_CAPACITY];
+static thread_local uint32_t _expr_stack_size = 0;
+
+FOUNDATION_STATIC uint32_t expr_code_emit(expr_code_t* code, expr_opcode_t opcode, uint32_t index = 0, void* ptr = nullptr)
+{
+    expr_instruction_t instruction;
+    instruction.opcode = opcode;
+    instruction.index = index;
+    instruction.node = (expr_t*)ptr;
+    array_push_memcpy(code->instructions, &instruction);
+    return array_size(code->instructions) - 1;
+}
+
+FOUNDATION_STATIC void expr_code_push(expr_code_t* code, uint32_t& depth)
+{
+    if (++depth > code->stack_size)
+        code->stack_size = depth;
+}
+
+/*! Checks if the node only operates on constant numbers and booleans, so it can be evaluated once when compiled. */
+FOUNDATION_STATIC bool expr_is_constant(const expr_t* e)
+{
+    if (e->type == OP_CONST)
+    {
+        const expr_result_type_t type = e->param.result.value.type;
+        return type == EXPR_RESULT_NULL || type == EXPR_RESULT_FALSE || type == EXPR_RESULT_TRUE || type == EXPR_RESULT_NUMBER;
+    }
+
+    if (e->type == OP_UNKNOWN || e->type == OP_ASSIGN || e->type >= OP_COMMA)
+        return false;
+
+    for (int i = 0; i < e->args.len; ++i)
+    {
+        if (!expr_is_constant(&e->args.buf[i]))
+            return false;
+    }
+
+    return true;
+}
+
+FOUNDATION_STATIC bool expr_code_fold(expr_code_t* code, expr_t* e, uint32_t& depth)
+{
+    if (e->type == OP_CONST || !expr_is_constant(e))
+        return false;
+
+    expr_result_t value;
+    try
+    {
+        value = expr_eval_tree(e);
+    }
+    catch (ExprError)
+    {
+        // Let the evaluation report the error
+        return false;
+    }
+
+    if (value.type != EXPR_RESULT_NULL && value.type != EXPR_RESULT_FALSE && value.type != EXPR_RESULT_TRUE && value.type != EXPR_RESULT_NUMBER)
+        return false;
+
+    array_push(code->constants, value);
+    expr_code_emit(code, EXPR_OPCODE_CONST, array_size(code->constants) - 1);
+    expr_code_push(code, depth);
+    return true;
+}
+
+FOUNDATION_STATIC void expr_code_compile_node(expr_code_t* code, expr_t* e, uint32_t& depth)
+{
+    if (expr_code_fold(code, e, depth))
+        return;
+
+    uint32_t jump;
+    switch (e->type)
+    {
+    case OP_UNARY_MINUS:
+    case OP_UNARY_LOGICAL_NOT:
+    case OP_UNARY_BITWISE_NOT:
+        expr_code_compile_node(code, &e->args.buf[0], depth);
+        expr_code_emit(code, (expr_opcode_t)(EXPR_OPCODE_NEGATE + (e->type - OP_UNARY_MINUS)));
+        break;
+
+    case OP_POWER: case OP_DIVIDE: case OP_MULTIPLY: case OP_REMAINDER:
+    case OP_PLUS: case OP_MINUS: case OP_SHL: case OP_SHR:
+    case OP_LT: case OP_LE: case OP_GT: case OP_GE: case OP_EQ: case OP_NE:
+    case OP_BITWISE_AND: case OP_BITWISE_OR: case OP_BITWISE_XOR:
+        expr_code_compile_node(code, &e->args.buf[0], depth);
+        expr_code_compile_node(code, &e->args.buf[1], depth);
+        expr_code_emit(code, (expr_opcode_t)(EXPR_OPCODE_POWER + (e->type - OP_POWER)));
+        depth--;
+        break;
+
+    case OP_LOGICAL_AND:
+        expr_code_compile_node(code, &e->args.buf[0], depth);
+        jump = expr_code_emit(code, EXPR_OPCODE_AND);
+        depth--;
+        expr_code_compile_node(code, &e->args.buf[1], depth);
+        expr_code_emit(code, EXPR_OPCODE_AND_RESULT);
+        code->instructions[jump].index = array_size(code->instructions);
+        break;
+
+    case OP_LOGICAL_OR:
+        expr_code_compile_node(code, &e->args.buf[0], depth);
+        jump = expr_code_emit(code, EXPR_OPCODE_OR);
+        depth--;
+        expr_code_compile_node(code, &e->args.buf[1], depth);
+        expr_code_emit(code, EXPR_OPCODE_OR_RESULT);
+        code->instructions[jump].index = array_size(code->instructions);
+        break;
+
+    case OP_ASSIGN:
+        expr_code_compile_node(code, &e->args.buf[1], depth);
+        if (e->args.buf[0].type == OP_VAR)
+            expr_code_emit(code, EXPR_OPCODE_STORE, 0, e->args.buf[0].param.var.value);
+        break;
+
+    case OP_COMMA:
+        expr_code_compile_node(code, &e->args.buf[0], depth);
+        // Exclude some patterns from returning a result set.
+        if (e->args.buf[0].type == OP_ASSIGN && (e->args.buf[0].token.length == 0 || e->args.buf[0].args.buf[0].type == OP_VAR))
+        {
+            expr_code_emit(code, EXPR_OPCODE_POP);
+            depth--;
+            expr_code_compile_node(code, &e->args.buf[1], depth);
+        }
+        else
+        {
+            expr_code_compile_node(code, &e->args.buf[1], depth);
+            expr_code_emit(code, EXPR_OPCODE_MERGE);
+            depth--;
+        }
+        break;
+
+    case OP_CONST:
+        array_push(code->constants, e->param.result.value);
+        expr_code_emit(code, EXPR_OPCODE_CONST, array_size(code->constants) - 1);
+        expr_code_push(code, depth);
+        break;
+
+    case OP_VAR:
+        expr_code_emit(code, EXPR_OPCODE_LOAD, 0, e->param.var.value);
+        expr_code_push(code, depth);
+        break;
+
+    case OP_FUNC:
+        expr_code_emit(code, EXPR_OPCODE_CALL, 0, e);
+        expr_code_push(code, depth);
+        break;
+
+    default:
+        expr_code_emit(code, EXPR_OPCODE_EVAL, 0, e);
+        expr_code_push(code, depth);
+        break;
+    }
+}
+
+FOUNDATION_STATIC void expr_code_deallocate(expr_code_t* code)
+{
+    array_deallocate(code->instructions);
+    array_deallocate(code->constants);
+    memory_deallocate(code);
+}
+
+/*! Compiles the bytecode of an operation node.
+ * 
+ *  @return Null if the node is faster to evaluate by walking its tree.
+ */
+FOUNDATION_STATIC expr_code_t* expr_code_compile(expr_t* e)
+{
+    // Constants, variables and sets are evaluated directly and function calls compile their own arguments.
+    if (e->type == OP_UNKNOWN || e->type >= OP_CONST)
+        return nullptr;
+
+    expr_code_t* code = (expr_code_t*)memory_allocate(HASH_EXPR, sizeof(expr_code_t), 0, MEMORY_PERSISTENT | MEMORY_ZERO_INITIALIZED);
+    code->node = e;
+    code->function_result = expr_positional_var(0);
+
+    uint32_t depth = 0;
+    expr_code_compile_node(code, e, depth);
+    expr_code_emit(code, EXPR_OPCODE_RETURN);
+    FOUNDATION_ASSERT(depth == 1);
+
+    if (code->stack_size > EXPR_STACK_CAPACITY)
+    {
+        expr_code_deallocate(code);
+        return nullptr;
+    }
+
+    return code;
+}
+
+FOUNDATION_FORCEINLINE bool expr_are_numbers(const expr_result_t& a, const expr_result_t& b)
+{
+    return a.type == EXPR_RESULT_NUMBER && b.type == EXPR_RESULT_NUMBER && math_real_is_finite(a.value) && math_real_is_finite(b.value);
+}
+
+FOUNDATION_STATIC expr_result_t expr_code_run(const expr_code_t* code)
+{
+    // Nested evaluations (i.e. function arguments) use the stack above the values of the calling evaluation.
+    const uint32_t base = _expr_stack_size;
+    if (base + code->stack_size > EXPR_STACK_CAPACITY)
+        return expr_eval_tree(code->node);
+
+    struct expr_stack_frame_t
+    {
+        const uint32_t base;
+        ~expr_stack_frame_t() { _expr_stack_size = base; }
+    } frame{ base };
+    _expr_stack_size = base + code->stack_size;
+
+    expr_result_t* sp = _expr_stack + base;
+    const expr_result_t* constants = code->constants;
+    const expr_instruction_t* ip = code->instructions;
+    for (;;)
+    {
+        const expr_instruction_t& i = *ip++;
+        switch (i.opcode)
+        {
+        case EXPR_OPCODE_RETURN:
+            return sp[-1];
+
+        case EXPR_OPCODE_CONST:
+            *sp++ = constants[i.index];
+            break;
+
+        case EXPR_OPCODE_LOAD:
+            *sp++ = *i.var;
+            break;
+
+        case EXPR_OPCODE_STORE:
+            *i.var = sp[-1];
+            break;
+
+        case EXPR_OPCODE_POP:
+            --sp;
+            break;
+
+        case EXPR_OPCODE_NEGATE:        sp[-1] = -sp[-1]; break;
+        case EXPR_OPCODE_LOGICAL_NOT:   sp[-1] = !sp[-1]; break;
+        case EXPR_OPCODE_BITWISE_NOT:   sp[-1] = ~sp[-1]; break;
+
+        case EXPR_OPCODE_POWER:         --sp; sp[-1] = math_pow(sp[-1].as_number(), sp[0].as_number()); break;
+        case EXPR_OPCODE_REMAINDER:     --sp; sp[-1] = math_mod(sp[-1].as_number(), sp[0].as_number()); break;
+        case EXPR_OPCODE_SHL:           --sp; sp[-1] = sp[-1] << sp[0]; break;
+        case EXPR_OPCODE_SHR:           --sp; sp[-1] = sp[-1] >> sp[0]; break;
+
+        // Operations on two finite numbers skip the generic operators, which give the same results.
+        case EXPR_OPCODE_DIVIDE:
+            --sp;
+            sp[-1] = expr_are_numbers(sp[-1], sp[0]) ? expr_result_t(sp[-1].value / sp[0].value) : sp[-1] / sp[0];
+            break;
+
+        case EXPR_OPCODE_MULTIPLY:
+            --sp;
+            sp[-1] = expr_are_numbers(sp[-1], sp[0]) ? expr_result_t(sp[-1].value * sp[0].value) : sp[-1] * sp[0];
+            break;
+
+        case EXPR_OPCODE_PLUS:
+            --sp;
+            sp[-1] = expr_are_numbers(sp[-1], sp[0]) ? expr_result_t(sp[-1].value + sp[0].value) : sp[-1] + sp[0];
+            break;
+
+        case EXPR_OPCODE_MINUS:
+            --sp;
+            sp[-1] = expr_are_numbers(sp[-1], sp[0]) ? expr_result_t(sp[-1].value - sp[0].value) : sp[-1] - sp[0];
+            break;
+
+        case EXPR_OPCODE_LT:
+            --sp;
+            sp[-1] = expr_are_numbers(sp[-1], sp[0]) ? expr_result_t(sp[-1].value < sp[0].value) : sp[-1] < sp[0];
+            break;
 
-    case OP_LE:
-        return expr_eval(&e->args.buf[0]) <= expr_eval(&e->args.buf[1]);
+        case EXPR_OPCODE_LE:
+            --sp;
+            sp[-1] = expr_are_numbers(sp[-1], sp[0]) ? expr_result_t(sp[-1].value <= sp[0].value) : sp[-1] <= sp[0];
+            break;
 
-    case OP_GT:
-        return expr_eval(&e->args.buf[0]) > expr_eval(&e->args.buf[1]);
+        case EXPR_OPCODE_GT:
+            --sp;
+            sp[-1] = expr_are_numbers(sp[-1], sp[0]) ? expr_result_t(sp[-1].value > sp[0].value) : sp[-1] > sp[0];
+            break;
 
-    case OP_GE:
-        return expr_eval(&e->args.buf[0]) >= expr_eval(&e->args.buf[1]);
+        case EXPR_OPCODE_GE:
+            --sp;
+            sp[-1] = expr_are_numbers(sp[-1], sp[0]) ? expr_result_t(sp[-1].value >= sp[0].value) : sp[-1] >= sp[0];
+            break;
 
-    case OP_EQ:
-        return expr_eval(&e->args.buf[0]) == expr_eval(&e->args.buf[1]);
+        case EXPR_OPCODE_EQ:
+            --sp;
+            sp[-1] = expr_are_numbers(sp[-1], sp[0]) ? expr_result_t(math_real_eq(sp[-1].value, sp[0].value, 4)) : sp[-1] == sp[0];
+            break;
 
-    case OP_NE:
-        return expr_eval(&e->args.buf[0]) != expr_eval(&e->args.buf[1]);
+        case EXPR_OPCODE_NE:
+            --sp;
+            sp[-1] = expr_are_numbers(sp[-1], sp[0]) ? expr_result_t(!math_real_eq(sp[-1].value, sp[0].value, 4)) : sp[-1] != sp[0];
+            break;
 
-    case OP_BITWISE_AND:
-        return expr_eval(&e->args.buf[0]) & expr_eval(&e->args.buf[1]);
+        case EXPR_OPCODE_BITWISE_AND:   --sp; sp[-1] = sp[-1] & sp[0]; break;
+        case EXPR_OPCODE_BITWISE_OR:    --sp; sp[-1] = sp[-1] | sp[0]; break;
+        case EXPR_OPCODE_BITWISE_XOR:   --sp; sp[-1] = sp[-1] ^ sp[0]; break;
 
-    case OP_BITWISE_OR:
-        return expr_eval(&e->args.buf[0]) | expr_eval(&e->args.buf[1]);
+        case EXPR_OPCODE_AND:
+            if (!sp[-1])
+            {
+                sp[-1] = expr_result_t(false);
+                ip = code->instructions + i.index;
+            }
+            else
+            {
+                --sp;
+            }
+            break;
 
-    case OP_BITWISE_XOR:
-        return expr_eval(&e->args.buf[0]) ^ expr_eval(&e->args.buf[1]);
+        case EXPR_OPCODE_AND_RESULT:
+            if (!sp[-1])
+                sp[-1] = expr_result_t(false);
+            else if (sp[-1].type != EXPR_RESULT_NUMBER || sp[-1].as_number() == 0.0)
+                sp[-1] = expr_result_t(true);
+            break;
 
-    case OP_LOGICAL_AND:
-        n = expr_eval(&e->args.buf[0]);
-        if (!n)
-            return expr_result_t(false);
-        n = expr_eval(&e->args.buf[1]);
-        if (!n)
-            return expr_result_t(false);
+        case EXPR_OPCODE_OR:
+            if (sp[-1])
+            {
+                if (sp[-1].type != EXPR_RESULT_NUMBER)
+                    sp[-1] = expr_result_t(true);
+                ip = code->instructions + i.index;
+            }
+            else
+            {
+                --sp;
+            }
+            break;
 
-        if (n.type == EXPR_RESULT_NUMBER && n.as_number() != 0.0)
-            return n;
-        return expr_result_t(true);
+        case EXPR_OPCODE_OR_RESULT:
+            if (!sp[-1])
+                sp[-1] = expr_result_t(false);
+            else if (sp[-1].type != EXPR_RESULT_NUMBER)
+                sp[-1] = expr_result_t(true);
+            break;
 
-    case OP_LOGICAL_OR:
-        n = expr_eval(&e->args.buf[0]);
-        if (n) {
-            if (n.type == EXPR_RESULT_NUMBER)
-                return n;
-            return expr_result_t(true);
-        }
-        n = expr_eval(&e->args.buf[1]);
-        if (n) {
-            if (n.type == EXPR_RESULT_NUMBER)
-                return n;
-            return expr_result_t(true);
-        }
+        case EXPR_OPCODE_MERGE:
+            --sp;
+            sp[-1] = expr_eval_merge(sp[-1], sp[0], false);
+            break;
 
-        return expr_result_t(false);
+        case EXPR_OPCODE_CALL:
+            *sp = expr_eval_function(i.node, code->function_result);
+            ++sp;
+            break;
 
-    case OP_ASSIGN:
-        n = expr_eval(&e->args.buf[1]);
-        if (vec_nth(&e->args, 0).type == OP_VAR) {
-            *e->args.buf[0].param.var.value = n;
+        case EXPR_OPCODE_EVAL:
+            *sp = expr_eval_tree(i.node);
+            ++sp;
+            break;
         }
-        return n;
-    case OP_COMMA:
-        n = expr_eval(&e->args.buf[0]);
-        // Exclude some patterns from returning a result set.
-        if (e->args.buf[0].type == OP_ASSIGN && (e->args.buf[0].token.length == 0 || e->args.buf[0].args.buf[0].type == OP_VAR))
-            return expr_eval(&e->args.buf[1]);
-        return expr_eval_merge(n, expr_eval(&e->args.buf[1]), false);
-    case OP_CONST:
-        return e->param.result.value;
-
-    case OP_VAR:
-        return expr_eval_var(e);
+    }
+}
 
-    case OP_FUNC:
+/*! Compiles the nodes evaluated by #expr_eval, that is the expression root, function arguments and set elements. */
+FOUNDATION_STATIC void expr_program_compile(expr_program_t* program, expr_t* e, bool evaluated)
+{
+    if (evaluated)
     {
-        try
-        {
-            expr_result_t fn_result = e->param.func.f->handler(e->param.func.f, &e->args, e->param.func.context);
-            expr_var_t* v = expr_get_or_create_global_var(STRING_CONST("$0"));
-            v->value = fn_result;
-            return fn_result;
-        }
-        catch (ExprError err)
+        expr_code_t* code = expr_code_compile(e);
+        if (code)
         {
-            if (err.outer == EXPR_ERROR_EVAL_FUNCTION)
-                throw err;
-
-            throw ExprError(err.code, EXPR_ERROR_EVAL_FUNCTION, "Failed to evaluate function %.*s: %.*s", 
-                STRING_FORMAT(e->token), (int)err.message_length, err.message);
+            e->code = code;
+            array_push(program->codes, code);
         }
-        
     }
 
-    case OP_SET:
-        return expr_eval_set(e);
+    if (e->type == OP_CONST || e->type == OP_VAR)
+        return;
 
-    default:
-        expr_error(EXPR_ERROR_UNKNOWN_OPERATOR, e->token, nullptr, "Failed to evaluate operator %d", e->type);
-        break;
-    }
+    for (int i = 0; i < e->args.len; ++i)
+        expr_program_compile(program, &e->args.buf[i], e->type == OP_FUNC || e->type == OP_SET);
+}
 
-    return NAN;
+#endif // EXPR_ENABLE_BYTECODE
+
+expr_result_t expr_eval(expr_t* e)
+{
+    #if EXPR_ENABLE_BYTECODE
+    if (e->code)
+        return expr_code_run(e->code);
+    #endif
+
+    return expr_eval_tree(e);
 }
 
 FOUNDATION_STATIC int expr_next_token(const char* s, size_t len, int& flags)
@@ -2329,27 +3606,327 @@ void expr_destroy(expr_t* e, expr_var_list_t* vars)
     }
     if (vars != NULL)
     {
-        for (expr_var_t* v = vars->head; v;)
+        for (unsigned i = 0, end = array_size(vars->blocks); i < end; ++i)
+            memory_deallocate(vars->blocks[i]);
+        array_deallocate(vars->blocks);
+        memory_deallocate(vars->buckets);
+        memset(vars, 0, sizeof(expr_var_list_t));
+    }
+}
+
+/*! Checks if the expression calls functions with a context, which is allocated for each evaluation. */
+FOUNDATION_STATIC bool expr_has_function_context(const expr_t* e)
+{
+    if (e->type == OP_FUNC && e->param.func.context)
+        return true;
+
+    if (e->type == OP_CONST || e->type == OP_VAR)
+        return false;
+
+    for (int i = 0; i < e->args.len; ++i)
+    {
+        if (expr_has_function_context(&e->args.buf[i]))
+            return true;
+    }
+
+    return false;
+}
+
+FOUNDATION_STATIC void expr_program_destroy_tree(expr_program_t* program)
+{
+    #if EXPR_ENABLE_BYTECODE
+    for (unsigned i = 0, end = array_size(program->codes); i < end; ++i)
+        expr_code_deallocate(program->codes[i]);
+    array_deallocate(program->codes);
+    #endif
+
+    expr_destroy(program->root, nullptr);
+    program->root = nullptr;
+}
+
+FOUNDATION_STATIC void expr_program_parse(expr_program_t* program)
+{
+    expr_program_destroy_tree(program);
+    program->generation = atomic_load32(&_expr_user_funcs_generation, memory_order_acquire);
+    program->root = expr_create(STRING_ARGS(program->text), &_global_vars, _expr_user_funcs);
+
+    #if EXPR_ENABLE_BYTECODE
+    if (program->root)
+        expr_program_compile(program, program->root, true);
+    #endif
+}
+
+FOUNDATION_STATIC expr_program_t* expr_program_allocate(string_const_t expression, hash_t key)
+{
+    expr_program_t* program = (expr_program_t*)memory_allocate(HASH_EXPR, sizeof(expr_program_t), 0, MEMORY_PERSISTENT | MEMORY_ZERO_INITIALIZED);
+    program->text = string_clone(STRING_ARGS(expression));
+    program->key = key;
+    program->thread = thread_id();
+    expr_program_parse(program);
+    if (program->root == nullptr)
+    {
+        expr_release(program);
+        return nullptr;
+    }
+
+    return program;
+}
+
+FOUNDATION_STATIC expr_result_t expr_program_run(expr_program_t* program, string_const_t expression)
+{
+    FOUNDATION_ASSERT_MSG(program->thread == thread_id(), "Compiled expressions must be evaluated by the thread that compiled them");
+
+    // Parse the expression again if functions were added or removed since it was parsed.
+    if (program->generation != atomic_load32(&_expr_user_funcs_generation, memory_order_acquire))
+        expr_program_parse(program);
+
+    if (program->root == nullptr)
+        return NIL;
+
+    *expr_positional_var(0) = expr_result_t(nullptr);
+
+    expr_result_t result;
+    program->running++;
+    try
+    {
+        EXPR_ERROR_CODE = EXPR_ERROR_NONE;
+        result = expr_eval(program->root);
+    }
+    catch (ExprError err)
+    {
+        expr_error(err.code, expression, nullptr,
+            "%.*s", err.message_length, err.message);
+    }
+    program->running--;
+
+    return result;
+}
+
+#if EXPR_CACHE_CAPACITY > 0
+FOUNDATION_STATIC uint32_t expr_cache_index_mask()
+{
+    uint32_t capacity = 16;
+    while (capacity < EXPR_CACHE_CAPACITY * 2)
+        capacity <<= 1;
+    return capacity - 1;
+}
+
+/*! Returns the index slot of the cached program of an expression, or -1 if it is not cached. */
+FOUNDATION_STATIC int expr_cache_find(hash_t key, string_const_t expression)
+{
+    if (_expr_cache.index == nullptr)
+        return -1;
+
+    const uint32_t mask = array_size(_expr_cache.index) - 1;
+    for (uint32_t slot = (uint32_t)key & mask;; slot = (slot + 1) & mask)
+    {
+        const uint32_t index = _expr_cache.index[slot];
+        if (index == 0)
+            return -1;
+
+        const expr_program_t* program = _expr_cache.programs[index - 1];
+        if (program->key == key && string_equal(STRING_ARGS(program->text), STRING_ARGS(expression)))
+            return (int)slot;
+    }
+}
+
+FOUNDATION_STATIC void expr_cache_index_insert(uint32_t program_index)
+{
+    if (_expr_cache.index == nullptr)
+    {
+        const uint32_t capacity = expr_cache_index_mask() + 1;
+        array_resize(_expr_cache.index, capacity);
+        memset(_expr_cache.index, 0, sizeof(uint32_t) * capacity);
+    }
+
+    const uint32_t mask = array_size(_expr_cache.index) - 1;
+    uint32_t slot = (uint32_t)_expr_cache.programs[program_index]->key & mask;
+    while (_expr_cache.index[slot] != 0)
+        slot = (slot + 1) & mask;
+    _expr_cache.index[slot] = program_index + 1;
+}
+
+/*! Remove an index slot, following entries of the probe sequence are moved back so lookups do not need tombstones. */
+FOUNDATION_STATIC void expr_cache_index_remove(uint32_t slot)
+{
+    const uint32_t mask = array_size(_expr_cache.index) - 1;
+    uint32_t hole = slot;
+    for (uint32_t next = (hole + 1) & mask; _expr_cache.index[next] != 0; next = (next + 1) & mask)
+    {
+        // Entries can only be moved back if their home slot is not between the hole and them.
+        const uint32_t home = (uint32_t)_expr_cache.programs[_expr_cache.index[next] - 1]->key & mask;
+        if (((next - home) & mask) >= ((next - hole) & mask))
         {
-            expr_var_t* next = v->next;
-            memory_deallocate(v);
-            v = next;
+            _expr_cache.index[hole] = _expr_cache.index[next];
+            hole = next;
         }
     }
+    _expr_cache.index[hole] = 0;
 }
 
-expr_result_t eval(const char* expression, size_t expression_length /*= -1*/)
+FOUNDATION_STATIC void expr_cache_unlink(expr_program_t* program)
 {
-    return eval(string_const(expression, expression_length != -1 ? expression_length : string_length(expression)));
+    if (program->more_recent)
+        program->more_recent->less_recent = program->less_recent;
+    else
+        _expr_cache.most_recent = program->less_recent;
+
+    if (program->less_recent)
+        program->less_recent->more_recent = program->more_recent;
+    else
+        _expr_cache.least_recent = program->more_recent;
+
+    program->more_recent = program->less_recent = nullptr;
 }
 
-expr_result_t eval(string_const_t expression)
+FOUNDATION_STATIC void expr_cache_link_most_recent(expr_program_t* program)
 {
-    memory_context_push(HASH_EXPR);
+    program->more_recent = nullptr;
+    program->less_recent = _expr_cache.most_recent;
+    if (_expr_cache.most_recent)
+        _expr_cache.most_recent->more_recent = program;
+    else
+        _expr_cache.least_recent = program;
+    _expr_cache.most_recent = program;
+}
+#endif
+
+/*! Returns the cached program of an expression, parsing and caching it if needed.
+ *
+ *  @return Null if the expression cannot be parsed or if the cached program is already running,
+ *          in which case #temporary is set to a program that must be released after use.
+ */
+FOUNDATION_STATIC expr_program_t* expr_cache_fetch(string_const_t expression, expr_program_t*& temporary)
+{
+    temporary = nullptr;
+    const hash_t key = hash(STRING_ARGS(expression));
+
+    #if EXPR_CACHE_CAPACITY > 0
+    const int found = expr_cache_find(key, expression);
+    if (found >= 0)
+    {
+        expr_program_t* program = _expr_cache.programs[_expr_cache.index[found] - 1];
+
+        // Nested evaluation of the same expression (i.e. from a function handler) uses its own program.
+        if (program->running > 0)
+        {
+            temporary = expr_program_allocate(expression, key);
+            return nullptr;
+        }
+
+        expr_cache_unlink(program);
+        expr_cache_link_most_recent(program);
+        return program;
+    }
+    #endif
+
+    expr_program_t* program = expr_program_allocate(expression, key);
+    if (program == nullptr)
+        return nullptr;
+
+    #if EXPR_CACHE_CAPACITY > 0
+    // Function contexts hold the state of a single evaluation, so these expressions are not cached.
+    if (expr_has_function_context(program->root))
+    {
+        temporary = program;
+        return nullptr;
+    }
+
+    if (array_size(_expr_cache.programs) < EXPR_CACHE_CAPACITY)
+    {
+        array_push(_expr_cache.programs, program);
+        expr_cache_index_insert(array_size(_expr_cache.programs) - 1);
+        expr_cache_link_most_recent(program);
+        return program;
+    }
+
+    // Replace the least recently used program that is not running
+    expr_program_t* lru = _expr_cache.least_recent;
+    while (lru && lru->running > 0)
+        lru = lru->more_recent;
+
+    if (lru)
+    {
+        const int slot = expr_cache_find(lru->key, string_to_const(lru->text));
+        FOUNDATION_ASSERT(slot >= 0);
+        const uint32_t program_index = _expr_cache.index[slot] - 1;
+        expr_cache_index_remove(slot);
+        expr_cache_unlink(lru);
+        expr_release(lru);
+
+        _expr_cache.programs[program_index] = program;
+        expr_cache_index_insert(program_index);
+        expr_cache_link_most_recent(program);
+        return program;
+    }
+    #endif
+
+    temporary = program;
+    return nullptr;
+}
+
+/*! Release the programs cached by the calling thread. */
+FOUNDATION_STATIC void expr_cache_clear()
+{
+    for (unsigned i = 0, end = array_size(_expr_cache.programs); i < end; ++i)
+        expr_release(_expr_cache.programs[i]);
+    array_deallocate(_expr_cache.programs);
+    array_deallocate(_expr_cache.index);
+    _expr_cache.most_recent = nullptr;
+    _expr_cache.least_recent = nullptr;
+}
 
+FOUNDATION_STATIC void expr_clear_lists()
+{
     for (size_t i = 0; i < array_size(_expr_lists); ++i)
         array_deallocate(_expr_lists[i]);
     array_clear(_expr_lists);
+}
+
+expr_program_t* expr_compile(const char* expression, size_t expression_length)
+{
+    memory_context_push(HASH_EXPR);
+    expr_program_t* program = expr_program_allocate(string_const(expression, expression_length), hash(expression, expression_length));
+    memory_context_pop();
+    return program;
+}
+
+expr_result_t expr_run(expr_program_t* program, const expr_binding_t* bindings /*= nullptr*/, size_t binding_count /*= 0*/)
+{
+    if (program == nullptr)
+        return NIL;
+
+    memory_context_push(HASH_EXPR);
+    expr_clear_lists();
+
+    for (size_t i = 0; i < binding_count; ++i)
+        expr_set_or_create_global_var(STRING_ARGS(bindings[i].name), bindings[i].value);
+
+    expr_result_t result = expr_program_run(program, string_to_const(program->text));
+    memory_context_pop();
+    return result;
+}
+
+void expr_release(expr_program_t* program)
+{
+    if (program == nullptr)
+        return;
+
+    FOUNDATION_ASSERT_MSG(program->running == 0, "Cannot release a running expression");
+    expr_program_destroy_tree(program);
+    string_deallocate(program->text.str);
+    memory_deallocate(program);
+}
+
+expr_result_t eval(const char* expression, size_t expression_length /*= -1*/)
+{
+    return eval(string_const(expression, expression_length != -1 ? expression_length : string_length(expression)));
+}
+
+expr_result_t eval(string_const_t expression)
+{
+    memory_context_push(HASH_EXPR);
+    expr_clear_lists();
 
     // Check if the expression is @FILE_PATH
     if (expression.length > 0 && expression.str[0] == '@')
@@ -2365,28 +3942,17 @@ expr_result_t eval(string_const_t expression)
         }
     }
 
-    expr_t* e = expr_create(STRING_ARGS(expression), &_global_vars, _expr_user_funcs);
-    if (e == NULL)
+    expr_program_t* temporary = nullptr;
+    expr_program_t* program = expr_cache_fetch(expression, temporary);
+    if (program == nullptr && temporary == nullptr)
     {
         memory_context_pop();
         return NIL;
     }
 
-    expr_set_or_create_global_var(STRING_CONST("$0"), nullptr);
-
-    expr_result_t result;
-    try
-    {
-        EXPR_ERROR_CODE = EXPR_ERROR_NONE;
-        result = expr_eval(e);
-    }
-    catch (ExprError err)
-    {
-        expr_error(err.code, expression, nullptr,
-            "%.*s", err.message_length, err.message);
-    }
+    expr_result_t result = expr_program_run(program ? program : temporary, expression);
 
-    expr_destroy(e, nullptr);
+    expr_release(temporary);
     memory_context_pop();
     return result;
 }
@@ -2406,6 +3972,8 @@ void expr_register_function(const char* name, exprfn_t fn, exprfn_cleanup_t clea
     efn.ctxsz = context_size;
     efn.name = string_to_const(name_copy);
     array_insert_memcpy_safe(_expr_user_funcs, array_size(_expr_user_funcs) - 2, &efn);
+    expr_funcs_index_build();
+    atomic_incr32(&_expr_user_funcs_generation, memory_order_release);
 
     memory_context_pop();
 }
@@ -2416,9 +3984,16 @@ bool expr_unregister_function(const char* name, exprfn_t fn /*= nullptr*/)
     for (unsigned i = 0, end = array_size(_expr_user_funcs); i < end; ++i)
     {
         expr_func_t& efn = _expr_user_funcs[i];
+
+        // Never remove the end of list marker.
+        if (efn.name.str == nullptr)
+            continue;
+
         if (efn.handler == fn || string_equal_nocase(name, name_length, STRING_ARGS(efn.name)))
         {
             array_erase_ordered_safe(_expr_user_funcs, i);
+            expr_funcs_index_build();
+            atomic_incr32(&_expr_user_funcs_generation, memory_order_release);
             return true;
         }
     }
@@ -2428,15 +4003,7 @@ bool expr_unregister_function(const char* name, exprfn_t fn /*= nullptr*/)
 
 expr_var_t* expr_find_global_var(const char* name, size_t name_length)
 {
-    expr_var_t* v = _global_vars.head;
-    while (v)
-    {
-        if (string_equal_nocase(STRING_ARGS(v->name), name, name_length))
-            return v;
-        v = v->next;
-    }
-
-    return nullptr;
+    return expr_var_find(&_global_vars, name, name_length, expr_name_hash(name, name_length), true);
 }
 
 FOUNDATION_STATIC expr_var_t* expr_get_global_var(const char* name, size_t name_length /*= 0ULL*/)
@@ -2455,14 +4022,12 @@ expr_result_t expr_get_global_var_value(const char* name, size_t name_length /*=
 expr_var_t* expr_get_or_create_global_var(const char* name, size_t name_length /*= 0ULL*/)
 {
     name_length = name_length == 0ULL ? string_length(name) : name_length;
-    expr_var_t* v = expr_find_global_var(name, name_length);
+    const hash_t h = expr_name_hash(name, name_length);
+    expr_var_t* v = expr_var_find(&_global_vars, name, name_length, h, true);
     if (v == nullptr)
     {
-        v = (expr_var_t*)memory_allocate(HASH_EXPR, sizeof(expr_var_t) + name_length + 1, 0, MEMORY_PERSISTENT);
-        v->name = string_copy((char*)v + sizeof(expr_var_t), name_length + 1, name, name_length);
+        v = expr_var_allocate(&_global_vars, name, name_length, h);
         v->value = NIL;
-        v->next = _global_vars.head;
-        _global_vars.head = v;
     }
 
     return v;
@@ -2609,12 +4174,16 @@ ExprError::ExprError(expr_error_code_t code, const expr_func_t* f, vec_expr_t* a
 
 FOUNDATION_STATIC void expr_initialize()
 {
+    expr_aggregate_select_kernels();
+
     // Set functions
     array_push(_expr_user_funcs, (expr_func_t{ STRING_CONST("MIN"), expr_eval_math_min, NULL, 0 })); // MIN([-1, 0, 1])
     array_push(_expr_user_funcs, (expr_func_t{ STRING_CONST("MAX"), expr_eval_math_max, NULL, 0 })); // MAX([1, 2, 3]) + MAX(4, 5, 6) = 9
     array_push(_expr_user_funcs, (expr_func_t{ STRING_CONST("SUM"), expr_eval_math_sum, NULL, 0 })); // SUM(0, 0, 1, 3) == 4
     array_push(_expr_user_funcs, (expr_func_t{ STRING_CONST("AVG"), expr_eval_math_avg, NULL, 0 })); // (AVG(1, [1, 1]) + AVG([1], [2], [3])) == 3
     array_push(_expr_user_funcs, (expr_func_t{ STRING_CONST("COUNT"), expr_eval_math_count, NULL, 0 })); // COUNT(SAMPLES())
+    array_push(_expr_user_funcs, (expr_func_t{ STRING_CONST("VARIANCE"), expr_eval_math_variance, NULL, 0 })); // VARIANCE(2, 4, 4, 4, 5, 5, 7, 9) == 32/7
+    array_push(_expr_user_funcs, (expr_func_t{ STRING_CONST("STDDEV"), expr_eval_math_stddev, NULL, 0 })); // STDDEV([1, 2, 3, 4]) == 1.291
     array_push(_expr_user_funcs, (expr_func_t{ STRING_CONST("INDEX"), expr_eval_array_index, NULL, 0 })); // INDEX([1, 2, 3], 2) == 2
     array_push(_expr_user_funcs, (expr_func_t{ STRING_CONST("MAP"), expr_eval_map, NULL, 0 })); // MAP([[a, 1], [b, 2], [c, 3]], INDEX($1, 1)) == [1, 2, 3]
     array_push(_expr_user_funcs, (expr_func_t{ STRING_CONST("FILTER"), expr_eval_filter, NULL, 0 })); // FILTER([1, 2, 3], EVAL($1 >= 3)) == [3]
@@ -2654,6 +4223,7 @@ FOUNDATION_STATIC void expr_initialize()
     
     // Must always be last
     array_push(_expr_user_funcs, (expr_func_t{ NULL, 0, NULL, NULL, 0 }));
+    expr_funcs_index_build();
 
     expr_set_global_var("PI", DBL_PI);
     expr_set_global_var("HALFPI", DBL_HALFPI);
@@ -2721,14 +4291,18 @@ FOUNDATION_STATIC void expr_shutdown()
     plot_expr_shutdown();
     table_expr_shutdown();
 
+    expr_cache_clear();
+
     for (size_t i = 0; i < array_size(_expr_lists); ++i)
         array_deallocate(_expr_lists[i]);
     array_deallocate(_expr_lists);
 
     array_deallocate(_expr_user_funcs);
+    array_deallocate(_expr_user_funcs_index);
     string_array_deallocate(_expr_user_funcs_names);
 
     expr_destroy(nullptr, &_global_vars);
+    memset(_expr_positional_vars, 0, sizeof(_expr_positional_vars));
 }
 
 DEFINE_MODULE(EXPR, expr_initialize, expr_shutdown, MODULE_PRIORITY_SYSTEM);
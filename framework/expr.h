@@ -22,6 +22,7 @@
 struct expr_t;
 struct expr_func_t;
 struct expr_result_t;
+struct expr_code_t;
 
 /*
  * Expression error codes
@@ -1172,6 +1173,9 @@ struct expr_t
 
     /*! Expression token from the original expression. */
     expr_string_t token;
+
+    /*! Bytecode evaluating the node, set for nodes evaluated by #expr_eval when the expression is compiled. */
+    const expr_code_t* code{ nullptr };
 };
 
 /*! Expression variable. 
@@ -1190,6 +1194,12 @@ struct expr_var_t
 
     /*! Variable name. */
     string_t name;
+
+    /*! Case insensitive hash of the variable name. */
+    hash_t hash;
+
+    /*! Next variable in the same #expr_var_list_t bucket. */
+    expr_var_t* bucket_next;
     
     // IMPORTANT: Variable string name buffer is stored at the end of the structure and name points to it.
 };
@@ -1199,6 +1209,15 @@ struct expr_var_list_t
 {
     /* Variable list head */
     expr_var_t* head;
+
+    /* Variables indexed by name hash, the most recent variable first in each bucket */
+    expr_var_t** buckets;
+    uint32_t bucket_count;
+    uint32_t count;
+
+    /* Memory blocks storing the variables */
+    void** blocks;
+    size_t block_used;
 };
 
 /*! Expression argument list. */
@@ -1222,6 +1241,8 @@ struct expr_macro_t
 };
 
 /*! Evaluate an expression node.
+ *
+ *  Nodes of compiled expressions are evaluated using their bytecode, others by walking the expression tree.
  *
  *  @param e Expression node to evaluate.
  *
@@ -1230,6 +1251,8 @@ struct expr_macro_t
 expr_result_t expr_eval(expr_t* e);
 
 /*! Evaluate an expression.
+ * 
+ *  Parsed expressions are kept in a per-thread cache, so evaluating the same expression again does not parse it again.
  * 
  *  @param expression Expression to evaluate.
  * 
@@ -1246,6 +1269,49 @@ expr_result_t eval(string_const_t expression);
  */
 expr_result_t eval(const char* expression, size_t expression_length = -1);
 
+/*! Compiled expression, see #expr_compile. */
+struct expr_program_t;
+
+/*! Variable value set before running a compiled expression, see #expr_run. */
+struct expr_binding_t
+{
+    /*! Variable name, i.e. `$price` */
+    string_const_t name;
+
+    /*! Variable value */
+    expr_result_t value;
+};
+
+/*! Parse an expression once so it can be evaluated many times with #expr_run.
+ *
+ *  @remark The compiled expression references the variables of the calling thread,
+ *          so it must be run and released on the same thread.
+ *
+ *  @param expression        Expression to compile, the string is copied.
+ *  @param expression_length Length of the expression string.
+ *
+ *  @return Compiled expression, or null if the expression cannot be parsed (see #EXPR_ERROR_CODE).
+ */
+expr_program_t* expr_compile(const char* expression, size_t expression_length);
+
+/*! Evaluate a compiled expression.
+ *
+ *  The expression gets parsed again if functions were registered or unregistered since it was compiled.
+ *
+ *  @param program       Compiled expression returned by #expr_compile.
+ *  @param bindings      Global variables to set before evaluating the expression, or null.
+ *  @param binding_count Number of bindings.
+ *
+ *  @return Result of the expression evaluation.
+ */
+expr_result_t expr_run(expr_program_t* program, const expr_binding_t* bindings = nullptr, size_t binding_count = 0);
+
+/*! Release a compiled expression returned by #expr_compile.
+ *
+ *  @param program Compiled expression to release, can be null.
+ */
+void expr_release(expr_program_t* program);
+
 /*! Set a global expression variable to point to an application pointer.
  * 
  *  @remark Nothing special is done to manage the ptr lifespan. It is up to the application to ensure
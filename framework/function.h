@@ -198,6 +198,15 @@ struct function<R(Args...)>
 
     FOUNDATION_FORCEINLINE function& operator=(function&& o) noexcept
     {
+        if (this == &o)
+            return *this;
+
+        // Release the current closure, i.e. when assigning nullptr to release the captures.
+        if (destroy_f && closure_size > 0)
+            this->destroy_f(get_closure_ptr());
+        if (closure_size > sizeof(fixed_closure))
+            memory_deallocate(dynamic_closure);
+
         handler = o.handler;
         construct_f = o.construct_f;
         destroy_f = o.destroy_f;
@@ -6,119 +6,579 @@
 #include "jobs.h"
 
 #include "common.h"
-#include "concurrent_queue.h"
+#include "array.h"
 #include "dispatcher.h"
+#include "shared_mutex.h"
+#include "concurrent_queue.h"
 
 #include <foundation/thread.h>
 #include <foundation/semaphore.h>
+#include <foundation/system.h>
+#include <foundation/atomic.h>
 
+/*! Maximum number of job threads, 0 uses a job thread per hardware thread (minus the main thread). */
 #ifndef MAX_JOB_THREADS
-#define MAX_JOB_THREADS 8
+#define MAX_JOB_THREADS 0
 #endif
 
-static concurrent_queue<job_t*> _scheduled_jobs{};
-static thread_t* _job_threads[MAX_JOB_THREADS]{ nullptr };
+/*! Marks the continuations of a completed job, continuations added afterward are scheduled right away. */
+static job_t* const JOB_CONTINUATIONS_COMPLETED = (job_t*)(uintptr_t)1;
+
+/*! Job state flags (see #job_t::state). */
+constexpr int32_t JOB_STATE_SCHEDULED = 1 << 0;
+constexpr int32_t JOB_STATE_COMPLETED = 1 << 1;
+
+/*! The owner released the job before it completed, so the thread completing it releases it instead. */
+constexpr int32_t JOB_STATE_RELEASED = 1 << 2;
+
+/*! Number of jobs a worker runs from its own deque before it checks the submitted jobs first, so they cannot be starved by child jobs. */
+constexpr uint32_t JOB_SUBMITTED_JOBS_CHECK_INTERVAL = 61;
+
+/*! Number of times a waiting thread looks for work before it parks until a job completes (see #job_wait). */
+constexpr uint32_t JOB_WAIT_SPIN_COUNT = 64;
+
+/*! Maximum time a parked waiting thread sleeps before it looks for work again.
+ *  
+ *  Waiting threads are woken up when their job or group completes, but not when new jobs are scheduled.
+ */
+constexpr unsigned JOB_WAIT_PARK_TIMEOUT_MS = 100;
+
+/*! Initial number of jobs a worker deque can hold, deques grow as needed. */
+constexpr int64_t JOB_DEQUE_INITIAL_CAPACITY = 256;
 
-static void* job_thread_fn(void* arg)
+/*! Number of submitted jobs held without a lock, see #concurrent_queue. */
+constexpr size_t JOB_SUBMITTED_JOBS_CAPACITY = 1024;
+
+/*! Number of free jobs a job thread keeps for itself before it gives half of them back to the shared job pool. */
+constexpr uint32_t JOB_POOL_THREAD_CAPACITY = 256;
+
+/*! Number of jobs allocated at once when the job pool is empty. */
+constexpr uint32_t JOB_POOL_SLAB_SIZE = 64;
+
+/*! Circular array of jobs of a worker deque.
+ *
+ *  Thieves can still read an array replaced when the deque grows, 
+ *  so replaced arrays are kept until the deque is released.
+ */
+struct job_deque_array_t
 {
-    job_t* job = nullptr;
+    int64_t            capacity;
+    job_deque_array_t* previous;
+    atomicptr_t        jobs[1];
+};
 
-    while (!thread_try_wait(1))
+/*! Lock-free work-stealing deque (Chase-Lev).
+ *
+ *  Only the worker owning the deque pushes and pops jobs at the bottom (LIFO). 
+ *  Any other thread can steal jobs at the top (FIFO).
+ */
+struct job_deque_t
+{
+    alignas(64) atomic64_t top;
+    alignas(64) atomic64_t bottom;
+    atomicptr_t array;
+};
+
+/*! Job thread and its own deque.
+ *
+ *  Jobs started by a job are pushed in the deque of its worker and popped in LIFO order,
+ *  since they most likely use the same data. Idle workers steal the oldest jobs of the other deques.
+ */
+struct job_worker_t
+{
+    job_deque_t deque;
+    thread_t*   thread{ nullptr };
+    uint32_t    index{ 0 };
+    uint32_t    tick{ 0 };
+
+    /*! Free jobs only used by this worker, so jobs started and deallocated by job threads do not need a lock */
+    job_t**     free_jobs{ nullptr };
+};
+
+static job_worker_t** _job_workers = nullptr;
+
+/*! Jobs submitted by threads that are not job threads, executed in FIFO order. */
+static concurrent_queue<job_t*, JOB_SUBMITTED_JOBS_CAPACITY> _submitted_jobs;
+
+/*! Idle workers park on the semaphore until jobs are submitted. */
+static semaphore_t _jobs_wake_semaphore;
+static atomic32_t _jobs_sleeping_count{ 0 };
+static volatile bool _jobs_exiting = false;
+
+/*! Thread parked until a job or a group completes (see #jobs_wait_until). */
+struct job_waiter_t
+{
+    const void*  target;
+    semaphore_t* semaphore;
+};
+
+/*! Semaphore a thread parks on while it waits for a job or a group. */
+struct job_wait_semaphore_t
+{
+    semaphore_t semaphore;
+
+    job_wait_semaphore_t() { semaphore_initialize(&semaphore, 0); }
+    ~job_wait_semaphore_t() { semaphore_finalize(&semaphore); }
+};
+
+/*! Parked waiting threads, only the threads waiting for a completed job or group are woken up. */
+static job_waiter_t* _jobs_waiters = nullptr;
+static shared_mutex _jobs_waiters_lock("Job Waiters");
+static atomic32_t _jobs_waiting_count{ 0 };
+static thread_local job_wait_semaphore_t _job_wait_semaphore;
+
+static thread_local job_worker_t* _job_worker = nullptr;
+
+/*! Free jobs shared by all threads. Jobs are allocated by slabs that are only deallocated when the job system shuts down. */
+static job_t** _job_pool = nullptr;
+static void** _job_pool_slabs = nullptr;
+static shared_mutex _job_pool_lock("Job Pool");
+
+//
+// # PRIVATE
+//
+
+FOUNDATION_STATIC job_deque_array_t* job_deque_array_allocate(int64_t capacity, job_deque_array_t* previous)
+{
+    const size_t size = sizeof(job_deque_array_t) + sizeof(atomicptr_t) * (capacity - 1);
+    job_deque_array_t* array = (job_deque_array_t*)memory_allocate(0, size, alignof(job_deque_array_t), MEMORY_PERSISTENT);
+    array->capacity = capacity;
+    array->previous = previous;
+    return array;
+}
+
+FOUNDATION_STATIC void job_deque_initialize(job_deque_t& deque)
+{
+    atomic_store64(&deque.top, 0, memory_order_relaxed);
+    atomic_store64(&deque.bottom, 0, memory_order_relaxed);
+    atomic_store_ptr(&deque.array, job_deque_array_allocate(JOB_DEQUE_INITIAL_CAPACITY, nullptr), memory_order_release);
+}
+
+FOUNDATION_STATIC void job_deque_finalize(job_deque_t& deque)
+{
+    job_deque_array_t* array = (job_deque_array_t*)atomic_load_ptr(&deque.array, memory_order_acquire);
+    while (array)
     {
-        if (_scheduled_jobs.try_pop(job, 16))
-        {
-            job->status = job->handler((payload_t*)job->payload);
-            job->completed = true;
+        job_deque_array_t* previous = array->previous;
+        memory_deallocate(array);
+        array = previous;
+    }
+    atomic_store_ptr(&deque.array, nullptr, memory_order_release);
+}
 
-            if (job->flags & JOB_DEALLOCATE_AFTER_EXECUTION)
-                job_deallocate(job);
-            signal_thread();
+/*! Push a job at the bottom of the deque, only called by the worker owning the deque. */
+FOUNDATION_STATIC void job_deque_push(job_deque_t& deque, job_t* job)
+{
+    const int64_t bottom = atomic_load64(&deque.bottom, memory_order_relaxed);
+    const int64_t top = atomic_load64(&deque.top, memory_order_acquire);
+    job_deque_array_t* array = (job_deque_array_t*)atomic_load_ptr(&deque.array, memory_order_relaxed);
+    if (bottom - top >= array->capacity)
+    {
+        job_deque_array_t* grown = job_deque_array_allocate(array->capacity * 2, array);
+        for (int64_t i = top; i < bottom; ++i)
+        {
+            void* pending = atomic_load_ptr(&array->jobs[i & (array->capacity - 1)], memory_order_relaxed);
+            atomic_store_ptr(&grown->jobs[i & (grown->capacity - 1)], pending, memory_order_relaxed);
         }
+        atomic_store_ptr(&deque.array, grown, memory_order_release);
+        array = grown;
     }
 
-    // Empty jobs before exiting thread (prevent memory leaks)
-    while (_scheduled_jobs.try_pop(job))
+    atomic_store_ptr(&array->jobs[bottom & (array->capacity - 1)], job, memory_order_relaxed);
+    atomic_thread_fence_release();
+    atomic_store64(&deque.bottom, bottom + 1, memory_order_relaxed);
+}
+
+/*! Pop the last job pushed in the deque, only called by the worker owning the deque. */
+FOUNDATION_STATIC job_t* job_deque_pop(job_deque_t& deque)
+{
+    // Reserve the last job before checking if thieves took it.
+    const int64_t bottom = atomic_load64(&deque.bottom, memory_order_relaxed) - 1;
+    job_deque_array_t* array = (job_deque_array_t*)atomic_load_ptr(&deque.array, memory_order_relaxed);
+    atomic_store64(&deque.bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence_sequentially_consistent();
+
+    const int64_t top = atomic_load64(&deque.top, memory_order_relaxed);
+    if (top > bottom)
     {
-        if (job->flags & JOB_DEALLOCATE_AFTER_EXECUTION)
-            job_deallocate(job);
+        atomic_store64(&deque.bottom, bottom + 1, memory_order_relaxed);
+        return nullptr;
     }
 
-    return 0;
+    job_t* job = (job_t*)atomic_load_ptr(&array->jobs[bottom & (array->capacity - 1)], memory_order_relaxed);
+    if (top == bottom)
+    {
+        // The last job can be stolen concurrently, whoever moves the top first gets it.
+        if (!atomic_cas64(&deque.top, top + 1, top, memory_order_seq_cst, memory_order_relaxed))
+            job = nullptr;
+        atomic_store64(&deque.bottom, bottom + 1, memory_order_relaxed);
+    }
+
+    return job;
 }
 
+/*! Steal the first job pushed in the deque, called by any thread. */
+FOUNDATION_STATIC job_t* job_deque_steal(job_deque_t& deque)
+{
+    for (;;)
+    {
+        const int64_t top = atomic_load64(&deque.top, memory_order_acquire);
+        atomic_thread_fence_sequentially_consistent();
+        const int64_t bottom = atomic_load64(&deque.bottom, memory_order_acquire);
+        if (top >= bottom)
+            return nullptr;
 
-void jobs_initialize()
+        job_deque_array_t* array = (job_deque_array_t*)atomic_load_ptr(&deque.array, memory_order_acquire);
+        job_t* job = (job_t*)atomic_load_ptr(&array->jobs[top & (array->capacity - 1)], memory_order_relaxed);
+        if (atomic_cas64(&deque.top, top + 1, top, memory_order_seq_cst, memory_order_relaxed))
+            return job;
+
+        // Another thread took the job, try the next one.
+    }
+}
+
+/*! Take a free job from the calling worker or the shared job pool, a new slab of jobs is allocated if the pool is empty. */
+FOUNDATION_STATIC job_t* job_pool_acquire()
 {
-    _scheduled_jobs.create();
+    job_t* job = nullptr;
+    if (_job_worker && array_size(_job_worker->free_jobs) > 0)
+    {
+        job = *array_last(_job_worker->free_jobs);
+        array_pop(_job_worker->free_jobs);
+        return new (job) job_t();
+    }
+
+    _job_pool_lock.exclusive_lock();
+    if (array_size(_job_pool) == 0)
+    {
+        job_t* slab = (job_t*)memory_allocate(0, sizeof(job_t) * JOB_POOL_SLAB_SIZE, alignof(job_t), MEMORY_PERSISTENT);
+        array_push(_job_pool_slabs, (void*)slab);
 
-    const size_t thread_count = ARRAY_COUNT(_job_threads);
-    for (int i = 0; i < thread_count; ++i)
-        _job_threads[i] = thread_allocate(job_thread_fn, nullptr, STRING_CONST("Jobber"), THREAD_PRIORITY_NORMAL, 0);
+        // Keep the first jobs of the slab at the end of the pool, so they get used first.
+        for (uint32_t i = JOB_POOL_SLAB_SIZE; i > 0; --i)
+            array_push(_job_pool, slab + i - 1);
+    }
+    job = *array_last(_job_pool);
+    array_pop(_job_pool);
+    _job_pool_lock.exclusive_unlock();
 
-    for (int i = 0; i < thread_count; ++i)
-        thread_start(_job_threads[i]);
+    return new (job) job_t();
 }
 
-void jobs_shutdown()
+/*! Give a job back to the calling worker or the shared job pool. */
+FOUNDATION_STATIC void job_pool_release(job_t* job)
 {
-    const size_t thread_count = ARRAY_COUNT(_job_threads);
-    for (size_t i = 0; i < thread_count; ++i)
+    if (job->payload_size > 0 && job->payload != job->inline_payload)
+        memory_deallocate(job->payload);
+    job->~job_t();
+
+    if (_job_worker)
     {
-        while (thread_is_running(_job_threads[i]))
+        array_push(_job_worker->free_jobs, job);
+        if (array_size(_job_worker->free_jobs) <= JOB_POOL_THREAD_CAPACITY)
+            return;
+
+        // Give half of the free jobs back, i.e. to the threads that submit the jobs executed by this worker.
+        _job_pool_lock.exclusive_lock();
+        const uint32_t keep_count = JOB_POOL_THREAD_CAPACITY / 2;
+        const uint32_t free_count = array_size(_job_worker->free_jobs);
+        for (uint32_t i = keep_count; i < free_count; ++i)
+            array_push(_job_pool, _job_worker->free_jobs[i]);
+        array_resize(_job_worker->free_jobs, keep_count);
+        _job_pool_lock.exclusive_unlock();
+    }
+    else
+    {
+        _job_pool_lock.exclusive_lock();
+        array_push(_job_pool, job);
+        _job_pool_lock.exclusive_unlock();
+    }
+}
+
+/*! Add state flags to a job.
+ * 
+ *  @return The previous state of the job.
+ */
+FOUNDATION_STATIC int32_t job_state_add(job_t* job, int32_t flags)
+{
+    int32_t state = atomic_load32(&job->state, memory_order_acquire);
+    while (!atomic_cas32(&job->state, state | flags, state, memory_order_acq_rel, memory_order_acquire))
+        state = atomic_load32(&job->state, memory_order_acquire);
+    return state;
+}
+
+FOUNDATION_STATIC job_t* job_take_continuations(job_t* job);
+FOUNDATION_STATIC void job_discard(job_t* job);
+FOUNDATION_STATIC void jobs_wake_waiters(const void* target);
+
+/*! Release the continuations of a job that will never be executed, they will never be scheduled either. */
+FOUNDATION_STATIC void job_discard_continuations(job_t* job)
+{
+    job_t* continuations = job_take_continuations(job);
+    while (continuations)
+    {
+        job_t* next = continuations->next_continuation;
+        continuations->next_continuation = nullptr;
+        job_discard(continuations);
+        continuations = next;
+    }
+}
+
+/*! Release a job that will never be executed.
+ * 
+ *  Jobs are completed without being executed, so their owner can still deallocate them.
+ *  Jobs already released by their owner are released right away.
+ */
+FOUNDATION_STATIC void job_discard(job_t* job)
+{
+    job_discard_continuations(job);
+
+    job_group_t* group = job->group;
+
+    // Release the handler captures and the payload right away.
+    job->handler = nullptr;
+    if (job->payload_size > 0 && job->payload != job->inline_payload)
+        memory_deallocate(job->payload);
+    job->payload = nullptr;
+    job->payload_size = 0;
+
+    if (job_state_add(job, JOB_STATE_COMPLETED) & JOB_STATE_RELEASED)
+        job_pool_release(job);
+    jobs_wake_waiters(job);
+
+    if (group && atomic_decr32(&group->pending, memory_order_release) == 0)
+        jobs_wake_waiters(group);
+}
+
+/*! Release the jobs left in a deque once its worker exited (prevent memory leaks). */
+FOUNDATION_STATIC void job_deque_clear(job_deque_t& deque)
+{
+    job_t* job = nullptr;
+    while ((job = job_deque_steal(deque)))
+        job_discard(job);
+    job_deque_finalize(deque);
+}
+
+/*! Wake up a parked worker if any. */
+FOUNDATION_STATIC void jobs_wake_worker()
+{
+    // Make sure the pushed job is visible to a worker that parks right now.
+    atomic_thread_fence_sequentially_consistent();
+
+    int32_t sleeping_count = atomic_load32(&_jobs_sleeping_count, memory_order_acquire);
+    while (sleeping_count > 0)
+    {
+        if (atomic_cas32(&_jobs_sleeping_count, sleeping_count - 1, sleeping_count, memory_order_acq_rel, memory_order_acquire))
         {
-            _scheduled_jobs.signal();
-            thread_signal(_job_threads[i]);
+            semaphore_post(&_jobs_wake_semaphore);
+            return;
         }
-        thread_join(_job_threads[i]);
+        sleeping_count = atomic_load32(&_jobs_sleeping_count, memory_order_acquire);
     }
+}
 
-    _scheduled_jobs.destroy();
+/*! Wake up the threads parked while waiting for #target to complete.
+ * 
+ *  #target is only compared with the waited jobs and groups, since it can already be released.
+ */
+FOUNDATION_STATIC void jobs_wake_waiters(const void* target)
+{
+    // Make sure the completion is visible to a thread that parks right now.
+    atomic_thread_fence_sequentially_consistent();
+    if (atomic_load32(&_jobs_waiting_count, memory_order_acquire) == 0)
+        return;
 
-    for (size_t i = 0; i < thread_count; ++i)
+    _jobs_waiters_lock.shared_lock();
+    for (unsigned i = 0, end = array_size(_jobs_waiters); i < end; ++i)
     {
-        thread_deallocate(_job_threads[i]);
-        _job_threads[i] = nullptr;
+        if (_jobs_waiters[i].target == target)
+            semaphore_post(_jobs_waiters[i].semaphore);
     }
+    _jobs_waiters_lock.shared_unlock();
 }
 
-job_t* job_allocate()
+/*! Find the next job to execute by #worker.
+ *
+ *  Worker jobs are executed first, then submitted jobs and finally jobs stolen from the other workers.
+ * 
+ *  @param worker The worker looking for a job, or null if the calling thread is not a job thread (see #jobs_help).
+ */
+FOUNDATION_STATIC job_t* jobs_find_work(job_worker_t* worker)
 {
-    void* job_mem = memory_allocate(0, sizeof(job_t), 8, MEMORY_PERSISTENT | MEMORY_ZERO_INITIALIZED);
-    job_t* j = new (job_mem) job_t();
-    return j;
+    job_t* job = nullptr;
+    if (worker && ++worker->tick % JOB_SUBMITTED_JOBS_CHECK_INTERVAL == 0)
+        _submitted_jobs.try_pop(job);
+
+    if (job == nullptr && worker)
+        job = job_deque_pop(worker->deque);
+
+    if (job == nullptr)
+        _submitted_jobs.try_pop(job);
+
+    const uint32_t worker_count = array_size(_job_workers);
+    const uint32_t worker_index = worker ? worker->index : 0;
+    for (uint32_t i = worker ? 1 : 0; job == nullptr && i < worker_count; ++i)
+    {
+        job_worker_t* victim = _job_workers[(worker_index + i) % worker_count];
+        job = job_deque_steal(victim->deque);
+    }
+
+    return job;
 }
 
-void job_deallocate(job_t*& job)
+FOUNDATION_STATIC void job_schedule(job_t* job)
 {
-    if (job == nullptr)
+    // Jobs started by a job thread are kept in its own deque.
+    if (_job_worker)
+    {
+        job_deque_push(_job_worker->deque, job);
+    }
+    else if (!_submitted_jobs.push(job))
+    {
+        job_discard(job);
         return;
-    if ((job->completed || !job->scheduled))
-    {   
-        if (job->payload_size > 0)
-            memory_deallocate(job->payload);
-        job->~job_t();
-        memory_deallocate(job);
-        job = nullptr;
     }
-    else
-        job->flags |= JOB_DEALLOCATE_AFTER_EXECUTION;
+
+    jobs_wake_worker();
 }
 
-job_t* job_execute(const job_handler_t& handler, void* payload /*= nullptr*/, job_flags_t flags /*= JOB_FLAGS_NONE*/)
+/*! Take the continuations of a job that is about to complete (see #job_then). 
+ *  Continuations added afterward are scheduled right away.
+ */
+FOUNDATION_STATIC job_t* job_take_continuations(job_t* job)
 {
-    return job_execute(handler, payload, 0, flags);
+    job_t* continuations = (job_t*)atomic_load_ptr(&job->continuations, memory_order_acquire);
+    while (!atomic_cas_ptr(&job->continuations, JOB_CONTINUATIONS_COMPLETED, continuations, memory_order_acq_rel, memory_order_acquire))
+        continuations = (job_t*)atomic_load_ptr(&job->continuations, memory_order_acquire);
+    return continuations;
 }
 
-job_t* job_execute(const job_handler_t& handler, void* payload, size_t payload_size, job_flags_t flags /*= JOB_FLAGS_NONE*/)
+/*! Schedule continuations taken from a completed job in the order they were added. */
+FOUNDATION_STATIC void job_schedule_continuations(job_t* continuations)
+{
+    // Continuations are pushed at the head of the list, so we reverse it first.
+    job_t* ordered = nullptr;
+    while (continuations)
+    {
+        job_t* next = continuations->next_continuation;
+        continuations->next_continuation = ordered;
+        ordered = continuations;
+        continuations = next;
+    }
+
+    while (ordered)
+    {
+        job_t* next = ordered->next_continuation;
+        ordered->next_continuation = nullptr;
+        job_schedule(ordered);
+        ordered = next;
+    }
+}
+
+FOUNDATION_STATIC void job_run(job_t* job)
+{
+    job->status = job->handler((payload_t*)job->payload);
+
+    // The job can be deallocated by its owner as soon as it is completed, so do not touch it afterward.
+    job_t* continuations = job_take_continuations(job);
+    job_group_t* group = job->group;
+
+    // Release the job if its owner already did, the owner releases it otherwise.
+    if (job_state_add(job, JOB_STATE_COMPLETED) & JOB_STATE_RELEASED)
+        job_pool_release(job);
+
+    // Continuations are scheduled once the job is completed, so they can wait for it.
+    job_schedule_continuations(continuations);
+
+    // The group can go out of scope as soon as its last job is completed (see #job_group_wait).
+    jobs_wake_waiters(job);
+    if (group && atomic_decr32(&group->pending, memory_order_release) == 0)
+        jobs_wake_waiters(group);
+    signal_thread();
+}
+
+/*! Execute a pending job on the calling thread, used while waiting for other jobs.
+ * 
+ *  @return True if a job was executed.
+ */
+FOUNDATION_STATIC bool jobs_help()
+{
+    job_t* job = jobs_find_work(_job_worker);
+    if (job == nullptr)
+        return false;
+
+    job_run(job);
+    return true;
+}
+
+/*! Execute pending jobs on the calling thread until #completed returns true.
+ * 
+ *  The thread parks until #target completes once it did not find any work for a while. 
+ *  The park is bounded, since new jobs do not wake up waiting threads.
+ * 
+ *  @param target The job or group waited for, the thread completing it wakes up the waiting thread.
+ */
+template<typename Predicate>
+FOUNDATION_STATIC void jobs_wait_until(const void* target, const Predicate& completed)
+{
+    uint32_t spin_count = 0;
+    while (!completed())
+    {
+        if (jobs_help())
+        {
+            spin_count = 0;
+            continue;
+        }
+
+        if (++spin_count < JOB_WAIT_SPIN_COUNT)
+        {
+            thread_yield();
+            continue;
+        }
+
+        // Register as waiting and check once more for a completion before we registered.
+        semaphore_t* semaphore = &_job_wait_semaphore.semaphore;
+        _jobs_waiters_lock.exclusive_lock();
+        array_push(_jobs_waiters, (job_waiter_t{ target, semaphore }));
+        _jobs_waiters_lock.exclusive_unlock();
+        atomic_incr32(&_jobs_waiting_count, memory_order_seq_cst);
+
+        if (!completed())
+            semaphore_try_wait(semaphore, JOB_WAIT_PARK_TIMEOUT_MS);
+
+        atomic_decr32(&_jobs_waiting_count, memory_order_relaxed);
+        _jobs_waiters_lock.exclusive_lock();
+        for (unsigned i = 0, end = array_size(_jobs_waiters); i < end; ++i)
+        {
+            if (_jobs_waiters[i].semaphore == semaphore)
+            {
+                array_erase_memcpy(_jobs_waiters, i);
+                break;
+            }
+        }
+        _jobs_waiters_lock.exclusive_unlock();
+
+        // Consume a wake up posted after the park timed out, so the next park does not return right away.
+        while (semaphore_try_wait(semaphore, 0))
+            ;
+    }
+}
+
+FOUNDATION_STATIC job_t* job_create(const job_handler_t& handler, void* payload, size_t payload_size, job_flags_t flags)
 {
     job_t* new_job = job_allocate();
     new_job->handler = handler;
-    
+
     if (payload_size == 0)
     {
         new_job->payload = payload;
         new_job->payload_size = 0;
     }
+    else if (payload_size <= sizeof(new_job->inline_payload))
+    {
+        new_job->payload = memcpy(new_job->inline_payload, payload, payload_size);
+        new_job->payload_size = payload_size;
+    }
     else
     {
         void* allocated_payload = memory_allocate(0, payload_size, 0, MEMORY_PERSISTENT);
@@ -127,20 +587,254 @@ job_t* job_execute(const job_handler_t& handler, void* payload, size_t payload_s
     }
 
     new_job->flags = flags;
-    new_job->scheduled = true;
-    _scheduled_jobs.push(new_job);
-    signal_thread();
+    const int32_t state = (flags & JOB_DEALLOCATE_AFTER_EXECUTION) ? JOB_STATE_SCHEDULED | JOB_STATE_RELEASED : JOB_STATE_SCHEDULED;
+    atomic_store32(&new_job->state, state, memory_order_relaxed);
     return new_job;
 }
 
+FOUNDATION_STATIC void* job_thread_fn(void* arg)
+{
+    job_worker_t* worker = (job_worker_t*)arg;
+    _job_worker = worker;
+
+    while (!_jobs_exiting)
+    {
+        job_t* job = jobs_find_work(worker);
+        if (job)
+        {
+            job_run(job);
+            continue;
+        }
+
+        // Register as sleeping and check once more for jobs pushed before we registered.
+        atomic_incr32(&_jobs_sleeping_count, memory_order_seq_cst);
+        job = jobs_find_work(worker);
+        if (job || _jobs_exiting)
+        {
+            // Unregister, unless a job submission already did so and posted the semaphore for us.
+            int32_t sleeping_count = atomic_load32(&_jobs_sleeping_count, memory_order_acquire);
+            while (sleeping_count > 0 && !atomic_cas32(&_jobs_sleeping_count, sleeping_count - 1, sleeping_count, memory_order_acq_rel, memory_order_acquire))
+                sleeping_count = atomic_load32(&_jobs_sleeping_count, memory_order_acquire);
+
+            if (job)
+                job_run(job);
+            continue;
+        }
+
+        semaphore_wait(&_jobs_wake_semaphore);
+    }
+
+    _job_worker = nullptr;
+    return 0;
+}
+
+//
+// # PUBLIC API
+//
+
+void jobs_initialize()
+{
+    FOUNDATION_ASSERT_MSG(_job_workers == nullptr, "Job system already initialized");
+
+    // Keep a hardware thread for the main thread
+    const uint32_t hardware_threads = (uint32_t)system_hardware_threads();
+    uint32_t thread_count = hardware_threads > 1 ? hardware_threads - 1 : 1;
+    if (MAX_JOB_THREADS > 0)
+        thread_count = min(thread_count, (uint32_t)MAX_JOB_THREADS);
+
+    _jobs_exiting = false;
+    atomic_store32(&_jobs_sleeping_count, 0, memory_order_release);
+    semaphore_initialize(&_jobs_wake_semaphore, 0);
+    atomic_store32(&_jobs_waiting_count, 0, memory_order_release);
+    _submitted_jobs.create();
+
+    for (uint32_t i = 0; i < thread_count; ++i)
+    {
+        job_worker_t* worker = MEM_NEW(0, job_worker_t);
+        worker->index = i;
+        job_deque_initialize(worker->deque);
+        worker->thread = thread_allocate(job_thread_fn, worker, STRING_CONST("Jobber"), THREAD_PRIORITY_NORMAL, 0);
+        array_push(_job_workers, worker);
+    }
+
+    for (uint32_t i = 0; i < thread_count; ++i)
+        thread_start(_job_workers[i]->thread);
+}
+
+void jobs_shutdown()
+{
+    const uint32_t thread_count = array_size(_job_workers);
+
+    _jobs_exiting = true;
+    semaphore_post_multiple(&_jobs_wake_semaphore, thread_count);
+
+    for (uint32_t i = 0; i < thread_count; ++i)
+        thread_join(_job_workers[i]->thread);
+
+    for (uint32_t i = 0; i < thread_count; ++i)
+        job_deque_clear(_job_workers[i]->deque);
+
+    job_t* submitted_job = nullptr;
+    while (_submitted_jobs.try_pop(submitted_job))
+        job_discard(submitted_job);
+    _submitted_jobs.destroy();
+
+    _job_pool_lock.exclusive_lock();
+    for (uint32_t i = 0; i < thread_count; ++i)
+    {
+        job_worker_t* worker = _job_workers[i];
+        foreach(job, worker->free_jobs)
+            array_push(_job_pool, *job);
+        array_deallocate(worker->free_jobs);
+        thread_deallocate(worker->thread);
+        MEM_DELETE(worker);
+    }
+    array_deallocate(_job_workers);
+
+    // Jobs still referenced would point to released memory.
+    FOUNDATION_ASSERT_MSGFORMAT(array_size(_job_pool) == array_size(_job_pool_slabs) * JOB_POOL_SLAB_SIZE, 
+        "%u jobs were not deallocated before shutting down the job system", 
+        array_size(_job_pool_slabs) * JOB_POOL_SLAB_SIZE - array_size(_job_pool));
+    for (unsigned i = 0, end = array_size(_job_pool_slabs); i < end; ++i)
+        memory_deallocate(_job_pool_slabs[i]);
+    array_deallocate(_job_pool_slabs);
+    array_deallocate(_job_pool);
+    _job_pool_lock.exclusive_unlock();
+
+    array_deallocate(_jobs_waiters);
+    semaphore_finalize(&_jobs_wake_semaphore);
+}
+
+job_t* job_allocate()
+{
+    return job_pool_acquire();
+}
+
+void job_deallocate(job_t*& job)
+{
+    if (job == nullptr)
+        return;
+
+    // Let the thread completing the job release it if it is still pending.
+    int32_t state = atomic_load32(&job->state, memory_order_acquire);
+    while ((state & JOB_STATE_SCHEDULED) && (state & JOB_STATE_COMPLETED) == 0)
+    {
+        if (atomic_cas32(&job->state, state | JOB_STATE_RELEASED, state, memory_order_acq_rel, memory_order_acquire))
+        {
+            job = nullptr;
+            return;
+        }
+        state = atomic_load32(&job->state, memory_order_acquire);
+    }
+
+    // Continuations of a job that was never executed would never be scheduled.
+    if ((state & JOB_STATE_SCHEDULED) == 0)
+        job_discard_continuations(job);
+    job_pool_release(job);
+    job = nullptr;
+}
+
+job_t* job_execute(const job_handler_t& handler, void* payload /*= nullptr*/, job_flags_t flags /*= JOB_FLAGS_NONE*/)
+{
+    return job_execute(handler, payload, 0, flags);
+}
+
+job_t* job_execute(const job_handler_t& handler, void* payload, size_t payload_size, job_flags_t flags /*= JOB_FLAGS_NONE*/)
+{
+    job_t* new_job = job_create(handler, payload, payload_size, flags);
+    job_schedule(new_job);
+    return new_job;
+}
+
+void job_submit(const job_handler_t& handler, void* payload /*= nullptr*/, size_t payload_size /*= 0*/)
+{
+    job_t* new_job = job_create(handler, payload, payload_size, JOB_DEALLOCATE_AFTER_EXECUTION);
+    job_schedule(new_job);
+}
+
 bool job_completed(job_t* job)
 {
     if (job == nullptr)
         return true;
 
-    if (job->completed)
-        return true;
+    return (atomic_load32(&job->state, memory_order_acquire) & JOB_STATE_COMPLETED) != 0;
+}
+
+job_t* job_then(job_t* job, const job_handler_t& handler, void* payload /*= nullptr*/, job_flags_t flags /*= JOB_FLAGS_NONE*/)
+{
+    FOUNDATION_ASSERT(job);
+    FOUNDATION_ASSERT_MSG((atomic_load32(&job->state, memory_order_acquire) & JOB_STATE_RELEASED) == 0, "Job can be deallocated before the continuation is added");
+
+    job_t* continuation = job_create(handler, payload, 0, flags);
+    job_t* continuations = (job_t*)atomic_load_ptr(&job->continuations, memory_order_acquire);
+    do
+    {
+        if (continuations == JOB_CONTINUATIONS_COMPLETED)
+        {
+            job_schedule(continuation);
+            break;
+        }
+
+        continuation->next_continuation = continuations;
+        if (atomic_cas_ptr(&job->continuations, continuation, continuations, memory_order_acq_rel, memory_order_acquire))
+            break;
+
+        continuations = (job_t*)atomic_load_ptr(&job->continuations, memory_order_acquire);
+    } while (true);
+
+    return continuation;
+}
+
+void job_wait(job_t* job)
+{
+    jobs_wait_until(job, [job]() { return job_completed(job); });
+}
+
+job_t* job_group_execute(job_group_t& group, const job_handler_t& handler, void* payload /*= nullptr*/, job_flags_t flags /*= JOB_DEALLOCATE_AFTER_EXECUTION*/)
+{
+    job_t* new_job = job_create(handler, payload, 0, flags);
+    new_job->group = &group;
+    atomic_incr32(&group.pending, memory_order_relaxed);
+    job_schedule(new_job);
+    return new_job;
+}
+
+bool job_group_completed(job_group_t& group)
+{
+    return atomic_load32(&group.pending, memory_order_acquire) == 0;
+}
+
+void job_group_wait(job_group_t& group)
+{
+    jobs_wait_until(&group, [&group]() { return job_group_completed(group); });
+}
+
+void job_parallel_for(uint32_t begin, uint32_t end, uint32_t grain, const function<void(uint32_t begin, uint32_t end)>& handler)
+{
+    if (end <= begin)
+        return;
+
+    if (grain == 0)
+    {
+        // Split the range in a few chunks per thread, so threads that finish early can steal the remaining chunks.
+        const uint32_t thread_count = array_size(_job_workers) + 1;
+        grain = max(1U, (end - begin) / (thread_count * 4));
+    }
+
+    const uint32_t first_end = end - begin > grain ? begin + grain : end;
+
+    job_group_t group{};
+    for (uint32_t from = first_end, to; from < end; from = to)
+    {
+        to = end - from > grain ? from + grain : end;
+        job_group_execute(group, [&handler, from, to](payload_t*)
+        {
+            handler(from, to);
+            return 0;
+        });
+    }
 
-    _scheduled_jobs.signal();
-    return false;
+    // Execute the first chunk while the job threads execute the others.
+    handler(begin, first_end);
+    job_group_wait(group);
 }
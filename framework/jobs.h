@@ -7,6 +7,8 @@
 
 #include <framework/option.h>
 
+#include <foundation/atomic.h>
+
 struct payload_t{};
 
 typedef function<int(payload_t* payload)> job_handler_t;
@@ -18,6 +20,18 @@ typedef enum job_enum_flag_t : unsigned int {
 } job_flag_t;
 typedef unsigned int job_flags_t;
 
+/*! Payloads up to this size are copied in the job itself instead of being allocated (see #job_execute). */
+constexpr size_t JOB_INLINE_PAYLOAD_SIZE = 64;
+
+/*! Counter of the pending jobs of a group, used to wait for all of them (see #job_group_execute).
+ * 
+ *  @remark The group must be zero initialized, i.e. `job_group_t group{};`
+ */
+struct job_group_t
+{
+    atomic32_t pending;
+};
+
 struct job_t
 {
     job_flags_t flags { JOB_FLAGS_NONE };
@@ -26,20 +40,127 @@ struct job_t
     size_t payload_size{  0};
 
     int status { 0 };
-    volatile bool scheduled { false };
-    volatile bool completed { false };
+
+    /*! Scheduling state, changed atomically so either the owner or the worker releases the job (see #job_deallocate) */
+    atomic32_t state;
+
+    /*! Group notified when the job completes (see #job_group_execute) */
+    job_group_t* group{ nullptr };
+
+    /*! Jobs scheduled once this job completes (see #job_then) */
+    atomicptr_t continuations;
+    job_t* next_continuation{ nullptr };
+
+    /*! Storage for small payloads copied by #job_execute */
+    alignas(16) uint8_t inline_payload[JOB_INLINE_PAYLOAD_SIZE];
 };
 
 void jobs_initialize();
 
 void jobs_shutdown();
 
+/*! Allocate a job from the job pool.
+ * 
+ *  Jobs are recycled by #job_deallocate, so most jobs are allocated without using the memory allocator.
+ * 
+ *  @remark Jobs must be deallocated before #jobs_shutdown releases the job pool.
+ * 
+ *  @return The new job.
+ */
 job_t* job_allocate();
 
+/*! Deallocate a job and reset #job to null.
+ * 
+ *  A job that is still pending is released by the thread that completes it instead.
+ */
 void job_deallocate(job_t*& job);
 
 job_t* job_execute(const job_handler_t& handler, void* payload = nullptr, job_flags_t flags = JOB_FLAGS_NONE);
 
+/*! Execute a job with a copy of its payload.
+ * 
+ *  Payloads up to #JOB_INLINE_PAYLOAD_SIZE bytes are copied in the job itself, larger ones are allocated.
+ * 
+ *  @param handler      The job handler.
+ *  @param payload      The payload to copy.
+ *  @param payload_size The payload size in bytes, 0 passes the payload pointer as is.
+ *  @param flags        The job flags.
+ * 
+ *  @return The new job.
+ */
 job_t* job_execute(const job_handler_t& handler, void* payload, size_t payload_size, job_flags_t flags = JOB_FLAGS_NONE);
 
+/*! Execute a job that gets deallocated once executed, without returning it.
+ * 
+ *  Jobs are taken from the job pool and small payloads are copied in the job itself, 
+ *  so submitting a job with a small handler closure does not use the memory allocator.
+ * 
+ *  @param handler      The job handler.
+ *  @param payload      The payload to copy.
+ *  @param payload_size The payload size in bytes, 0 passes the payload pointer as is.
+ */
+void job_submit(const job_handler_t& handler, void* payload = nullptr, size_t payload_size = 0);
+
 bool job_completed(job_t* job);
+
+/*! Schedule a job once #job completes.
+ * 
+ *  The continuation is scheduled right away if #job is already completed.
+ * 
+ *  The continuation is never executed if #job is deallocated without being executed, 
+ *  but it still gets completed so it can be deallocated.
+ * 
+ *  @remark #job must not be deallocated yet, so it cannot be started with #JOB_DEALLOCATE_AFTER_EXECUTION.
+ * 
+ *  @param job      The job to wait for.
+ *  @param handler  The continuation handler.
+ *  @param payload  The continuation payload.
+ *  @param flags    The continuation job flags.
+ * 
+ *  @return The continuation job.
+ */
+job_t* job_then(job_t* job, const job_handler_t& handler, void* payload = nullptr, job_flags_t flags = JOB_FLAGS_NONE);
+
+/*! Wait for a job to complete. 
+ * 
+ *  Other jobs are executed by the calling thread while it waits, 
+ *  so a job can wait for the jobs it started without blocking a job thread.
+ *  The thread sleeps until another job completes if there is no other job to execute.
+ * 
+ *  @param job The job to wait for.
+ */
+void job_wait(job_t* job);
+
+/*! Execute a job as part of a group, see #job_group_wait.
+ * 
+ *  @param group    The group to add the job to.
+ *  @param handler  The job handler.
+ *  @param payload  The job payload.
+ *  @param flags    The job flags, group jobs are deallocated after their execution by default.
+ * 
+ *  @return The new job, which should not be used if #JOB_DEALLOCATE_AFTER_EXECUTION is set.
+ */
+job_t* job_group_execute(job_group_t& group, const job_handler_t& handler, void* payload = nullptr, job_flags_t flags = JOB_DEALLOCATE_AFTER_EXECUTION);
+
+/*! Checks if all the jobs of a group are completed.
+ * 
+ *  @param group The group to check.
+ */
+bool job_group_completed(job_group_t& group);
+
+/*! Wait for all the jobs of a group to complete, other jobs are executed by the calling thread while it waits.
+ * 
+ *  @param group The group to wait for.
+ */
+void job_group_wait(job_group_t& group);
+
+/*! Split a range in chunks executed in parallel by the job threads and wait for all of them to complete.
+ * 
+ *  The first chunk is executed by the calling thread.
+ * 
+ *  @param begin    The first index of the range.
+ *  @param end      The end of the range (excluded).
+ *  @param grain    Number of indexes per chunk, 0 splits the range in a few chunks per job thread.
+ *  @param handler  The handler invoked for each chunk with the range [begin, end) of the chunk.
+ */
+void job_parallel_for(uint32_t begin, uint32_t end, uint32_t grain, const function<void(uint32_t begin, uint32_t end)>& handler);
@@ -14,11 +14,38 @@
 #include <framework/string.h>
 #include <framework/array.h>
 #include <framework/profiler.h>
+#include <framework/jobs.h>
 
 #include <foundation/stream.h>
+#include <foundation/bufferstream.h>
+#include <foundation/system.h>
+
+#if FOUNDATION_PLATFORM_WINDOWS
+    #include <foundation/windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+#include <algorithm>
 
  /*! Search database version */
-constexpr uint8_t SEARCH_DATABASE_VERSION = 12;
+constexpr uint8_t SEARCH_DATABASE_VERSION = 19;
+
+/*! Number of documents per compressed posting list block */
+constexpr uint32_t SEARCH_POSTING_BLOCK_SIZE = 128;
+
+/*! Search database journal version (see #search_database_open_journal) */
+constexpr uint8_t SEARCH_JOURNAL_VERSION = 1;
+
+/*! BM25 term frequency saturation and document length normalization parameters (see #SearchDatabaseFlags::RankResults) */
+constexpr double SEARCH_RANK_BM25_K1 = 1.2;
+constexpr double SEARCH_RANK_BM25_B = 0.75;
+
+/*! BM25 scores are stored in #search_result_t::score as negative fixed point numbers, so the lowest score is still the best. */
+constexpr double SEARCH_RANK_SCORE_SCALE = 1000.0;
 
 /*! List of common words of three characters or more that we should skip for indexing text or words. */
 constexpr string_const_t COMMON_WORDS[] = {
@@ -56,7 +83,6 @@ typedef enum class SearchIndexType : uint32_t
 {
     Undefined   = 0,
     Word        = (1 << 0),
-    Variation   = (1 << 1),
     Number      = (1 << 2),
     Property    = (1 << 3)
 } search_index_type_t;
@@ -112,36 +138,207 @@ FOUNDATION_ALIGNED_STRUCT(search_index_t, 8)
     search_index_key_t  key;
     
     uint32_t document_count{ 0 };
+    bool     packed{ false }; // True if #docs_packed is used instead of #docs_list
+    bool     mapped{ false }; // True if the packed documents are stored in a mapped file (see #docs_mapped)
     union {
         search_document_handle_t  doc;
         search_document_handle_t  docs[6]; // Ideally align this padding with 8 bytes
         search_document_handle_t* docs_list{ nullptr };
+        uint8_t*                  docs_packed; // See #search_database_posting_encode
+
+        /*! Packed documents stored relative to the index entry itself, so saved 
+         *  indexes can be used in place once the file is mapped in memory. */
+        struct {
+            int64_t  offset;
+            uint32_t size;
+        } docs_mapped;
     };
 };
 
+/*! Compressed posting list block skip entry */
+struct search_posting_skip_t
+{
+    search_document_handle_t first_doc;
+    uint32_t                 offset;
+};
+
 /*! Search database document entry */
 FOUNDATION_ALIGNED_STRUCT(search_document_t, 8) 
 {
     search_document_type_t  type{ SearchDocumentType::Unused };
     string_t                name{};
     time_t                  timestamp{ 0 };
+
+    /*! Number of words indexed for the document, used to normalize its ranking score */
+    uint32_t                length{ 0 };
 };
 
-/*! Search database structure
+/*! Search database staged index entry (see #search_database_begin_batch) */
+struct search_index_staging_t
+{
+    search_index_key_t       key;
+    search_document_handle_t doc{ SEARCH_DOCUMENT_INVALID_ID };
+};
+
+/*! Number of occurrences of a word in a document.
+ *  Only words occurring more than once in a document are stored (see #search_database_term_frequency).
+ */
+struct search_term_frequency_t
+{
+    hash_t                   hash{ 0 }; // Word hash, see #search_index_key_t::hash
+    search_document_handle_t doc{ SEARCH_DOCUMENT_INVALID_ID };
+    uint32_t                 count{ 0 };
+};
+
+/*! Numeric property value of a document.
+ *  Values are sorted by property and then by value, so a range of values is a contiguous slice (see #search_database_query_property_number).
+ */
+struct search_number_entry_t
+{
+    uint64_t                 crc{ 0 }; // Property name symbol, see #search_index_key_t::crc
+    double                   number{ 0 };
+    search_document_handle_t doc{ SEARCH_DOCUMENT_INVALID_ID };
+    int32_t                  score{ 0 };
+};
+
+/*! Search database shard
  * 
- * The search database is thread safe and use a shared mutex to allow multiple reads concurrently.
+ * Each shard owns the indexes of a partition of the key space and the strings used by their keys. 
+ * Keys are routed to a shard using the hash of the word or property name they were built from 
+ * (see #search_database_select_shard), so each query term only needs to look in a single shard.
  */
-FOUNDATION_ALIGNED_STRUCT(search_database_t, 8)
+FOUNDATION_ALIGNED_STRUCT(search_database_shard_t, 8)
 {
     shared_mutex            mutex;
     search_index_t*         indexes{ nullptr };
-    search_document_t*      documents{ nullptr };
-    uint32_t                document_count{ 0 };
     string_table_t*         strings{ nullptr };
-    search_database_flags_t options{ SearchDatabaseFlags::Default };
+    search_index_staging_t* batch{ nullptr };
     bool                    dirty{ false };
 
-    search_query_t**         queries{ nullptr };
+    /*! Words indexed with their variations, sorted alphabetically so all the words 
+     *  starting with the same prefix are contiguous (see #search_database_lexicon_lower_bound) */
+    string_table_symbol_t*  words{ nullptr };
+
+    /*! Word occurrences of the shard words, sorted by word hash and then by document */
+    search_term_frequency_t* frequencies{ nullptr };
+
+    /*! Numeric property values of the shard, sorted by property, value and then by document */
+    search_number_entry_t*  numbers{ nullptr };
+
+    /*! True if the #indexes and #strings are used in place from the database file mapping */
+    bool                    mapped{ false };
+};
+
+/*! Search database journal record operations */
+typedef enum class SearchJournalOperation : uint8_t
+{
+    None = 0,
+    AddDocument,
+    RemoveDocument,
+    UpdateTimestamp,
+    IndexText,
+    IndexWord,
+    IndexExactMatch,
+    IndexNumber,
+    IndexProperty
+
+} search_journal_operation_t;
+
+/*! Search database journal record, saved as a checksummed and length prefixed entry. */
+struct search_journal_record_t
+{
+    search_journal_operation_t op{ SearchJournalOperation::None };
+    search_document_handle_t   doc{ SEARCH_DOCUMENT_INVALID_ID };
+
+    /*! Include variations or case sensitive flag of the indexing operation */
+    bool                       flag{ false };
+
+    /*! Property number or document timestamp */
+    double                     number{ 0 };
+
+    /*! Document name, indexed text, word or property name */
+    string_const_t             name{};
+
+    /*! Property value */
+    string_const_t             value{};
+};
+
+/*! Search database journal (see #search_database_open_journal) */
+struct search_database_journal_t
+{
+    /*! Locked shared by journaled operations and exclusively to save a snapshot that includes exactly the appended records */
+    shared_mutex snapshot_mutex;
+
+    /*! Protects the journal file and the record #buffer */
+    shared_mutex mutex;
+    stream_t*    stream{ nullptr };
+    string_t     path{};
+    uint8_t*     buffer{ nullptr };
+
+    /*! Set while a compaction job is running */
+    atomic32_t   compacting;
+
+    /*! Last compaction job, waited for before the journal gets closed */
+    job_t*       compaction_job{ nullptr };
+};
+
+/*! Search database structure
+ * 
+ * The search database is thread safe and use a shared mutex to allow multiple reads concurrently.
+ * The database mutex protects the documents and the queries, while each shard has its own mutex 
+ * to protect its indexes, so many threads can index documents concurrently.
+ * 
+ * @remark When both are needed, the database mutex must be locked before the shard mutex.
+ */
+FOUNDATION_ALIGNED_STRUCT(search_database_t, 8)
+{
+    shared_mutex              mutex;
+    search_document_t*        documents{ nullptr };
+    uint32_t                  document_count{ 0 };
+    search_database_flags_t   options{ SearchDatabaseFlags::Default };
+    bool                      dirty{ false };
+
+    /*! Sum of the #search_document_t::length of all documents */
+    uint64_t                  document_length_total{ 0 };
+
+    /*! Sequence number of the last journal record included in the database (see #search_database_open_journal) */
+    uint64_t                  journal_sequence{ 0 };
+    search_database_journal_t* journal{ nullptr };
+
+    search_database_shard_t** shards{ nullptr };
+    uint32_t                  shard_count{ 0 };
+
+    search_query_t**          queries{ nullptr };
+
+    /*! Evaluation jobs of the async queries, waited for before the database gets deallocated */
+    job_t**                   query_jobs{ nullptr };
+
+    atomic32_t                batch_depth;
+
+    /*! Read-only file mapping used in place by the mapped shards (see #search_database_map_file) */
+    void*                     mapped_data{ nullptr };
+    size_t                    mapped_size{ 0 };
+    atomic32_t                mapped_shards;
+};
+
+/*! Search query evaluation context passed to #search_database_handle_query_evaluation */
+struct search_database_query_context_t
+{
+    search_database_t* db{ nullptr };
+    search_query_t*    query{ nullptr };
+
+    /*! If greater than 0, only the best results are kept while the query results are scored. */
+    uint32_t           top_k{ 0 };
+};
+
+/*! Best results kept while the results of a query are scored (see #search_database_query_top_k).
+ *
+ *  The worst of the kept results is on top of the heap, so other results only get compared with it.
+ */
+struct search_database_top_results_t
+{
+    uint32_t         k{ 0 };
+    search_result_t* heap{ nullptr };
 };
 
 /*! Search database header */
@@ -160,29 +357,214 @@ FOUNDATION_ALIGNED_STRUCT(search_database_header_t, 8) {
     sizeof(string_table_t)
 };
 
+/*! Search database journal header */
+FOUNDATION_ALIGNED_STRUCT(search_journal_header_t, 8) {
+    char magic[4] = { 0 };
+    uint8_t version = 0;
+} SEARCH_JOURNAL_HEADER{
+    { 'S', 'J', 'R', 'N' }, SEARCH_JOURNAL_VERSION
+};
+
 //
 // # PRIVATE
 //
 
-FOUNDATION_STATIC void search_database_deallocate_documents(search_database_t*& db)
+FOUNDATION_STATIC void search_database_deallocate_documents(search_document_t*& documents)
 {
-    for (unsigned i = 0, end = array_size(db->documents); i < end; ++i)
+    for (unsigned i = 0, end = array_size(documents); i < end; ++i)
     {
-        search_document_t& doc = db->documents[i];
+        search_document_t& doc = documents[i];
         string_deallocate(doc.name);
     }
-    array_deallocate(db->documents);
+    array_deallocate(documents);
+}
+
+FOUNDATION_STATIC void search_database_deallocate_documents(search_database_t*& db)
+{
+    search_database_deallocate_documents(db->documents);
 }
 
-FOUNDATION_STATIC void search_database_deallocate_indexes(search_database_t*& db)
+FOUNDATION_STATIC void search_database_deallocate_indexes(search_index_t*& indexes)
 {
-    for (unsigned i = 0, end = array_size(db->indexes); i < end; ++i)
+    for (unsigned i = 0, end = array_size(indexes); i < end; ++i)
     {
-        search_index_t& index = db->indexes[i];
-        if (index.document_count > ARRAY_COUNT(index.docs))
+        search_index_t& index = indexes[i];
+        if (index.packed)
+            array_deallocate(index.docs_packed);
+        else if (index.document_count > ARRAY_COUNT(index.docs))
             array_deallocate(index.docs_list);
     }
-    array_deallocate(db->indexes);
+    array_deallocate(indexes);
+}
+
+FOUNDATION_STATIC void search_database_deallocate_shard_data(search_database_shard_t* shard)
+{
+    // Mapped indexes and strings are released with the file mapping, see #search_database_unmap_nolock
+    if (!shard->mapped)
+    {
+        search_database_deallocate_indexes(shard->indexes);
+        string_table_deallocate(shard->strings);
+        array_deallocate(shard->words);
+        array_deallocate(shard->frequencies);
+        array_deallocate(shard->numbers);
+    }
+
+    shard->indexes = nullptr;
+    shard->strings = nullptr;
+    shard->words = nullptr;
+    shard->frequencies = nullptr;
+    shard->numbers = nullptr;
+    shard->mapped = false;
+}
+
+FOUNDATION_STATIC void* search_database_map_view(const char* path, size_t path_length, size_t& size)
+{
+    size = 0;
+    void* data = nullptr;
+
+    #if FOUNDATION_PLATFORM_WINDOWS
+        wchar_t* wpath = wstring_allocate_from_string(path, path_length);
+        HANDLE file = CreateFileW(wpath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        wstring_deallocate(wpath);
+        if (file == INVALID_HANDLE_VALUE)
+            return nullptr;
+
+        LARGE_INTEGER file_size;
+        if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0)
+        {
+            // The view keeps the mapping alive once the handles are closed.
+            HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping)
+            {
+                data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                CloseHandle(mapping);
+            }
+        }
+        CloseHandle(file);
+
+        if (data)
+            size = (size_t)file_size.QuadPart;
+    #else
+        char path_buffer[BUILD_MAX_PATHLEN];
+        string_t file_path = string_copy(STRING_BUFFER(path_buffer), path, path_length);
+        int fd = open(file_path.str, O_RDONLY);
+        if (fd < 0)
+            return nullptr;
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED)
+                data = nullptr;
+        }
+        close(fd);
+
+        if (data)
+            size = (size_t)st.st_size;
+    #endif
+
+    return data;
+}
+
+FOUNDATION_STATIC void search_database_unmap_view(void* data, size_t size)
+{
+    #if FOUNDATION_PLATFORM_WINDOWS
+        UnmapViewOfFile(data);
+    #else
+        munmap(data, size);
+    #endif
+}
+
+FOUNDATION_STATIC void search_database_unmap_nolock(search_database_t* db)
+{
+    if (db->mapped_data == nullptr)
+        return;
+
+    search_database_unmap_view(db->mapped_data, db->mapped_size);
+    db->mapped_data = nullptr;
+    db->mapped_size = 0;
+}
+
+FOUNDATION_FORCEINLINE uint32_t search_database_shard_index(uint32_t shard_count, const char* str, size_t length)
+{
+    if (shard_count <= 1)
+        return 0;
+    return (uint32_t)(string_hash(str, length) % shard_count);
+}
+
+/*! Returns the shard holding the keys built from the #str word or property name. */
+FOUNDATION_FORCEINLINE search_database_shard_t* search_database_select_shard(search_database_t* db, const char* str, size_t length)
+{
+    return db->shards[search_database_shard_index(db->shard_count, str, length)];
+}
+
+/*! Prevents a snapshot from being saved while a journaled operation is executed (see #search_database_save). 
+ * 
+ *  @remark The scope must be opened before locking the database.
+ */
+struct search_database_journal_scope_t
+{
+    search_database_journal_t* journal;
+
+    FOUNDATION_FORCEINLINE search_database_journal_scope_t(search_database_t* db)
+        : journal(db->journal)
+    {
+        if (journal)
+            journal->snapshot_mutex.shared_lock();
+    }
+
+    FOUNDATION_FORCEINLINE ~search_database_journal_scope_t()
+    {
+        if (journal)
+            journal->snapshot_mutex.shared_unlock();
+    }
+};
+
+/*! Append a record to the database journal if one is opened.
+ * 
+ *  Records are written as [size][checksum][sequence, operation, flag, document, number, name, value], 
+ *  so a record partially written when the application crashed is ignored when replaying the journal.
+ * 
+ *  @remark Must be called within a #search_database_journal_scope_t.
+ */
+FOUNDATION_STATIC void search_database_journal_append(search_database_t* db, const search_journal_record_t& record)
+{
+    search_database_journal_t* journal = db->journal;
+    if (journal == nullptr)
+        return;
+
+    SHARED_WRITE_LOCK(journal->mutex);
+    if (journal->stream == nullptr)
+        return;
+
+    const uint32_t name_length = (uint32_t)record.name.length;
+    const uint32_t value_length = (uint32_t)record.value.length;
+    const uint32_t size = 8 + 1 + 1 + 4 + 8 + 4 + name_length + 4 + value_length;
+    const uint64_t sequence = ++db->journal_sequence;
+
+    array_resize(journal->buffer, 8 + size);
+    uint8_t* data = journal->buffer + 8;
+    const auto write = [&data](const void* value, size_t length) { memcpy(data, value, length); data += length; };
+    const uint8_t op = (uint8_t)record.op;
+    const uint8_t flag = record.flag ? 1 : 0;
+    write(&sequence, sizeof(sequence));
+    write(&op, sizeof(op));
+    write(&flag, sizeof(flag));
+    write(&record.doc, sizeof(record.doc));
+    write(&record.number, sizeof(record.number));
+    write(&name_length, sizeof(name_length));
+    write(record.name.str, name_length);
+    write(&value_length, sizeof(value_length));
+    write(record.value.str, value_length);
+    FOUNDATION_ASSERT(data == journal->buffer + 8 + size);
+
+    const uint32_t checksum = (uint32_t)hash(journal->buffer + 8, size);
+    memcpy(journal->buffer, &size, sizeof(size));
+    memcpy(journal->buffer + 4, &checksum, sizeof(checksum));
+
+    stream_write(journal->stream, journal->buffer, 8 + size);
+    stream_flush(journal->stream);
 }
 
 FOUNDATION_STATIC string_const_t search_database_format_word(const char* word, size_t& word_length, search_indexing_flags_t flags)
@@ -275,1067 +657,3464 @@ FOUNDATION_FORCEINLINE int search_database_index_compare(const search_index_t& s
     return search_database_index_key_compare(s.key, key);
 }
 
-FOUNDATION_STATIC int search_database_find_index(search_database_t* db, const search_index_key_t& key)
+FOUNDATION_STATIC int search_database_find_index(const search_database_shard_t* shard, const search_index_key_t& key)
 {
-    return array_binary_search_compare(db->indexes, key, search_database_index_compare);
+    return array_binary_search_compare(shard->indexes, key, search_database_index_compare);
 }
 
-FOUNDATION_STATIC int search_database_insert_index(search_database_t* db, search_document_handle_t doc, const search_index_key_t& key)
+FOUNDATION_STATIC int search_database_lexicon_compare(string_table_t* strings, string_table_symbol_t symbol, const char* str, size_t length)
 {
-    SHARED_WRITE_LOCK(db->mutex);
-    
-    int insert_at = search_database_find_index(db, key);
-    if (insert_at >= 0)
-    {
-        // Found existing index, add document to list
-        search_index_t& index = db->indexes[insert_at];
+    string_const_t word = string_table_to_string_const(strings, symbol);
+    const int c = memcmp(word.str, str, min(word.length, length));
+    if (c != 0)
+        return c;
+    if (word.length == length)
+        return 0;
+    return word.length < length ? -1 : 1;
+}
 
-        if (index.document_count == 0)
-        {
-            // This can happen if a document gets removed eventually.
-            db->dirty = true;
-            index.doc = doc;
-            index.document_count = 1;
-        }
-        else if (index.document_count < ARRAY_COUNT(index.docs))
-        {
-            // Check if doc already exist
-            for (unsigned i = 0; i < index.document_count; ++i)
-            {
-                if (index.docs[i] == doc)
-                    return insert_at;
-            }
-            db->dirty = true;
-            index.docs[index.document_count++] = doc;
-        }
-        else if (index.document_count == ARRAY_COUNT(index.docs))
-        {
-            // Check if doc already exist
-            for (unsigned i = 0; i < index.document_count; ++i)
-            {
-                if (index.docs[i] == doc)
-                    return insert_at;
-            }
-            
-            // Create new list and copy existing docs
-            search_document_handle_t* docs = nullptr;
-            for (int i = 0; i < ARRAY_COUNT(index.docs); ++i)
-                array_push(docs, index.docs[i]);
-            db->dirty = true;
-            array_push(docs, doc);
-            index.docs_list = docs;
-            index.document_count = array_size(docs);
-            FOUNDATION_ASSERT(index.document_count > ARRAY_COUNT(index.docs));
-        }
-        else
-        {
-            // Check if doc already exist
-            for (unsigned i = 0, end = array_size(index.docs_list); i < end; ++i)
-            {
-                if (index.docs_list[i] == doc)
-                    return insert_at;
-            }
-            
-            // Add to existing list
-            db->dirty = true;
-            array_push(index.docs_list, doc);
-            index.document_count = array_size(index.docs_list);
-            FOUNDATION_ASSERT(index.document_count > ARRAY_COUNT(index.docs));
-        }
-    }
-    else
+/*! Returns the position of the first word of the shard lexicon which is not less than #str. */
+FOUNDATION_STATIC uint32_t search_database_lexicon_lower_bound(const search_database_shard_t* shard, const char* str, size_t length)
+{
+    uint32_t lo = 0, hi = array_size(shard->words);
+    while (lo < hi)
     {
-        // Create new index
-        insert_at = ~insert_at;
-        search_index_t index{ key };
-        index.docs[0] = doc;
-        for (int i = 1; i < ARRAY_COUNT(index.docs); ++i)
-            index.docs[i] = SEARCH_DOCUMENT_INVALID_ID;
-        index.document_count = 1;
-        db->dirty = true;
-        array_insert_memcpy(db->indexes, insert_at, &index);
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if (search_database_lexicon_compare(shard->strings, shard->words[mid], str, length) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
+    return lo;
+}
 
-    return insert_at;
+FOUNDATION_STATIC void search_database_lexicon_insert(search_database_shard_t* shard, string_table_symbol_t symbol, const char* str, size_t length)
+{
+    const uint32_t pos = search_database_lexicon_lower_bound(shard, str, length);
+    if (pos < array_size(shard->words) && shard->words[pos] == symbol)
+        return;
+    array_insert(shard->words, pos, symbol);
 }
 
-FOUNDATION_FORCEINLINE string_const_t search_database_clean_up_text(const char* text, size_t text_length)
+FOUNDATION_STATIC void search_database_lexicon_remove(search_database_shard_t* shard, string_table_symbol_t symbol)
 {
-    string_const_t clean_text = string_const(text, text_length);
-    clean_text = string_trim(clean_text, '"');
-    clean_text = string_trim(clean_text, '\'');
-    clean_text = string_trim(clean_text, '.');
-    clean_text = string_trim(clean_text, ':');
-    return string_trim(clean_text, ' ');
+    string_const_t word = string_table_to_string_const(shard->strings, symbol);
+    const uint32_t pos = search_database_lexicon_lower_bound(shard, STRING_ARGS(word));
+    if (pos < array_size(shard->words) && shard->words[pos] == symbol)
+        array_erase_ordered_safe(shard->words, pos);
 }
 
-FOUNDATION_STATIC hash_t search_database_string_to_symbol(search_database_t* db, const char* str, size_t length)
+/*! Invoke #handler with the index of each lexicon word starting with #prefix, excluding the #prefix word itself.
+ * 
+ *  @remark The shard must be locked.
+ */
+template<typename Handler>
+FOUNDATION_STATIC void search_database_lexicon_for_each(search_database_shard_t* shard, const char* prefix, size_t length, const Handler& handler)
 {
-    string_table_symbol_t symbol = string_table_to_symbol(db->strings, str, length);
-    while (symbol == STRING_TABLE_FULL)
+    search_index_key_t key{ SearchIndexType::Word };
+    for (uint32_t i = search_database_lexicon_lower_bound(shard, prefix, length), end = array_size(shard->words); i < end; ++i)
     {
-        const int grow_size = (int)math_align_up(db->strings->allocated_bytes * 1.5f, 8);
-        log_debugf(0, STRING_CONST("Search database string table full, growing to %d bytes"), grow_size);
-        string_table_grow(&db->strings, grow_size);
-        symbol = string_table_to_symbol(db->strings, str, length);
-    }
+        string_const_t word = string_table_to_string_const(shard->strings, shard->words[i]);
+        if (word.length < length || memcmp(word.str, prefix, length) != 0)
+            break;
 
-    FOUNDATION_ASSERT(symbol > 0);
-    return (hash_t)(symbol);
+        if (word.length == length)
+            continue;
+
+        key.crc = shard->words[i];
+        key.hash = string_hash(STRING_ARGS(word));
+        const int index = search_database_find_index(shard, key);
+        if (index >= 0)
+            handler(shard->indexes[index]);
+    }
 }
 
-FOUNDATION_STATIC int32_t search_database_string_to_key(search_database_t* db, const char* str, size_t length, search_index_key_t& key)
+/*! Returns the index of the first term frequency entry which is not less than (#hash, #doc). */
+FOUNDATION_STATIC uint32_t search_database_term_frequency_lower_bound(const search_term_frequency_t* frequencies, hash_t hash, search_document_handle_t doc)
 {
-    key.hash = string_hash(str, length);
-    key.crc = search_database_string_to_symbol(db, str, length);
-    return -to_int(length);
+    uint32_t lo = 0, hi = array_size(frequencies);
+    while (lo < hi)
+    {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        const search_term_frequency_t& f = frequencies[mid];
+        if (f.hash < hash || (f.hash == hash && f.doc < doc))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
 }
 
-FOUNDATION_STATIC bool search_database_skip_word(const char* _word, size_t _word_length, SearchIndexingFlags flags)
+/*! Count another occurrence of a word that is already indexed for #doc.
+ * 
+ *  @remark The shard must be write locked and promoted.
+ */
+FOUNDATION_STATIC void search_database_term_frequency_increment_nolock(search_database_shard_t* shard, const search_index_key_t& key, search_document_handle_t doc)
 {
-    string_const_t word = string_const(_word, _word_length);
-
-    if ((flags & SearchIndexingFlags::TrimWord) == SearchIndexingFlags::TrimWord)
-        word = search_database_clean_up_text(word.str, word.length);
-
-    if (word.str == nullptr || word.length < 3)
-        return true;
+    if (key.type != SearchIndexType::Word)
+        return;
 
-    const bool skip_common_words = (flags & SearchIndexingFlags::SkipCommonWords) != 0;
-    if (skip_common_words)
+    const uint32_t pos = search_database_term_frequency_lower_bound(shard->frequencies, key.hash, doc);
+    if (pos < array_size(shard->frequencies) && shard->frequencies[pos].hash == key.hash && shard->frequencies[pos].doc == doc)
     {
-        for (const auto& cw : COMMON_WORDS)
-        {
-            if (string_equal_nocase(STRING_ARGS(cw), STRING_ARGS(word)))
-                return true;
-        }
+        shard->frequencies[pos].count++;
+        return;
     }
 
-    return false;
+    search_term_frequency_t entry;
+    entry.hash = key.hash;
+    entry.doc = doc;
+    entry.count = 2;
+    array_insert_memcpy(shard->frequencies, pos, &entry);
 }
 
-FOUNDATION_STATIC bool search_database_index_word(
-    search_database_t* db, search_document_handle_t doc, 
-    const char* _word, size_t _word_length, 
-    SearchIndexingFlags flags)
+/*! Stage another occurrence of a word that is already indexed for #doc while committing a batch.
+ * 
+ *  Staged entries count the additional occurrences of a word, see #search_database_term_frequency_merge_nolock.
+ */
+FOUNDATION_STATIC void search_database_term_frequency_stage(search_term_frequency_t*& staged, const search_index_key_t& key, search_document_handle_t doc)
 {
-    FOUNDATION_ASSERT(db);
+    if (key.type != SearchIndexType::Word)
+        return;
 
-    if (search_database_skip_word(_word, _word_length, flags))
-        return false;
-        
-    if (!search_database_is_document_valid(db, doc))
-        return false;
+    search_term_frequency_t* last = array_last(staged);
+    if (last && last->hash == key.hash && last->doc == doc)
+    {
+        last->count++;
+        return;
+    }
 
-    string_const_t word = search_database_format_word(_word, _word_length, flags);
+    search_term_frequency_t entry;
+    entry.hash = key.hash;
+    entry.doc = doc;
+    entry.count = 1;
+    array_push_memcpy(staged, &entry);
+}
 
-    // Insert exact word
-    search_index_key_t key;
-    key.type = SearchIndexType::Word;
-    key.score = search_database_string_to_key(db, STRING_ARGS(word), key);
-    search_database_insert_index(db, doc, key);
+/*! Merge the additional word occurrences staged by a batch in the shard term frequencies.
+ * 
+ *  @remark The shard must be write locked and promoted.
+ */
+FOUNDATION_STATIC void search_database_term_frequency_merge_nolock(search_database_shard_t* shard, search_term_frequency_t* staged)
+{
+    const uint32_t count = array_size(staged);
+    if (count == 0)
+        return;
 
-    const bool include_variations = (flags & SearchIndexingFlags::Variations) != SearchIndexingFlags::None;
-    if (!include_variations)
-        return true;
+    std::sort(staged, staged + count, [](const search_term_frequency_t& a, const search_term_frequency_t& b)
+    {
+        if (a.hash != b.hash)
+            return a.hash < b.hash;
+        return a.doc < b.doc;
+    });
 
-    word.length--;
-    if (word.length < 3)
-        return true;
+    const search_term_frequency_t* frequencies = shard->frequencies;
+    const uint32_t frequency_count = array_size(frequencies);
+    search_term_frequency_t* merged = nullptr;
+    array_reserve(merged, frequency_count + count);
 
-    key.type = SearchIndexType::Variation;
-    for (; word.length > 2; --word.length, ++key.score)
+    uint32_t i = 0, j = 0;
+    while (i < frequency_count || j < count)
     {
-        // Skip spaces at the end
-        if (word.str[word.length - 1] == ' ')
+        if (j >= count || (i < frequency_count && (frequencies[i].hash < staged[j].hash || 
+            (frequencies[i].hash == staged[j].hash && frequencies[i].doc < staged[j].doc))))
+        {
+            array_push_memcpy(merged, &frequencies[i++]);
             continue;
-            
-        search_database_string_to_key(db, word.str, word.length, key);
-        search_database_insert_index(db, doc, key);
+        }
+
+        // Words are counted once they occur a second time in a document.
+        search_term_frequency_t entry = staged[j];
+        entry.count++;
+        if (i < frequency_count && frequencies[i].hash == entry.hash && frequencies[i].doc == entry.doc)
+            entry.count = frequencies[i++].count + staged[j].count;
+        for (++j; j < count && staged[j].hash == entry.hash && staged[j].doc == entry.doc; ++j)
+            entry.count += staged[j].count;
+        array_push_memcpy(merged, &entry);
     }
 
-    return true;
+    array_deallocate(shard->frequencies);
+    shard->frequencies = merged;
 }
 
-FOUNDATION_FORCEINLINE SearchIndexingFlags search_database_case_indexing_flag(search_database_t* db)
+FOUNDATION_FORCEINLINE int search_database_number_entry_compare(const search_number_entry_t& a, uint64_t crc, double number, search_document_handle_t doc)
 {
-    SearchIndexingFlags flags = SearchIndexingFlags::None;
-    if ((db->options & SearchDatabaseFlags::CaseSensitive) == 0)
-        flags |= SearchIndexingFlags::Lowercase;
-
-    if ((db->options & SearchDatabaseFlags::SkipCommonWords) != 0)
-        flags |= SearchIndexingFlags::SkipCommonWords;
-
-    return flags;
+    if (a.crc != crc)
+        return a.crc < crc ? -1 : 1;
+    if (a.number != number)
+        return a.number < number ? -1 : 1;
+    if (a.doc != doc)
+        return a.doc < doc ? -1 : 1;
+    return 0;
 }
 
-//
-// # PUBLIC API
-//
+/*! Returns the index of the first numeric value which is not less than (#crc, #number, #doc). */
+FOUNDATION_STATIC uint32_t search_database_number_lower_bound(
+    const search_number_entry_t* numbers, uint32_t count, 
+    uint64_t crc, double number, search_document_handle_t doc = 0)
+{
+    uint32_t lo = 0, hi = count;
+    while (lo < hi)
+    {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if (search_database_number_entry_compare(numbers[mid], crc, number, doc) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
 
-search_database_t* search_database_allocate(search_database_flags_t flags /*= SearchDatabaseFlags::None*/)
+/*! Returns the index of the first numeric value of property #crc which is greater than #number. */
+FOUNDATION_STATIC uint32_t search_database_number_upper_bound(const search_number_entry_t* numbers, uint32_t count, uint64_t crc, double number)
 {
-    FOUNDATION_ASSERT(sizeof(search_index_t) <= 64);
+    uint32_t lo = 0, hi = count;
+    while (lo < hi)
+    {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        const search_number_entry_t& e = numbers[mid];
+        if (e.crc < crc || (e.crc == crc && e.number <= number))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
 
-    search_database_t* db = MEM_NEW(0, search_database_t);
-    if (flags != SearchDatabaseFlags::None)
-        db->options = flags;
+/*! Add the numeric value of a #SearchIndexType::Number index entry of #doc.
+ * 
+ *  @remark The shard must be write locked and promoted.
+ */
+FOUNDATION_STATIC void search_database_number_insert_nolock(search_database_shard_t* shard, const search_index_key_t& key, search_document_handle_t doc)
+{
+    FOUNDATION_ASSERT(key.type == SearchIndexType::Number);
 
-    db->strings = string_table_allocate(1024, 10);
+    const uint32_t count = array_size(shard->numbers);
+    const uint32_t pos = search_database_number_lower_bound(shard->numbers, count, key.crc, key.number, doc);
+    if (pos < count && search_database_number_entry_compare(shard->numbers[pos], key.crc, key.number, doc) == 0)
+        return;
 
-    // Add a dummy query so the handle indexes start at 1
-    array_push(db->queries, nullptr);
-    
-    // Add first "special" root document
-    search_document_t root{};
-    root.type = SearchDocumentType::Root;
-    root.name = string_clone(STRING_CONST("<root>"));
-    root.timestamp = time_now();
-    array_push_memcpy(db->documents, &root);
-    
-    return db;
+    search_number_entry_t entry;
+    entry.crc = key.crc;
+    entry.number = key.number;
+    entry.doc = doc;
+    entry.score = key.score;
+    array_insert_memcpy(shard->numbers, pos, &entry);
 }
 
-void search_database_deallocate(search_database_t*& db)
+/*! Merge sorted numeric values in the shard numeric values, duplicates are skipped.
+ * 
+ *  @remark The shard must be write locked and promoted.
+ */
+FOUNDATION_STATIC void search_database_number_merge_nolock(search_database_shard_t* shard, const search_number_entry_t* entries, uint32_t count)
 {
-    if (db == nullptr)
+    if (count == 0)
         return;
 
-    search_database_deallocate_indexes(db);
-    search_database_deallocate_documents(db);
-    
-    string_table_deallocate(db->strings);
+    const search_number_entry_t* numbers = shard->numbers;
+    const uint32_t number_count = array_size(numbers);
+    search_number_entry_t* merged = nullptr;
+    array_reserve(merged, number_count + count);
 
-    for (unsigned i = 0, end = array_size(db->queries); i < end; ++i)
-        search_query_deallocate(db->queries[i]);
-    array_deallocate(db->queries);
-    
-    MEM_DELETE(db);
-    db = nullptr;
-}
+    uint32_t i = 0, j = 0;
+    while (i < number_count || j < count)
+    {
+        int c = -1;
+        if (i >= number_count)
+            c = 1;
+        else if (j < count)
+            c = search_database_number_entry_compare(numbers[i], entries[j].crc, entries[j].number, entries[j].doc);
 
-bool search_database_is_dirty(search_database_t* database)
-{
-    FOUNDATION_ASSERT(database);
-    return database->dirty;
+        if (c <= 0)
+        {
+            array_push_memcpy(merged, &numbers[i++]);
+            if (c == 0)
+                j++;
+        }
+        else
+        {
+            array_push_memcpy(merged, &entries[j++]);
+        }
+    }
+
+    array_deallocate(shard->numbers);
+    shard->numbers = merged;
 }
 
-bool search_database_document_update_timestamp(search_database_t* db, search_document_handle_t document, time_t timestamp /*= 0*/)
+FOUNDATION_FORCEINLINE bool search_database_compress_posting_lists(search_database_t* db)
 {
-    if (!search_database_is_document_valid(db, document))
-        return false;
-
-    if (timestamp == 0)
-        timestamp = time_now();
-
-    SHARED_WRITE_LOCK(db->mutex);
-    if (db->documents[document].timestamp == timestamp)
-        return false;
-    db->dirty = true;
-    return (db->documents[document].timestamp = timestamp) > 0;
+    return any(db->options, SearchDatabaseFlags::CompressPostingLists);
 }
 
-time_t search_database_document_timestamp(search_database_t* db, search_document_handle_t document)
+FOUNDATION_FORCEINLINE uint32_t search_database_posting_block_count(uint32_t document_count)
 {
-    if (!search_database_is_document_valid(db, document))
-        return 0;
-
-    SHARED_READ_LOCK(db->mutex);
-    return db->documents[document].timestamp;
+    return (document_count + SEARCH_POSTING_BLOCK_SIZE - 1) / SEARCH_POSTING_BLOCK_SIZE;
 }
 
-search_document_handle_t search_database_find_document(search_database_t* db, const char* name, size_t name_length)
+/*! Encode a sorted list of unique documents into a compressed posting list.
+ * 
+ *  The compressed list starts with a skip entry per block of #SEARCH_POSTING_BLOCK_SIZE documents 
+ *  holding the first document of the block and the offset of its data. Each block data then starts 
+ *  with the bit width used to pack the (delta - 1) of the following documents of the block.
+ * 
+ *  @return A byte array that must be deallocated with #array_deallocate.
+ */
+FOUNDATION_STATIC uint8_t* search_database_posting_encode(const search_document_handle_t* docs, uint32_t count)
 {
-    FOUNDATION_ASSERT(db);
-
-    if (name == nullptr || name_length == 0)
-        return SEARCH_DOCUMENT_INVALID_ID;
+    const uint32_t block_count = search_database_posting_block_count(count);
+    const uint32_t skips_size = sizeof(search_posting_skip_t) * block_count;
 
-    SHARED_READ_LOCK(db->mutex);
-    for (unsigned doc_index = 1, end = array_size(db->documents); doc_index < end; ++doc_index)
+    uint8_t* packed = nullptr;
+    array_reserve(packed, skips_size + count + block_count);
+    array_resize(packed, skips_size);
+    
+    for (uint32_t b = 0; b < block_count; ++b)
     {
-        search_document_t& doc = db->documents[doc_index];
-        if (string_equal_nocase(STRING_ARGS(doc.name), name, name_length))
-            return doc_index;
-    }
+        const uint32_t begin = b * SEARCH_POSTING_BLOCK_SIZE;
+        const uint32_t end = min(begin + SEARCH_POSTING_BLOCK_SIZE, count);
 
-    return SEARCH_DOCUMENT_INVALID_ID;
-}
+        uint32_t max_delta = 0;
+        for (uint32_t i = begin + 1; i < end; ++i)
+        {
+            FOUNDATION_ASSERT(docs[i] > docs[i - 1]);
+            max_delta |= docs[i] - docs[i - 1] - 1;
+        }
 
-search_document_handle_t search_database_add_document(search_database_t* db, const char* name, size_t name_length)
-{
-    FOUNDATION_ASSERT(db);
-    FOUNDATION_ASSERT(name && name_length > 0);
-    
-    search_document_t document{};
-    document.type = SearchDocumentType::Default;
-    document.name = string_clone(name, name_length);
-    document.timestamp = time_now();
+        uint8_t bits = 0;
+        while (bits < 32 && (max_delta >> bits) != 0)
+            ++bits;
 
-    SHARED_WRITE_LOCK(db->mutex);
+        const search_posting_skip_t skip{ docs[begin], array_size(packed) - skips_size };
+        memcpy(packed + sizeof(search_posting_skip_t) * b, &skip, sizeof(skip));
+        array_push(packed, bits);
 
-    // Find removed slot if any
-    for (unsigned doc_index = 1, end = array_size(db->documents); doc_index < end; ++doc_index)
-    {
-        search_document_t& doc = db->documents[doc_index];
-        if (doc.type == SearchDocumentType::Removed)
+        uint64_t acc = 0;
+        uint32_t acc_bits = 0;
+        for (uint32_t i = begin + 1; i < end; ++i)
         {
-            doc = document;
-            db->dirty = true;
-            db->document_count++;
-            return doc_index;
+            acc |= (uint64_t)(docs[i] - docs[i - 1] - 1) << acc_bits;
+            acc_bits += bits;
+            for (; acc_bits >= 8; acc_bits -= 8, acc >>= 8)
+                array_push(packed, (uint8_t)acc);
         }
+
+        if (acc_bits > 0)
+            array_push(packed, (uint8_t)acc);
     }
 
-    db->dirty = true;
-    db->document_count++;
-    array_push_memcpy(db->documents, &document);
-    return array_size(db->documents) - 1;
+    return packed;
 }
 
-search_document_handle_t search_database_get_or_add_document(search_database_t* db, const char* name, size_t name_length)
+FOUNDATION_FORCEINLINE const uint8_t* search_database_index_packed_data(const search_index_t& idx)
 {
-    FOUNDATION_ASSERT(db);
-    FOUNDATION_ASSERT(name && name_length > 0);
-
-    search_document_handle_t doc = search_database_find_document(db, name, name_length);
-    if (doc == SEARCH_DOCUMENT_INVALID_ID)
-        doc = search_database_add_document(db, name, name_length);
-    return doc;
+    FOUNDATION_ASSERT(idx.packed);
+    if (idx.mapped)
+        return (const uint8_t*)&idx + idx.docs_mapped.offset;
+    return idx.docs_packed;
 }
 
-bool search_database_index_text(search_database_t* db, search_document_handle_t doc, const char* text, size_t text_length, bool include_variations /*= true*/)
+FOUNDATION_FORCEINLINE uint32_t search_database_index_packed_size(const search_index_t& idx)
 {
-    if (text == nullptr || text_length == 0)
-        return false;
-        
-    if (!search_database_is_document_valid(db, doc))
-        return false;
-        
-    SearchIndexingFlags flags = search_database_case_indexing_flag(db) | SearchIndexingFlags::RemovePonctuations;
-    if (include_variations)
-        flags |= SearchIndexingFlags::Variations;
-    string_const_t expression, r = search_database_clean_up_text(text, text_length);
-    do
-    {
-        // Split words by space
-        string_split(STRING_ARGS(r), STRING_CONST(","), &expression, &r, false);
-        if (expression.length)
-        {
-            // Split words by double colon
-            string_const_t kvp, rr = search_database_clean_up_text(STRING_ARGS(expression));
-            do
-            {
-                // Split words by :
-                string_split(STRING_ARGS(rr), STRING_CONST(":"), &kvp, &rr, false);
-                if (kvp.length)
-                {
-                    // Split words by space
-                    string_const_t word, rrr = search_database_clean_up_text(STRING_ARGS(kvp));
-                    do
-                    {
-                        // Split words by :
-                        string_split(STRING_ARGS(rrr), STRING_CONST(" "), &word, &rrr, false);
-                        if (word.length)
-                        {
-                            search_database_index_word(db, doc, STRING_ARGS(word), flags);
-                        }
-                    } while (rrr.length > 0);
-                }
-            } while (rr.length > 0);
-        }
-    } while (r.length > 0);
-
-    return true;
+    FOUNDATION_ASSERT(idx.packed);
+    if (idx.mapped)
+        return idx.docs_mapped.size;
+    return array_size(idx.docs_packed);
 }
 
-bool search_database_index_exact_match(search_database_t* db, search_document_handle_t document, const char* _word, size_t _word_length, bool case_sensitive /*= false*/)
+/*! Decode a single block of a compressed posting list.
+ * 
+ *  @param out Buffer of at least #SEARCH_POSTING_BLOCK_SIZE documents.
+ * 
+ *  @return Number of documents decoded.
+ */
+FOUNDATION_STATIC uint32_t search_database_posting_decode_block(const search_index_t& idx, uint32_t block, search_document_handle_t* out)
 {
-    FOUNDATION_ASSERT(db);
+    FOUNDATION_ASSERT(idx.packed);
 
-    if (!_word || _word_length == 0)
-        return false;
-    
-    if (!search_database_is_document_valid(db, document))
-        return false;
+    const uint32_t block_count = search_database_posting_block_count(idx.document_count);
+    FOUNDATION_ASSERT(block < block_count);
 
-    const search_indexing_flags_t flags = case_sensitive ? SearchIndexingFlags::None : SearchIndexingFlags::Lowercase;
-    string_const_t word = search_database_format_word(_word, _word_length, flags);
-    
-    search_index_key_t key;
-    key.type = SearchIndexType::Word;
-    key.score = INT_MIN - search_database_string_to_key(db, STRING_ARGS(word), key);
-    return search_database_insert_index(db, document, key) >= 0;
-}
+    const uint8_t* packed = search_database_index_packed_data(idx);
+    const search_posting_skip_t* skips = (const search_posting_skip_t*)packed;
+    const uint8_t* data = packed + sizeof(search_posting_skip_t) * block_count + skips[block].offset;
+    const uint32_t count = min(SEARCH_POSTING_BLOCK_SIZE, idx.document_count - block * SEARCH_POSTING_BLOCK_SIZE);
 
-bool search_database_index_word(search_database_t* db, search_document_handle_t doc, const char* word, size_t word_length, bool include_variations /*= true*/)
-{
-    search_indexing_flags_t flags = search_database_case_indexing_flag(db) | SearchIndexingFlags::TrimWord;
-    if (include_variations)
-        flags |= SearchIndexingFlags::Variations;
-    return search_database_index_word(db, doc, word, word_length, flags);
+    const uint8_t bits = *data++;
+    const uint64_t mask = (1ULL << bits) - 1;
+
+    uint64_t acc = 0;
+    uint32_t acc_bits = 0;
+    out[0] = skips[block].first_doc;
+    for (uint32_t i = 1; i < count; ++i)
+    {
+        for (; acc_bits < bits; acc_bits += 8)
+            acc |= (uint64_t)(*data++) << acc_bits;
+        out[i] = out[i - 1] + (search_document_handle_t)(acc & mask) + 1;
+        acc >>= bits;
+        acc_bits -= bits;
+    }
+
+    return count;
 }
 
-uint32_t search_database_index_count(search_database_t* database)
+/*! Returns the block of a compressed posting list that could contain #doc. */
+FOUNDATION_STATIC uint32_t search_database_posting_find_block(const search_index_t& idx, search_document_handle_t doc)
 {
-    return array_size(database->indexes);
+    const search_posting_skip_t* skips = (const search_posting_skip_t*)search_database_index_packed_data(idx);
+    uint32_t lo = 0, hi = search_database_posting_block_count(idx.document_count);
+    while (hi - lo > 1)
+    {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if (skips[mid].first_doc <= doc)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
 }
 
-uint32_t search_database_document_count(search_database_t* database)
+FOUNDATION_STATIC bool search_database_index_contains(const search_index_t& idx, search_document_handle_t doc)
 {
-    return database->document_count;
+    if (!idx.packed)
+    {
+        if (idx.document_count <= ARRAY_COUNT(idx.docs))
+            return array_binary_search(idx.docs, idx.document_count, doc) >= 0;
+        return array_binary_search(idx.docs_list, doc) >= 0;
+    }
+
+    search_document_handle_t block_docs[SEARCH_POSTING_BLOCK_SIZE];
+    const uint32_t count = search_database_posting_decode_block(idx, search_database_posting_find_block(idx, doc), block_docs);
+    return array_binary_search(block_docs, count, doc) >= 0;
 }
 
-string_const_t search_database_document_name(search_database_t* database, search_document_handle_t document)
+/*! Append all the (sorted) documents of an index to #docs. */
+FOUNDATION_STATIC search_document_handle_t* search_database_index_copy_documents(const search_index_t& idx, search_document_handle_t*& docs)
 {
-    if (!search_database_is_document_valid(database, document))
-        return string_null();
+    const uint32_t offset = array_size(docs);
+    array_resize(docs, offset + idx.document_count);
+    
+    if (idx.packed)
+    {
+        for (uint32_t b = 0, i = offset, end = search_database_posting_block_count(idx.document_count); b < end; ++b)
+            i += search_database_posting_decode_block(idx, b, docs + i);
+    }
+    else
+    {
+        const search_document_handle_t* index_docs = idx.document_count <= ARRAY_COUNT(idx.docs) ? idx.docs : idx.docs_list;
+        memcpy(docs + offset, index_docs, sizeof(search_document_handle_t) * idx.document_count);
+    }
 
-    SHARED_READ_LOCK(database->mutex);
-    return string_to_const(database->documents[document].name);
+    return docs;
 }
 
-uint32_t search_database_word_document_count(search_database_t* db, const char* _word, size_t _word_length, bool include_variations /*= false*/)
-{    
-    string_const_t word = search_database_format_word(_word, _word_length, search_database_case_indexing_flag(db) | SearchIndexingFlags::TrimWord);
-    search_index_key_t key{ SearchIndexType::Word };
-    search_database_string_to_key(db, STRING_ARGS(word), key);
+FOUNDATION_STATIC void search_database_index_deallocate_documents(search_index_t& index)
+{
+    FOUNDATION_ASSERT_MSG(!index.mapped, "Mapped indexes must be promoted before being modified");
+    if (index.packed)
+        array_deallocate(index.docs_packed);
+    else if (index.document_count > ARRAY_COUNT(index.docs))
+        array_deallocate(index.docs_list);
+    index.packed = false;
+}
 
-    int count = 0;
-    SHARED_READ_LOCK(db->mutex);
-    int index = search_database_find_index(db, key);
-    if (index >= 0)
-        count = db->indexes[index].document_count;
+FOUNDATION_STATIC void search_database_index_set_documents(search_index_t& index, const search_document_handle_t* docs, uint32_t count, bool compress)
+{
+    search_database_index_deallocate_documents(index);
 
-    if (include_variations)
+    if (count <= ARRAY_COUNT(index.docs))
     {
-        key.type = SearchIndexType::Variation;
-        index = search_database_find_index(db, key);
-        if (index >= 0)
-            count += db->indexes[index].document_count;
+        for (uint32_t i = 0; i < ARRAY_COUNT(index.docs); ++i)
+            index.docs[i] = i < count ? docs[i] : SEARCH_DOCUMENT_INVALID_ID;
     }
-
-    return count;
+    else if (compress)
+    {
+        index.docs_packed = search_database_posting_encode(docs, count);
+        index.packed = true;
+    }
+    else
+    {
+        index.docs_list = nullptr;
+        array_resize(index.docs_list, count);
+        memcpy(index.docs_list, docs, sizeof(search_document_handle_t) * count);
+    }
+    
+    index.document_count = count;
 }
 
-bool search_database_index_property(search_database_t* db, search_document_handle_t doc, const char* name, size_t name_length, double value)
+/*! Copy the mapped string table and indexes of a shard to the heap so they can be modified.
+ * 
+ *  @remark The shard must be write locked.
+ */
+FOUNDATION_STATIC void search_database_promote_nolock(search_database_t* db, search_database_shard_t* shard)
 {
-    if (!search_database_is_document_valid(db, doc))
-        return false;
-        
-    const SearchIndexingFlags flags = search_database_case_indexing_flag(db);
-    string_const_t property_name = search_database_format_word(name, name_length, flags);
+    if (!shard->mapped)
+        return;
 
-    search_index_key_t key;
-    key.type = SearchIndexType::Number;
-    key.crc = search_database_string_to_symbol(db, STRING_ARGS(property_name));
-    key.score = -to_int(name_length);
-    key.number = value;
+    TIME_TRACKER("Promote mapped search database shard");
 
-    return search_database_insert_index(db, doc, key) >= 0;
-}
+    string_table_t* strings = (string_table_t*)memory_allocate(0, shard->strings->allocated_bytes, 8, MEMORY_PERSISTENT);
+    memcpy(strings, shard->strings, shard->strings->allocated_bytes);
+    strings->free_slots = nullptr;
 
-bool search_database_index_property(
-    search_database_t* db, search_document_handle_t doc, 
-    const char* name, size_t name_length, 
-    const char* value, size_t value_length,
-    bool include_variations /*= true*/)
-{
-    FOUNDATION_ASSERT(name && name_length > 0);
+    const bool compress = search_database_compress_posting_lists(db);
+    const uint32_t index_count = array_size(shard->indexes);
+    search_index_t* indexes = nullptr;
+    array_resize(indexes, index_count);
+    memcpy(indexes, shard->indexes, sizeof(search_index_t) * index_count);
+    for (uint32_t i = 0; i < index_count; ++i)
+    {
+        const search_index_t& mapped_index = shard->indexes[i];
+        if (!mapped_index.mapped)
+            continue;
+
+        search_index_t& index = indexes[i];
+        index.mapped = false;
+        if (compress)
+        {
+            const uint32_t packed_size = search_database_index_packed_size(mapped_index);
+            index.docs_packed = nullptr;
+            array_resize(index.docs_packed, packed_size);
+            memcpy(index.docs_packed, search_database_index_packed_data(mapped_index), packed_size);
+        }
+        else
+        {
+            index.packed = false;
+            index.docs_list = nullptr;
+            search_database_index_copy_documents(mapped_index, index.docs_list);
+        }
+    }
+
+    string_table_symbol_t* words = nullptr;
+    array_copy(words, shard->words);
+
+    search_term_frequency_t* frequencies = nullptr;
+    array_copy(frequencies, shard->frequencies);
+
+    search_number_entry_t* numbers = nullptr;
+    array_copy(numbers, shard->numbers);
+
+    shard->strings = strings;
+    shard->indexes = indexes;
+    shard->words = words;
+    shard->frequencies = frequencies;
+    shard->numbers = numbers;
+    shard->mapped = false;
+
+    // Release the file mapping once the last mapped shard got promoted.
+    if (atomic_decr32(&db->mapped_shards, memory_order_acq_rel) == 0)
+        search_database_unmap_nolock(db);
+}
+
+/*! Insert a document in the index of #key.
+ * 
+ *  @remark The shard must be write locked and promoted (see #search_database_promote_nolock).
+ */
+FOUNDATION_STATIC int search_database_insert_index_nolock(search_database_t* db, search_database_shard_t* shard, search_document_handle_t doc, const search_index_key_t& key)
+{
+    FOUNDATION_ASSERT(!shard->mapped);
+
+    if (atomic_load32(&db->batch_depth, memory_order_acquire) > 0)
+    {
+        // Defer the insertion until the batch gets committed, see #search_database_commit_batch
+        search_index_staging_t entry{ key, doc };
+        array_push_memcpy(shard->batch, &entry);
+        return array_size(shard->batch) - 1;
+    }
+
+    if (key.type == SearchIndexType::Number)
+        search_database_number_insert_nolock(shard, key, doc);
+    
+    int insert_at = search_database_find_index(shard, key);
+    if (insert_at >= 0)
+    {
+        // Found existing index, add document to the sorted list
+        search_index_t& index = shard->indexes[insert_at];
+
+        if (index.document_count < ARRAY_COUNT(index.docs))
+        {
+            // Find insertion point and check if doc already exist
+            uint32_t pos = 0;
+            while (pos < index.document_count && index.docs[pos] < doc)
+                ++pos;
+            if (pos < index.document_count && index.docs[pos] == doc)
+            {
+                search_database_term_frequency_increment_nolock(shard, key, doc);
+                return insert_at;
+            }
+
+            shard->dirty = true;
+            memmove(index.docs + pos + 1, index.docs + pos, sizeof(search_document_handle_t) * (index.document_count - pos));
+            index.docs[pos] = doc;
+            index.document_count++;
+        }
+        else if (index.document_count == ARRAY_COUNT(index.docs))
+        {
+            const int pos = array_binary_search(index.docs, index.document_count, doc);
+            if (pos >= 0)
+            {
+                search_database_term_frequency_increment_nolock(shard, key, doc);
+                return insert_at;
+            }
+            
+            // Create new list and copy existing docs
+            search_document_handle_t* docs = nullptr;
+            array_reserve(docs, ARRAY_COUNT(index.docs) * 2);
+            for (int i = 0; i < ARRAY_COUNT(index.docs); ++i)
+                array_push(docs, index.docs[i]);
+            shard->dirty = true;
+            array_insert(docs, ~pos, doc);
+            if (search_database_compress_posting_lists(db))
+            {
+                search_database_index_set_documents(index, docs, array_size(docs), true);
+                array_deallocate(docs);
+            }
+            else
+            {
+                index.docs_list = docs;
+                index.document_count = array_size(docs);
+            }
+            FOUNDATION_ASSERT(index.document_count > ARRAY_COUNT(index.docs));
+        }
+        else if (index.packed)
+        {
+            if (search_database_index_contains(index, doc))
+            {
+                search_database_term_frequency_increment_nolock(shard, key, doc);
+                return insert_at;
+            }
+
+            // Compressed lists need to be re-encoded, this is why batches should be 
+            // preferred when indexing many documents (see #search_database_begin_batch).
+            search_document_handle_t* docs = nullptr;
+            array_reserve(docs, index.document_count + 1);
+            search_database_index_copy_documents(index, docs);
+            const int pos = array_binary_search(docs, doc);
+            array_insert(docs, ~pos, doc);
+            shard->dirty = true;
+            search_database_index_set_documents(index, docs, array_size(docs), true);
+            array_deallocate(docs);
+        }
+        else
+        {
+            const int pos = array_binary_search(index.docs_list, doc);
+            if (pos >= 0)
+            {
+                search_database_term_frequency_increment_nolock(shard, key, doc);
+                return insert_at;
+            }
+            
+            // Add to existing list
+            shard->dirty = true;
+            array_insert(index.docs_list, ~pos, doc);
+            index.document_count = array_size(index.docs_list);
+            FOUNDATION_ASSERT(index.document_count > ARRAY_COUNT(index.docs));
+        }
+    }
+    else
+    {
+        // Create new index
+        insert_at = ~insert_at;
+        search_index_t index{ key };
+        index.docs[0] = doc;
+        for (int i = 1; i < ARRAY_COUNT(index.docs); ++i)
+            index.docs[i] = SEARCH_DOCUMENT_INVALID_ID;
+        index.document_count = 1;
+        shard->dirty = true;
+        array_insert_memcpy(shard->indexes, insert_at, &index);
+    }
+
+    return insert_at;
+}
+
+FOUNDATION_STATIC void search_database_index_merge_documents(
+    search_index_t& index, 
+    const search_document_handle_t* docs, uint32_t count, 
+    search_document_handle_t*& merged, search_term_frequency_t*& frequencies, bool compress)
+{
+    // Gather existing documents in order to merge them with the new sorted documents.
+    search_document_handle_t* existing = nullptr;
+    search_database_index_copy_documents(index, existing);
+
+    array_clear(merged);
+    array_reserve(merged, index.document_count + count);
+
+    uint32_t i = 0, j = 0;
+    while (i < index.document_count && j < count)
+    {
+        if (existing[i] < docs[j])
+            array_push(merged, existing[i++]);
+        else if (existing[i] > docs[j])
+            array_push(merged, docs[j++]);
+        else
+        {
+            // The document was already indexed, count the word occurrence
+            search_database_term_frequency_stage(frequencies, index.key, docs[j]);
+            array_push(merged, existing[i++]);
+            j++;
+        }
+    }
+    for (; i < index.document_count; ++i)
+        array_push(merged, existing[i]);
+    for (; j < count; ++j)
+        array_push(merged, docs[j]);
+    array_deallocate(existing);
+
+    search_database_index_set_documents(index, merged, array_size(merged), compress);
+}
+
+FOUNDATION_FORCEINLINE string_const_t search_database_clean_up_text(const char* text, size_t text_length)
+{
+    string_const_t clean_text = string_const(text, text_length);
+    clean_text = string_trim(clean_text, '"');
+    clean_text = string_trim(clean_text, '\'');
+    clean_text = string_trim(clean_text, '.');
+    clean_text = string_trim(clean_text, ':');
+    return string_trim(clean_text, ' ');
+}
+
+FOUNDATION_STATIC hash_t search_database_string_to_symbol(string_table_t*& strings, const char* str, size_t length)
+{
+    string_table_symbol_t symbol = string_table_to_symbol(strings, str, length);
+    while (symbol == STRING_TABLE_FULL)
+    {
+        const int grow_size = (int)math_align_up(strings->allocated_bytes * 1.5f, 8);
+        log_debugf(0, STRING_CONST("Search database string table full, growing to %d bytes"), grow_size);
+        string_table_grow(&strings, grow_size);
+        symbol = string_table_to_symbol(strings, str, length);
+    }
+
+    FOUNDATION_ASSERT(symbol > 0);
+    return (hash_t)(symbol);
+}
+
+FOUNDATION_STATIC int32_t search_database_string_to_key(string_table_t*& strings, const char* str, size_t length, search_index_key_t& key)
+{
+    key.hash = string_hash(str, length);
+    key.crc = search_database_string_to_symbol(strings, str, length);
+    return -to_int(length);
+}
+
+/*! Insert a document in the word index built from #str.
+ * 
+ *  @remark The shard of the word gets locked, so words can be indexed concurrently.
+ * 
+ *  @param variations If true, the word is added to the shard lexicon, so it can be found by its prefixes.
+ */
+FOUNDATION_STATIC int search_database_insert_word_index(
+    search_database_t* db, search_document_handle_t doc, 
+    const char* str, size_t length, int32_t score, bool variations)
+{
+    search_index_key_t key;
+    key.type = SearchIndexType::Word;
+    key.score = score;
+
+    search_database_shard_t* shard = search_database_select_shard(db, str, length);
+    SHARED_WRITE_LOCK(shard->mutex);
+    search_database_promote_nolock(db, shard);
+    search_database_string_to_key(shard->strings, str, length, key);
+    if (variations)
+        search_database_lexicon_insert(shard, (string_table_symbol_t)key.crc, str, length);
+    return search_database_insert_index_nolock(db, shard, doc, key);
+}
+
+FOUNDATION_STATIC bool search_database_skip_word(const char* _word, size_t _word_length, SearchIndexingFlags flags)
+{
+    string_const_t word = string_const(_word, _word_length);
+
+    if ((flags & SearchIndexingFlags::TrimWord) == SearchIndexingFlags::TrimWord)
+        word = search_database_clean_up_text(word.str, word.length);
+
+    if (word.str == nullptr || word.length < 3)
+        return true;
+
+    const bool skip_common_words = (flags & SearchIndexingFlags::SkipCommonWords) != 0;
+    if (skip_common_words)
+    {
+        for (const auto& cw : COMMON_WORDS)
+        {
+            if (string_equal_nocase(STRING_ARGS(cw), STRING_ARGS(word)))
+                return true;
+        }
+    }
+
+    return false;
+}
+
+FOUNDATION_STATIC bool search_database_index_word(
+    search_database_t* db, search_document_handle_t doc, 
+    const char* _word, size_t _word_length, 
+    SearchIndexingFlags flags)
+{
+    FOUNDATION_ASSERT(db);
+
+    if (search_database_skip_word(_word, _word_length, flags))
+        return false;
+        
+    if (!search_database_is_document_valid(db, doc))
+        return false;
+
+    string_const_t word = search_database_format_word(_word, _word_length, flags);
+
+    // Insert exact word, variations (prefixes of at least 3 characters) are found using the shard lexicons.
+    const bool include_variations = (flags & SearchIndexingFlags::Variations) != SearchIndexingFlags::None;
+    search_database_insert_word_index(db, doc, STRING_ARGS(word), -to_int(word.length), include_variations && word.length > 3);
+
+    return true;
+}
+
+/*! Add #word_count indexed words to the length of a document (see #search_database_rank_index_results). 
+ *
+ *  @remark Indexing functions add the words they indexed once they are done, so the database is not write locked for each word.
+ */
+FOUNDATION_STATIC void search_database_add_document_length(search_database_t* db, search_document_handle_t doc, uint32_t word_count)
+{
+    if (word_count == 0)
+        return;
+
+    SHARED_WRITE_LOCK(db->mutex);
+    search_document_t& document = db->documents[doc];
+    if (document.type != SearchDocumentType::Default)
+        return;
+
+    document.length += word_count;
+    db->document_length_total += word_count;
+}
+
+FOUNDATION_FORCEINLINE SearchIndexingFlags search_database_case_indexing_flag(search_database_t* db)
+{
+    SearchIndexingFlags flags = SearchIndexingFlags::None;
+    if ((db->options & SearchDatabaseFlags::CaseSensitive) == 0)
+        flags |= SearchIndexingFlags::Lowercase;
+
+    if ((db->options & SearchDatabaseFlags::SkipCommonWords) != 0)
+        flags |= SearchIndexingFlags::SkipCommonWords;
+
+    return flags;
+}
+
+//
+// # PUBLIC API
+//
+
+search_database_t* search_database_allocate(search_database_flags_t flags /*= SearchDatabaseFlags::None*/, uint32_t shard_count /*= 1*/)
+{
+    FOUNDATION_ASSERT(sizeof(search_index_t) <= 64);
+
+    search_database_t* db = MEM_NEW(0, search_database_t);
+    if (flags != SearchDatabaseFlags::None)
+        db->options = flags;
+
+    if (shard_count == 0)
+        shard_count = max(1U, (uint32_t)system_hardware_threads());
+
+    db->shard_count = shard_count;
+    array_reserve(db->shards, shard_count);
+    for (uint32_t i = 0; i < shard_count; ++i)
+    {
+        search_database_shard_t* shard = MEM_NEW(0, search_database_shard_t);
+        shard->strings = string_table_allocate(1024, 10);
+        array_push(db->shards, shard);
+    }
+
+    atomic_store32(&db->batch_depth, 0, memory_order_relaxed);
+    atomic_store32(&db->mapped_shards, 0, memory_order_relaxed);
+
+    // Add a dummy query so the handle indexes start at 1
+    array_push(db->queries, nullptr);
+    
+    // Add first "special" root document
+    search_document_t root{};
+    root.type = SearchDocumentType::Root;
+    root.name = string_clone(STRING_CONST("<root>"));
+    root.timestamp = time_now();
+    array_push_memcpy(db->documents, &root);
+    
+    return db;
+}
+
+void search_database_deallocate(search_database_t*& db)
+{
+    if (db == nullptr)
+        return;
+
+    // Cancel pending queries so their evaluation jobs exit early
+    {
+        SHARED_WRITE_LOCK(db->mutex);
+        for (unsigned i = 0, end = array_size(db->queries); i < end; ++i)
+        {
+            search_query_t* query = db->queries[i];
+            if (query && !atomic_load32(&query->completed, memory_order_acquire))
+            {
+                atomic_store32(&query->cancelled, 1, memory_order_release);
+                db->queries[i] = nullptr;
+            }
+        }
+    }
+    search_database_close_journal(db);
+
+    // The evaluation jobs use the database, so they must all complete before it gets released.
+    for (unsigned i = 0, end = array_size(db->query_jobs); i < end; ++i)
+    {
+        job_wait(db->query_jobs[i]);
+        job_deallocate(db->query_jobs[i]);
+    }
+    array_deallocate(db->query_jobs);
+
+    for (unsigned i = 0, end = array_size(db->shards); i < end; ++i)
+    {
+        search_database_shard_t* shard = db->shards[i];
+        search_database_deallocate_shard_data(shard);
+        array_deallocate(shard->batch);
+        MEM_DELETE(shard);
+    }
+    array_deallocate(db->shards);
+    search_database_deallocate_documents(db);
+    search_database_unmap_nolock(db);
+
+    for (unsigned i = 0, end = array_size(db->queries); i < end; ++i)
+        search_query_deallocate(db->queries[i]);
+    array_deallocate(db->queries);
+    
+    MEM_DELETE(db);
+    db = nullptr;
+}
+
+bool search_database_is_dirty(search_database_t* database)
+{
+    FOUNDATION_ASSERT(database);
+    if (database->dirty)
+        return true;
+
+    for (unsigned i = 0; i < database->shard_count; ++i)
+    {
+        if (database->shards[i]->dirty)
+            return true;
+    }
+    return false;
+}
+
+void search_database_begin_batch(search_database_t* db)
+{
+    FOUNDATION_ASSERT(db);
+    atomic_incr32(&db->batch_depth, memory_order_acq_rel);
+}
+
+/*! Merge the staged entries of a shard in its indexes.
+ * 
+ *  @remark The database must be read locked and the shard write locked.
+ */
+FOUNDATION_STATIC bool search_database_commit_shard_batch_nolock(search_database_t* db, search_database_shard_t* shard)
+{
+    search_index_staging_t* batch = shard->batch;
+    const uint32_t batch_size = array_size(batch);
+    shard->batch = nullptr;
+    if (batch_size == 0)
+    {
+        array_deallocate(batch);
+        return false;
+    }
+
+    TIME_TRACKER("Commit search database batch (%u entries)", batch_size);
+    search_database_promote_nolock(db, shard);
+
+    // Sort all staged entries by key and then by document so we can merge them in a single pass.
+    std::sort(batch, batch + batch_size, [](const search_index_staging_t& a, const search_index_staging_t& b)
+    {
+        const int c = search_database_index_key_compare(a.key, b.key);
+        if (c != 0)
+            return c < 0;
+        return a.doc < b.doc;
+    });
+
+    // Count unique keys in order to reserve the merged index array only once.
+    uint32_t unique_key_count = 1;
+    for (uint32_t i = 1; i < batch_size; ++i)
+    {
+        if (search_database_index_key_compare(batch[i - 1].key, batch[i].key) != 0)
+            unique_key_count++;
+    }
+
+    const uint32_t index_count = array_size(shard->indexes);
+    search_index_t* indexes = nullptr;
+    array_reserve(indexes, index_count + unique_key_count);
+    
+    uint32_t ii = 0, bi = 0;
+    const bool compress = search_database_compress_posting_lists(db);
+    search_document_handle_t* docs = nullptr;
+    search_document_handle_t* merged = nullptr;
+    search_number_entry_t* numbers = nullptr;
+    search_term_frequency_t* frequencies = nullptr;
+    while (bi < batch_size)
+    {
+        // Collect the sorted and unique documents of the next staged key
+        const search_index_key_t& key = batch[bi].key;
+        array_clear(docs);
+        for (; bi < batch_size && search_database_index_key_compare(batch[bi].key, key) == 0; ++bi)
+        {
+            const search_document_handle_t doc = batch[bi].doc;
+
+            // Skip documents that got removed since they were staged
+            if (db->documents[doc].type != SearchDocumentType::Default)
+                continue;
+
+            if (array_size(docs) == 0 || *array_last(docs) != doc)
+                array_push(docs, doc);
+            else
+                search_database_term_frequency_stage(frequencies, key, doc);
+        }
+
+        // Move existing indexes that come before the staged key
+        while (ii < index_count && search_database_index_compare(shard->indexes[ii], key) < 0)
+            array_push_memcpy(indexes, &shard->indexes[ii++]);
+
+        if (array_size(docs) == 0)
+            continue;
+
+        // Staged keys are sorted by property and value, so the numeric values are collected in order.
+        if (key.type == SearchIndexType::Number)
+        {
+            search_number_entry_t entry;
+            entry.crc = key.crc;
+            entry.number = key.number;
+            entry.score = key.score;
+            foreach(doc, docs)
+            {
+                entry.doc = *doc;
+                array_push_memcpy(numbers, &entry);
+            }
+        }
+
+        if (ii < index_count && search_database_index_compare(shard->indexes[ii], key) == 0)
+        {
+            search_index_t index = shard->indexes[ii++];
+            search_database_index_merge_documents(index, docs, array_size(docs), merged, frequencies, compress);
+            array_push_memcpy(indexes, &index);
+        }
+        else
+        {
+            search_index_t index{ key };
+            search_database_index_set_documents(index, docs, array_size(docs), compress);
+            array_push_memcpy(indexes, &index);
+        }
+    }
+
+    // Move remaining existing indexes
+    for (; ii < index_count; ++ii)
+        array_push_memcpy(indexes, &shard->indexes[ii]);
+
+    search_database_number_merge_nolock(shard, numbers, array_size(numbers));
+    search_database_term_frequency_merge_nolock(shard, frequencies);
+    array_deallocate(frequencies);
+    array_deallocate(numbers);
+    array_deallocate(merged);
+    array_deallocate(docs);
+    array_deallocate(batch);
+
+    array_deallocate(shard->indexes);
+    shard->indexes = indexes;
+    shard->dirty = true;
+    return true;
+}
+
+bool search_database_commit_batch(search_database_t* db)
+{
+    FOUNDATION_ASSERT(db);
+
+    FOUNDATION_ASSERT_MSG(atomic_load32(&db->batch_depth, memory_order_relaxed) > 0, "No batch to commit");
+    if (atomic_load32(&db->batch_depth, memory_order_relaxed) <= 0)
+        return false;
+
+    if (atomic_decr32(&db->batch_depth, memory_order_acq_rel) > 0)
+        return false;
+
+    // Shards are committed one after the other, so indexing can continue in the other shards.
+    bool committed = false;
+    search_database_journal_scope_t journal_scope(db);
+    SHARED_READ_LOCK(db->mutex);
+    for (unsigned i = 0; i < db->shard_count; ++i)
+    {
+        search_database_shard_t* shard = db->shards[i];
+        SHARED_WRITE_LOCK(shard->mutex);
+        committed |= search_database_commit_shard_batch_nolock(db, shard);
+    }
+
+    return committed;
+}
+
+bool search_database_document_update_timestamp(search_database_t* db, search_document_handle_t document, time_t timestamp /*= 0*/)
+{
+    if (!search_database_is_document_valid(db, document))
+        return false;
+
+    if (timestamp == 0)
+        timestamp = time_now();
+
+    search_database_journal_scope_t journal_scope(db);
+    SHARED_WRITE_LOCK(db->mutex);
+    if (db->documents[document].timestamp == timestamp)
+        return false;
+    db->dirty = true;
+    db->documents[document].timestamp = timestamp;
+
+    search_journal_record_t record;
+    record.op = SearchJournalOperation::UpdateTimestamp;
+    record.doc = document;
+    record.number = (double)timestamp;
+    search_database_journal_append(db, record);
+    return timestamp > 0;
+}
+
+time_t search_database_document_timestamp(search_database_t* db, search_document_handle_t document)
+{
+    if (!search_database_is_document_valid(db, document))
+        return 0;
+
+    SHARED_READ_LOCK(db->mutex);
+    return db->documents[document].timestamp;
+}
+
+search_document_handle_t search_database_find_document(search_database_t* db, const char* name, size_t name_length)
+{
+    FOUNDATION_ASSERT(db);
+
+    if (name == nullptr || name_length == 0)
+        return SEARCH_DOCUMENT_INVALID_ID;
+
+    SHARED_READ_LOCK(db->mutex);
+    for (unsigned doc_index = 1, end = array_size(db->documents); doc_index < end; ++doc_index)
+    {
+        search_document_t& doc = db->documents[doc_index];
+        if (string_equal_nocase(STRING_ARGS(doc.name), name, name_length))
+            return doc_index;
+    }
+
+    return SEARCH_DOCUMENT_INVALID_ID;
+}
+
+search_document_handle_t search_database_add_document(search_database_t* db, const char* name, size_t name_length)
+{
+    FOUNDATION_ASSERT(db);
+    FOUNDATION_ASSERT(name && name_length > 0);
+    
+    search_document_t document{};
+    document.type = SearchDocumentType::Default;
+    document.name = string_clone(name, name_length);
+    document.timestamp = time_now();
+
+    search_database_journal_scope_t journal_scope(db);
+    SHARED_WRITE_LOCK(db->mutex);
+
+    // Find removed slot if any
+    search_document_handle_t doc_index = SEARCH_DOCUMENT_INVALID_ID;
+    for (unsigned i = 1, end = array_size(db->documents); i < end; ++i)
+    {
+        search_document_t& doc = db->documents[i];
+        if (doc.type == SearchDocumentType::Removed)
+        {
+            doc = document;
+            doc_index = i;
+            break;
+        }
+    }
+
+    if (doc_index == SEARCH_DOCUMENT_INVALID_ID)
+    {
+        array_push_memcpy(db->documents, &document);
+        doc_index = array_size(db->documents) - 1;
+    }
+
+    db->dirty = true;
+    db->document_count++;
+
+    // Journal records are appended while the database is locked, so removed slots get reused in the same order when replayed.
+    search_journal_record_t record;
+    record.op = SearchJournalOperation::AddDocument;
+    record.doc = doc_index;
+    record.name = string_to_const(document.name);
+    record.number = (double)document.timestamp;
+    search_database_journal_append(db, record);
+    return doc_index;
+}
+
+search_document_handle_t search_database_get_or_add_document(search_database_t* db, const char* name, size_t name_length)
+{
+    FOUNDATION_ASSERT(db);
+    FOUNDATION_ASSERT(name && name_length > 0);
+
+    search_document_handle_t doc = search_database_find_document(db, name, name_length);
+    if (doc == SEARCH_DOCUMENT_INVALID_ID)
+        doc = search_database_add_document(db, name, name_length);
+    return doc;
+}
+
+bool search_database_index_text(search_database_t* db, search_document_handle_t doc, const char* text, size_t text_length, bool include_variations /*= true*/)
+{
+    if (text == nullptr || text_length == 0)
+        return false;
+        
+    if (!search_database_is_document_valid(db, doc))
+        return false;
+        
+    search_database_journal_scope_t journal_scope(db);
+    SearchIndexingFlags flags = search_database_case_indexing_flag(db) | SearchIndexingFlags::RemovePonctuations;
+    if (include_variations)
+        flags |= SearchIndexingFlags::Variations;
+    uint32_t word_count = 0;
+    string_const_t expression, r = search_database_clean_up_text(text, text_length);
+    do
+    {
+        // Split words by space
+        string_split(STRING_ARGS(r), STRING_CONST(","), &expression, &r, false);
+        if (expression.length)
+        {
+            // Split words by double colon
+            string_const_t kvp, rr = search_database_clean_up_text(STRING_ARGS(expression));
+            do
+            {
+                // Split words by :
+                string_split(STRING_ARGS(rr), STRING_CONST(":"), &kvp, &rr, false);
+                if (kvp.length)
+                {
+                    // Split words by space
+                    string_const_t word, rrr = search_database_clean_up_text(STRING_ARGS(kvp));
+                    do
+                    {
+                        // Split words by :
+                        string_split(STRING_ARGS(rrr), STRING_CONST(" "), &word, &rrr, false);
+                        if (word.length && search_database_index_word(db, doc, STRING_ARGS(word), flags))
+                            word_count++;
+                    } while (rrr.length > 0);
+                }
+            } while (rr.length > 0);
+        }
+    } while (r.length > 0);
+
+    search_database_add_document_length(db, doc, word_count);
+
+    search_journal_record_t record;
+    record.op = SearchJournalOperation::IndexText;
+    record.doc = doc;
+    record.name = string_const(text, text_length);
+    record.flag = include_variations;
+    search_database_journal_append(db, record);
+    return true;
+}
+
+bool search_database_index_exact_match(search_database_t* db, search_document_handle_t document, const char* _word, size_t _word_length, bool case_sensitive /*= false*/)
+{
+    FOUNDATION_ASSERT(db);
+
+    if (!_word || _word_length == 0)
+        return false;
+    
+    if (!search_database_is_document_valid(db, document))
+        return false;
+
+    const search_indexing_flags_t flags = case_sensitive ? SearchIndexingFlags::None : SearchIndexingFlags::Lowercase;
+    string_const_t word = search_database_format_word(_word, _word_length, flags);
+    
+    const int32_t score = INT_MIN + to_int(word.length);
+    search_database_journal_scope_t journal_scope(db);
+    if (search_database_insert_word_index(db, document, STRING_ARGS(word), score, false) < 0)
+        return false;
+
+    search_journal_record_t record;
+    record.op = SearchJournalOperation::IndexExactMatch;
+    record.doc = document;
+    record.name = string_const(_word, _word_length);
+    record.flag = case_sensitive;
+    search_database_journal_append(db, record);
+    return true;
+}
+
+bool search_database_index_word(search_database_t* db, search_document_handle_t doc, const char* word, size_t word_length, bool include_variations /*= true*/)
+{
+    search_indexing_flags_t flags = search_database_case_indexing_flag(db) | SearchIndexingFlags::TrimWord;
+    if (include_variations)
+        flags |= SearchIndexingFlags::Variations;
+    search_database_journal_scope_t journal_scope(db);
+    if (!search_database_index_word(db, doc, word, word_length, flags))
+        return false;
+
+    search_database_add_document_length(db, doc, 1);
+
+    search_journal_record_t record;
+    record.op = SearchJournalOperation::IndexWord;
+    record.doc = doc;
+    record.name = string_const(word, word_length);
+    record.flag = include_variations;
+    search_database_journal_append(db, record);
+    return true;
+}
+
+uint32_t search_database_index_count(search_database_t* database)
+{
+    uint32_t count = 0;
+    for (unsigned i = 0; i < database->shard_count; ++i)
+    {
+        search_database_shard_t* shard = database->shards[i];
+        SHARED_READ_LOCK(shard->mutex);
+        count += array_size(shard->indexes);
+    }
+    return count;
+}
+
+uint32_t search_database_document_count(search_database_t* database)
+{
+    return database->document_count;
+}
+
+string_const_t search_database_document_name(search_database_t* database, search_document_handle_t document)
+{
+    if (!search_database_is_document_valid(database, document))
+        return string_null();
+
+    SHARED_READ_LOCK(database->mutex);
+    return string_to_const(database->documents[document].name);
+}
+
+uint32_t search_database_word_document_count(search_database_t* db, const char* _word, size_t _word_length, bool include_variations /*= false*/)
+{    
+    string_const_t word = search_database_format_word(_word, _word_length, search_database_case_indexing_flag(db) | SearchIndexingFlags::TrimWord);
+    search_index_key_t key{ SearchIndexType::Word };
+    key.hash = string_hash(STRING_ARGS(word));
+
+    uint32_t count = 0;
+    {
+        search_database_shard_t* shard = search_database_select_shard(db, STRING_ARGS(word));
+        SHARED_READ_LOCK(shard->mutex);
+        key.crc = string_table_find_symbol(shard->strings, STRING_ARGS(word));
+        const int index = (int64_t)key.crc > 0 ? search_database_find_index(shard, key) : -1;
+        if (index >= 0)
+            count = shard->indexes[index].document_count;
+    }
+
+    if (include_variations && word.length >= 3)
+    {
+        // Count the documents of all the words starting with the word only once.
+        search_document_handle_t* docs = nullptr;
+        for (unsigned i = 0; i < db->shard_count; ++i)
+        {
+            search_database_shard_t* shard = db->shards[i];
+            SHARED_READ_LOCK(shard->mutex);
+            search_database_lexicon_for_each(shard, STRING_ARGS(word), [&docs](const search_index_t& index)
+            {
+                search_database_index_copy_documents(index, docs);
+            });
+        }
+
+        if (docs)
+        {
+            std::sort(docs, docs + array_size(docs));
+            count += (uint32_t)(std::unique(docs, docs + array_size(docs)) - docs);
+            array_deallocate(docs);
+        }
+    }
+
+    return count;
+}
+
+bool search_database_index_property(search_database_t* db, search_document_handle_t doc, const char* name, size_t name_length, double value)
+{
+    if (!search_database_is_document_valid(db, doc))
+        return false;
+        
+    const SearchIndexingFlags flags = search_database_case_indexing_flag(db);
+    string_const_t property_name = search_database_format_word(name, name_length, flags);
+
+    search_database_journal_scope_t journal_scope(db);
+    {
+        // Property indexes are routed using the property name, so the range of a property stays in a single shard.
+        search_database_shard_t* shard = search_database_select_shard(db, STRING_ARGS(property_name));
+        SHARED_WRITE_LOCK(shard->mutex);
+        search_database_promote_nolock(db, shard);
+
+        search_index_key_t key;
+        key.type = SearchIndexType::Number;
+        key.crc = search_database_string_to_symbol(shard->strings, STRING_ARGS(property_name));
+        key.score = -to_int(name_length);
+        key.number = value;
+
+        if (search_database_insert_index_nolock(db, shard, doc, key) < 0)
+            return false;
+    }
+
+    search_journal_record_t record;
+    record.op = SearchJournalOperation::IndexNumber;
+    record.doc = doc;
+    record.name = string_const(name, name_length);
+    record.number = value;
+    search_database_journal_append(db, record);
+    return true;
+}
+
+bool search_database_index_property(
+    search_database_t* db, search_document_handle_t doc, 
+    const char* name, size_t name_length, 
+    const char* value, size_t value_length,
+    bool include_variations /*= true*/)
+{
+    FOUNDATION_ASSERT(name && name_length > 0);
+    
+    const SearchIndexingFlags flags = search_database_case_indexing_flag(db) | SearchIndexingFlags::TrimWord;
+    if (value_length == 0 || (value_length >= 3 && search_database_skip_word(value, value_length, flags)))
+        return false;
+    
+    if (!search_database_is_document_valid(db, doc))
+        return false;
+        
+    search_database_journal_scope_t journal_scope(db);
+    {
+        string_const_t property_name = search_database_format_word(name, name_length, flags);
+        search_database_shard_t* shard = search_database_select_shard(db, STRING_ARGS(property_name));
+        SHARED_WRITE_LOCK(shard->mutex);
+        search_database_promote_nolock(db, shard);
+
+        search_index_key_t key;
+        key.type = SearchIndexType::Property;
+        key.score = to_int(value_length);
+        key.crc = search_database_string_to_symbol(shard->strings, STRING_ARGS(property_name));
+
+        string_const_t property_value = search_database_format_word(value, value_length, flags);
+        key.hash = search_database_string_to_symbol(shard->strings, STRING_ARGS(property_value));
+
+        search_database_insert_index_nolock(db, shard, doc, key);
+
+        if (include_variations)
+        {
+            property_value.length--;        
+            for (; property_value.length > 2; --property_value.length, ++key.score)
+            {
+                // Skip spaces at the end
+                if (property_value.str[property_value.length - 1] == ' ')
+                    continue;
+                key.hash = search_database_string_to_symbol(shard->strings, property_value.str, property_value.length);
+                search_database_insert_index_nolock(db, shard, doc, key);
+            }
+        }
+
+        // TODO: Add support to split property text value with spaces and index each word as a property variation
+    }
+
+    search_journal_record_t record;
+    record.op = SearchJournalOperation::IndexProperty;
+    record.doc = doc;
+    record.name = string_const(name, name_length);
+    record.value = string_const(value, value_length);
+    record.flag = include_variations;
+    search_database_journal_append(db, record);
+    return true;
+}
+
+uint32_t search_database_word_count(search_database_t* database)
+{
+    uint32_t count = 0;
+    for (unsigned i = 0; i < database->shard_count; ++i)
+    {
+        search_database_shard_t* shard = database->shards[i];
+        SHARED_READ_LOCK(shard->mutex);
+        count += shard->strings->count;
+    }
+    return count;
+}
+
+bool search_database_contains_word(search_database_t* db, const char* word, size_t word_length)
+{
+    FOUNDATION_ASSERT(db);
+
+    if (word == nullptr || word_length == 0)
+        return false;
+
+    // Property values are stored in the shard of their property name, so we need to look in all shards.
+    string_const_t formatted_word = search_database_format_word(word, word_length, search_database_case_indexing_flag(db));
+    for (unsigned i = 0; i < db->shard_count; ++i)
+    {
+        search_database_shard_t* shard = db->shards[i];
+        SHARED_READ_LOCK(shard->mutex);
+        if (string_table_find_symbol(shard->strings, STRING_ARGS(formatted_word)) > 0)
+            return true;
+    }
+    return false;
+}
+
+bool search_database_is_document_valid(search_database_t* database, search_document_handle_t document)
+{
+    FOUNDATION_ASSERT(database);
+
+    if (document == 0)
+        return false; // User cannot access root document
+
+    if (document >= array_size(database->documents))
+        return false;
+
+    SHARED_READ_LOCK(database->mutex);
+    return (database->documents[document].type == SearchDocumentType::Default);
+}
+
+FOUNDATION_FORCEINLINE search_document_handle_t search_database_get_indexed_document(const search_index_t& idx, uint32_t element_at)
+{
+    FOUNDATION_ASSERT(idx.document_count > 0 && element_at < idx.document_count);
+
+    if (idx.packed)
+    {
+        search_document_handle_t block_docs[SEARCH_POSTING_BLOCK_SIZE];
+        search_database_posting_decode_block(idx, element_at / SEARCH_POSTING_BLOCK_SIZE, block_docs);
+        return block_docs[element_at % SEARCH_POSTING_BLOCK_SIZE];
+    }
+        
+    if (idx.document_count <= ARRAY_COUNT(idx.docs))
+        return idx.docs[element_at];
+
+    return idx.docs_list[element_at];
+}
+
+FOUNDATION_FORCEINLINE const search_document_handle_t* search_database_index_documents(const search_index_t& idx)
+{
+    FOUNDATION_ASSERT(!idx.packed);
+    if (idx.document_count <= ARRAY_COUNT(idx.docs))
+        return idx.docs;
+    return idx.docs_list;
+}
+
+FOUNDATION_FORCEINLINE hash_t search_database_result_id(const search_result_t& result)
+{
+    return result.id;
+}
+
+FOUNDATION_FORCEINLINE hash_t search_database_result_id(const search_document_handle_t& doc)
+{
+    return doc;
+}
+
+/*! Returns the index of the first element of the sorted range [from, count) which is not less than #id.
+ *  We gallop (exponential search) from #from, then binary search the last interval, 
+ *  so intersecting a small list with a large one skips most of the large list.
+ */
+template<typename T>
+FOUNDATION_STATIC uint32_t search_database_gallop(const T* sorted, uint32_t from, uint32_t count, hash_t id)
+{
+    if (from >= count || search_database_result_id(sorted[from]) >= id)
+        return from;
+
+    uint32_t lo = from, step = 1;
+    uint32_t hi = from + step;
+    while (hi < count && search_database_result_id(sorted[hi]) < id)
+    {
+        lo = hi;
+        step <<= 1;
+        hi = from + step;
+    }
+
+    if (hi > count)
+        hi = count;
+
+    // sorted[lo] < id <= sorted[hi]
+    ++lo;
+    while (lo < hi)
+    {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if (search_database_result_id(sorted[mid]) < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/*! Sort results by document id and merge duplicates by keeping their best score. */
+FOUNDATION_STATIC search_result_t* search_database_sort_results(search_result_t*& results)
+{
+    const uint32_t count = array_size(results);
+    if (count < 2)
+        return results;
+
+    const auto less_by_id = [](const search_result_t& a, const search_result_t& b) { return a.id < b.id; };
+    if (!std::is_sorted(results, results + count, less_by_id))
+        std::sort(results, results + count, less_by_id);
+
+    uint32_t w = 0;
+    for (uint32_t r = 1; r < count; ++r)
+    {
+        if (results[r].id == results[w].id)
+            results[w].score = min(results[w].score, results[r].score);
+        else
+            results[++w] = results[r];
+    }
+    array_resize(results, w + 1);
+    return results;
+}
+
+/*! Append the #docs that are also in the #and_set to #results. */
+FOUNDATION_STATIC search_result_t* search_database_intersect_documents(
+    const search_document_handle_t* docs, uint32_t doc_count, 
+    const search_result_t* and_set, uint32_t and_count, 
+    int32_t score, search_result_t*& results)
+{
+    search_result_t entry;
+    entry.score = score;
+
+    // Both lists are sorted, so we walk the smallest one and gallop in the largest one.
+    if (doc_count <= and_count)
+    {
+        for (uint32_t i = 0, j = 0; i < doc_count; ++i)
+        {
+            j = search_database_gallop(and_set, j, and_count, docs[i]);
+            if (j >= and_count)
+                break;
+            if (and_set[j].id == docs[i])
+            {
+                entry.id = docs[i];
+                array_push_memcpy(results, &entry);
+            }
+        }
+    }
+    else
+    {
+        for (uint32_t i = 0, j = 0; j < and_count; ++j)
+        {
+            i = search_database_gallop(docs, i, doc_count, and_set[j].id);
+            if (i >= doc_count)
+                break;
+            if (docs[i] == and_set[j].id)
+            {
+                entry.id = docs[i];
+                array_push_memcpy(results, &entry);
+            }
+        }
+    }
+
+    return results;
+}
+
+FOUNDATION_STATIC search_result_t* search_database_get_packed_index_document_results(const search_index_t& idx, const search_result_t* and_set, search_result_t*& results)
+{
+    search_result_t entry;
+    entry.score = idx.key.score;
+
+    search_document_handle_t block_docs[SEARCH_POSTING_BLOCK_SIZE];
+    const uint32_t block_count = search_database_posting_block_count(idx.document_count);
+    if (and_set == nullptr)
+    {
+        array_reserve(results, array_size(results) + idx.document_count);
+        for (uint32_t b = 0; b < block_count; ++b)
+        {
+            const uint32_t count = search_database_posting_decode_block(idx, b, block_docs);
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                entry.id = block_docs[i];
+                array_push_memcpy(results, &entry);
+            }
+        }
+        return results;
+    }
+
+    // Use the block skip entries to only decode blocks that can intersect with the #and_set.
+    const uint32_t and_count = array_size(and_set);
+    const search_posting_skip_t* skips = (const search_posting_skip_t*)search_database_index_packed_data(idx);
+    for (uint32_t b = 0, j = 0; b < block_count; ++b)
+    {
+        j = search_database_gallop(and_set, j, and_count, skips[b].first_doc);
+        if (j >= and_count)
+            break;
+
+        if (b + 1 < block_count && and_set[j].id >= skips[b + 1].first_doc)
+            continue;
+
+        const uint32_t count = search_database_posting_decode_block(idx, b, block_docs);
+        search_database_intersect_documents(block_docs, count, and_set + j, and_count - j, idx.key.score, results);
+    }
+
+    return results;
+}
+
+/*! Append the index documents that are also in the #and_set to #results.
+ * 
+ *  @remark Appended results are sorted for a single index, but when gathering the 
+ *          results of many indexes, #search_database_sort_results must be called after.
+ */
+FOUNDATION_STATIC search_result_t* search_database_get_index_document_results(const search_index_t& idx, const search_result_t* and_set, search_result_t*& results)
+{
+    if (idx.packed)
+        return search_database_get_packed_index_document_results(idx, and_set, results);
+
+    const search_document_handle_t* docs = search_database_index_documents(idx);
+    const uint32_t doc_count = idx.document_count;
+    if (and_set == nullptr)
+    {
+        search_result_t entry;
+        entry.score = idx.key.score;
+        array_reserve(results, array_size(results) + doc_count);
+        for (uint32_t i = 0; i < doc_count; ++i)
+        {
+            entry.id = docs[i];
+            array_push_memcpy(results, &entry);
+        }
+        return results;
+    }
+
+    return search_database_intersect_documents(docs, doc_count, and_set, array_size(and_set), idx.key.score, results);
+}
+
+FOUNDATION_STATIC search_result_t* search_database_get_key_document_results(const search_database_shard_t* shard, const search_index_key_t& key, const search_result_t* and_set, search_result_t*& results)
+{
+    int index = search_database_find_index(shard, key);
+    if (index < 0)
+        return nullptr;
+     
+    const search_index_t& idx = shard->indexes[index];
+    return search_database_get_index_document_results(idx, and_set, results);
+}
+
+FOUNDATION_STATIC search_result_t* search_database_exclude_documents(search_database_t* db, search_result_t*& results)
+{
+    // This operation is costly as we have to execute the query and then iterate over ALL the documents to exclude those found.
+    // Document handles are their index, so we walk the documents and the sorted excluded set together.
+    SHARED_READ_LOCK(db->mutex);
+    search_result_t* included_set = nullptr;
+    const search_result_t* excluded_set = results;
+    const uint32_t excluded_count = array_size(excluded_set);
+    array_reserve(included_set, db->document_count > excluded_count ? db->document_count - excluded_count : 1);
+
+    uint32_t j = 0;
+    foreach(d, db->documents)
+    {
+        if (d->type != SearchDocumentType::Default)
+            continue;
+
+        const auto docid = (search_document_handle_t)i;
+        while (j < excluded_count && excluded_set[j].id < docid)
+            ++j;
+        if (j < excluded_count && excluded_set[j].id == docid)
+            continue;
+
+        search_result_t entry;
+        entry.id = docid;
+        entry.score = 0;
+        array_push_memcpy(included_set, &entry);
+    }
+
+    array_deallocate(excluded_set);
+    results = included_set;
+    return included_set;
+}
+
+FOUNDATION_FORCEINLINE bool search_database_rank_results(search_database_t* db)
+{
+    return any(db->options, SearchDatabaseFlags::RankResults);
+}
+
+/*! Score with BM25 the results appended from #idx since #offset.
+ * 
+ *  @remark The database must be read locked to access the document lengths and the shard must be locked.
+ * 
+ *  @param weight Factor applied to the word score, i.e. to lower the score of words only matched by their prefix.
+ */
+FOUNDATION_STATIC void search_database_rank_index_results(
+    const search_database_t* db, const search_database_shard_t* shard, const search_index_t& idx, 
+    search_result_t* results, uint32_t offset, double weight)
+{
+    const uint32_t end = array_size(results);
+    if (offset >= end)
+        return;
+
+    // Rare words are worth more than common ones
+    const double document_count = (double)max(db->document_count, idx.document_count);
+    const double matched_count = (double)idx.document_count;
+    const double idf = math_logn((real)(1.0 + (document_count - matched_count + 0.5) / (matched_count + 0.5)));
+    const double average_length = db->document_count > 0 ? (double)db->document_length_total / (double)db->document_count : 0;
+
+    // Results appended for a single index are sorted by document, so we walk their term frequencies along.
+    const search_term_frequency_t* frequencies = shard->frequencies;
+    const uint32_t frequency_count = array_size(frequencies);
+    const hash_t hash = idx.key.hash;
+    uint32_t f = search_database_term_frequency_lower_bound(frequencies, hash, (search_document_handle_t)results[offset].id);
+    for (uint32_t r = offset; r < end; ++r)
+    {
+        const search_document_handle_t doc = (search_document_handle_t)results[r].id;
+        while (f < frequency_count && frequencies[f].hash == hash && frequencies[f].doc < doc)
+            ++f;
+
+        double tf = 1.0;
+        if (f < frequency_count && frequencies[f].hash == hash && frequencies[f].doc == doc)
+            tf = (double)frequencies[f].count;
+
+        // Matches in long documents are worth less than in short ones
+        const double length_ratio = average_length > 0 ? (double)db->documents[doc].length / average_length : 1.0;
+        const double norm = SEARCH_RANK_BM25_K1 * (1.0 - SEARCH_RANK_BM25_B + SEARCH_RANK_BM25_B * length_ratio);
+        const double score = weight * idf * tf * (SEARCH_RANK_BM25_K1 + 1.0) / (tf + norm);
+        results[r].score = min(-1, -(int32_t)math_round((real)(score * SEARCH_RANK_SCORE_SCALE)));
+    }
+}
+
+/*! Add the scores of the #and_set to the ranked #results, so documents matching many words rank higher.
+ * 
+ *  @param filter If true, the results do not have a relevance score of their own, i.e. property matches.
+ */
+FOUNDATION_STATIC search_result_t* search_database_rank_and_results(search_result_t* results, const search_result_t* and_set, bool filter)
+{
+    const uint32_t count = array_size(results);
+    const uint32_t and_count = array_size(and_set);
+    for (uint32_t r = 0, j = 0; r < count; ++r)
+    {
+        int32_t score = filter ? 0 : results[r].score;
+        if (and_set)
+        {
+            j = search_database_gallop(and_set, j, and_count, results[r].id);
+            if (j < and_count && and_set[j].id == results[r].id)
+                score += and_set[j].score;
+        }
+        results[r].score = score;
+    }
+
+    return results;
+}
+
+FOUNDATION_STATIC search_result_t* search_database_query_property_number(
+    const search_database_shard_t* shard, 
+    search_query_eval_flags_t eval_flags, const search_index_key_t& key, 
+    search_result_t* and_set, search_result_t*& results)
+{
+    // We expect the shard to already be locked
+    FOUNDATION_ASSERT(shard->mutex.locked());
+
+    // Values of the property are sorted, so the matching range is found with two binary searches.
+    const search_number_entry_t* numbers = shard->numbers;
+    const uint32_t number_count = array_size(numbers);
+    uint32_t first = search_database_number_lower_bound(numbers, number_count, key.crc, -INFINITY);
+    uint32_t last = search_database_number_upper_bound(numbers, number_count, key.crc, INFINITY);
+
+    if (test(eval_flags, SearchQueryEvalFlags::OpLess))
+        last = search_database_number_lower_bound(numbers, number_count, key.crc, key.number);
+    else if (test(eval_flags, SearchQueryEvalFlags::OpLessEq))
+        last = search_database_number_upper_bound(numbers, number_count, key.crc, key.number);
+    else if (test(eval_flags, SearchQueryEvalFlags::OpGreater))
+        first = search_database_number_upper_bound(numbers, number_count, key.crc, key.number);
+    else if (test(eval_flags, SearchQueryEvalFlags::OpGreaterEq))
+        first = search_database_number_lower_bound(numbers, number_count, key.crc, key.number);
+    else
+    {
+        FOUNDATION_ASSERT_FAIL("Invalid number query operator");
+        return results;
+    }
+
+    if (first >= last)
+        return results; // Nothing to be found
+
+    search_result_t entry;
+    const uint32_t and_count = array_size(and_set);
+    array_reserve(results, array_size(results) + (and_set ? min(and_count, last - first) : last - first));
+    for (uint32_t i = first; i < last; ++i)
+    {
+        const search_number_entry_t& number = numbers[i];
+        if (and_set)
+        {
+            // The slice is sorted by value, so each document is looked up in the AND set.
+            const uint32_t j = search_database_gallop(and_set, 0, and_count, number.doc);
+            if (j >= and_count || and_set[j].id != number.doc)
+                continue;
+        }
+
+        entry.id = number.doc;
+        entry.score = number.score;
+        array_push_memcpy(results, &entry);
+    }
+
+    return search_database_sort_results(results);
+}
+
+FOUNDATION_STATIC search_result_t* search_database_query_property(
+    search_database_t* db,
+    string_const_t name,
+    string_const_t value,
+    search_result_t* and_set,
+    search_query_eval_flags_t eval_flags,
+    search_indexing_flags_t indexing_flags)
+{
+    if (value.length == 0)
+        return nullptr;
+
+    search_result_t* results = nullptr;
+    search_index_key_t key{ SearchIndexType::Property };
+
+    string_const_t property_name = search_database_format_word(STRING_ARGS(name), indexing_flags);
+    search_database_shard_t* shard = search_database_select_shard(db, STRING_ARGS(property_name));
+    SHARED_READ_LOCK(shard->mutex);
+
+    key.crc = string_table_find_symbol(shard->strings, STRING_ARGS(property_name));
+    if ((int64_t)key.crc <= 0)
+        return nullptr;
+        
+    time_t date;
+    string_const_t property_value = search_database_format_word(STRING_ARGS(value), indexing_flags);
+    if (string_try_convert_number(STRING_ARGS(property_value), key.number))
+    {
+        key.type = SearchIndexType::Number;
+
+        if (none(eval_flags, SearchQueryEvalFlags::OpEqual | SearchQueryEvalFlags::OpContains))
+        {
+            return search_database_query_property_number(shard, eval_flags, key, and_set, results);
+        }
+    }
+    else if (string_try_convert_date(STRING_ARGS(property_value), date))
+    {
+        key.number = (double)date;
+        key.type = SearchIndexType::Number;
+        return search_database_query_property_number(shard, eval_flags, key, and_set, results);
+    }
+    else
+    {
+        key.hash = string_table_find_symbol(shard->strings, STRING_ARGS(property_value));
+        if ((int64_t)key.hash <= 0)
+            return nullptr;
+    }     
+        
+    return search_database_get_key_document_results(shard, key, and_set, results);
+}
+
+/*! Checks if result #a ranks before result #b, results with the same score are sorted by document id. */
+FOUNDATION_FORCEINLINE bool search_database_result_better(const search_result_t& a, const search_result_t& b)
+{
+    return a.score < b.score || (a.score == b.score && a.id < b.id);
+}
+
+/*! Keep #result if it is one of the best results, otherwise it is dropped. */
+FOUNDATION_STATIC void search_database_top_results_push(search_database_top_results_t& top, const search_result_t& result)
+{
+    const uint32_t count = array_size(top.heap);
+    if (count == top.k && !search_database_result_better(result, top.heap[0]))
+        return;
+
+    // Documents matched by many word variations keep their best score (see #search_database_sort_results).
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        if (top.heap[i].id != result.id)
+            continue;
+
+        if (result.score < top.heap[i].score)
+        {
+            top.heap[i].score = result.score;
+            std::make_heap(top.heap, top.heap + count, search_database_result_better);
+        }
+        return;
+    }
+
+    if (count < top.k)
+    {
+        array_push_memcpy(top.heap, &result);
+        std::push_heap(top.heap, top.heap + count + 1, search_database_result_better);
+    }
+    else
+    {
+        std::pop_heap(top.heap, top.heap + count, search_database_result_better);
+        top.heap[count - 1] = result;
+        std::push_heap(top.heap, top.heap + count, search_database_result_better);
+    }
+}
+
+/*! Move the scored results appended since #offset to the best results, so #results only holds the results of one index at once.
+ * 
+ *  @param and_set Results of the previous query words, their scores are added to the results (see #search_database_rank_and_results).
+ */
+FOUNDATION_STATIC void search_database_top_results_collect(
+    search_database_top_results_t& top, search_result_t*& results, uint32_t offset, const search_result_t* and_set)
+{
+    const uint32_t and_count = array_size(and_set);
+    for (uint32_t r = offset, end = array_size(results), j = 0; r < end; ++r)
+    {
+        search_result_t result = results[r];
+        if (and_set)
+        {
+            j = search_database_gallop(and_set, j, and_count, result.id);
+            if (j < and_count && and_set[j].id == result.id)
+                result.score += and_set[j].score;
+        }
+        search_database_top_results_push(top, result);
+    }
+    array_resize(results, offset);
+}
+
+/*! Evaluate a query word.
+ * 
+ *  @param top If not null, only the best results are kept, sorted by score, with the scores of the #and_set already added.
+ */
+FOUNDATION_STATIC search_result_t* search_database_query_word(
+    search_database_t* db, 
+    string_const_t value, 
+    search_result_t* and_set,
+    search_query_eval_flags_t eval_flags, 
+    search_indexing_flags_t indexing_flags,
+    search_database_top_results_t* top)
+{    
+    if (value.length < 2)
+        return nullptr;
+
+    search_result_t* results = nullptr;
+    string_const_t word = search_database_format_word(STRING_ARGS(value), indexing_flags);
+
+    search_index_key_t key{ SearchIndexType::Word };
+    key.hash = string_hash(STRING_ARGS(word));
+
+    // Ranking needs the document lengths, so the database gets locked before the shards.
+    const bool rank = search_database_rank_results(db);
+    if (rank)
+        db->mutex.shared_lock();
+
+    {
+        search_database_shard_t* shard = search_database_select_shard(db, STRING_ARGS(word));
+        SHARED_READ_LOCK(shard->mutex);
+
+        key.crc = string_table_find_symbol(shard->strings, STRING_ARGS(word));
+        const int index = (int64_t)key.crc > 0 ? search_database_find_index(shard, key) : -1;
+        if (index >= 0)
+        {
+            search_database_get_index_document_results(shard->indexes[index], and_set, results);
+            if (rank)
+                search_database_rank_index_results(db, shard, shard->indexes[index], results, 0, 1.0);
+            if (top)
+                search_database_top_results_collect(*top, results, 0, rank ? and_set : nullptr);
+        }
+    }
+
+    if (test(eval_flags, SearchQueryEvalFlags::OpContains) && any(indexing_flags, SearchIndexingFlags::Variations) && word.length >= 3)
+    {
+        // Words starting with the query word are spread in all shards. 
+        // Their documents all get the same score, which is lower than an exact match.
+        const int32_t score = -to_int(word.length) - 1;
+        for (unsigned i = 0; i < db->shard_count; ++i)
+        {
+            search_database_shard_t* shard = db->shards[i];
+            SHARED_READ_LOCK(shard->mutex);
+            search_database_lexicon_for_each(shard, STRING_ARGS(word), [db, shard, rank, word, and_set, score, top, &results](const search_index_t& index)
+            {
+                const uint32_t offset = array_size(results);
+                search_database_get_index_document_results(index, and_set, results);
+                if (rank)
+                {
+                    // Longer words only partially match the query word, so they weight less.
+                    string_const_t variation = string_table_to_string_const(shard->strings, (string_table_symbol_t)index.key.crc);
+                    search_database_rank_index_results(db, shard, index, results, offset, (double)word.length / (double)variation.length);
+                }
+                else
+                {
+                    for (uint32_t r = offset, end = array_size(results); r < end; ++r)
+                        results[r].score = score;
+                }
+
+                if (top)
+                    search_database_top_results_collect(*top, results, offset, rank ? and_set : nullptr);
+            });
+        }
+    }
+
+    if (rank)
+        db->mutex.shared_unlock();
+
+    if (top)
+    {
+        array_deallocate(results);
+        std::sort_heap(top->heap, top->heap + array_size(top->heap), search_database_result_better);
+        results = top->heap;
+        top->heap = nullptr;
+        return results;
+    }
+    
+    return search_database_sort_results(results);
+}
+
+FOUNDATION_STATIC search_result_t* search_database_handle_query_evaluation(
+    string_const_t name,
+    string_const_t value,
+    search_query_eval_flags_t eval_flags,
+    search_result_t* and_set,
+    void* user_data)
+{
+    const search_database_query_context_t* context = (const search_database_query_context_t*)user_data;
+    FOUNDATION_ASSERT(context && context->db);
+
+    // Do not bother evaluating the rest of a query that got cancelled.
+    if (context->query && atomic_load32(&context->query->cancelled, memory_order_acquire))
+        return nullptr;
+
+    search_database_t* db = context->db;
+    SearchIndexingFlags indexing_flags = search_database_case_indexing_flag(db);
+    if (any(eval_flags, SearchQueryEvalFlags::Exclude))
+        indexing_flags |= SearchIndexingFlags::Exclude;
+        
+    if (!any(db->options, SearchDatabaseFlags::DoNotIndexVariations))
+        indexing_flags |= SearchIndexingFlags::Variations;
+    
+    search_result_t* results = nullptr;
+    if (any(eval_flags, SearchQueryEvalFlags::Word))
+    {
+        if (context->top_k > 0 && any(eval_flags, SearchQueryEvalFlags::Final))
+        {
+            // Results of the last query word are the query results, so only the best ones are kept while they are scored.
+            search_database_top_results_t top{ context->top_k };
+            return search_database_query_word(db, value, and_set, eval_flags, indexing_flags, &top);
+        }
+
+        results = search_database_query_word(db, value, and_set, eval_flags, indexing_flags, nullptr);
+    }
+    else if (any(eval_flags, SearchQueryEvalFlags::Property))
+    {
+        results = search_database_query_property(db, name, value, and_set, eval_flags, indexing_flags);
+    }
+    else if (any(eval_flags, SearchQueryEvalFlags::Function))
+    {
+        log_warnf(0, WARNING_UNSUPPORTED, STRING_CONST("Function support is not supported yet"));
+        //FOUNDATION_ASSERT_FAIL("Not implemented");
+    }
+    else
+    {
+        FOUNDATION_ASSERT_FAIL("Not implemented");
+    }
+
+    if (any(eval_flags, SearchQueryEvalFlags::Exclude))
+        return search_database_exclude_documents(db, results);
+
+    if (search_database_rank_results(db))
+        return search_database_rank_and_results(results, and_set, none(eval_flags, SearchQueryEvalFlags::Word));
+
+    return results;
+}
+
+/*! Keep the #k best results, sorted by score and then by document id. 
+ * 
+ *  @remark Only needed for queries whose results are combined once scored (i.e. or, not, properties), 
+ *          the best results of other queries are already kept while they are scored.
+ */
+FOUNDATION_STATIC search_result_t* search_database_select_top_results(search_result_t*& results, uint32_t k)
+{
+    FOUNDATION_ASSERT(k > 0);
+
+    const auto better = search_database_result_better;
+
+    const uint32_t count = array_size(results);
+    if (count <= k)
+    {
+        std::sort(results, results + count, better);
+        return results;
+    }
+
+    // The k best results are kept in a heap with the worst of them on top, 
+    // so each other result only needs to be compared with it.
+    std::make_heap(results, results + k, better);
+    for (uint32_t i = k; i < count; ++i)
+    {
+        if (!better(results[i], results[0]))
+            continue;
+
+        std::pop_heap(results, results + k, better);
+        results[k - 1] = results[i];
+        std::push_heap(results, results + k, better);
+    }
+    std::sort_heap(results, results + k, better);
+
+    // Only keep the memory needed for the top results
+    search_result_t* top_results = nullptr;
+    array_resize(top_results, k);
+    memcpy(top_results, results, sizeof(search_result_t) * k);
+    array_deallocate(results);
+    results = top_results;
+    return results;
+}
+
+/*! Evaluate a search query and keep its results in the database queries.
+ * 
+ *  @param top_k If greater than 0, only the #top_k best results are kept (see #search_database_query_top_k).
+ */
+FOUNDATION_STATIC search_query_handle_t search_database_execute_query(search_database_t* db, const char* query_string, size_t query_string_length, uint32_t top_k)
+{
+    FOUNDATION_ASSERT(db);
+
+    if (query_string == nullptr || query_string_length == 0)
+        return SEARCH_QUERY_INVALID_ID;
+
+    // Create query
+    search_query_t* query = search_query_allocate(query_string, query_string_length);
+    FOUNDATION_ASSERT(query);
+    
+    try
+    {
+        search_database_query_context_t context{ db, query, top_k };
+        query->results = search_query_evaluate(query, search_database_handle_query_evaluation, &context);
+    }
+    catch (SearchQueryException ex)
+    {
+        search_query_deallocate(query);
+        throw ex;
+    }
+
+    if (top_k > 0)
+        search_database_select_top_results(query->results, top_k);
     
-    const SearchIndexingFlags flags = search_database_case_indexing_flag(db) | SearchIndexingFlags::TrimWord;
-    if (value_length == 0 || (value_length >= 3 && search_database_skip_word(value, value_length, flags)))
+    atomic_store32(&query->completed, 1, memory_order_release);
+
+    SHARED_WRITE_LOCK(db->mutex);
+    array_push(db->queries, query);
+    return (search_query_handle_t)array_size(db->queries) - 1;
+}
+
+search_query_handle_t search_database_query(search_database_t* db, const char* query_string, size_t query_string_length)
+{
+    return search_database_execute_query(db, query_string, query_string_length, 0);
+}
+
+search_query_handle_t search_database_query_top_k(search_database_t* db, const char* query_string, size_t query_string_length, uint32_t k)
+{
+    FOUNDATION_ASSERT_MSG(k > 0, "At least one result must be requested");
+    return search_database_execute_query(db, query_string, query_string_length, max(k, 1U));
+}
+
+search_query_handle_t search_database_query_async(
+    search_database_t* db, 
+    const char* query_string, size_t query_string_length, 
+    const search_query_completed_handler_t& completed /*= nullptr*/,
+    search_query_handle_t supersede /*= SEARCH_QUERY_INVALID_ID*/)
+{
+    FOUNDATION_ASSERT(db);
+
+    if (supersede != SEARCH_QUERY_INVALID_ID)
+        search_database_query_dispose(db, supersede);
+
+    if (query_string == nullptr || query_string_length == 0)
+        return SEARCH_QUERY_INVALID_ID;
+
+    // Parse the query on the calling thread so parsing errors are reported to the caller right away.
+    search_query_t* query = search_query_allocate(query_string, query_string_length);
+    FOUNDATION_ASSERT(query);
+
+    search_query_handle_t handle = SEARCH_QUERY_INVALID_ID;
+    {
+        SHARED_WRITE_LOCK(db->mutex);
+        array_push(db->queries, query);
+        handle = (search_query_handle_t)array_size(db->queries) - 1;
+    }
+
+    job_t* job = job_execute([db, query, handle, completed](payload_t*)
+    {
+        search_result_t* results = nullptr;
+        search_parser_error_t error = SearchQueryError::None;
+        if (!atomic_load32(&query->cancelled, memory_order_acquire))
+        {
+            try
+            {
+                search_database_query_context_t context{ db, query };
+                results = search_query_evaluate(query, search_database_handle_query_evaluation, &context);
+            }
+            catch (SearchQueryException ex)
+            {
+                error = ex.error;
+                log_warnf(0, WARNING_INVALID_VALUE, STRING_CONST("Failed to evaluate query %.*s: %s"), STRING_FORMAT(query->text), ex.msg);
+            }
+        }
+
+        bool cancelled = false;
+        {
+            SHARED_WRITE_LOCK(db->mutex);
+            cancelled = atomic_load32(&query->cancelled, memory_order_acquire);
+            if (cancelled)
+            {
+                // The query was disposed while we were evaluating it, so we are the last owner.
+                search_query_t* disposed_query = query;
+                array_deallocate(results);
+                search_query_deallocate(disposed_query);
+            }
+            else
+            {
+                query->results = results;
+                query->error = error;
+                atomic_store32(&query->completed, 1, memory_order_release);
+            }
+        }
+
+        if (!cancelled && completed)
+            completed(db, handle);
+
+        signal_thread();
+        return 0;
+    });
+
+    {
+        SHARED_WRITE_LOCK(db->mutex);
+
+        // Release the jobs of the queries that already completed
+        for (unsigned i = array_size(db->query_jobs); i > 0; --i)
+        {
+            if (job_completed(db->query_jobs[i - 1]))
+            {
+                job_deallocate(db->query_jobs[i - 1]);
+                array_erase_memcpy(db->query_jobs, i - 1);
+            }
+        }
+        array_push(db->query_jobs, job);
+    }
+
+    return handle;
+}
+
+bool search_database_query_is_completed(search_database_t* database, search_query_handle_t query)
+{
+    FOUNDATION_ASSERT(query > 0);
+    if (query == 0 || query >= array_size(database->queries))
+        return false;
+    SHARED_READ_LOCK(database->mutex);
+    const search_query_t* q = database->queries[query];
+    return q && atomic_load32(&q->completed, memory_order_acquire);
+}
+
+const search_result_t* search_database_query_results(search_database_t* database, search_query_handle_t query)
+{
+    FOUNDATION_ASSERT(query > 0);
+    if (query == 0 || query >= array_size(database->queries))
+        return nullptr;
+    SHARED_READ_LOCK(database->mutex);
+    const search_query_t* q = database->queries[query];
+    if (q == nullptr || !atomic_load32(&q->completed, memory_order_acquire))
+        return nullptr;
+    return q->results;
+}
+
+bool search_database_query_dispose(search_database_t* database, search_query_handle_t query)
+{
+    FOUNDATION_ASSERT(query > 0);
+    if (query == 0 || query >= array_size(database->queries))
         return false;
+    SHARED_WRITE_LOCK(database->mutex);
+    search_query_t* q = database->queries[query];
+    if (q == nullptr)
+        return false;
+
+    if (!atomic_load32(&q->completed, memory_order_acquire))
+    {
+        // Let the evaluation job release the query once it exits.
+        atomic_store32(&q->cancelled, 1, memory_order_release);
+        database->queries[query] = nullptr;
+        return true;
+    }
     
-    if (!search_database_is_document_valid(db, doc))
+    search_query_deallocate(database->queries[query]);
+    return database->queries[query] == nullptr;
+}
+
+FOUNDATION_STATIC void search_database_stream_align(stream_t* stream, size_t alignment)
+{
+    static const uint8_t zeros[8]{};
+    FOUNDATION_ASSERT(alignment <= sizeof(zeros));
+
+    const size_t offset = stream_tell(stream);
+    const size_t padding = math_align_up(offset, alignment) - offset;
+    if (padding == 0)
+        return;
+        
+    if (stream->mode & STREAM_OUT)
+        stream_write(stream, zeros, padding);
+    else
+        stream_seek(stream, padding, STREAM_SEEK_CURRENT);
+}
+
+/*! Write an array preceded by its array header, so it can be used in place once the file is mapped in memory. */
+template<typename T>
+FOUNDATION_STATIC void search_database_write_array(stream_t* stream, const T* arr)
+{
+    const uint32_t count = array_size(arr);
+    search_database_stream_align(stream, 8);
+    stream_write_uint32(stream, count);
+
+    uint32_t array_header[_array_header_size] = { 0 };
+    if (arr)
+        memcpy(array_header, _array_raw_const(arr), sizeof(array_header));
+    array_header[0] = array_header[1] = count;
+    stream_write(stream, array_header, sizeof(array_header));
+    stream_write(stream, arr, sizeof(T) * count);
+}
+
+/*! Read an array saved with #search_database_write_array.
+ * 
+ *  @param mapped_data If the stream reads a mapped file, the array is used in place instead of being copied on the heap.
+ */
+template<typename T>
+FOUNDATION_STATIC bool search_database_read_array(stream_t* stream, void* mapped_data, size_t mapped_size, T*& arr)
+{
+    search_database_stream_align(stream, 8);
+    const uint32_t count = stream_read_uint32(stream);
+    uint32_t array_header[_array_header_size];
+    stream_read(stream, array_header, sizeof(array_header));
+    FOUNDATION_ASSERT(count == 0 || (array_header[1] == count && array_header[3] == sizeof(T)));
+
+    arr = nullptr;
+    const size_t offset = stream_tell(stream);
+    if (mapped_data)
+    {
+        if (offset + sizeof(T) * count > mapped_size)
+            return false;
+
+        if (count > 0)
+            arr = (T*)pointer_offset(mapped_data, offset);
+        stream_seek(stream, offset + sizeof(T) * count, STREAM_SEEK_BEGIN);
+    }
+    else
+    {
+        array_resize(arr, count);
+        stream_read(stream, arr, sizeof(T) * count);
+    }
+
+    return true;
+}
+
+/*! Shard string table and indexes read by #search_database_read_shard */
+struct search_database_shard_data_t
+{
+    string_table_t*        strings{ nullptr };
+    search_index_t*        indexes{ nullptr };
+    string_table_symbol_t* words{ nullptr };
+    search_term_frequency_t* frequencies{ nullptr };
+    search_number_entry_t* numbers{ nullptr };
+};
+
+FOUNDATION_STATIC void search_database_deallocate_shard_data(search_database_shard_data_t*& shards, bool mapped)
+{
+    for (unsigned i = 0, end = array_size(shards); i < end && !mapped; ++i)
+    {
+        search_database_deallocate_indexes(shards[i].indexes);
+        string_table_deallocate(shards[i].strings);
+        array_deallocate(shards[i].words);
+        array_deallocate(shards[i].frequencies);
+        array_deallocate(shards[i].numbers);
+    }
+    array_deallocate(shards);
+}
+
+/*! Read the string table and the indexes of a shard saved with #search_database_write_shard.
+ * 
+ *  @param mapped_data If the stream reads a mapped file, the string table, the indexes and 
+ *                     the posting lists are used in place instead of being copied on the heap.
+ */
+FOUNDATION_STATIC bool search_database_read_shard(
+    search_database_t* db, stream_t* stream, 
+    void* mapped_data, size_t mapped_size, 
+    search_database_shard_data_t& shard)
+{
+    // Read string table
+    search_database_stream_align(stream, 8);
+    string_table_t* strings = nullptr;
+    int32_t string_count = stream_read_int32(stream);
+    uint64_t average_string_length = stream_read_uint64(stream);
+    uint64_t allocated_bytes = stream_read_uint64(stream);
+    search_database_stream_align(stream, 8);
+
+    if (mapped_data)
+    {
+        if (stream_tell(stream) + allocated_bytes > mapped_size)
+            return false;
+
+        strings = (string_table_t*)pointer_offset(mapped_data, stream_tell(stream));
+        stream_seek(stream, allocated_bytes, STREAM_SEEK_CURRENT);
+    }
+    else
+    {
+        strings = (string_table_t*)memory_allocate(0, allocated_bytes, 8, MEMORY_PERSISTENT);
+        FOUNDATION_ASSERT(strings);
+    
+        stream_read(stream, strings, allocated_bytes);
+        strings->free_slots = nullptr;
+    }
+    FOUNDATION_ASSERT(strings->count == string_count);
+    FOUNDATION_ASSERT(strings->allocated_bytes == allocated_bytes);
+    FOUNDATION_ASSERT(string_table_average_string_length(strings) == average_string_length);
+
+    // Read indexes, which are preceded by an array header so they can be used in place as a regular array.
+    search_database_stream_align(stream, 8);
+    const uint32_t index_count = stream_read_uint32(stream);
+    const uint32_t postings_size = stream_read_uint32(stream);
+    uint32_t array_header[_array_header_size];
+    stream_read(stream, array_header, sizeof(array_header));
+    FOUNDATION_ASSERT(index_count == 0 || (array_header[1] == index_count && array_header[3] == sizeof(search_index_t)));
+
+    search_index_t* indexes = nullptr;
+    const size_t indexes_offset = stream_tell(stream);
+    const size_t postings_offset = indexes_offset + sizeof(search_index_t) * index_count;
+    if (mapped_data)
+    {
+        if (postings_offset + postings_size > mapped_size)
+            return false;
+
+        if (index_count > 0)
+            indexes = (search_index_t*)pointer_offset(mapped_data, indexes_offset);
+        stream_seek(stream, postings_offset + postings_size, STREAM_SEEK_BEGIN);
+    }
+    else
+    {
+        array_resize(indexes, index_count);
+        stream_read(stream, indexes, sizeof(search_index_t) * index_count);
+
+        uint8_t* postings = nullptr;
+        array_resize(postings, postings_size);
+        stream_read(stream, postings, postings_size);
+
+        // Move saved posting lists to the heap
+        const bool compress = search_database_compress_posting_lists(db);
+        for (uint32_t i = 0; i < index_count; ++i)
+        {
+            search_index_t* index = indexes + i;
+            if (!index->mapped)
+                continue;
+
+            const size_t offset = indexes_offset + sizeof(search_index_t) * i + index->docs_mapped.offset - postings_offset;
+            const uint32_t packed_size = index->docs_mapped.size;
+            FOUNDATION_ASSERT(offset + packed_size <= postings_size);
+
+            index->mapped = false;
+            index->docs_packed = nullptr;
+            array_resize(index->docs_packed, packed_size);
+            memcpy(index->docs_packed, postings + offset, packed_size);
+            if (!compress)
+            {
+                search_document_handle_t* docs = nullptr;
+                search_database_index_copy_documents(*index, docs);
+                array_deallocate(index->docs_packed);
+                index->docs_list = docs;
+                index->packed = false;
+            }
+        }
+        array_deallocate(postings);
+    }
+
+    // Read the lexicon, the term frequencies and the numeric values, which are also preceded by an array header.
+    string_table_symbol_t* words = nullptr;
+    search_term_frequency_t* frequencies = nullptr;
+    search_number_entry_t* numbers = nullptr;
+    if (!search_database_read_array(stream, mapped_data, mapped_size, words) ||
+        !search_database_read_array(stream, mapped_data, mapped_size, frequencies) ||
+        !search_database_read_array(stream, mapped_data, mapped_size, numbers))
+    {
+        return false;
+    }
+
+    shard.strings = strings;
+    shard.indexes = indexes;
+    shard.words = words;
+    shard.frequencies = frequencies;
+    shard.numbers = numbers;
+    return true;
+}
+
+/*! Redistribute the indexes of a database saved with a different number of shards.
+ * 
+ *  Index keys hold symbols of their shard string table, so they get rebuilt with the 
+ *  string table of their new shard. The new shards are always allocated on the heap.
+ */
+FOUNDATION_STATIC search_database_shard_data_t* search_database_reshard(search_database_t* db, const search_database_shard_data_t* source_shards)
+{
+    TIME_TRACKER("Reshard search database (%u -> %u shards)", array_size(source_shards), db->shard_count);
+
+    search_database_shard_data_t* shards = nullptr;
+    array_resize(shards, db->shard_count);
+    for (uint32_t i = 0; i < db->shard_count; ++i)
+    {
+        shards[i].strings = string_table_allocate(1024, 10);
+        shards[i].indexes = nullptr;
+        shards[i].words = nullptr;
+        shards[i].frequencies = nullptr;
+        shards[i].numbers = nullptr;
+    }
+
+    const bool compress = search_database_compress_posting_lists(db);
+    search_document_handle_t* docs = nullptr;
+    foreach(source, source_shards)
+    {
+        for (unsigned j = 0, end = array_size(source->indexes); j < end; ++j)
+        {
+            const search_index_t& source_index = source->indexes[j];
+            
+            // Keys are routed with the word or the property name of their crc symbol
+            string_const_t name = string_table_to_string_const(source->strings, (string_table_symbol_t)source_index.key.crc);
+            search_database_shard_data_t& shard = shards[search_database_shard_index(db->shard_count, STRING_ARGS(name))];
+
+            search_index_t index{ source_index.key };
+            index.key.crc = search_database_string_to_symbol(shard.strings, STRING_ARGS(name));
+            if (index.key.type == SearchIndexType::Property)
+            {
+                string_const_t value = string_table_to_string_const(source->strings, (string_table_symbol_t)source_index.key.hash);
+                index.key.hash = search_database_string_to_symbol(shard.strings, STRING_ARGS(value));
+            }
+
+            array_clear(docs);
+            search_database_index_copy_documents(source_index, docs);
+            search_database_index_set_documents(index, docs, array_size(docs), compress);
+            array_push_memcpy(shard.indexes, &index);
+
+            // Numeric values are rebuilt from the number indexes since their property symbol changed
+            if (index.key.type == SearchIndexType::Number)
+            {
+                search_number_entry_t entry;
+                entry.crc = index.key.crc;
+                entry.number = index.key.number;
+                entry.score = index.key.score;
+                for (unsigned k = 0, count = array_size(docs); k < count; ++k)
+                {
+                    entry.doc = docs[k];
+                    array_push_memcpy(shard.numbers, &entry);
+                }
+            }
+        }
+
+        for (unsigned j = 0, end = array_size(source->words); j < end; ++j)
+        {
+            string_const_t word = string_table_to_string_const(source->strings, source->words[j]);
+            search_database_shard_data_t& shard = shards[search_database_shard_index(db->shard_count, STRING_ARGS(word))];
+            const string_table_symbol_t symbol = (string_table_symbol_t)search_database_string_to_symbol(shard.strings, STRING_ARGS(word));
+            array_push(shard.words, symbol);
+        }
+
+        // Term frequencies are keyed by the word hash, which is also used to route the word (see #search_database_shard_index)
+        for (unsigned j = 0, end = array_size(source->frequencies); j < end; ++j)
+        {
+            const search_term_frequency_t& frequency = source->frequencies[j];
+            search_database_shard_data_t& shard = shards[db->shard_count > 1 ? (uint32_t)(frequency.hash % db->shard_count) : 0];
+            array_push_memcpy(shard.frequencies, &frequency);
+        }
+    }
+    array_deallocate(docs);
+
+    // New symbols change the order of the indexes
+    foreach(shard, shards)
+    {
+        std::sort(shard->indexes, shard->indexes + array_size(shard->indexes), [](const search_index_t& a, const search_index_t& b)
+        {
+            return search_database_index_key_compare(a.key, b.key) < 0;
+        });
+
+        string_table_t* strings = shard->strings;
+        std::sort(shard->words, shard->words + array_size(shard->words), [strings](string_table_symbol_t a, string_table_symbol_t b)
+        {
+            string_const_t word = string_table_to_string_const(strings, b);
+            return search_database_lexicon_compare(strings, a, STRING_ARGS(word)) < 0;
+        });
+
+        std::sort(shard->frequencies, shard->frequencies + array_size(shard->frequencies), [](const search_term_frequency_t& a, const search_term_frequency_t& b)
+        {
+            return a.hash < b.hash || (a.hash == b.hash && a.doc < b.doc);
+        });
+
+        std::sort(shard->numbers, shard->numbers + array_size(shard->numbers), [](const search_number_entry_t& a, const search_number_entry_t& b)
+        {
+            return search_database_number_entry_compare(a, b.crc, b.number, b.doc) < 0;
+        });
+    }
+
+    return shards;
+}
+
+/*! Read a search database saved with #search_database_save.
+ * 
+ *  @param mapped_data If the stream reads a mapped file, the string table, the indexes and 
+ *                     the posting lists are used in place instead of being copied on the heap.
+ */
+FOUNDATION_STATIC bool search_database_read(search_database_t* db, stream_t* stream, void* mapped_data, size_t mapped_size)
+{
+    if (db->journal)
+    {
+        log_warnf(0, WARNING_UNSUPPORTED, STRING_CONST("Close the search database journal before loading another database"));
         return false;
+    }
+
+    // Read database header, files saved by other versions are rejected so posting lists are always loaded sorted.
+    search_database_header_t header;
+    stream_read(stream, &header, sizeof(SEARCH_DATABASE_HEADER));
+    if (memcmp(&header, &SEARCH_DATABASE_HEADER, sizeof(SEARCH_DATABASE_HEADER)) != 0)
+        return false;
+    const uint64_t journal_sequence = stream_read_uint64(stream);
         
-    string_const_t property_name = search_database_format_word(name, name_length, flags);
+    // Read documents
+    search_document_t* documents = nullptr;
+    uint64_t document_length_total = 0;
+    uint32_t valid_document_count = 0;
+    uint32_t document_count = stream_read_uint32(stream);
+    array_resize(documents, document_count);
+    for (uint32_t i = 0; i < document_count; ++i)
+    {
+        search_document_t* doc = documents + i;
+        doc->type = (search_document_type_t)stream_read_uint8(stream);
+        doc->name = stream_read_string(stream);
+        doc->timestamp = stream_read_uint64(stream);
+        doc->length = stream_read_uint32(stream);
+        if (doc->type == SearchDocumentType::Default)
+        {
+            valid_document_count++;
+            document_length_total += doc->length;
+        }
+    }
+    
+    // Read shards
+    const uint32_t shard_count = stream_read_uint32(stream);
+    search_database_shard_data_t* shards = nullptr;
+    array_resize(shards, shard_count);
+    for (uint32_t i = 0; i < shard_count; ++i)
+    {
+        if (!search_database_read_shard(db, stream, mapped_data, mapped_size, shards[i]))
+        {
+            array_resize(shards, i);
+            search_database_deallocate_shard_data(shards, mapped_data != nullptr);
+            search_database_deallocate_documents(documents);
+            return false;
+        }
+    }
 
-    search_index_key_t key;
-    key.type = SearchIndexType::Property;
-    key.score = to_int(value_length);
-    key.crc = search_database_string_to_symbol(db, STRING_ARGS(property_name));
+    if (shard_count != db->shard_count)
+    {
+        search_database_shard_data_t* source_shards = shards;
+        shards = search_database_reshard(db, source_shards);
+        search_database_deallocate_shard_data(source_shards, mapped_data != nullptr);
 
-    string_const_t property_value = search_database_format_word(value, value_length, flags);
-    key.hash = search_database_string_to_symbol(db, STRING_ARGS(property_value));
+        // Nothing uses the file mapping anymore
+        if (mapped_data)
+        {
+            search_database_unmap_view(mapped_data, mapped_size);
+            mapped_data = nullptr;
+            mapped_size = 0;
+        }
+    }
 
-    search_database_insert_index(db, doc, key);
+    // So far so good, lets swap new entries.
+    SHARED_WRITE_LOCK(db->mutex);
+    search_database_deallocate_documents(db);
+    db->dirty = false;
+    db->documents = documents;
+    db->document_count = valid_document_count; /* Removed documents and the root document are excluded */
+    db->document_length_total = document_length_total;
+    db->journal_sequence = journal_sequence;
 
-    if (!include_variations)
-        return true;
+    // Lock all the shards so no one can use (and promote) the new mapped shards before we are done.
+    for (uint32_t i = 0; i < db->shard_count; ++i)
+        db->shards[i]->mutex.exclusive_lock();
 
-    property_value.length--;        
-    for (; property_value.length > 2; --property_value.length, ++key.score)
+    for (uint32_t i = 0; i < db->shard_count; ++i)
     {
-        // Skip spaces at the end
-        if (property_value.str[property_value.length - 1] == ' ')
-            continue;
-        key.hash = search_database_string_to_symbol(db, property_value.str, property_value.length);
-        search_database_insert_index(db, doc, key);
+        search_database_shard_t* shard = db->shards[i];
+        search_database_deallocate_shard_data(shard);
+        shard->indexes = shards[i].indexes;
+        shard->strings = shards[i].strings;
+        shard->words = shards[i].words;
+        shard->frequencies = shards[i].frequencies;
+        shard->numbers = shards[i].numbers;
+        shard->mapped = mapped_data != nullptr;
+        shard->dirty = false;
     }
+    array_deallocate(shards);
 
-    // TODO: Add support to split property text value with spaces and index each word as a property variation
+    search_database_unmap_nolock(db);
+    db->mapped_data = mapped_data;
+    db->mapped_size = mapped_size;
+    atomic_store32(&db->mapped_shards, mapped_data ? db->shard_count : 0, memory_order_release);
+
+    for (uint32_t i = 0; i < db->shard_count; ++i)
+        db->shards[i]->mutex.exclusive_unlock();
     
     return true;
 }
 
-uint32_t search_database_word_count(search_database_t* database)
+bool search_database_load(search_database_t* db, stream_t* stream)
 {
-    return database->strings->count;
+    FOUNDATION_ASSERT(db);
+    return search_database_read(db, stream, nullptr, 0);
 }
 
-bool search_database_contains_word(search_database_t* db, const char* word, size_t word_length)
+bool search_database_map_file(search_database_t* db, const char* path, size_t path_length)
 {
     FOUNDATION_ASSERT(db);
 
-    if (word == nullptr || word_length == 0)
+    size_t mapped_size = 0;
+    void* mapped_data = search_database_map_view(path, path_length, mapped_size);
+    if (mapped_data == nullptr)
         return false;
 
-    string_const_t formatted_word = search_database_format_word(word, word_length, search_database_case_indexing_flag(db));
-    return string_table_find_symbol(db->strings, STRING_ARGS(formatted_word)) > 0;
+    stream_t* stream = buffer_stream_allocate(mapped_data, STREAM_IN | STREAM_BINARY, mapped_size, mapped_size, false, false);
+    const bool loaded = search_database_read(db, stream, mapped_data, mapped_size);
+    stream_deallocate(stream);
+
+    if (!loaded)
+        search_database_unmap_view(mapped_data, mapped_size);
+    return loaded;
 }
 
-bool search_database_is_document_valid(search_database_t* database, search_document_handle_t document)
+bool search_database_is_mapped(search_database_t* database)
 {
     FOUNDATION_ASSERT(database);
-
-    if (document == 0)
-        return false; // User cannot access root document
-
-    if (document >= array_size(database->documents))
-        return false;
-
-    SHARED_READ_LOCK(database->mutex);
-    return (database->documents[document].type == SearchDocumentType::Default);
+    return atomic_load32(&database->mapped_shards, memory_order_acquire) > 0;
 }
 
-FOUNDATION_FORCEINLINE search_document_handle_t search_database_get_indexed_document(const search_index_t& idx, uint32_t element_at)
+string_t* search_database_property_keywords(search_database_t* database)
 {
-    FOUNDATION_ASSERT(idx.document_count > 0 && element_at < idx.document_count);
-        
-    if (idx.document_count <= ARRAY_COUNT(idx.docs))
-        return idx.docs[element_at];
+    string_t* keywords = nullptr;
 
-    return idx.docs_list[element_at];
+    // Iterate all indexes with the type property
+    for (unsigned s = 0; s < database->shard_count; ++s)
+    {
+        search_database_shard_t* shard = database->shards[s];
+        SHARED_READ_LOCK(shard->mutex);
+    
+        for (uint32_t i = 0; i < array_size(shard->indexes); ++i)
+        {
+            const search_index_t* index = shard->indexes + i;
+            if (index->key.type == SearchIndexType::Property || index->key.type == SearchIndexType::Number)
+            {
+                string_const_t keyword = string_table_to_string_const(shard->strings, (string_table_symbol_t)index->key.crc);
+                if (keyword.length && !array_contains(keywords, keyword, LC2(string_equal(STRING_ARGS(_1), STRING_ARGS(_2)))))
+                    array_push(keywords, string_clone(STRING_ARGS(keyword)));
+            }
+        }
+    }
+
+    return keywords;
 }
 
-FOUNDATION_STATIC bool search_database_insert_result(search_result_t*& results, const search_result_t& new_entry)
+/*! Write the string table and the indexes of a shard.
+ * 
+ *  @remark The shard must be locked.
+ */
+FOUNDATION_STATIC void search_database_write_shard(search_database_shard_t* shard, stream_t* stream)
 {
-    int ridx = array_binary_search_compare(results, new_entry, [](const search_result_t& lhs, const search_result_t& rhs) 
+    // Save string table
     {
-        if (lhs.id < rhs.id)
-            return -1;
-
-        if (lhs.id > rhs.id)
-            return 1;
+        TIME_TRACKER("Write string table");
 
-        return 0;
-    });
+        // Mapped string tables are read-only and were already packed when saved.
+        if (!shard->mapped)
+            string_table_pack(shard->strings);
+        search_database_stream_align(stream, 8);
+        stream_write_int32(stream, shard->strings->count);
+        stream_write_uint64(stream, string_table_average_string_length(shard->strings));
+        stream_write_uint64(stream, shard->strings->allocated_bytes);
+        search_database_stream_align(stream, 8);
+        stream_write(stream, shard->strings, shard->strings->allocated_bytes);
+    }
 
-    if (ridx < 0)
+    // Save indexes
     {
-        ridx = ~ridx;
-        array_insert_memcpy(results, ridx, &new_entry);
-        return true;
-    }
+        TIME_TRACKER("Write indexes");
 
-    search_result_t& entry = results[ridx];
-    entry.score = min(new_entry.score, entry.score);
-    return false;
-}
+        // Encode the posting lists first in order to know where each of them will be saved.
+        const search_index_t* indexes = shard->indexes;
+        const uint32_t index_count = array_size(indexes);
+        uint8_t** encoded_postings = nullptr;
+        uint32_t postings_size = 0;
+        for (uint32_t i = 0; i < index_count; ++i)
+        {
+            const search_index_t& index = indexes[i];
+            if (index.document_count <= ARRAY_COUNT(index.docs))
+                continue;
 
-FOUNDATION_STATIC search_result_t* search_database_get_index_document_results(search_database_t* db, const search_index_t& idx, const search_result_t* and_set, search_result_t*& results)
-{
-    search_result_t entry;
-    search_result_t* matches = nullptr;
-    for (uint32_t i = 0; i < idx.document_count; ++i)
-    {
-        entry.id = search_database_get_indexed_document(idx, i);
+            if (index.packed)
+            {
+                postings_size += math_align_up(search_database_index_packed_size(index), 4);
+            }
+            else
+            {
+                uint8_t* packed = search_database_posting_encode(index.docs_list, index.document_count);
+                postings_size += math_align_up(array_size(packed), 4);
+                array_push(encoded_postings, packed);
+            }
+        }
+
+        search_database_stream_align(stream, 8);
+        stream_write_uint32(stream, index_count);
+        stream_write_uint32(stream, postings_size);
+
+        // Copy the header of the index array, so mapped indexes can be used with the array functions.
+        uint32_t array_header[_array_header_size] = { 0 };
+        if (indexes)
+            memcpy(array_header, _array_raw_const(indexes), sizeof(array_header));
+        array_header[0] = array_header[1] = index_count;
+        stream_write(stream, array_header, sizeof(array_header));
+
+        // Save index entries with their posting list offset relative to themselves, see #search_index_t::docs_mapped
+        const size_t indexes_offset = stream_tell(stream);
+        size_t postings_offset = indexes_offset + sizeof(search_index_t) * index_count;
+        for (uint32_t i = 0, e = 0; i < index_count; ++i)
+        {
+            search_index_t entry = indexes[i];
+            if (entry.document_count > ARRAY_COUNT(entry.docs))
+            {
+                uint32_t packed_size;
+                if (entry.packed)
+                    packed_size = search_database_index_packed_size(indexes[i]);
+                else
+                {
+                    const uint8_t* packed = encoded_postings[e++];
+                    packed_size = array_size(packed);
+                }
+                entry.packed = true;
+                entry.mapped = true;
+                entry.docs_mapped.offset = (int64_t)(postings_offset - indexes_offset - sizeof(search_index_t) * i);
+                entry.docs_mapped.size = packed_size;
+                postings_offset += math_align_up(packed_size, 4);
+            }
+            stream_write(stream, &entry, sizeof(entry));
+        }
 
-        if (and_set == nullptr || array_contains(and_set, entry.id))
+        // Save posting lists
+        for (uint32_t i = 0, e = 0; i < index_count; ++i)
         {
-            entry.score = idx.key.score;
-            if (search_database_insert_result(results, entry))
-                matches = results;
+            const search_index_t& index = indexes[i];
+            if (index.document_count <= ARRAY_COUNT(index.docs))
+                continue;
+
+            if (index.packed)
+            {
+                stream_write(stream, search_database_index_packed_data(index), search_database_index_packed_size(index));
+            }
+            else
+            {
+                stream_write(stream, encoded_postings[e], array_size(encoded_postings[e]));
+                array_deallocate(encoded_postings[e]);
+                e++;
+            }
+            search_database_stream_align(stream, 4);
         }
+        array_deallocate(encoded_postings);
     }
 
-    return matches;
-}
+    // Save lexicon, term frequencies and numeric values
+    search_database_write_array(stream, shard->words);
+    search_database_write_array(stream, shard->frequencies);
+    search_database_write_array(stream, shard->numbers);
 
-FOUNDATION_STATIC search_result_t* search_database_get_key_document_results(search_database_t* db, const search_index_key_t& key, const search_result_t* and_set, search_result_t*& results)
-{
-    int index = search_database_find_index(db, key);
-    if (index < 0)
-        return nullptr;
-     
-    const search_index_t& idx = db->indexes[index];
-    return search_database_get_index_document_results(db, idx, and_set, results);
+    shard->dirty = false;
 }
 
-FOUNDATION_STATIC search_result_t* search_database_exclude_documents(search_database_t* db, search_result_t*& results)
+/*! Returns the number of index entries staged by opened batches (see #search_database_begin_batch). */
+FOUNDATION_STATIC uint32_t search_database_staged_count(search_database_t* db)
 {
-    // This operation is costly as we have to execute the query and then iterate over ALL the documents to exclude those found
-    search_result_t* included_set = nullptr;
-    const search_result_t* excluded_set = results;
-
-    foreach(d, db->documents)
+    uint32_t staged_count = 0;
+    for (unsigned i = 0; i < db->shard_count; ++i)
     {
-        if (d->type != SearchDocumentType::Default)
-            continue;
-
-        const auto docid = (search_document_handle_t)i;
-        if (array_contains(excluded_set, docid))
-            continue;
-
-        search_result_t entry;
-        entry.id = docid;
-        entry.score = 0;
-        search_database_insert_result(included_set, entry);
+        search_database_shard_t* shard = db->shards[i];
+        SHARED_READ_LOCK(shard->mutex);
+        staged_count += array_size(shard->batch);
     }
-
-    array_deallocate(excluded_set);
-    results = included_set;
-    return included_set;
+    return staged_count;
 }
 
-FOUNDATION_STATIC search_result_t* search_database_query_property_number(
-    search_database_t* db, 
-    search_query_eval_flags_t eval_flags, const search_index_key_t& key, 
-    search_result_t* and_set, search_result_t*& results)
+/*! Save the database in #stream. 
+ * 
+ *  @remark When a journal is opened, the journal snapshot mutex must be locked, so the saved 
+ *          #search_database_t::journal_sequence matches exactly the saved documents and indexes.
+ */
+FOUNDATION_STATIC bool search_database_write(search_database_t* db, stream_t* stream)
 {
-    // We expect the db to already be locked
-    FOUNDATION_ASSERT(db->mutex.locked());
-    
-    // Find the range of numbers to match
-    int start = search_database_find_index(db, key);
-    if (start < 0)
-        start = ~start;
-
-    int end = start;
-
-    // Try to fix the insertion point by one index
-    if (db->indexes[start].key.type == key.type && db->indexes[start].key.crc != key.crc)
-        start++;
-
-    if (db->indexes[end].key.type == key.type && db->indexes[end].key.crc != key.crc)
-        end--;
-
-    if (db->indexes[start].key.crc != key.crc || db->indexes[end].key.crc != key.crc)
-        return results; // Nothing to be found
+    SHARED_READ_LOCK(db->mutex);
     
-    // Rewind to first index with same crc
-    while (start > 0 && db->indexes[start - 1].key.crc == key.crc)
-        --start;
-    FOUNDATION_ASSERT(db->indexes[start].key.type == key.type && db->indexes[start].key.crc == key.crc);
-
-    // Forward to the last index with same crc
-    const int index_count = array_size(db->indexes);
-    while (end < index_count - 1 && db->indexes[end + 1].key.crc == key.crc)
-        ++end;
-    FOUNDATION_ASSERT(db->indexes[end].key.type == key.type && db->indexes[end].key.crc == key.crc);
-
-    if (any(eval_flags, SearchQueryEvalFlags::OpLess | SearchQueryEvalFlags::OpLessEq))
+    // Save database header
     {
-        for (; start <= end; ++start)
-        {
-            const search_index_t& idx = db->indexes[start];
-            if (idx.key.number >= key.number)
-                break;
-            search_database_get_index_document_results(db, idx, and_set, results);
-        }
-        
-        if (test(eval_flags, SearchQueryEvalFlags::OpLessEq))
-        {
-            for (; start <= end; ++start)
-            {
-                const search_index_t& idx = db->indexes[start];
-                if (idx.key.number > key.number)
-                    break;
-                search_database_get_index_document_results(db, idx, and_set, results);
-            }
-        }
+        TIME_TRACKER("Write header");
+        stream_write(stream, &SEARCH_DATABASE_HEADER, sizeof(SEARCH_DATABASE_HEADER));
+        stream_write_uint64(stream, db->journal_sequence);
     }
-    else if (any(eval_flags, SearchQueryEvalFlags::OpGreater | SearchQueryEvalFlags::OpGreaterEq))
-    {
-        for (; end >= start; --end)
-        {
-            const search_index_t& idx = db->indexes[end];
-            if (idx.key.number <= key.number)
-                break;
-            search_database_get_index_document_results(db, idx, and_set, results);
-        }
 
-        if (test(eval_flags, SearchQueryEvalFlags::OpGreaterEq))
+    // Save documents
+    {
+        TIME_TRACKER("Write document");
+        stream_write_uint32(stream, array_size(db->documents));
+        foreach(d, db->documents)
         {
-            for (; end >= start; --end)
-            {
-                const search_index_t& idx = db->indexes[end];
-                if (idx.key.number < key.number)
-                    break;
-                search_database_get_index_document_results(db, idx, and_set, results);
-            }
+            stream_write_uint8(stream, (uint32_t)d->type);
+            stream_write_string(stream, STRING_ARGS(d->name));
+            stream_write_uint64(stream, d->timestamp);
+            stream_write_uint32(stream, d->length);
         }
     }
-    else
+
+    // Save shards
+    stream_write_uint32(stream, db->shard_count);
+    for (unsigned i = 0; i < db->shard_count; ++i)
     {
-        FOUNDATION_ASSERT_FAIL("Invalid number query operator");
-    }    
+        search_database_shard_t* shard = db->shards[i];
+        SHARED_READ_LOCK(shard->mutex);
+        search_database_write_shard(shard, stream);
+    }
 
-    return results;
+    db->dirty = false;
+    return true;
 }
 
-FOUNDATION_STATIC search_result_t* search_database_query_property(
-    search_database_t* db,
-    string_const_t name,
-    string_const_t value,
-    search_result_t* and_set,
-    search_query_eval_flags_t eval_flags,
-    search_indexing_flags_t indexing_flags)
+bool search_database_save(search_database_t* db, stream_t* stream)
 {
-    if (value.length == 0)
-        return nullptr;
+    search_database_journal_t* journal = db->journal;
+    if (journal == nullptr)
+        return search_database_write(db, stream);
 
-    search_result_t* results = nullptr;
-    search_index_key_t key{ SearchIndexType::Property };
+    SHARED_WRITE_LOCK(journal->snapshot_mutex);
 
-    SHARED_READ_LOCK(db->mutex);
+    // Staged entries are not saved, but their journal records would not be replayed either.
+    if (search_database_staged_count(db) > 0)
+    {
+        log_warnf(0, WARNING_SUSPICIOUS, STRING_CONST("Cannot save a journaled search database while a batch has staged entries"));
+        return false;
+    }
 
-    string_const_t property_name = search_database_format_word(STRING_ARGS(name), indexing_flags);
-    key.crc = string_table_find_symbol(db->strings, STRING_ARGS(property_name));
-    if ((int64_t)key.crc <= 0)
-        return nullptr;
-        
-    time_t date;
-    string_const_t property_value = search_database_format_word(STRING_ARGS(value), indexing_flags);
-    if (string_try_convert_number(STRING_ARGS(property_value), key.number))
+    return search_database_write(db, stream);
+}
+
+/*! Replace the file at #path with #source, the replacement is atomic so #path is never left incomplete. */
+FOUNDATION_STATIC bool search_database_replace_file(const char* source, size_t source_length, const char* path, size_t path_length)
+{
+    #if FOUNDATION_PLATFORM_WINDOWS
+        wchar_t* wsource = wstring_allocate_from_string(source, source_length);
+        wchar_t* wpath = wstring_allocate_from_string(path, path_length);
+        const bool replaced = MoveFileExW(wsource, wpath, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+        wstring_deallocate(wsource);
+        wstring_deallocate(wpath);
+        return replaced;
+    #else
+        // Renaming a file replaces the destination atomically
+        return fs_move_file(source, source_length, path, path_length);
+    #endif
+}
+
+/*! Decode a journal record written by #search_database_journal_append. 
+ *  
+ *  @remark Decoded record strings point into #data.
+ */
+FOUNDATION_STATIC bool search_database_journal_decode(const uint8_t* data, uint32_t size, uint64_t& sequence, search_journal_record_t& record)
+{
+    const uint8_t* end = data + size;
+    const auto read = [&data, end](void* value, size_t length)
     {
-        key.type = SearchIndexType::Number;
+        if (data + length > end)
+            return false;
+        memcpy(value, data, length);
+        data += length;
+        return true;
+    };
 
-        if (none(eval_flags, SearchQueryEvalFlags::OpEqual | SearchQueryEvalFlags::OpContains))
-        {
-            return search_database_query_property_number(db, eval_flags, key, and_set, results);
-        }
-    }
-    else if (string_try_convert_date(STRING_ARGS(property_value), date))
+    uint8_t op, flag;
+    uint32_t name_length, value_length;
+    if (!read(&sequence, sizeof(sequence)) || !read(&op, sizeof(op)) || !read(&flag, sizeof(flag)) ||
+        !read(&record.doc, sizeof(record.doc)) || !read(&record.number, sizeof(record.number)) || 
+        !read(&name_length, sizeof(name_length)) || data + name_length > end)
     {
-        key.number = (double)date;
-        key.type = SearchIndexType::Number;
-        return search_database_query_property_number(db, eval_flags, key, and_set, results);
+        return false;
     }
-    else
-    {
-        key.hash = string_table_find_symbol(db->strings, STRING_ARGS(property_value));
-        if ((int64_t)key.hash <= 0)
-            return nullptr;
-    }     
-        
-    return search_database_get_key_document_results(db, key, and_set, results);
-}
 
-FOUNDATION_STATIC search_result_t* search_database_query_word(
-    search_database_t* db, 
-    string_const_t value, 
-    search_result_t* and_set,
-    search_query_eval_flags_t eval_flags, 
-    search_indexing_flags_t indexing_flags)
-{    
-    if (value.length < 2)
-        return nullptr;
+    record.name = string_const((const char*)data, name_length);
+    data += name_length;
 
-    search_result_t* results = nullptr;
-    string_const_t word = search_database_format_word(STRING_ARGS(value), indexing_flags);
+    if (!read(&value_length, sizeof(value_length)) || data + value_length > end)
+        return false;
 
-    search_index_key_t key{ SearchIndexType::Word };
-    key.hash = string_hash(STRING_ARGS(word));
+    record.value = string_const((const char*)data, value_length);
+    data += value_length;
 
-    SHARED_READ_LOCK(db->mutex);
+    record.op = (search_journal_operation_t)op;
+    record.flag = flag != 0;
+    return data == end;
+}
 
-    key.crc = string_table_find_symbol(db->strings, STRING_ARGS(word));
-    if ((int64_t)key.crc <= 0)
-        return nullptr;
+/*! Apply a journal record to the database.
+ * 
+ *  @param handles Handles of the documents added while replaying the journal, indexed by their journaled handle.
+ */
+FOUNDATION_STATIC void search_database_journal_apply(search_database_t* db, const search_journal_record_t& record, search_document_handle_t*& handles)
+{
+    search_document_handle_t doc = record.doc;
+    if (doc < array_size(handles) && handles[doc] != SEARCH_DOCUMENT_INVALID_ID)
+        doc = handles[doc];
 
-    search_database_get_key_document_results(db, key, and_set, results);
-    if (test(eval_flags, SearchQueryEvalFlags::OpContains))
+    switch (record.op)
     {
-        if (any(indexing_flags, SearchIndexingFlags::Variations))
+        case SearchJournalOperation::AddDocument:
         {
-            key.type = SearchIndexType::Variation;
-            search_database_get_key_document_results(db, key, and_set, results);
-        }
+            doc = search_database_add_document(db, STRING_ARGS(record.name));
+            search_database_document_update_timestamp(db, doc, (time_t)record.number);
+
+            for (unsigned i = array_size(handles); i <= record.doc; ++i)
+                array_push(handles, SEARCH_DOCUMENT_INVALID_ID);
+            handles[record.doc] = doc;
+        } break;
+
+        case SearchJournalOperation::RemoveDocument:
+            if (search_database_is_document_valid(db, doc))
+                search_database_remove_document(db, doc);
+            break;
+
+        case SearchJournalOperation::UpdateTimestamp:
+            search_database_document_update_timestamp(db, doc, (time_t)record.number);
+            break;
+
+        case SearchJournalOperation::IndexText:
+            search_database_index_text(db, doc, STRING_ARGS(record.name), record.flag);
+            break;
+
+        case SearchJournalOperation::IndexWord:
+            search_database_index_word(db, doc, STRING_ARGS(record.name), record.flag);
+            break;
+
+        case SearchJournalOperation::IndexExactMatch:
+            search_database_index_exact_match(db, doc, STRING_ARGS(record.name), record.flag);
+            break;
+
+        case SearchJournalOperation::IndexNumber:
+            search_database_index_property(db, doc, STRING_ARGS(record.name), record.number);
+            break;
+
+        case SearchJournalOperation::IndexProperty:
+            search_database_index_property(db, doc, STRING_ARGS(record.name), STRING_ARGS(record.value), record.flag);
+            break;
+
+        default:
+            log_warnf(0, WARNING_INVALID_VALUE, STRING_CONST("Unknown search database journal operation %u"), (unsigned)record.op);
+            break;
     }
-    
-    return results;
 }
 
-FOUNDATION_STATIC search_result_t* search_database_handle_query_evaluation(
-    string_const_t name,
-    string_const_t value,
-    search_query_eval_flags_t eval_flags,
-    search_result_t* and_set,
-    void* user_data)
+/*! Replay the journal records that are not included in the database yet (see #search_database_t::journal_sequence).
+ * 
+ *  @return The size of the valid part of the journal. Records after it were partially written and must be dropped.
+ */
+FOUNDATION_STATIC size_t search_database_journal_replay(search_database_t* db, stream_t* stream)
 {
-    search_database_t* db = (search_database_t*)user_data;
-    FOUNDATION_ASSERT(db);
+    TIME_TRACKER("Replay search database journal");
 
-    if (array_size(db->indexes) == 0)
-        return nullptr;
-    
-    SearchIndexingFlags indexing_flags = search_database_case_indexing_flag(db);
-    if (any(eval_flags, SearchQueryEvalFlags::Exclude))
-        indexing_flags |= SearchIndexingFlags::Exclude;
-        
-    if (!any(db->options, SearchDatabaseFlags::DoNotIndexVariations))
-        indexing_flags |= SearchIndexingFlags::Variations;
-    
-    search_result_t* results = nullptr;
-    if (any(eval_flags, SearchQueryEvalFlags::Word))
+    const size_t size = stream_size(stream);
+    size_t valid_size = sizeof(SEARCH_JOURNAL_HEADER);
+    stream_seek(stream, valid_size, STREAM_SEEK_BEGIN);
+
+    uint8_t* payload = nullptr;
+    search_document_handle_t* handles = nullptr;
+    uint32_t replayed_count = 0;
+
+    search_database_begin_batch(db);
+    while (valid_size + 8 <= size)
     {
-        results = search_database_query_word(db, value, and_set, eval_flags, indexing_flags);
+        const uint32_t record_size = stream_read_uint32(stream);
+        const uint32_t checksum = stream_read_uint32(stream);
+        if (valid_size + 8 + record_size > size)
+            break;
+
+        array_resize(payload, record_size);
+        stream_read(stream, payload, record_size);
+
+        uint64_t sequence = 0;
+        search_journal_record_t record;
+        if ((uint32_t)hash(payload, record_size) != checksum || !search_database_journal_decode(payload, record_size, sequence, record))
+            break;
+        valid_size += 8 + record_size;
+
+        // Skip records already included in the loaded database
+        if (sequence <= db->journal_sequence)
+            continue;
+
+        search_database_journal_apply(db, record, handles);
+        db->journal_sequence = sequence;
+        replayed_count++;
     }
-    else if (any(eval_flags, SearchQueryEvalFlags::Property))
+    search_database_commit_batch(db);
+
+    if (replayed_count > 0)
+        log_infof(0, STRING_CONST("Replayed %u search database journal records"), replayed_count);
+
+    array_deallocate(handles);
+    array_deallocate(payload);
+    return valid_size;
+}
+
+/*! Drop the journal records before #offset, which were saved in a snapshot. */
+FOUNDATION_STATIC bool search_database_journal_truncate(search_database_journal_t* journal, size_t offset)
+{
+    SHARED_WRITE_LOCK(journal->mutex);
+    if (journal->stream == nullptr)
+        return false;
+
+    // Gather the records appended since the snapshot was saved
+    const size_t end = stream_tell(journal->stream);
+    FOUNDATION_ASSERT(offset <= end);
+    uint8_t* records = nullptr;
+    array_resize(records, end - offset);
+    stream_seek(journal->stream, offset, STREAM_SEEK_BEGIN);
+    stream_read(journal->stream, records, end - offset);
+
+    char temp_path_buffer[BUILD_MAX_PATHLEN];
+    string_t temp_path = string_format(STRING_BUFFER(temp_path_buffer), STRING_CONST("%.*s.tmp"), STRING_FORMAT(journal->path));
+    stream_t* temp_stream = fs_open_file(STRING_ARGS(temp_path), STREAM_CREATE | STREAM_OUT | STREAM_BINARY | STREAM_TRUNCATE);
+    bool truncated = temp_stream != nullptr;
+    if (temp_stream)
     {
-        results = search_database_query_property(db, name, value, and_set, eval_flags, indexing_flags);
+        stream_write(temp_stream, &SEARCH_JOURNAL_HEADER, sizeof(SEARCH_JOURNAL_HEADER));
+        stream_write(temp_stream, records, end - offset);
+        stream_flush(temp_stream);
+        stream_deallocate(temp_stream);
+
+        stream_deallocate(journal->stream);
+        truncated = search_database_replace_file(STRING_ARGS(temp_path), STRING_ARGS(journal->path));
+        journal->stream = fs_open_file(STRING_ARGS(journal->path), STREAM_IN | STREAM_OUT | STREAM_BINARY);
     }
-    else if (any(eval_flags, SearchQueryEvalFlags::Function))
+
+    if (journal->stream)
     {
-        log_warnf(0, WARNING_UNSUPPORTED, STRING_CONST("Function support is not supported yet"));
-        //FOUNDATION_ASSERT_FAIL("Not implemented");
+        stream_seek(journal->stream, 0, STREAM_SEEK_END);
     }
     else
     {
-        FOUNDATION_ASSERT_FAIL("Not implemented");
+        log_errorf(0, ERROR_SYSTEM_CALL_FAIL, STRING_CONST("Failed to reopen search database journal %.*s, changes are not journaled anymore"), 
+            STRING_FORMAT(journal->path));
     }
 
-    if (any(eval_flags, SearchQueryEvalFlags::Exclude))
-        return search_database_exclude_documents(db, results);
-
-    return results;
+    array_deallocate(records);
+    return truncated;
 }
 
-search_query_handle_t search_database_query(search_database_t* db, const char* query_string, size_t query_string_length)
+/*! Save a snapshot of the database at #path and drop the journal records it includes. */
+FOUNDATION_STATIC bool search_database_journal_compact(search_database_t* db, search_database_journal_t* journal, string_const_t path)
 {
-    FOUNDATION_ASSERT(db);
-
-    if (query_string == nullptr || query_string_length == 0)
-        return SEARCH_QUERY_INVALID_ID;
+    TIME_TRACKER("Compact search database journal");
 
-    // Create query
-    search_query_t* query = search_query_allocate(query_string, query_string_length);
-    FOUNDATION_ASSERT(query);
-    
-    // TODO: Use the job system to spawn a new query job.
-    try
+    // Serialize the snapshot in memory, so journaled operations are only blocked while the database is being serialized.
+    size_t journal_offset = 0;
+    stream_t* snapshot = buffer_stream_allocate(nullptr, STREAM_IN | STREAM_OUT | STREAM_BINARY, 0, 0, true, true);
     {
-        query->results = search_query_evaluate(query, search_database_handle_query_evaluation, db);
+        SHARED_WRITE_LOCK(journal->snapshot_mutex);
+        if (search_database_staged_count(db) > 0)
+        {
+            log_debugf(0, STRING_CONST("Search database journal compaction postponed, a batch has staged entries"));
+            stream_deallocate(snapshot);
+            return false;
+        }
+
+        {
+            SHARED_READ_LOCK(journal->mutex);
+            journal_offset = journal->stream ? stream_tell(journal->stream) : sizeof(SEARCH_JOURNAL_HEADER);
+        }
+        search_database_write(db, snapshot);
     }
-    catch (SearchQueryException ex)
+
+    // Write the snapshot next to the previous one and replace it once complete.
+    char temp_path_buffer[BUILD_MAX_PATHLEN];
+    string_t temp_path = string_format(STRING_BUFFER(temp_path_buffer), STRING_CONST("%.*s.tmp"), STRING_FORMAT(path));
+    stream_t* file = fs_open_file(STRING_ARGS(temp_path), STREAM_CREATE | STREAM_OUT | STREAM_BINARY | STREAM_TRUNCATE);
+    if (file == nullptr)
     {
-        search_query_deallocate(query);
-        throw ex;
+        log_errorf(0, ERROR_SYSTEM_CALL_FAIL, STRING_CONST("Failed to create search database snapshot %.*s"), STRING_FORMAT(temp_path));
+        stream_deallocate(snapshot);
+        return false;
     }
-    
-    query->completed = true;
 
-    SHARED_WRITE_LOCK(db->mutex);
-    array_push(db->queries, query);
-    return (search_query_handle_t)array_size(db->queries) - 1;
-}
+    stream_seek(snapshot, 0, STREAM_SEEK_BEGIN);
+    stream_copy(snapshot, file);
+    stream_flush(file);
+    stream_deallocate(file);
+    stream_deallocate(snapshot);
 
-bool search_database_query_is_completed(search_database_t* database, search_query_handle_t query)
-{
-    FOUNDATION_ASSERT(query > 0);
-    if (query == 0 || query >= array_size(database->queries))
+    if (!search_database_replace_file(STRING_ARGS(temp_path), STRING_ARGS(path)))
+    {
+        log_errorf(0, ERROR_SYSTEM_CALL_FAIL, STRING_CONST("Failed to replace search database snapshot %.*s"), STRING_FORMAT(path));
         return false;
-    SHARED_READ_LOCK(database->mutex);
-    return database->queries[query]->completed;
-}
+    }
 
-const search_result_t* search_database_query_results(search_database_t* database, search_query_handle_t query)
-{
-    FOUNDATION_ASSERT(query > 0);
-    if (query == 0 || query >= array_size(database->queries))
-        return nullptr;
-    SHARED_READ_LOCK(database->mutex);
-    return database->queries[query]->results;
+    // Records of the old journal are ignored once replayed over the new snapshot, so it is safe to drop them now.
+    return search_database_journal_truncate(journal, journal_offset);
 }
 
-bool search_database_query_dispose(search_database_t* database, search_query_handle_t query)
+bool search_database_open_journal(search_database_t* db, const char* path, size_t path_length)
 {
-    FOUNDATION_ASSERT(query > 0);
-    if (query >= array_size(database->queries))
+    FOUNDATION_ASSERT(db);
+    FOUNDATION_ASSERT_MSG(db->journal == nullptr, "Search database journal already opened");
+
+    if (db->journal || path == nullptr || path_length == 0)
         return false;
-    SHARED_WRITE_LOCK(database->mutex);
-    search_query_deallocate(database->queries[query]);
-    return database->queries[query] == nullptr;
-}
 
-bool search_database_load(search_database_t* db, stream_t* stream)
-{
-    // Read database header
-    search_database_header_t header;
-    stream_read(stream, &header, sizeof(SEARCH_DATABASE_HEADER));
-    if (memcmp(&header, &SEARCH_DATABASE_HEADER, sizeof(SEARCH_DATABASE_HEADER)) != 0)
+    stream_t* stream = fs_open_file(path, path_length, STREAM_IN | STREAM_OUT | STREAM_BINARY | STREAM_CREATE);
+    if (stream == nullptr)
         return false;
-        
-    // Read documents
-    search_document_t* documents = nullptr;
-    uint32_t document_count = stream_read_uint32(stream);
-    array_resize(documents, document_count);
-    for (uint32_t i = 0; i < document_count; ++i)
+
+    if (stream_size(stream) < sizeof(SEARCH_JOURNAL_HEADER))
     {
-        search_document_t* doc = documents + i;
-        doc->type = (search_document_type_t)stream_read_uint8(stream);
-        doc->name = stream_read_string(stream);
-        doc->timestamp = stream_read_uint64(stream);
+        stream_truncate(stream, 0);
+        stream_seek(stream, 0, STREAM_SEEK_BEGIN);
+        stream_write(stream, &SEARCH_JOURNAL_HEADER, sizeof(SEARCH_JOURNAL_HEADER));
+        stream_flush(stream);
     }
-    
-    // Read string table
-    string_table_t* strings = nullptr;
-    int32_t string_count = stream_read_int32(stream);
-    uint64_t average_string_length = stream_read_uint64(stream);
-    uint64_t allocated_bytes = stream_read_uint64(stream);
-    
-    strings = (string_table_t*)memory_allocate(0, allocated_bytes, 4, MEMORY_PERSISTENT);
-    FOUNDATION_ASSERT(strings);
-    
-    stream_read(stream, strings, allocated_bytes);
-    strings->free_slots = nullptr;
-    FOUNDATION_ASSERT(strings->count == string_count);
-    FOUNDATION_ASSERT(strings->allocated_bytes == allocated_bytes);
-    FOUNDATION_ASSERT(string_table_average_string_length(strings) == average_string_length);
-
-    // Read indexes
-    search_index_t* indexes = nullptr;
-    const uint32_t index_count = stream_read_uint32(stream);
-    array_resize(indexes, index_count);
-    for (uint32_t i = 0; i < index_count; ++i)
+    else
     {
-        search_index_t* index = indexes + i;
-        stream_read(stream, &index->key, sizeof(index->key));
-        index->document_count = stream_read_uint32(stream);
-        if (index->document_count <= ARRAY_COUNT(index->docs))
+        search_journal_header_t header;
+        stream_read(stream, &header, sizeof(SEARCH_JOURNAL_HEADER));
+        if (memcmp(&header, &SEARCH_JOURNAL_HEADER, sizeof(SEARCH_JOURNAL_HEADER)) != 0)
         {
-            stream_read(stream, index->docs, sizeof(uint32_t) * index->document_count);
+            log_warnf(0, WARNING_INVALID_VALUE, STRING_CONST("Invalid search database journal %.*s"), (int)path_length, path);
+            stream_deallocate(stream);
+            return false;
         }
-        else
+
+        const size_t valid_size = search_database_journal_replay(db, stream);
+        if (valid_size < stream_size(stream))
         {
-            index->docs_list = nullptr;
-            array_resize(index->docs_list, index->document_count);
-            stream_read(stream, index->docs_list, sizeof(uint32_t) * index->document_count);
+            log_warnf(0, WARNING_SUSPICIOUS, STRING_CONST("Dropping %" PRIsize " bytes of incomplete search database journal records"), 
+                stream_size(stream) - valid_size);
+            stream_truncate(stream, valid_size);
         }
     }
+    stream_seek(stream, 0, STREAM_SEEK_END);
 
-    // So far so good, lets swap new entries.
-    SHARED_WRITE_LOCK(db->mutex);
-    search_database_deallocate_documents(db);
-    db->dirty = false;
-    db->documents = documents;
-    db->document_count = document_count - 1; /* -1 to exclude the root document */
+    search_database_journal_t* journal = MEM_NEW(0, search_database_journal_t);
+    journal->stream = stream;
+    journal->path = string_clone(path, path_length);
+    atomic_store32(&journal->compacting, 0, memory_order_relaxed);
+    db->journal = journal;
+    return true;
+}
 
-    search_database_deallocate_indexes(db);
-    db->indexes = indexes;
+bool search_database_compact_journal(search_database_t* db, const char* path, size_t path_length)
+{
+    FOUNDATION_ASSERT(db);
+
+    search_database_journal_t* journal = db->journal;
+    if (journal == nullptr || path == nullptr || path_length == 0)
+        return false;
+
+    // Only one compaction runs at a time
+    if (!atomic_cas32(&journal->compacting, 1, 0, memory_order_acquire, memory_order_relaxed))
+        return false;
+
+    // The previous compaction job is about to complete, if not already
+    job_wait(journal->compaction_job);
+    job_deallocate(journal->compaction_job);
+
+    string_t snapshot_path = string_clone(path, path_length);
+    journal->compaction_job = job_execute([db, journal, snapshot_path](payload_t*)
+    {
+        search_database_journal_compact(db, journal, string_to_const(snapshot_path));
+        string_deallocate(snapshot_path.str);
+        atomic_store32(&journal->compacting, 0, memory_order_release);
+        return 0;
+    });
 
-    string_table_deallocate(db->strings);
-    db->strings = strings;    
-    
     return true;
 }
 
-string_t* search_database_property_keywords(search_database_t* database)
+bool search_database_is_compacting_journal(search_database_t* db)
 {
-    string_t* keywords = nullptr;
+    FOUNDATION_ASSERT(db);
+    search_database_journal_t* journal = db->journal;
+    return journal && atomic_load32(&journal->compacting, memory_order_acquire) != 0;
+}
 
-    // Iterate all indexes with the type property
-    SHARED_READ_LOCK(database->mutex);
-    
-    for (uint32_t i = 0; i < array_size(database->indexes); ++i)
-    {
-        const search_index_t* index = database->indexes + i;
-        if (index->key.type == SearchIndexType::Property || index->key.type == SearchIndexType::Number)
-        {
-            string_const_t keyword = string_table_to_string_const(database->strings, (string_table_symbol_t)index->key.crc);
-            if (keyword.length && !array_contains(keywords, keyword, LC2(string_equal(STRING_ARGS(_1), STRING_ARGS(_2)))))
-                array_push(keywords, string_clone(STRING_ARGS(keyword)));
-        }
-    }
+size_t search_database_journal_size(search_database_t* db)
+{
+    FOUNDATION_ASSERT(db);
 
-    return keywords;
+    search_database_journal_t* journal = db->journal;
+    if (journal == nullptr)
+        return 0;
+
+    SHARED_READ_LOCK(journal->mutex);
+    return journal->stream ? stream_tell(journal->stream) : 0;
 }
 
-bool search_database_save(search_database_t* db, stream_t* stream)
+void search_database_close_journal(search_database_t* db)
 {
-    SHARED_READ_LOCK(db->mutex);
-    
-    // Save database header
+    FOUNDATION_ASSERT(db);
+
+    search_database_journal_t* journal = db->journal;
+    if (journal == nullptr)
+        return;
+
+    // The compaction job uses the database and the journal, so it must complete before they get released.
+    job_wait(journal->compaction_job);
+    job_deallocate(journal->compaction_job);
+
+    db->journal = nullptr;
+    stream_deallocate(journal->stream);
+    string_deallocate(journal->path);
+    array_deallocate(journal->buffer);
+    MEM_DELETE(journal);
+}
+
+/*! Returns true if the staged entries, term frequencies, numbers or indexes of a shard reference #document.
+ * 
+ *  @remark The shard must be locked, mapped shards can be checked without being promoted.
+ */
+FOUNDATION_STATIC bool search_database_shard_has_document_nolock(const search_database_shard_t* shard, search_document_handle_t document)
+{
+    for (unsigned i = 0, end = array_size(shard->batch); i < end; ++i)
     {
-        TIME_TRACKER("Write header");
-        stream_write(stream, &SEARCH_DATABASE_HEADER, sizeof(SEARCH_DATABASE_HEADER));
+        if (shard->batch[i].doc == document)
+            return true;
     }
 
-    // Save documents
+    for (unsigned i = 0, end = array_size(shard->frequencies); i < end; ++i)
     {
-        TIME_TRACKER("Write document");
-        stream_write_uint32(stream, array_size(db->documents));
-        foreach(d, db->documents)
-        {
-            stream_write_uint8(stream, (uint32_t)d->type);
-            stream_write_string(stream, STRING_ARGS(d->name));
-            stream_write_uint64(stream, d->timestamp);
-        }
+        if (shard->frequencies[i].doc == document)
+            return true;
     }
 
-    // Save string table
+    for (unsigned i = 0, end = array_size(shard->numbers); i < end; ++i)
     {
-        TIME_TRACKER("Write string table");
-        string_table_pack(db->strings);
-        stream_write_int32(stream, db->strings->count);
-        stream_write_uint64(stream, string_table_average_string_length(db->strings));
-        stream_write_uint64(stream, db->strings->allocated_bytes);
-        stream_write(stream, db->strings, db->strings->allocated_bytes);
+        if (shard->numbers[i].doc == document)
+            return true;
     }
 
-    // Save indexes
+    for (unsigned i = 0, end = array_size(shard->indexes); i < end; ++i)
     {
-        TIME_TRACKER("Write indexes");
-        stream_write_uint32(stream, array_size(db->indexes));
-        foreach(e, db->indexes)
-        {
-            stream_write(stream, &e->key, sizeof(e->key));
-
-            stream_write_uint32(stream, e->document_count);
-
-            if (e->document_count <= ARRAY_COUNT(e->docs))
-            {
-                stream_write(stream, e->docs, sizeof(uint32_t) * e->document_count);
-            }
-            else
-            {
-                stream_write(stream, e->docs_list, sizeof(uint32_t) * e->document_count);
-            }
-        }
+        if (search_database_index_contains(shard->indexes[i], document))
+            return true;
     }
 
-    db->dirty = false;
-    return true;
+    return false;
 }
 
-FOUNDATION_STATIC bool search_database_remove_document_nolock(search_database_t* db, search_document_handle_t document)
+/*! Remove a document from the indexes of a shard.
+ * 
+ *  @remark The shard must be write locked.
+ */
+FOUNDATION_STATIC bool search_database_remove_shard_document_nolock(search_database_t* db, search_database_shard_t* shard, search_document_handle_t document)
 {
-    bool document_removed = false;
-    search_document_t* doc = &db->documents[document];
-    if (doc->type == SearchDocumentType::Removed)
+    // Only promote mapped shards that reference the document, the others are left untouched.
+    if (shard->mapped && !search_database_shard_has_document_nolock(shard, document))
         return false;
 
-    for (unsigned i = 0, end = array_size(db->indexes); i < end/* && !document_removed*/; ++i)
+    bool document_removed = false;
+    search_database_promote_nolock(db, shard);
+
+    // Drop staged entries of the document, otherwise they would get committed to the next document reusing its slot.
+    uint32_t staged_count = 0;
+    for (unsigned i = 0, end = array_size(shard->batch); i < end; ++i)
+    {
+        if (shard->batch[i].doc != document)
+            shard->batch[staged_count++] = shard->batch[i];
+    }
+    if (staged_count != array_size(shard->batch))
+    {
+        array_resize(shard->batch, staged_count);
+        document_removed = true;
+    }
+
+    uint32_t frequency_count = 0;
+    for (unsigned i = 0, end = array_size(shard->frequencies); i < end; ++i)
+    {
+        if (shard->frequencies[i].doc != document)
+            shard->frequencies[frequency_count++] = shard->frequencies[i];
+    }
+    if (frequency_count != array_size(shard->frequencies))
+        array_resize(shard->frequencies, frequency_count);
+
+    uint32_t number_count = 0;
+    for (unsigned i = 0, end = array_size(shard->numbers); i < end; ++i)
+    {
+        if (shard->numbers[i].doc != document)
+            shard->numbers[number_count++] = shard->numbers[i];
+    }
+    if (number_count != array_size(shard->numbers))
+        array_resize(shard->numbers, number_count);
+
+    for (unsigned i = 0, end = array_size(shard->indexes); i < end/* && !document_removed*/; ++i)
     {
-        search_index_t& index = db->indexes[i];
+        search_index_t& index = shard->indexes[i];
 
         // Remove document from index
         if (index.document_count <= ARRAY_COUNT(index.docs))
         {
-            for (unsigned j = 0, endj = ARRAY_COUNT(index.docs); j < endj; ++j)
+            for (unsigned j = 0, endj = index.document_count; j < endj; ++j)
             {
                 if (index.docs[j] == document)
                 {
@@ -1350,53 +4129,95 @@ FOUNDATION_STATIC bool search_database_remove_document_nolock(search_database_t*
                 }
             }
         }
+        else if (index.packed)
+        {
+            if (search_database_index_contains(index, document))
+            {
+                search_document_handle_t* docs = nullptr;
+                search_database_index_copy_documents(index, docs);
+                const int pos = array_binary_search(docs, document);
+                array_erase_ordered_safe(docs, pos);
+                search_database_index_set_documents(index, docs, array_size(docs), true);
+                array_deallocate(docs);
+                document_removed = true;
+            }
+        }
         else
         {
-            for (unsigned j = 0, endj = array_size(index.docs_list); j < endj; ++j)
+            const int j = array_binary_search(index.docs_list, document);
+            if (j >= 0)
             {
-                if (index.docs_list[j] == document)
-                {
-                    array_erase_ordered_safe(index.docs_list, j);
-                    --index.document_count;
-                    FOUNDATION_ASSERT(index.document_count == array_size(index.docs_list));
-
-                    if (index.document_count <= ARRAY_COUNT(index.docs))
-                    {
-                        // Move all documents from list to array
-                        search_document_handle_t static_docs[ARRAY_COUNT(index.docs)];
-                        for (unsigned k = 0, endk = array_size(index.docs_list); k < endk; ++k)
-                            static_docs[k] = index.docs_list[k];
-                        array_deallocate(index.docs_list);
-                        memcpy(&index.docs, &static_docs, sizeof(static_docs));
-                    }
+                array_erase_ordered_safe(index.docs_list, j);
+                --index.document_count;
+                FOUNDATION_ASSERT(index.document_count == array_size(index.docs_list));
 
-                    document_removed = true;
-                    break;
+                if (index.document_count <= ARRAY_COUNT(index.docs))
+                {
+                    // Move all documents from list to array
+                    search_document_handle_t static_docs[ARRAY_COUNT(index.docs)];
+                    for (unsigned k = 0, endk = array_size(index.docs_list); k < endk; ++k)
+                        static_docs[k] = index.docs_list[k];
+                    array_deallocate(index.docs_list);
+                    memcpy(&index.docs, &static_docs, sizeof(static_docs));
                 }
+
+                document_removed = true;
             }
         }
 
         if (index.document_count == 0)
         {
-            const char* value = (int32_t)index.key.hash > 0 ? string_table_to_string(db->strings, (uint32_t)index.key.hash) : nullptr;
+            const char* value = (int32_t)index.key.hash > 0 ? string_table_to_string(shard->strings, (uint32_t)index.key.hash) : nullptr;
             #if 0
             log_debugf(0, STRING_CONST("Deleting index %u (%d) -> %s:%s(%.lf)"), 
                 i, index.key.type, 
-                string_table_to_string(db->strings, (int32_t)index.key.crc),
+                string_table_to_string(shard->strings, (int32_t)index.key.crc),
                 value ? value : "NA", index.key.number);
             #endif
-            array_erase_ordered_safe(db->indexes, i);
+            if (index.key.type == SearchIndexType::Word)
+                search_database_lexicon_remove(shard, (string_table_symbol_t)index.key.crc);
+            array_erase_ordered_safe(shard->indexes, i);
             --i;
             --end;
-            FOUNDATION_ASSERT(array_size(db->indexes) == end);
+            FOUNDATION_ASSERT(array_size(shard->indexes) == end);
         }
     }
 
+    shard->dirty |= document_removed;
+    return document_removed;
+}
+
+/*! Remove a document from all the shards.
+ * 
+ *  @remark The database must be write locked, shards are write locked one at a time.
+ */
+FOUNDATION_STATIC bool search_database_remove_document_nolock(search_database_t* db, search_document_handle_t document)
+{
+    search_document_t* doc = &db->documents[document];
+    if (doc->type == SearchDocumentType::Removed)
+        return false;
+
+    bool document_removed = false;
+    for (unsigned i = 0; i < db->shard_count; ++i)
+    {
+        search_database_shard_t* shard = db->shards[i];
+        SHARED_WRITE_LOCK(shard->mutex);
+        document_removed |= search_database_remove_shard_document_nolock(db, shard, document);
+    }
+
     FOUNDATION_ASSERT(db->document_count > 0);
+    FOUNDATION_ASSERT(db->document_length_total >= doc->length);
     db->document_count--;
+    db->document_length_total -= doc->length;
+    doc->length = 0;
     doc->type = SearchDocumentType::Removed;
     db->dirty |= document_removed;
     string_deallocate(doc->name);
+
+    search_journal_record_t record;
+    record.op = SearchJournalOperation::RemoveDocument;
+    record.doc = document;
+    search_database_journal_append(db, record);
     return document_removed;
 }
 
@@ -1406,6 +4227,7 @@ bool search_database_remove_document(search_database_t* db, search_document_hand
     FOUNDATION_ASSERT(document < array_size(db->documents));
     FOUNDATION_ASSERT(document != 0);
 
+    search_database_journal_scope_t journal_scope(db);
     SHARED_WRITE_LOCK(db->mutex);
     return search_database_remove_document_nolock(db, document);
 }
@@ -1413,6 +4235,7 @@ bool search_database_remove_document(search_database_t* db, search_document_hand
 bool search_database_remove_old_documents(search_database_t* db, time_t reference, double timeout_seconds)
 {
     FOUNDATION_ASSERT(db);
+    search_database_journal_scope_t journal_scope(db);
     SHARED_WRITE_LOCK(db->mutex);
 
     tick_t time = 0;
@@ -1442,66 +4265,133 @@ bool search_database_remove_old_documents(search_database_t* db, time_t referenc
 
 void search_database_print_stats(search_database_t* db)
 {
-    SHARED_READ_LOCK(db->mutex);
+    // Shards are locked one at a time (see #shared_mutex::MAX_HELD_SHARED_LOCKS), 
+    // so statistics of different shards can be taken at slightly different times.
+
+    // Print the number of indexes per shard.
+    if (db->shard_count > 1)
+    {
+        for (unsigned s = 0; s < db->shard_count; ++s)
+        {
+            search_database_shard_t* shard = db->shards[s];
+            SHARED_READ_LOCK(shard->mutex);
+            log_infof(0, STRING_CONST("Shard %u: %u indexes, %u words, %d strings"), s, array_size(shard->indexes), array_size(shard->words), shard->strings->count);
+        }
+    }
 
     // Print the average document count per index.
     {
-        uint64_t total = 0;
-        for (unsigned i = 0, end = array_size(db->indexes); i < end; ++i)
-            total += db->indexes[i].document_count;
-        log_infof(0, STRING_CONST("Average document count per index: %.1lf"), (double)total / (double)array_size(db->indexes));
+        uint64_t total = 0, index_count = 0;
+        for (unsigned s = 0; s < db->shard_count; ++s)
+        {
+            search_database_shard_t* shard = db->shards[s];
+            SHARED_READ_LOCK(shard->mutex);
+            const search_index_t* indexes = shard->indexes;
+            for (unsigned i = 0, end = array_size(indexes); i < end; ++i)
+                total += indexes[i].document_count;
+            index_count += array_size(indexes);
+        }
+        log_infof(0, STRING_CONST("Average document count per index: %.1lf"), (double)total / (double)index_count);
+    }
+
+    // Print the memory used by posting lists
+    {
+        uint64_t raw_size = 0, used_size = 0;
+        for (unsigned s = 0; s < db->shard_count; ++s)
+        {
+            search_database_shard_t* shard = db->shards[s];
+            SHARED_READ_LOCK(shard->mutex);
+            const search_index_t* indexes = shard->indexes;
+            for (unsigned i = 0, end = array_size(indexes); i < end; ++i)
+            {
+                const search_index_t& index = indexes[i];
+                if (index.document_count <= ARRAY_COUNT(index.docs))
+                    continue;
+
+                raw_size += sizeof(search_document_handle_t) * index.document_count;
+                used_size += index.packed ? search_database_index_packed_size(index) : sizeof(search_document_handle_t) * index.document_count;
+            }
+        }
+        log_infof(0, STRING_CONST("Posting lists memory: %.1lf KB (%.1lf KB uncompressed)"), used_size / 1024.0, raw_size / 1024.0);
     }
 
     // Print the index with the most documents
     {
+        unsigned max_shard = 0;
         unsigned max_index = 0;
         unsigned max_count = 0;
-        for (unsigned i = 0, end = array_size(db->indexes); i < end; ++i)
+        for (unsigned s = 0; s < db->shard_count; ++s)
+        {
+            search_database_shard_t* shard = db->shards[s];
+            SHARED_READ_LOCK(shard->mutex);
+            const search_index_t* indexes = shard->indexes;
+            for (unsigned i = 0, end = array_size(indexes); i < end; ++i)
+            {
+                if (indexes[i].document_count > max_count)
+                {
+                    max_shard = s;
+                    max_index = i;
+                    max_count = indexes[i].document_count;
+                }
+            }
+        }
+
+        search_database_shard_t* shard = db->shards[max_shard];
+        SHARED_READ_LOCK(shard->mutex);
+        if (max_count > 0 && max_index < array_size(shard->indexes))
         {
-            if (db->indexes[i].document_count > max_count)
+            // Only number keys hold a number, others hold the symbol of their value if any.
+            const search_index_key_t& key = shard->indexes[max_index].key;
+            const char* name = string_table_to_string(shard->strings, (int32_t)key.crc);
+            if (key.type == SearchIndexType::Number)
+            {
+                log_infof(0, STRING_CONST("Index with most documents: %u (%d) -> %s(%.lf)"), max_index, key.type, name, key.number);
+            }
+            else
             {
-                max_index = i;
-                max_count = db->indexes[i].document_count;
+                const char* value = (int32_t)key.hash > 0 ? string_table_to_string(shard->strings, (int32_t)key.hash) : "";
+                log_infof(0, STRING_CONST("Index with most documents: %u (%d) -> %s:%s"), max_index, key.type, name, value);
             }
         }
-        log_infof(0, STRING_CONST("Index with most documents: %u (%d) -> %s:%s(%.lf)"), 
-            max_index, db->indexes[max_index].key.type, 
-            string_table_to_string(db->strings, (int32_t)db->indexes[max_index].key.crc),
-            string_table_to_string(db->strings, (int32_t)db->indexes[max_index].key.hash),
-            db->indexes[max_index].key.number);
     }
 
     // Print the top 50 of the most used word
     {
         struct word_count_t
         {
-            string_table_symbol_t symbol;
-            size_t                document_count;
+            search_database_shard_t* shard;
+            string_table_symbol_t    symbol;
+            size_t                   document_count;
         };
 
         word_count_t* word_counts = 0;
-        for (unsigned i = 0, end = array_size(db->indexes); i < end; ++i)
+        for (unsigned s = 0; s < db->shard_count; ++s)
         {
-            if (db->indexes[i].key.type == SearchIndexType::Word)
+            search_database_shard_t* shard = db->shards[s];
+            SHARED_READ_LOCK(shard->mutex);
+            for (unsigned i = 0, end = array_size(shard->indexes); i < end; ++i)
             {
-                string_table_symbol_t symbol = (string_table_symbol_t)db->indexes[i].key.crc;
-                if (symbol > 0)
+                if (shard->indexes[i].key.type == SearchIndexType::Word)
                 {
-                    bool found = false;
-                    for (unsigned j = 0, endj = array_size(word_counts); j < endj; ++j)
+                    string_table_symbol_t symbol = (string_table_symbol_t)shard->indexes[i].key.crc;
+                    if (symbol > 0)
                     {
-                        if (word_counts[j].symbol == symbol)
+                        bool found = false;
+                        for (unsigned j = 0, endj = array_size(word_counts); j < endj; ++j)
                         {
-                            word_counts[j].document_count += db->indexes[i].document_count;
-                            found = true;
-                            break;
+                            if (word_counts[j].shard == shard && word_counts[j].symbol == symbol)
+                            {
+                                word_counts[j].document_count += shard->indexes[i].document_count;
+                                found = true;
+                                break;
+                            }
                         }
-                    }
 
-                    if (!found)
-                    {
-                        word_count_t wc = { symbol, db->indexes[i].document_count };
-                        array_push(word_counts, wc);
+                        if (!found)
+                        {
+                            word_count_t wc = { shard, symbol, shard->indexes[i].document_count };
+                            array_push(word_counts, wc);
+                        }
                     }
                 }
             }
@@ -1518,7 +4408,8 @@ void search_database_print_stats(search_database_t* db)
         log_infof(0, STRING_CONST("Top 50 most used words:"));
         for (unsigned i = 0, end = array_size(word_counts); i < end && i < 50; ++i)
         {
-            const char* word = string_table_to_string(db->strings, (int32_t)word_counts[i].symbol);
+            SHARED_READ_LOCK(word_counts[i].shard->mutex);
+            const char* word = string_table_to_string(word_counts[i].shard->strings, (int32_t)word_counts[i].symbol);
             log_infof(0, STRING_CONST("  %2u: %8s (%" PRIsize ")"), i + 1, word, word_counts[i].document_count);
         }
 
@@ -1529,34 +4420,40 @@ void search_database_print_stats(search_database_t* db)
     {
         struct property_count_t
         {
-            string_table_symbol_t name;
-            string_table_symbol_t symbol;
-            size_t                document_count;
+            search_database_shard_t* shard;
+            string_table_symbol_t    name;
+            string_table_symbol_t    symbol;
+            size_t                   document_count;
         };
 
         property_count_t* property_counts = 0;
-        for (unsigned i = 0, end = array_size(db->indexes); i < end; ++i)
+        for (unsigned s = 0; s < db->shard_count; ++s)
         {
-            if (db->indexes[i].key.type == SearchIndexType::Property)
+            search_database_shard_t* shard = db->shards[s];
+            SHARED_READ_LOCK(shard->mutex);
+            for (unsigned i = 0, end = array_size(shard->indexes); i < end; ++i)
             {
-                string_table_symbol_t symbol = (string_table_symbol_t)db->indexes[i].key.hash;
-                if (symbol > 0)
+                if (shard->indexes[i].key.type == SearchIndexType::Property)
                 {
-                    bool found = false;
-                    for (unsigned j = 0, endj = array_size(property_counts); j < endj; ++j)
+                    string_table_symbol_t symbol = (string_table_symbol_t)shard->indexes[i].key.hash;
+                    if (symbol > 0)
                     {
-                        if (property_counts[j].symbol == symbol)
+                        bool found = false;
+                        for (unsigned j = 0, endj = array_size(property_counts); j < endj; ++j)
                         {
-                            property_counts[j].document_count += db->indexes[i].document_count;
-                            found = true;
-                            break;
+                            if (property_counts[j].shard == shard && property_counts[j].symbol == symbol)
+                            {
+                                property_counts[j].document_count += shard->indexes[i].document_count;
+                                found = true;
+                                break;
+                            }
                         }
-                    }
 
-                    if (!found)
-                    {
-                        property_count_t pc = { (string_table_symbol_t)db->indexes[i].key.crc, symbol, db->indexes[i].document_count };
-                        array_push(property_counts, pc);
+                        if (!found)
+                        {
+                            property_count_t pc = { shard, (string_table_symbol_t)shard->indexes[i].key.crc, symbol, shard->indexes[i].document_count };
+                            array_push(property_counts, pc);
+                        }
                     }
                 }
             }
@@ -1573,8 +4470,9 @@ void search_database_print_stats(search_database_t* db)
         log_infof(0, STRING_CONST("Top 25 most used property words/strings:"));
         for (unsigned i = 0, end = array_size(property_counts); i < end && i < 25; ++i)
         {
-            const char* name = string_table_to_string(db->strings, (int32_t)property_counts[i].name);
-            const char* word = string_table_to_string(db->strings, (int32_t)property_counts[i].symbol);
+            SHARED_READ_LOCK(property_counts[i].shard->mutex);
+            const char* name = string_table_to_string(property_counts[i].shard->strings, (int32_t)property_counts[i].name);
+            const char* word = string_table_to_string(property_counts[i].shard->strings, (int32_t)property_counts[i].symbol);
             log_infof(0, STRING_CONST("  %2u: %8s:%8s (%" PRIsize ")"), i + 1, name, word, property_counts[i].document_count);
         }
 
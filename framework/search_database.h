@@ -22,6 +22,13 @@ constexpr uint32_t SEARCH_DOCUMENT_INVALID_ID = (0);
 constexpr uint8_t SEARCH_DOCUMENT_MAX_NAME_LENGTH = (64);
 constexpr uint8_t SEARCH_INDEX_WORD_MAX_LENGTH = (64);
 
+/*! Search query completion callback signature used by #search_database_query_async.
+ * 
+ *  @param database The search database the query was executed on.
+ *  @param query    The completed query handle.
+ */
+typedef function<void(search_database_t* database, search_query_handle_t query)> search_query_completed_handler_t;
+
 typedef enum class SearchDatabaseFlags : uint32_t {
     
     None                    = 0,
@@ -32,6 +39,13 @@ typedef enum class SearchDatabaseFlags : uint32_t {
 
     SkipCommonWords         = 1 << 4,
 
+    /*! Keep large posting lists delta encoded and bit-packed in memory (saved files are always compressed). */
+    CompressPostingLists    = 1 << 5,
+
+    /*! Score word matches with BM25 using the word occurrences and the length of each document.
+     *  Scores of words combined with AND are summed, and the best score is kept for OR. */
+    RankResults             = 1 << 6,
+
     Default = None
 
 } search_database_flags_t;
@@ -42,7 +56,16 @@ FOUNDATION_FORCEINLINE bool operator==(const search_result_t& result, const sear
     return result.id == id;
 }
 
-search_database_t* search_database_allocate(search_database_flags_t flags = SearchDatabaseFlags::None);
+/*! Allocate a new search database.
+ *
+ *  @param flags        Search database options.
+ *  @param shard_count  Number of shards used to partition the indexes. Each shard has its own lock,
+ *                      so documents can be indexed concurrently by many threads. Pass 0 to use
+ *                      a shard per hardware thread.
+ *
+ *  @return The new search database, which must be deallocated with #search_database_deallocate.
+ */
+search_database_t* search_database_allocate(search_database_flags_t flags = SearchDatabaseFlags::None, uint32_t shard_count = 1);
 
 void search_database_deallocate(search_database_t*& database);
 
@@ -57,6 +80,29 @@ search_document_handle_t search_database_find_document(
 
 bool search_database_is_dirty(search_database_t* database);
 
+/*! Start a batch of indexing operations. 
+ * 
+ *  While a batch is opened, indexed words, texts and properties are staged and only 
+ *  merged in the database indexes when the batch gets committed. This is a lot faster 
+ *  than inserting each index entry one by one when building a large database.
+ * 
+ *  @note Batches can be nested, only the outer most #search_database_commit_batch merges the staged entries.
+ *  @note Queries executed while a batch is opened do not see the staged entries.
+ * 
+ *  @param database The search database to start a batch for.
+ */
+void search_database_begin_batch(search_database_t* database);
+
+/*! Commit a batch of indexing operations started with #search_database_begin_batch.
+ * 
+ *  Staged entries are sorted and merged with the existing indexes in a single pass.
+ * 
+ *  @param database The search database to commit the batch for.
+ * 
+ *  @return True if staged entries were merged in the database indexes.
+ */
+bool search_database_commit_batch(search_database_t* database);
+
 time_t search_database_document_timestamp(search_database_t* database, search_document_handle_t document);
 
 bool search_database_document_update_timestamp(search_database_t* database, search_document_handle_t document, time_t timestamp = 0);
@@ -109,16 +155,139 @@ bool search_database_contains_word(search_database_t* database, const char* word
 
 search_query_handle_t search_database_query(search_database_t* database, const char* query, size_t query_length);
 
+/*! Execute a search query asynchronously using the job system.
+ * 
+ *  The query is parsed on the calling thread, so parsing errors are still thrown as #SearchQueryException,
+ *  but the evaluation is executed by a job. Use #search_database_query_is_completed to know when the
+ *  results are ready or provide a #completed callback.
+ * 
+ *  @remark The job system must be initialized with #jobs_initialize.
+ * 
+ *  @param database      The search database to query.
+ *  @param query         The query string.
+ *  @param query_length  The query string length.
+ *  @param completed     Callback invoked from the job thread once the query results are ready. 
+ *                       The callback is not invoked if the query gets disposed before it completes.
+ *  @param supersede     Previous query to dispose (and cancel if still running), i.e. the last type-ahead query.
+ * 
+ *  @return The new query handle or #SEARCH_QUERY_INVALID_ID if the query string is empty.
+ */
+search_query_handle_t search_database_query_async(
+    search_database_t* database, 
+    const char* query, size_t query_length, 
+    const search_query_completed_handler_t& completed = nullptr,
+    search_query_handle_t supersede = SEARCH_QUERY_INVALID_ID);
+
 bool search_database_query_is_completed(search_database_t* database, search_query_handle_t query);
 
+/*! Execute a search query and only keep its #k best results.
+ * 
+ *  Instead of sorting all the matched documents, the best results are selected using a heap bounded to #k elements. 
+ *  This is best used with #SearchDatabaseFlags::RankResults in order to get the most relevant documents.
+ * 
+ *  @remark Unlike #search_database_query, results are sorted by score (best first) and then by document id.
+ * 
+ *  @param database      The search database to query.
+ *  @param query         The query string.
+ *  @param query_length  The query string length.
+ *  @param k             Maximum number of results to keep.
+ * 
+ *  @return The new query handle or #SEARCH_QUERY_INVALID_ID if the query string is empty.
+ */
+search_query_handle_t search_database_query_top_k(search_database_t* database, const char* query, size_t query_length, uint32_t k);
+
 const search_result_t* search_database_query_results(search_database_t* database, search_query_handle_t query);
 
+/*! Dispose a search query and its results.
+ * 
+ *  @remark If the query is still being evaluated, it gets cancelled and released once the evaluation job exits.
+ * 
+ *  @param database The search database the query was executed on.
+ *  @param query    The query handle to dispose.
+ * 
+ *  @return True if the query was disposed or cancelled.
+ */
 bool search_database_query_dispose(search_database_t* database, search_query_handle_t query);
 
 bool search_database_load(search_database_t* database, stream_t* stream);
 
+/*! Map a search database file saved with #search_database_save and use its string table,
+ *  indexes and posting lists in place instead of loading them on the heap.
+ * 
+ *  The file mapping is read-only. The mapped data gets copied on the heap the first time
+ *  the database is modified, i.e. when indexing or removing documents.
+ * 
+ *  @param database     The search database to load.
+ *  @param path         Path of the search database file.
+ *  @param path_length  Length of the path.
+ * 
+ *  @return True if the file was mapped and loaded.
+ */
+bool search_database_map_file(search_database_t* database, const char* path, size_t path_length);
+
+/*! Checks if the search database still uses a file mapping (see #search_database_map_file).
+ * 
+ *  @param database The search database to check.
+ * 
+ *  @return True if the database is queried in place from a mapped file.
+ */
+bool search_database_is_mapped(search_database_t* database);
+
 bool search_database_save(search_database_t* database, stream_t* stream);
 
+/*! Open an append-only journal for the search database.
+ * 
+ *  Once opened, added and removed documents, indexed words and properties and timestamp updates are 
+ *  appended to the journal file as they happen, so they are not lost if the application exits before 
+ *  the database gets saved again. Records not included in the loaded database are replayed when the journal gets opened.
+ * 
+ *  @remark Load the last database snapshot before opening its journal.
+ * 
+ *  @param database     The search database to journal.
+ *  @param path         Path of the journal file, which gets created if it does not exist.
+ *  @param path_length  Length of the path.
+ * 
+ *  @return True if the journal was opened and replayed.
+ */
+bool search_database_open_journal(search_database_t* database, const char* path, size_t path_length);
+
+/*! Close the search database journal opened with #search_database_open_journal.
+ * 
+ *  Waits for a running compaction (see #search_database_compact_journal) to complete first.
+ * 
+ *  @param database The search database to close the journal for.
+ */
+void search_database_close_journal(search_database_t* database);
+
+/*! Save a new snapshot of the database in the background and drop the journal records it includes.
+ * 
+ *  The snapshot is written to a temporary file that replaces #path once complete.
+ *  The compaction is postponed if a batch has staged entries.
+ * 
+ *  @remark The job system must be initialized with #jobs_initialize.
+ * 
+ *  @param database     The search database to compact the journal for.
+ *  @param path         Path of the database snapshot file.
+ *  @param path_length  Length of the path.
+ * 
+ *  @return True if the compaction job was started.
+ */
+bool search_database_compact_journal(search_database_t* database, const char* path, size_t path_length);
+
+/*! Checks if a journal compaction started with #search_database_compact_journal is still running.
+ * 
+ *  @param database The search database to check.
+ * 
+ *  @return True if the journal is being compacted.
+ */
+bool search_database_is_compacting_journal(search_database_t* database);
+
+/*! Returns the size in bytes of the search database journal, or 0 if no journal is opened.
+ * 
+ *  @param database The search database to check.
+ */
+size_t search_database_journal_size(search_database_t* database);
+
 string_t* search_database_property_keywords(search_database_t* database);
 
 /*! Print statistics about the search database to the console.
@@ -498,6 +498,7 @@ FOUNDATION_STATIC search_query_node_t* search_query_allocate_node(search_query_t
     throw SearchQueryException(SearchQueryError::InvalidLeafNode, token->identifier, "Invalid leaf node");
 }
 
+/*! Merge two result sets sorted by id in a single pass. Duplicates keep their best score. */
 FOUNDATION_STATIC search_result_t* search_query_merge_sets(search_result_t*& lhs, search_result_t*& rhs)
 {
     if (!lhs)
@@ -505,39 +506,70 @@ FOUNDATION_STATIC search_result_t* search_query_merge_sets(search_result_t*& lhs
     if (!rhs)
         return lhs;
 
+    const uint32_t lhs_count = array_size(lhs);
+    const uint32_t rhs_count = array_size(rhs);
+
     search_result_t* results = nullptr;
-    array_copy(results, lhs);
-    array_deallocate(lhs);
+    array_reserve(results, lhs_count + rhs_count);
 
-    foreach(e, rhs)
+    uint32_t i = 0, j = 0;
+    while (i < lhs_count && j < rhs_count)
     {
-        bool exists = false;
-        foreach(r, results)
+        if (lhs[i].id < rhs[j].id)
+            array_push_memcpy(results, &lhs[i++]);
+        else if (lhs[i].id > rhs[j].id)
+            array_push_memcpy(results, &rhs[j++]);
+        else
         {
-            if (r->id == e->id)
-            {
-                exists = true;
-                break;
-            }
+            search_result_t entry = lhs[i++];
+            entry.score = min(entry.score, rhs[j++].score);
+            array_push_memcpy(results, &entry);
         }
-
-        if (!exists)
-            array_push_memcpy(results, e);
     }
+    for (; i < lhs_count; ++i)
+        array_push_memcpy(results, &lhs[i]);
+    for (; j < rhs_count; ++j)
+        array_push_memcpy(results, &rhs[j]);
 
+    array_deallocate(lhs);
     array_deallocate(rhs);
     return results;
 }
 
+/*! Returns the elements of #set sorted by id that are not in #excluded (also sorted by id). */
+FOUNDATION_STATIC search_result_t* search_query_difference_sets(const search_result_t* set, const search_result_t* excluded)
+{
+    const uint32_t set_count = array_size(set);
+    const uint32_t excluded_count = array_size(excluded);
+
+    search_result_t* results = nullptr;
+    for (uint32_t i = 0, j = 0; i < set_count; ++i)
+    {
+        while (j < excluded_count && excluded[j].id < set[i].id)
+            ++j;
+        if (j < excluded_count && excluded[j].id == set[i].id)
+            continue;
+        array_push_memcpy(results, &set[i]);
+    }
+
+    return results;
+}
+
+/*! Evaluate a query node.
+ * 
+ *  @param final If true, the node results are the query results (see #SearchQueryEvalFlags::Final).
+ */
 FOUNDATION_STATIC search_result_t* search_query_evaluate_node(
     search_query_node_t* node, 
     const search_query_eval_handler_t& handler, 
-    search_result_t* and_set, bool exclude, void* user_data)
+    search_result_t* and_set, bool exclude, bool final, void* user_data)
 {
     if (!node)
         return nullptr;
 
     SearchQueryEvalFlags eval_flags = exclude ? SearchQueryEvalFlags::Exclude : SearchQueryEvalFlags::None;
+    if (final && !exclude)
+        eval_flags |= SearchQueryEvalFlags::Final;
 
     if (node->type == SearchQueryNodeType::Word)
     {
@@ -631,28 +663,22 @@ FOUNDATION_STATIC search_result_t* search_query_evaluate_node(
         if (and_set)
         {
             // Remove from the and set the left results that are negated
-            search_result_t* results = nullptr;
-            search_result_t* left = search_query_evaluate_node(node->left, handler, nullptr, false, user_data);
-            
-            foreach(e, and_set)
-            {
-                if (!array_contains(left, *e))
-                    array_push_memcpy(results, e);
-            }
-
+            search_result_t* left = search_query_evaluate_node(node->left, handler, nullptr, false, false, user_data);
+            search_result_t* results = search_query_difference_sets(and_set, left);
             array_deallocate(left);
             return results;
         }
 
-        return search_query_evaluate_node(node->left, handler, nullptr, true, user_data);
+        return search_query_evaluate_node(node->left, handler, nullptr, true, false, user_data);
     }
     else if (node->type == SearchQueryNodeType::And)
     {        
-        search_result_t* left = search_query_evaluate_node(node->left, handler, and_set, exclude, user_data);
+        search_result_t* left = search_query_evaluate_node(node->left, handler, and_set, exclude, false, user_data);
         if (left == nullptr)
             array_reserve(left, 1);
 
-        search_result_t* right = search_query_evaluate_node(node->right, handler, left, exclude, user_data);
+        // The right side results are the And results
+        search_result_t* right = search_query_evaluate_node(node->right, handler, left, exclude, final, user_data);
         array_deallocate(left);
 
         // If the right side is null, we need to return an empty set because the nullptr 
@@ -664,15 +690,15 @@ FOUNDATION_STATIC search_result_t* search_query_evaluate_node(
     }
     else if (node->type == SearchQueryNodeType::Or)
     {
-        search_result_t* left = search_query_evaluate_node(node->left, handler, and_set, exclude, user_data);
-        search_result_t* right = search_query_evaluate_node(node->right, handler, and_set, exclude, user_data);
+        search_result_t* left = search_query_evaluate_node(node->left, handler, and_set, exclude, false, user_data);
+        search_result_t* right = search_query_evaluate_node(node->right, handler, and_set, exclude, false, user_data);
         return search_query_merge_sets(left, right);
     }
     else if (node->type == SearchQueryNodeType::Root)
     {
         FOUNDATION_ASSERT(and_set == nullptr);
         FOUNDATION_ASSERT(exclude == false);
-        return search_query_evaluate_node(node->left, handler, nullptr, false, user_data);
+        return search_query_evaluate_node(node->left, handler, nullptr, false, final, user_data);
     }
 
     FOUNDATION_ASSERT_FAIL("Node type evaluation not implemented");
@@ -690,6 +716,9 @@ const char* search_query_eval_flags_to_string(search_query_eval_flags_t flags)
     if (any(flags, SearchQueryEvalFlags::Exclude))
         str = string_concat(STRING_BUFFER(buffer), STRING_ARGS(str), STRING_CONST("Exclude | "));
 
+    if (any(flags, SearchQueryEvalFlags::Final))
+        str = string_concat(STRING_BUFFER(buffer), STRING_ARGS(str), STRING_CONST("Final | "));
+
     FOUNDATION_ASSERT(one(flags, SearchQueryEvalFlags::Word | SearchQueryEvalFlags::Property | SearchQueryEvalFlags::Function));
 
     if (any(flags, SearchQueryEvalFlags::Word))
@@ -732,7 +761,7 @@ search_result_t* search_query_evaluate(search_query_t* query, const search_query
         return nullptr;
 
     FOUNDATION_ASSERT(query->root && query->root->right == nullptr);
-    return search_query_evaluate_node(query->root->left, handler, nullptr, false, user_data);
+    return search_query_evaluate_node(query->root->left, handler, nullptr, false, true, user_data);
 }
 
 search_query_node_t* search_query_scan_operator_node(search_query_token_t* tokens)
@@ -960,7 +989,9 @@ search_query_t* search_query_allocate(const char* text, size_t length)
     search_query_t* query = (search_query_t*)memory_allocate(0, sizeof(search_query_t), 8, MEMORY_PERSISTENT);
     query->text = string_clone(text, length);
     
-    query->completed = false;
+    atomic_store32(&query->completed, 0, memory_order_relaxed);
+    atomic_store32(&query->cancelled, 0, memory_order_relaxed);
+    query->error = SearchQueryError::None;
     query->results = nullptr;
     
     FOUNDATION_ASSERT(root);
@@ -7,6 +7,7 @@
 
 #include <framework/common.h>
 
+#include <foundation/atomic.h>
 #include <foundation/hash.h>
 #include <foundation/string.h>
 
@@ -46,6 +47,9 @@ typedef enum class SearchQueryEvalFlags
     Property    = 1 << 2,
     Function    = 1 << 3,
 
+    /*! The handler results are the query results, they are not combined with the results of other terms. */
+    Final       = 1 << 4,
+
     OpLess      = 1 << 13,
     OpLessEq    = 1 << 14,
     OpEqual     = 1 << 15,
@@ -94,7 +98,9 @@ struct search_query_t
     string_t text{};
     search_query_node_t* root{ nullptr };
 
-    bool completed{ false };
+    atomic32_t completed;
+    atomic32_t cancelled;
+    search_parser_error_t error{ SearchQueryError::None };
     search_result_t* results{ nullptr };
 };
 
@@ -116,6 +122,10 @@ struct search_result_t
     int32_t score{ 0 };
 };
 
+/*! Search query evaluation handler signature.
+ * 
+ *  @remark Returned results and the #and_set are sorted by id, so sets can be combined in a single pass.
+ */
 typedef function<search_result_t*(
     string_const_t name,
     string_const_t value,
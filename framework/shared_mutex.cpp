@@ -3,4 +3,175 @@
  * License: https://wiimag.com/LICENSE
  */
 
-#include "shared_mutex.h"
\ No newline at end of file
+#include "shared_mutex.h"
+
+#include <foundation/time.h>
+#include <foundation/profile.h>
+
+/*! Number of attempts made to acquire a contended lock before sleeping until it gets released. */
+constexpr int SHARED_MUTEX_SPIN_COUNT = 64;
+
+//
+// # PRIVATE
+//
+
+void shared_mutex::initialize()
+{
+    atomic_store32(&state_, 0, memory_order_relaxed);
+    atomic_store32(&writers_, 0, memory_order_relaxed);
+    atomic_store32(&sleepers_, 0, memory_order_relaxed);
+    atomic_store32(&contentions_, 0, memory_order_relaxed);
+    atomic_store32(&waits_, 0, memory_order_relaxed);
+    atomic_store64(&wait_ticks_, 0, memory_order_release);
+
+    #if FOUNDATION_PLATFORM_WINDOWS
+    InitializeSRWLock(&sleep_lock_);
+    InitializeConditionVariable(&sleep_condition_);
+    #else
+    pthread_mutex_init(&sleep_lock_, NULL);
+    pthread_cond_init(&sleep_condition_, NULL);
+    #endif
+}
+
+void shared_mutex::finalize()
+{
+    #if FOUNDATION_PLATFORM_WINDOWS
+    // SRW locks and condition variables do not need to be destroyed
+    #else
+    pthread_cond_destroy(&sleep_condition_);
+    pthread_mutex_destroy(&sleep_lock_);
+    #endif
+}
+
+tick_t shared_mutex::wait_begin() const
+{
+    atomic_incr32(&contentions_, memory_order_relaxed);
+    if (name_)
+        profile_begin_block(name_, name_length_);
+    return time_current();
+}
+
+void shared_mutex::wait_end(tick_t start, bool slept) const
+{
+    if (slept)
+        atomic_incr32(&waits_, memory_order_relaxed);
+    atomic_add64(&wait_ticks_, time_diff(start, time_current()), memory_order_relaxed);
+    if (name_)
+        profile_end_block();
+}
+
+void shared_mutex::wake_sleepers() const
+{
+    #if FOUNDATION_PLATFORM_WINDOWS
+    AcquireSRWLockExclusive(&sleep_lock_);
+    WakeAllConditionVariable(&sleep_condition_);
+    ReleaseSRWLockExclusive(&sleep_lock_);
+    #else
+    pthread_mutex_lock(&sleep_lock_);
+    pthread_cond_broadcast(&sleep_condition_);
+    pthread_mutex_unlock(&sleep_lock_);
+    #endif
+}
+
+template<typename TryLock>
+FOUNDATION_STATIC bool shared_mutex_sleep_until(
+    atomic32_t* sleepers,
+    #if FOUNDATION_PLATFORM_WINDOWS
+    SRWLOCK* lock, CONDITION_VARIABLE* condition,
+    #else
+    pthread_mutex_t* lock, pthread_cond_t* condition,
+    #endif
+    const TryLock& try_lock)
+{
+    #if FOUNDATION_PLATFORM_WINDOWS
+    AcquireSRWLockExclusive(lock);
+    #else
+    if (pthread_mutex_lock(lock) != 0)
+        return false;
+    #endif
+
+    // Register as sleeping before trying again, so the thread releasing the lock wakes us up.
+    atomic_incr32(sleepers, memory_order_relaxed);
+    atomic_thread_fence_sequentially_consistent();
+    while (!try_lock())
+    {
+        #if FOUNDATION_PLATFORM_WINDOWS
+        SleepConditionVariableSRW(condition, lock, INFINITE, 0);
+        #else
+        pthread_cond_wait(condition, lock);
+        #endif
+    }
+    atomic_decr32(sleepers, memory_order_relaxed);
+
+    #if FOUNDATION_PLATFORM_WINDOWS
+    ReleaseSRWLockExclusive(lock);
+    #else
+    pthread_mutex_unlock(lock);
+    #endif
+    return true;
+}
+
+bool shared_mutex::shared_lock_contended() const
+{
+    const tick_t start = wait_begin();
+
+    for (int spin = 0; spin < SHARED_MUTEX_SPIN_COUNT; ++spin)
+    {
+        thread_yield();
+        if (try_shared_lock())
+        {
+            wait_end(start, false);
+            return true;
+        }
+    }
+
+    const bool locked = shared_mutex_sleep_until(&sleepers_, &sleep_lock_, &sleep_condition_, [this]()
+    {
+        return try_shared_lock();
+    });
+
+    wait_end(start, true);
+    return locked;
+}
+
+bool shared_mutex::exclusive_lock_contended()
+{
+    const tick_t start = wait_begin();
+
+    // Waiting writers prevent new readers from acquiring the lock.
+    atomic_incr32(&writers_, memory_order_relaxed);
+
+    bool locked = false;
+    for (int spin = 0; spin < SHARED_MUTEX_SPIN_COUNT && !locked; ++spin)
+    {
+        thread_yield();
+        locked = atomic_cas32(&state_, WRITER, 0, memory_order_acquire, memory_order_relaxed);
+    }
+
+    const bool slept = !locked;
+    if (slept)
+    {
+        locked = shared_mutex_sleep_until(&sleepers_, &sleep_lock_, &sleep_condition_, [this]()
+        {
+            return atomic_cas32(&state_, WRITER, 0, memory_order_acquire, memory_order_relaxed);
+        });
+    }
+
+    atomic_decr32(&writers_, memory_order_relaxed);
+
+    wait_end(start, slept);
+    return locked;
+}
+
+//
+// # PUBLIC API
+//
+
+shared_mutex_stats_t shared_mutex::stats() const
+{
+    shared_mutex_stats_t stats;
+    stats.contentions = (uint32_t)atomic_load32(&contentions_, memory_order_relaxed);
+    stats.waits = (uint32_t)atomic_load32(&waits_, memory_order_relaxed);
+    stats.wait_ticks = atomic_load64(&wait_ticks_, memory_order_acquire);
+    return stats;
+}
@@ -14,107 +14,218 @@
 #include <foundation/posix.h>
 #endif
 
+#include <foundation/atomic.h>
 #include <foundation/thread.h>
 
+/*! Contention statistics of a #shared_mutex. */
+struct shared_mutex_stats_t
+{
+    /*! Number of times a lock was not acquired on the fast path. */
+    uint32_t contentions{ 0 };
+
+    /*! Number of times a thread had to sleep to acquire a lock. */
+    uint32_t waits{ 0 };
+
+    /*! Total time spent acquiring contended locks. */
+    tick_t wait_ticks{ 0 };
+};
+
+/*! Reader-writer lock with an atomic fast path.
+ * 
+ *  Shared and exclusive locks are acquired with a single atomic operation when the lock is not contended.
+ *  Contended locks spin for a while and then sleep until the lock is released.
+ * 
+ *  Waiting writers are preferred, new readers back off while a writer is waiting. Threads already holding 
+ *  a shared lock on the same mutex bypass waiting writers, so a thread can take a shared lock it already holds 
+ *  without deadlocking. Shared locks are tracked for up to #MAX_HELD_SHARED_LOCKS mutexes per thread.
+ * 
+ *  Named locks emit a profile block with their name each time a thread has to wait for them,
+ *  so hot locks show up in the profiler. Contention statistics are kept for all locks (see #stats).
+ * 
+ *  @remark Locks are not recursive, a thread holding an exclusive lock must not lock it again.
+ */
 class shared_mutex 
 {
 public:
     FOUNDATION_FORCEINLINE shared_mutex()
     {
-        #if FOUNDATION_PLATFORM_WINDOWS
-        InitializeSRWLock(&mutex_);
-        #else
-        pthread_rwlock_init(&mutex_, NULL);
-        #endif
+        initialize();
+    }
+
+    /*! Creates a named lock, the name must be a constant string (i.e. a literal). */
+    template<size_t N>
+    FOUNDATION_FORCEINLINE shared_mutex(const char(&name)[N])
+        : name_(name)
+        , name_length_(N - 1)
+    {
+        initialize();
     }
 
     // Move constructor
     FOUNDATION_FORCEINLINE shared_mutex(shared_mutex&& other) noexcept
+        : name_(other.name_)
+        , name_length_(other.name_length_)
     {
-        #ifdef _WIN32
-        mutex_ = other.mutex_;
-        #else
-        pthread_rwlock_init(&mutex_, NULL);
-        pthread_rwlock_wrlock(&other.mutex_);
-        pthread_rwlock_unlock(&other.mutex_);
-        pthread_rwlock_destroy(&other.mutex_);
-        other.mutex_ = mutex_;
-        mutex_ = pthread_rwlock_t();
-        #endif
+        FOUNDATION_ASSERT(!other.locked());
+        initialize();
     }
 
     FOUNDATION_FORCEINLINE ~shared_mutex()
     {
-        #if FOUNDATION_PLATFORM_WINDOWS
-        (void)mutex_;  // The SRWLOCK type does not need to be destroyed
-        #else
-        pthread_rwlock_destroy(&mutex_);
-        #endif
+        finalize();
     }
 
     FOUNDATION_FORCEINLINE bool shared_lock() const
     {
-        #if FOUNDATION_PLATFORM_WINDOWS
-        SetLastError(ERROR_SUCCESS);
-        AcquireSRWLockShared(&mutex_);
-        return GetLastError() == ERROR_SUCCESS;
-        #else
-        return pthread_rwlock_rdlock(&mutex_) == 0;
-        #endif
+        if (!try_shared_lock() && !shared_lock_contended())
+            return false;
+        
+        hold_shared_lock();
+        return true;
     }
 
     FOUNDATION_FORCEINLINE bool shared_unlock() const
     {
-        #if FOUNDATION_PLATFORM_WINDOWS
-        SetLastError(ERROR_SUCCESS);
-        ReleaseSRWLockShared(&mutex_);
-        return GetLastError() == ERROR_SUCCESS;
-        #else
-        return pthread_rwlock_unlock(&mutex_) == 0;
-        #endif
+        FOUNDATION_ASSERT((atomic_load32(&state_, memory_order_relaxed) & READERS) > 0);
+        release_shared_lock();
+        
+        // Wake up waiters once the last reader leaves
+        if (atomic_decr32(&state_, memory_order_release) == 0)
+            wake();
+        return true;
     }
 
     FOUNDATION_FORCEINLINE bool exclusive_lock()
     {
-        #if FOUNDATION_PLATFORM_WINDOWS
-        SetLastError(ERROR_SUCCESS);
-        AcquireSRWLockExclusive(&mutex_);
-        return GetLastError() == ERROR_SUCCESS;
-        #else
-        return pthread_rwlock_wrlock(&mutex_) == 0;
-        #endif
+        if (atomic_cas32(&state_, WRITER, 0, memory_order_acquire, memory_order_relaxed))
+            return true;
+        return exclusive_lock_contended();
     }
 
     FOUNDATION_FORCEINLINE bool exclusive_unlock()
     {
-        #if FOUNDATION_PLATFORM_WINDOWS
-        SetLastError(ERROR_SUCCESS);
-        ReleaseSRWLockExclusive(&mutex_);
-        return GetLastError() == ERROR_SUCCESS;
-        #else
-        return pthread_rwlock_unlock(&mutex_) == 0;
-        #endif
+        FOUNDATION_ASSERT(atomic_load32(&state_, memory_order_relaxed) == WRITER);
+        atomic_store32(&state_, 0, memory_order_release);
+        wake();
+        return true;
     }
 
     FOUNDATION_FORCEINLINE bool locked() const
     {
-        #if FOUNDATION_PLATFORM_WINDOWS
-        return mutex_.Ptr != 0;
-        #else
-        if (pthread_rwlock_trywrlock(&mutex_) == 0)
-        {
-            pthread_rwlock_unlock(&mutex_);
+        return atomic_load32(&state_, memory_order_acquire) != 0;
+    }
+
+    /*! Returns the lock name, or null if the lock is not named. */
+    FOUNDATION_FORCEINLINE const char* name() const
+    {
+        return name_;
+    }
+
+    /*! Returns the contention statistics of the lock. */
+    shared_mutex_stats_t stats() const;
+
+private:
+
+    static constexpr int32_t WRITER = 1 << 30;
+    static constexpr int32_t READERS = WRITER - 1;
+
+    /*! Maximum number of mutexes a thread is tracked holding shared locks on. 
+     *  Shared locks taken beyond that are not tracked, so nesting them waits for pending writers. */
+    static constexpr uint32_t MAX_HELD_SHARED_LOCKS = 8;
+
+    /*! Shared lock held by a thread, see #held_shared_locks_. */
+    struct held_shared_lock_t
+    {
+        const shared_mutex* mutex;
+        uint32_t count;
+    };
+
+    void initialize();
+    void finalize();
+
+    FOUNDATION_FORCEINLINE bool try_shared_lock() const
+    {
+        const int32_t state = atomic_load32(&state_, memory_order_relaxed);
+        if ((state & WRITER) != 0)
             return false;
+
+        if (atomic_load32(&writers_, memory_order_relaxed) > 0 && find_held_shared_lock() == nullptr)
+            return false;
+        
+        return atomic_cas32(&state_, state + 1, state, memory_order_acquire, memory_order_relaxed);
+    }
+
+    bool shared_lock_contended() const;
+    bool exclusive_lock_contended();
+
+    FOUNDATION_FORCEINLINE held_shared_lock_t* find_held_shared_lock() const
+    {
+        for (uint32_t i = 0; i < held_shared_lock_count_; ++i)
+        {
+            if (held_shared_locks_[i].mutex == this)
+                return &held_shared_locks_[i];
         }
-        return true;
-        #endif
+        return nullptr;
     }
 
-private:
+    FOUNDATION_FORCEINLINE void hold_shared_lock() const
+    {
+        held_shared_lock_t* held = find_held_shared_lock();
+        if (held)
+            held->count++;
+        else if (held_shared_lock_count_ < MAX_HELD_SHARED_LOCKS)
+            held_shared_locks_[held_shared_lock_count_++] = { this, 1 };
+    }
+
+    FOUNDATION_FORCEINLINE void release_shared_lock() const
+    {
+        held_shared_lock_t* held = find_held_shared_lock();
+        if (held == nullptr || --held->count > 0)
+            return;
+
+        // Keep the held locks packed
+        *held = held_shared_locks_[--held_shared_lock_count_];
+    }
+
+    /*! Wake up sleeping threads, only if there are any. */
+    FOUNDATION_FORCEINLINE void wake() const
+    {
+        atomic_thread_fence_sequentially_consistent();
+        if (atomic_load32(&sleepers_, memory_order_relaxed) > 0)
+            wake_sleepers();
+    }
+
+    void wake_sleepers() const;
+
+    tick_t wait_begin() const;
+    void wait_end(tick_t start, bool slept) const;
+
+    /*! Mutexes the calling thread holds shared locks on, with the number of shared locks held on each. */
+    static inline thread_local held_shared_lock_t held_shared_locks_[MAX_HELD_SHARED_LOCKS]{};
+    static inline thread_local uint32_t held_shared_lock_count_ = 0;
+
+    /*! Lock state, #WRITER when exclusively locked, or the number of readers. */
+    mutable atomic32_t state_{};
+
+    /*! Number of writers waiting to acquire the lock. */
+    mutable atomic32_t writers_{};
+
+    /*! Number of threads sleeping until the lock gets released. */
+    mutable atomic32_t sleepers_{};
+
+    mutable atomic32_t contentions_{};
+    mutable atomic32_t waits_{};
+    mutable atomic64_t wait_ticks_{};
+
+    const char* name_{ nullptr };
+    size_t name_length_{ 0 };
+
     #if FOUNDATION_PLATFORM_WINDOWS
-    mutable SRWLOCK mutex_;
+    mutable SRWLOCK sleep_lock_;
+    mutable CONDITION_VARIABLE sleep_condition_;
     #else
-    mutable pthread_rwlock_t mutex_;
+    mutable pthread_mutex_t sleep_lock_;
+    mutable pthread_cond_t sleep_condition_;
     #endif
 };
 
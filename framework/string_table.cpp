@@ -27,7 +27,7 @@ struct string_table_free_slot_t
 };
 
 /*! Global string table lock mutex. */
-static shared_mutex _string_table_lock;
+static shared_mutex _string_table_lock("String Table");
 
 /// <summary>
 /// Global string table shared by all systems of the application.
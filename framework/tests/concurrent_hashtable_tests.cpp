@@ -0,0 +1,155 @@
+/*
+ * Copyright 2022-2023 - All rights reserved.
+ * License: https://wiimag.com/LICENSE
+ */
+
+#include <foundation/platform.h>
+
+#if BUILD_TESTS
+
+#include "test_utils.h"
+
+#include <framework/concurrent_hashtable.h>
+
+#include <foundation/thread.h>
+
+#include <doctest/doctest.h>
+
+TEST_SUITE("ConcurrentHashtable")
+{
+    TEST_CASE("Set And Get")
+    {
+        concurrent_hashtable64 table;
+        CHECK_EQ(table.size(), 0);
+        CHECK_EQ(table.get(1), 0);
+
+        CHECK(table.insert(1, 10));
+        CHECK_FALSE(table.insert(1, 11));
+        CHECK_EQ(table.get(1), 10);
+
+        CHECK(table.set(1, 12));
+        CHECK(table.set(2, 20));
+        CHECK_EQ(table.get(1), 12);
+        CHECK_EQ(table.get(2), 20);
+        CHECK_EQ(table.size(), 2);
+
+        CHECK(table.erase(1));
+        CHECK_FALSE(table.erase(1));
+        CHECK_FALSE(table.contains(1));
+        CHECK_EQ(table.size(), 1);
+
+        table.clear();
+        CHECK_EQ(table.size(), 0);
+        CHECK_FALSE(table.contains(2));
+    }
+
+    TEST_CASE("Grow")
+    {
+        concurrent_hashtable64 table(4);
+        for (uint64_t i = 1; i <= 10000; ++i)
+            REQUIRE(table.insert(i, i * 2));
+
+        CHECK_EQ(table.size(), 10000);
+        CHECK_GE(table.capacity(), 20000);
+        for (uint64_t i = 1; i <= 10000; ++i)
+            REQUIRE_EQ(table.get(i), i * 2);
+    }
+
+    TEST_CASE("Churn")
+    {
+        // Removed entries are dropped by the rehashes, so the table does not grow with the number of keys written.
+        concurrent_hashtable64 table;
+        for (uint64_t i = 1; i <= 100000; ++i)
+        {
+            REQUIRE(table.insert(i, i));
+            if (i > 8)
+                REQUIRE(table.erase(i - 8));
+        }
+
+        CHECK_EQ(table.size(), 8);
+        CHECK_LE(table.capacity(), 64);
+        for (uint64_t i = 100000 - 7; i <= 100000; ++i)
+            CHECK_EQ(table.get(i), i);
+    }
+
+    TEST_CASE("Shrink")
+    {
+        concurrent_hashtable64 table;
+        for (uint64_t i = 1; i <= 4096; ++i)
+            REQUIRE(table.insert(i, i));
+        const uint64_t grown_capacity = table.capacity();
+
+        for (uint64_t i = 17; i <= 4096; ++i)
+            REQUIRE(table.erase(i));
+
+        // Keep writing until the next rehash migrated the live entries to a smaller table.
+        uint64_t key = 4097;
+        while (table.capacity() >= grown_capacity)
+        {
+            REQUIRE(table.insert(key, key));
+            REQUIRE(table.erase(key));
+            key++;
+        }
+
+        CHECK_EQ(table.size(), 16);
+        for (uint64_t i = 1; i <= 16; ++i)
+            CHECK_EQ(table.get(i), i);
+    }
+
+    TEST_CASE("Lookups During Migrations" * doctest::timeout(60))
+    {
+        concurrent_hashtable64 table;
+        static atomic32_t misses;
+        static atomic32_t lookups;
+        constexpr uint64_t STABLE_KEY_COUNT = 256;
+
+        atomic_store32(&misses, 0, memory_order_relaxed);
+        atomic_store32(&lookups, 0, memory_order_relaxed);
+        for (uint64_t i = 1; i <= STABLE_KEY_COUNT; ++i)
+            REQUIRE(table.insert(i, i));
+
+        // Readers look up keys that are never removed while the writer keeps rehashing the table.
+        thread_t readers[4];
+        for (unsigned i = 0; i < ARRAY_COUNT(readers); ++i)
+        {
+            thread_initialize(&readers[i], [](void* arg)->void*
+            {
+                const concurrent_hashtable64& table = *(const concurrent_hashtable64*)arg;
+                uint64_t key = 0;
+                while (!thread_try_wait(0))
+                {
+                    key = key % STABLE_KEY_COUNT + 1;
+                    if (table.get(key) != key)
+                        atomic_incr32(&misses, memory_order_relaxed);
+                    atomic_incr32(&lookups, memory_order_relaxed);
+                }
+                return nullptr;
+            }, &table, STRING_CONST("hashtable_reader"), THREAD_PRIORITY_NORMAL, 0);
+            REQUIRE(thread_start(&readers[i]));
+        }
+
+        uint64_t key = STABLE_KEY_COUNT + 1;
+        for (unsigned round = 0; round < 64; ++round)
+        {
+            // Grow the table, then remove the new entries so the next rehashes shrink it again.
+            const uint64_t first_key = key;
+            for (unsigned i = 0; i < 2048; ++i)
+                table.insert(key++, 1);
+            for (uint64_t k = first_key; k < key; ++k)
+                table.erase(k);
+        }
+
+        for (unsigned i = 0; i < ARRAY_COUNT(readers); ++i)
+        {
+            thread_signal(&readers[i]);
+            thread_join(&readers[i]);
+            thread_finalize(&readers[i]);
+        }
+
+        CHECK_GT(atomic_load32(&lookups, memory_order_relaxed), 0);
+        CHECK_EQ(atomic_load32(&misses, memory_order_relaxed), 0);
+        CHECK_EQ(table.size(), STABLE_KEY_COUNT);
+    }
+}
+
+#endif // BUILD_TESTS
@@ -0,0 +1,201 @@
+/*
+ * Copyright 2022-2023 - All rights reserved.
+ * License: https://wiimag.com/LICENSE
+ */
+
+#include <foundation/platform.h>
+
+#if BUILD_TESTS
+
+#include "test_utils.h"
+
+#include <framework/concurrent_queue.h>
+
+#include <foundation/thread.h>
+
+#include <doctest/doctest.h>
+
+TEST_SUITE("ConcurrentQueue")
+{
+    TEST_CASE("Push And Pop")
+    {
+        concurrent_queue<uint32_t> queue;
+        queue.create();
+
+        uint32_t e = 0;
+        CHECK(queue.empty());
+        CHECK_FALSE(queue.try_pop(e));
+        CHECK_FALSE(queue.try_pop(e, 10));
+
+        CHECK(queue.push(1));
+        CHECK(queue.push(2));
+        CHECK_EQ(queue.size(), 2);
+
+        REQUIRE(queue.try_pop(e));
+        CHECK_EQ(e, 1);
+        REQUIRE(queue.try_pop(e, 10));
+        CHECK_EQ(e, 2);
+
+        // Popping an empty queue leaves the element untouched
+        CHECK_FALSE(queue.try_pop(e));
+        CHECK_EQ(e, 2);
+        CHECK(queue.empty());
+
+        queue.destroy();
+    }
+
+    TEST_CASE("Overflow Order")
+    {
+        // Elements pushed once the ring buffer is full go to the overflow list, but are still popped in order.
+        concurrent_queue<uint32_t, 8> queue;
+        queue.create();
+
+        uint32_t next = 0, expected = 0, e = 0;
+        for (unsigned round = 0; round < 4; ++round)
+        {
+            for (unsigned i = 0; i < 50; ++i)
+                REQUIRE(queue.push(next++));
+            CHECK_EQ(queue.size(), next - expected);
+
+            // Only drain part of the queue, so the next elements are pushed while some still overflow.
+            for (unsigned i = 0; i < 30; ++i)
+            {
+                REQUIRE(queue.try_pop(e));
+                CHECK_EQ(e, expected++);
+            }
+        }
+
+        while (queue.try_pop(e))
+            CHECK_EQ(e, expected++);
+        CHECK_EQ(expected, next);
+        CHECK(queue.empty());
+
+        // The ring buffer is used again once the overflow list is drained.
+        for (uint32_t i = 0; i < 8; ++i)
+            REQUIRE(queue.push(i));
+        for (uint32_t i = 0; i < 8; ++i)
+        {
+            REQUIRE(queue.try_pop(e));
+            CHECK_EQ(e, i);
+        }
+        CHECK_FALSE(queue.try_pop(e));
+
+        // Remaining elements are released with the queue.
+        for (uint32_t i = 0; i < 20; ++i)
+            REQUIRE(queue.push(i));
+        queue.destroy();
+    }
+
+    TEST_CASE("Destroy")
+    {
+        // Elements do not need a default constructor, the remaining ones are released in place.
+        static int32_t live_count = 0;
+        struct element_t
+        {
+            int32_t value;
+
+            element_t(int32_t v) : value(v) { live_count++; }
+            element_t(const element_t& other) : value(other.value) { live_count++; }
+            element_t& operator=(const element_t& other) = default;
+            ~element_t() { live_count--; }
+        };
+
+        {
+            concurrent_queue<element_t, 8> queue;
+            queue.create();
+            for (int32_t i = 0; i < 20; ++i)
+                REQUIRE(queue.push(element_t(i)));
+
+            element_t e(-1);
+            REQUIRE(queue.try_pop(e));
+            CHECK_EQ(e.value, 0);
+            CHECK_EQ(live_count, 20);
+
+            queue.destroy();
+            CHECK_EQ(live_count, 1);
+        }
+    }
+
+    TEST_CASE("Producers And Consumers" * doctest::timeout(60))
+    {
+        constexpr uint32_t PRODUCER_COUNT = 4;
+        constexpr uint32_t CONSUMER_COUNT = 4;
+        constexpr uint32_t ELEMENT_COUNT = 20000;
+
+        static concurrent_queue<uint32_t, 64> queue;
+        static atomic32_t popped_count;
+        static atomic32_t popped[PRODUCER_COUNT * ELEMENT_COUNT];
+
+        queue.create();
+        atomic_store32(&popped_count, 0, memory_order_relaxed);
+        for (unsigned i = 0; i < ARRAY_COUNT(popped); ++i)
+            atomic_store32(&popped[i], 0, memory_order_relaxed);
+
+        // Each producer pushes its own range of elements, small enough to overflow the ring buffer.
+        thread_t producers[PRODUCER_COUNT];
+        for (uint32_t i = 0; i < PRODUCER_COUNT; ++i)
+        {
+            thread_initialize(&producers[i], [](void* arg)->void*
+            {
+                const uint32_t first = (uint32_t)(uintptr_t)arg * ELEMENT_COUNT;
+                for (uint32_t e = first; e < first + ELEMENT_COUNT; ++e)
+                    queue.push(e);
+                return nullptr;
+            }, (void*)(uintptr_t)i, STRING_CONST("queue_producer"), THREAD_PRIORITY_NORMAL, 0);
+        }
+
+        thread_t consumers[CONSUMER_COUNT];
+        for (uint32_t i = 0; i < CONSUMER_COUNT; ++i)
+        {
+            thread_initialize(&consumers[i], [](void* arg)->void*
+            {
+                uint32_t e = 0;
+                while (atomic_load32(&popped_count, memory_order_acquire) < (int32_t)(PRODUCER_COUNT * ELEMENT_COUNT) && !thread_try_wait(0))
+                {
+                    if (!queue.try_pop(e, 10))
+                        continue;
+                    atomic_incr32(&popped[e], memory_order_relaxed);
+                    atomic_incr32(&popped_count, memory_order_release);
+                }
+                return nullptr;
+            }, nullptr, STRING_CONST("queue_consumer"), THREAD_PRIORITY_NORMAL, 0);
+        }
+
+        for (uint32_t i = 0; i < CONSUMER_COUNT; ++i)
+            REQUIRE(thread_start(&consumers[i]));
+        for (uint32_t i = 0; i < PRODUCER_COUNT; ++i)
+            REQUIRE(thread_start(&producers[i]));
+
+        for (uint32_t i = 0; i < PRODUCER_COUNT; ++i)
+        {
+            thread_join(&producers[i]);
+            thread_finalize(&producers[i]);
+        }
+
+        const tick_t timeout = time_current();
+        while (atomic_load32(&popped_count, memory_order_acquire) < (int32_t)(PRODUCER_COUNT * ELEMENT_COUNT) && time_elapsed(timeout) < 30.0)
+            thread_sleep(1);
+
+        for (uint32_t i = 0; i < CONSUMER_COUNT; ++i)
+        {
+            thread_signal(&consumers[i]);
+            thread_join(&consumers[i]);
+            thread_finalize(&consumers[i]);
+        }
+
+        // Every element is popped exactly once
+        CHECK_EQ(atomic_load32(&popped_count, memory_order_acquire), (int32_t)(PRODUCER_COUNT * ELEMENT_COUNT));
+        uint32_t mismatch_count = 0;
+        for (unsigned i = 0; i < ARRAY_COUNT(popped); ++i)
+        {
+            if (atomic_load32(&popped[i], memory_order_relaxed) != 1)
+                mismatch_count++;
+        }
+        CHECK_EQ(mismatch_count, 0);
+        CHECK(queue.empty());
+
+        queue.destroy();
+    }
+}
+
+#endif // BUILD_TESTS
@@ -325,6 +325,83 @@ TEST_SUITE("Database")
         CHECK(db.elements != nullptr); // The element array should only be cleared, not deallocated
     }
 
+    TEST_CASE("Remove And Select")
+    {
+        database<price_t> db;
+        for (uint64_t i = 1; i <= 1000; ++i)
+            REQUIRE_NE(db.insert({ i, (double)i }), 0);
+        REQUIRE_EQ(db.size(), 1000);
+
+        // Removed elements are replaced by the last one, which must still be found.
+        for (uint64_t i = 1; i <= 1000; i += 2)
+            CHECK(db.remove(hash(price_t{ i, 0 })));
+        REQUIRE_EQ(db.size(), 500);
+
+        for (uint64_t i = 1; i <= 1000; ++i)
+        {
+            price_t p;
+            const hash_t key = hash(price_t{ i, 0 });
+            if (i % 2)
+            {
+                CHECK_FALSE(db.contains(key));
+                CHECK_FALSE(db.select(key, p));
+            }
+            else
+            {
+                REQUIRE(db.select(key, p));
+                CHECK_EQ(p.id, i);
+            }
+        }
+    }
+
+    TEST_CASE("Chunked Storage")
+    {
+        database<int, hashint, 8> db;
+        for (int i = 1; i <= 20; ++i)
+            REQUIRE_EQ(db.insert(i), (hash_t)i);
+        REQUIRE_EQ(db.size(), 20);
+        CHECK_EQ(array_size(db.chunks), 3);
+
+        // Elements must keep their address when others are inserted or removed.
+        const int* last = nullptr;
+        {
+            auto locked = db.lock(20);
+            last = locked.value;
+        }
+        REQUIRE_NE(last, nullptr);
+
+        for (int i = 1; i <= 20; i += 2)
+            CHECK(db.remove((hash_t)i));
+        CHECK_EQ(db.size(), 10);
+
+        int count = 0;
+        for (auto e : db)
+        {
+            CHECK_EQ(e % 2, 0);
+            count++;
+        }
+        CHECK_EQ(count, 10);
+
+        // Removed slots are reused before allocating new chunks.
+        for (int i = 21; i <= 30; ++i)
+            REQUIRE_EQ(db.insert(i), (hash_t)i);
+        CHECK_EQ(array_size(db.chunks), 3);
+        CHECK_EQ(db.size(), 20);
+        CHECK_EQ(*last, 20);
+        CHECK_EQ(&db.get(20), last);
+
+        for (int i = 2; i <= 30; i += 2)
+        {
+            int value = 0;
+            REQUIRE(db.select((hash_t)i, value));
+            CHECK_EQ(value, i);
+        }
+
+        db.clear();
+        CHECK(db.empty());
+        CHECK_EQ(array_size(db.chunks), 3); // Chunks are kept for future inserts
+    }
+
     TEST_CASE("Failures")
     {
         database<kvp_t, hash_uuid> db;
@@ -90,6 +90,48 @@ TEST_SUITE("Dispatcher")
         }
     }
 
+    TEST_CASE("Unregister From Listener")
+    {
+        static int invoked = 0;
+        static dispatcher_event_listener_id_t listener_id = INVALID_DISPATCHER_EVENT_LISTENER_ID;
+        listener_id = dispatcher_register_event_listener("ONCE_1", [](const auto& args)
+        {
+            invoked++;
+            return dispatcher_unregister_event_listener(listener_id);
+        });
+        REQUIRE_NE(listener_id, INVALID_DISPATCHER_EVENT_LISTENER_ID);
+
+        dispatcher_post_event("ONCE_1");
+        dispatcher_post_event("ONCE_1");
+        dispatcher_process_events();
+
+        CHECK_EQ(invoked, 1);
+        CHECK_FALSE(dispatcher_unregister_event_listener(listener_id));
+    }
+
+    TEST_CASE("Worker Thread Listener")
+    {
+        static atomic32_t invoked;
+        atomic_store32(&invoked, 0, memory_order_release);
+
+        auto event_listener_id = dispatcher_register_event_listener("WORKER_1", [](const dispatcher_event_args_t& args)
+        {
+            if (args.size == 6 && string_equal(args.c_str(), 5, STRING_CONST("hello")))
+                atomic_incr32(&invoked, memory_order_release);
+            return true;
+        }, DISPATCHER_EVENT_OPTION_WORKER_THREAD);
+        REQUIRE_NE(event_listener_id, INVALID_DISPATCHER_EVENT_LISTENER_ID);
+
+        dispatcher_post_event("WORKER_1", (void*)"hello", 6, DISPATCHER_EVENT_OPTION_COPY_DATA);
+        dispatcher_process_events();
+
+        const tick_t timeout = time_current();
+        while (atomic_load32(&invoked, memory_order_acquire) == 0 && time_elapsed(timeout) < 10.0)
+            thread_yield();
+        CHECK_EQ(atomic_load32(&invoked, memory_order_acquire), 1);
+        REQUIRE(dispatcher_unregister_event_listener(event_listener_id));
+    }
+
     TEST_CASE("Main Thread Dispatch")
     {
         static bool main_thread_dispatched = false;
@@ -106,6 +148,153 @@ TEST_SUITE("Dispatcher")
         REQUIRE(main_thread_dispatched);
     }
 
+    TEST_CASE("Timers")
+    {
+        SUBCASE("Cancel")
+        {
+            static bool executed = false;
+            dispatcher_timer_handle_t timer = dispatch_timer([]() { executed = true; }, 10);
+            REQUIRE_NE(timer, INVALID_DISPATCHER_TIMER_HANDLE);
+            CHECK(dispatcher_cancel_timer(timer));
+            CHECK_FALSE(dispatcher_cancel_timer(timer));
+
+            thread_sleep(20);
+            dispatcher_update();
+            CHECK_FALSE(executed);
+        }
+
+        SUBCASE("Delay")
+        {
+            static bool executed = false;
+            dispatcher_timer_handle_t timer = dispatch_timer([]() { executed = true; }, 10);
+            dispatcher_update();
+            CHECK_FALSE(executed);
+
+            thread_sleep(20);
+            dispatcher_update();
+            CHECK(executed);
+            CHECK_FALSE(dispatcher_cancel_timer(timer));
+        }
+
+        SUBCASE("Repeat")
+        {
+            static int count = 0;
+            static dispatcher_timer_handle_t timer = INVALID_DISPATCHER_TIMER_HANDLE;
+            timer = dispatch_timer([]()
+            {
+                if (++count == 3)
+                    CHECK(dispatcher_cancel_timer(timer));
+            }, 0, 1);
+
+            for (int i = 0; i < 10; ++i)
+            {
+                dispatcher_update();
+                thread_sleep(2);
+            }
+
+            CHECK_EQ(count, 3);
+        }
+
+        SUBCASE("Cancel Running")
+        {
+            // A one-shot timer cancelled from its own callback is already executed.
+            static int count = 0;
+            static bool cancelled = true;
+            static dispatcher_timer_handle_t timer = INVALID_DISPATCHER_TIMER_HANDLE;
+            timer = dispatch_timer([]()
+            {
+                count++;
+                cancelled = dispatcher_cancel_timer(timer);
+            }, 0);
+
+            thread_sleep(2);
+            dispatcher_update();
+            dispatcher_update();
+            CHECK_EQ(count, 1);
+            CHECK_FALSE(cancelled);
+            CHECK_FALSE(dispatcher_cancel_timer(timer));
+        }
+
+        SUBCASE("Dispatch From Handler")
+        {
+            // Dispatching from a handler grows the timers while the handler is running.
+            static int sum = 0;
+            const int values[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+            dispatch([values]()
+            {
+                for (int i = 0; i < 64; ++i)
+                    dispatch([]() {});
+                for (int v : values)
+                    sum += v;
+            });
+
+            dispatcher_update();
+            CHECK_EQ(sum, 36);
+            dispatcher_update();
+        }
+
+        SUBCASE("Cancel Due")
+        {
+            static bool executed = false;
+            static dispatcher_timer_handle_t second = INVALID_DISPATCHER_TIMER_HANDLE;
+            dispatch_timer([]() { CHECK(dispatcher_cancel_timer(second)); }, 0);
+            second = dispatch_timer([]() { executed = true; }, 0);
+
+            thread_sleep(2);
+            dispatcher_update();
+            dispatcher_update();
+            CHECK_FALSE(executed);
+        }
+    }
+
+    TEST_CASE("Threads")
+    {
+        SUBCASE("Completed")
+        {
+            static atomic32_t executed;
+            static int completed = 0;
+            atomic_store32(&executed, 0, memory_order_release);
+            completed = 0;
+
+            for (int i = 0; i < 100; ++i)
+            {
+                dispatch_thread([](void*)->void* 
+                {
+                    atomic_incr32(&executed, memory_order_relaxed);
+                    return nullptr; 
+                }, []() { completed++; });
+            }
+
+            tick_t timeout = time_current();
+            while (completed < 100 && time_elapsed(timeout) < 10.0)
+            {
+                dispatcher_wait_for_wakeup_main_thread(10);
+                dispatcher_update();
+            }
+
+            CHECK_EQ(atomic_load32(&executed, memory_order_acquire), 100);
+            CHECK_EQ(completed, 100);
+        }
+
+        SUBCASE("Stop")
+        {
+            static bool signaled = false;
+            dispatcher_thread_handle_t thread = dispatch_thread("Stop", [](void*)->void*
+            {
+                while (!thread_try_wait(10))
+                    ;
+                signaled = true;
+                return nullptr;
+            });
+
+            REQUIRE_NE(thread, 0);
+            CHECK(dispatcher_thread_is_running(thread));
+            CHECK(dispatcher_thread_stop(thread, 5.0));
+            CHECK_FALSE(dispatcher_thread_is_running(thread));
+            CHECK(signaled);
+        }
+    }
+
     TEST_CASE("Button Event Trigger" * doctest::may_fail(true))
     {
         static bool event_sent = false;
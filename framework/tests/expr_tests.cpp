@@ -932,6 +932,234 @@ TEST_SUITE("Expressions")
         test_expr("zzlowercase(COUCOU)=='coucou'", true);
         CHECK_EQ(eval("zzlowercase('')").as_boolean(), false);
     }
+
+    TEST_CASE("Compile")
+    {
+        expr_program_t* program = expr_compile(STRING_CONST("$price * $quantity + 1"));
+        REQUIRE_NE(program, nullptr);
+
+        expr_binding_t bindings[] = {
+            { CTEXT("$price"), 2.5 },
+            { CTEXT("$quantity"), 4.0 }
+        };
+        CHECK_EQ(expr_run(program, bindings, ARRAY_COUNT(bindings)).as_number(), 11.0);
+
+        bindings[0].value = 10.0;
+        CHECK_EQ(expr_run(program, bindings, ARRAY_COUNT(bindings)).as_number(), 41.0);
+        expr_release(program);
+
+        CHECK_EQ(expr_compile(STRING_CONST("(1 + 2")), nullptr);
+        CHECK_EQ(EXPR_ERROR_CODE, EXPR_ERROR_BAD_PARENS);
+    }
+
+    TEST_CASE("Bytecode")
+    {
+        // Short-circuit operators do not evaluate their right operand
+        test_expr("x=0, y=(0 && (x=1)), x", 0);
+        test_expr("x=0, y=(1 || (x=1)), x", 0);
+        test_expr("x=0, y=(1 && (x=2)), x", 2);
+        test_expr("2 && 3", 3.0);
+        test_expr("0 || 4", 4.0);
+        test_expr("nil || 0", false);
+
+        // Constant operations are folded
+        test_expr("2 * (3 + 4) - 10 / 5", 12.0);
+        test_expr("x=3, (1 + 2) * x", 9);
+        test_expr("-(2 ** 3) + 9 % 4", -7.0);
+        test_expr("(1 < 2) == (3 >= 3)", true);
+
+        // Function arguments are compiled too
+        test_expr("i=0, s=0, r=while(i < 100, (s = s + i, i = i + 1)), s", 4950);
+        test_expr("i=0, s=0, r=while(i < 10, (s = s + if(i % 2 == 0, i * 2, -i), i = i + 1)), s", 15);
+        test_expr("SUM(REPEAT($i * 2, 10))", 90.0);
+
+        // Long lists exceeding the evaluation stack are evaluated by walking the tree
+        char list[2048];
+        size_t list_length = 0;
+        for (int i = 0; i < 300; ++i)
+            list_length += string_format(list + list_length, sizeof(list) - list_length, STRING_CONST("%d,"), i).length;
+        expr_result_t result = eval(list, list_length - 1);
+        CHECK_EQ(result.element_count(), 300);
+        CHECK_EQ(result.last().as_number(), 299.0);
+    }
+
+    TEST_CASE("Names")
+    {
+        // Function names are case insensitive, the first function registered with a name is used
+        expr_register_function("zzFirst", [](const expr_func_t* f, vec_expr_t* args, void* c) -> expr_result_t { return 1.0; });
+        expr_register_function("ZZFIRST", [](const expr_func_t* f, vec_expr_t* args, void* c) -> expr_result_t { return 2.0; });
+        test_expr("zzfirst()", 1.0);
+        CHECK(expr_unregister_function("zzfirst"));
+        test_expr("ZzFirst()", 2.0);
+        CHECK(expr_unregister_function("zzfirst"));
+        CHECK_FALSE(expr_unregister_function("zzfirst"));
+        test_expr("MIN(3, 2) + min(4, 5)", 6.0);
+
+        // Variables are case sensitive in expressions, but not when accessed by name
+        test_expr("zzv=1, ZZV=2, zzv+ZZV*10", 21);
+        CHECK(expr_set_global_var(STRING_CONST("zzVar"), 5.0));
+        test_expr("zzVar * 2", 10.0);
+        CHECK_EQ(expr_get_global_var_value(STRING_CONST("ZZVAR")).as_number(), 5.0);
+        CHECK_EQ(expr_get_or_create_global_var(STRING_CONST("zzvar"))->value.as_number(), 5.0);
+
+        char name[16];
+        for (int i = 0; i < 1000; ++i)
+        {
+            string_t var_name = string_format(STRING_BUFFER(name), STRING_CONST("zzv%d"), i);
+            expr_set_global_var(STRING_ARGS(var_name), (double)i);
+        }
+        for (int i = 0; i < 1000; ++i)
+        {
+            string_t var_name = string_format(STRING_BUFFER(name), STRING_CONST("ZZV%d"), i);
+            CHECK_EQ(expr_get_global_var_value(STRING_ARGS(var_name)).as_number(), (double)i);
+        }
+        test_expr("zzv999 - zzv10", 989.0);
+    }
+
+    TEST_CASE("Cache invalidation")
+    {
+        expr_register_function("zzanswer", [](const expr_func_t* f, vec_expr_t* args, void* c) -> expr_result_t { return 42.0; });
+        CHECK_EQ(eval("zzanswer() + 1").as_number(), 43.0);
+        CHECK_EQ(eval("zzanswer() + 1").as_number(), 43.0);
+
+        REQUIRE(expr_unregister_function("zzanswer"));
+        expr_register_function("zzanswer", [](const expr_func_t* f, vec_expr_t* args, void* c) -> expr_result_t { return 1.0; });
+        CHECK_EQ(eval("zzanswer() + 1").as_number(), 2.0);
+
+        CHECK(expr_unregister_function("zzanswer"));
+    }
+
+    TEST_CASE("Cache eviction")
+    {
+        // Evaluate more expressions than the cache can hold, so least recently used ones get replaced.
+        char buffer[64];
+        for (unsigned pass = 0; pass < 2; ++pass)
+        {
+            for (unsigned i = 0; i < 1500; ++i)
+            {
+                string_t expression = string_format(STRING_BUFFER(buffer), STRING_CONST("%u + %u"), i, pass);
+                CHECK_EQ(eval(STRING_ARGS(expression)).as_number(), (double)(i + pass));
+
+                // Keep a few expressions in use, so they stay cached.
+                CHECK_EQ(eval("1 + 1").as_number(), 2.0);
+            }
+        }
+    }
+
+    TEST_CASE("Positional frames")
+    {
+        expr_set_global_var(STRING_CONST("$1"), 7.0);
+        expr_set_global_var(STRING_CONST("$2"), 8.0);
+
+        test_expr("MAP([[1, 2], [3, 4]], $1 * 10 + $2) == [12, 34]", true);
+        test_expr("MAP([[1, 2], 3], $2) == [2, 8]", true);
+        test_expr("MAP([[1, 2], [3, 4]], SUM(MAP([5, 6], $1))) == [11, 11]", true);
+        test_expr("SUM(MAP([[1, 2], [3, 4]], SUM(FILTER([5, 6], $1 > 5)) + $1))", 16.0);
+        test_expr("MAP([1, 2, 3], REDUCE([10, 20], $0 + $1, 0) + $1) == [31, 32, 33]", true);
+
+        // Bound variables get their previous value back once the iteration completes
+        CHECK_EQ(expr_get_global_var_value(STRING_CONST("$1")).as_number(), 7.0);
+        CHECK_EQ(expr_get_global_var_value(STRING_CONST("$2")).as_number(), 8.0);
+
+        double values[1000];
+        for (unsigned i = 0; i < ARRAY_COUNT(values); ++i)
+            values[i] = i % 2 ? (double)i : -(double)i;
+        expr_get_or_create_global_var(STRING_CONST("zzvalues"))->value = expr_result_t(values, sizeof(double), ARRAY_COUNT(values), EXPR_POINTER_ARRAY_FLOAT);
+        CHECK_EQ(eval("COUNT(FILTER(zzvalues, $1 > 0))").as_number(), 500.0);
+
+        // Unbind the variable before the values go out of scope
+        expr_get_or_create_global_var(STRING_CONST("zzvalues"))->value = NIL;
+
+        // Elements with many members bind as many positional variables
+        test_expr("MAP([[1, 2, 3, 4, 5, 6, 7, 8, 9, 10], [11, 12, 13, 14, 15, 16, 17, 18, 19, 20]], $10 + $2) == [12, 32]", true);
+        CHECK_EQ(expr_get_global_var_value(STRING_CONST("$2")).as_number(), 8.0);
+
+        // Members that cannot be bound to a positional variable are reported
+        char expression[1024];
+        size_t length = string_copy(STRING_BUFFER(expression), STRING_CONST("MAP([[0")).length;
+        for (unsigned i = 1; i < 100; ++i)
+            length += string_format(expression + length, sizeof(expression) - length, STRING_CONST(", %u"), i).length;
+        length += string_copy(expression + length, sizeof(expression) - length, STRING_CONST("]], $1)")).length;
+        CHECK(eval(expression, length).is_null());
+        CHECK_EQ(EXPR_ERROR_CODE, EXPR_ERROR_INVALID_ARGUMENT);
+        CHECK_EQ(expr_get_global_var_value(STRING_CONST("$1")).as_number(), 7.0);
+    }
+
+    TEST_CASE("Aggregates")
+    {
+        test_expr("VARIANCE(2, 4, 4, 4, 5, 5, 7, 9) == 32/7", true);
+        CHECK_EQ(eval("STDDEV([1, 2, 3, 4])").as_number(), doctest::Approx(math_sqrt(5.0 / 3.0)));
+        test_expr("VARIANCE([1, 2], [3, 4], 5) == VARIANCE(1, 2, 3, 4, 5)", true);
+        CHECK(eval("VARIANCE(1)").is_null());
+
+        // Odd sizes exercise the vector loops and their scalar tails
+        static double f64[1003];
+        static float f32[1003];
+        static int16_t i16[1003];
+        static uint8_t u8[1003];
+        double sum = 0, vmin = DBL_MAX, vmax = -DBL_MAX, count = 0;
+        for (unsigned i = 0; i < ARRAY_COUNT(f64); ++i)
+        {
+            f64[i] = f32[i] = i16[i] = (int16_t)((int)((i * 37) % 200) - 100);
+            u8[i] = (uint8_t)(i % 256);
+            if (i % 100 == 7)
+            {
+                f64[i] = f32[i] = NAN;
+                continue;
+            }
+
+            sum += f64[i];
+            vmin = min(vmin, f64[i]);
+            vmax = max(vmax, f64[i]);
+            count++;
+        }
+
+        double m2 = 0;
+        for (unsigned i = 0; i < ARRAY_COUNT(f64); ++i)
+        {
+            if (i % 100 != 7)
+                m2 += (f64[i] - sum / count) * (f64[i] - sum / count);
+        }
+
+        expr_get_or_create_global_var(STRING_CONST("zzf64"))->value = expr_result_t(f64, sizeof(f64[0]), ARRAY_COUNT(f64), EXPR_POINTER_ARRAY | EXPR_POINTER_ARRAY_FLOAT);
+        expr_get_or_create_global_var(STRING_CONST("zzf32"))->value = expr_result_t(f32, sizeof(f32[0]), ARRAY_COUNT(f32), EXPR_POINTER_ARRAY | EXPR_POINTER_ARRAY_FLOAT);
+        expr_get_or_create_global_var(STRING_CONST("zzi16"))->value = expr_result_t(i16, sizeof(i16[0]), ARRAY_COUNT(i16), EXPR_POINTER_ARRAY | EXPR_POINTER_ARRAY_INTEGER);
+        expr_get_or_create_global_var(STRING_CONST("zzu8"))->value = expr_result_t(u8, sizeof(u8[0]), ARRAY_COUNT(u8), EXPR_POINTER_ARRAY | EXPR_POINTER_ARRAY_UNSIGNED);
+
+        for (const char* name : { "zzf64", "zzf32" })
+        {
+            char expr[64];
+            CHECK_EQ(eval(string_format(STRING_BUFFER(expr), STRING_CONST("SUM(%s)"), name).str).as_number(), doctest::Approx(sum));
+            CHECK_EQ(eval(string_format(STRING_BUFFER(expr), STRING_CONST("MIN(%s)"), name).str).as_number(), vmin);
+            CHECK_EQ(eval(string_format(STRING_BUFFER(expr), STRING_CONST("MAX(%s)"), name).str).as_number(), vmax);
+            CHECK_EQ(eval(string_format(STRING_BUFFER(expr), STRING_CONST("AVG(%s)"), name).str).as_number(), doctest::Approx(sum / count));
+            CHECK_EQ(eval(string_format(STRING_BUFFER(expr), STRING_CONST("VARIANCE(%s)"), name).str).as_number(), doctest::Approx(m2 / (count - 1)));
+        }
+
+        // NaN values are not counted either
+        CHECK_EQ(eval("COUNT(zzf64)").as_number(), count);
+        CHECK_EQ(eval("COUNT(zzf32)").as_number(), count);
+        CHECK_EQ(eval("COUNT(zzi16)").as_number(), (double)ARRAY_COUNT(i16));
+        CHECK_EQ(eval("COUNT(zzf64, 1, [2, 3])").as_number(), count + 3);
+
+        CHECK_EQ(eval("MIN(zzi16)").as_number(), -100.0);
+        CHECK_EQ(eval("MAX(zzi16)").as_number(), 99.0);
+        CHECK_EQ(eval("SUM(zzu8)").as_number(), (double)(3 * (255 * 256 / 2) + (234 * 235 / 2)));
+        CHECK_EQ(eval("MAX(zzu8)").as_number(), 255.0);
+
+        // Pairwise summation keeps large sums accurate
+        const uint32_t large_count = 1 << 22;
+        float* values = (float*)memory_allocate(0, sizeof(float) * large_count, 16, MEMORY_TEMPORARY);
+        for (uint32_t i = 0; i < large_count; ++i)
+            values[i] = 0.1f;
+        expr_get_or_create_global_var(STRING_CONST("zzlarge"))->value = expr_result_t(values, sizeof(float), large_count, EXPR_POINTER_ARRAY | EXPR_POINTER_ARRAY_FLOAT);
+        CHECK_EQ(eval("SUM(zzlarge)").as_number(), doctest::Approx((double)0.1f * large_count).epsilon(1e-12));
+        CHECK_EQ(eval("VARIANCE(zzlarge)").as_number(), doctest::Approx(0).epsilon(1e-12));
+
+        // Unbind the variable before its values get released
+        expr_get_or_create_global_var(STRING_CONST("zzlarge"))->value = NIL;
+        memory_deallocate(values);
+    }
 }
 
 #endif // BUILD_TESTS
@@ -0,0 +1,308 @@
+/*
+ * Copyright 2022-2023 - All rights reserved.
+ * License: https://wiimag.com/LICENSE
+ */
+
+#include <foundation/platform.h>
+
+#if BUILD_TESTS
+
+#include "test_utils.h"
+
+#include <framework/jobs.h>
+
+#include <doctest/doctest.h>
+
+TEST_SUITE("Jobs")
+{
+    TEST_CASE("Execute")
+    {
+        job_t* job = job_execute([](payload_t* payload) { return 42; });
+        REQUIRE_NE(job, nullptr);
+
+        job_wait(job);
+        CHECK(job_completed(job));
+        CHECK_EQ(job->status, 42);
+
+        job_deallocate(job);
+        CHECK_EQ(job, nullptr);
+    }
+
+    TEST_CASE("Deallocate Pending")
+    {
+        static atomic32_t count;
+        atomic_store32(&count, 0, memory_order_release);
+
+        // Jobs deallocated while they are still pending or running are released by the thread that completes them.
+        for (int i = 0; i < 1000; ++i)
+        {
+            job_t* job = job_execute([](payload_t* payload)
+            {
+                atomic_incr32(&count, memory_order_release);
+                return 0;
+            });
+            job_deallocate(job);
+            CHECK_EQ(job, nullptr);
+        }
+
+        const tick_t timeout = time_current();
+        while (atomic_load32(&count, memory_order_acquire) != 1000 && time_elapsed(timeout) < 10.0)
+            thread_yield();
+        CHECK_EQ(atomic_load32(&count, memory_order_acquire), 1000);
+    }
+
+    TEST_CASE("Submit")
+    {
+        struct payload_data_t
+        {
+            int32_t value;
+            atomic32_t* count;
+        };
+
+        static atomic32_t count;
+        atomic_store32(&count, 0, memory_order_release);
+
+        for (int32_t i = 0; i < 100; ++i)
+        {
+            // The payload is copied in the job, so it can go out of scope.
+            payload_data_t data{ i + 1, &count };
+            job_submit([](payload_t* payload)
+            {
+                payload_data_t* data = (payload_data_t*)payload;
+                atomic_add32(data->count, data->value, memory_order_relaxed);
+                return 0;
+            }, &data, sizeof(data));
+        }
+
+        const tick_t timeout = time_current();
+        while (atomic_load32(&count, memory_order_acquire) != 5050 && time_elapsed(timeout) < 10.0)
+            thread_yield();
+        CHECK_EQ(atomic_load32(&count, memory_order_acquire), 5050);
+    }
+
+    TEST_CASE("Then")
+    {
+        static atomic32_t sequence;
+        static int32_t order[3];
+        atomic_store32(&sequence, 0, memory_order_release);
+
+        job_t* first = job_execute([](payload_t* payload)
+        {
+            order[0] = atomic_incr32(&sequence, memory_order_acq_rel);
+            return 1;
+        });
+
+        job_t* second = job_then(first, [](payload_t* payload)
+        {
+            order[1] = atomic_incr32(&sequence, memory_order_acq_rel);
+            return 2;
+        });
+
+        job_t* third = job_then(second, [](payload_t* payload)
+        {
+            order[2] = atomic_incr32(&sequence, memory_order_acq_rel);
+            return 3;
+        });
+
+        job_wait(third);
+        CHECK(job_completed(first));
+        CHECK(job_completed(second));
+        CHECK_EQ(order[0], 1);
+        CHECK_EQ(order[1], 2);
+        CHECK_EQ(order[2], 3);
+        CHECK_EQ(third->status, 3);
+
+        SUBCASE("Completed")
+        {
+            job_t* late = job_then(first, [](payload_t* payload) { return 4; });
+            job_wait(late);
+            CHECK_EQ(late->status, 4);
+            job_deallocate(late);
+        }
+
+        SUBCASE("Never Executed")
+        {
+            job_t* pending = job_allocate();
+            job_t* never = job_then(pending, [](payload_t* payload) { return 5; });
+            job_deallocate(pending);
+
+            // The continuation is released with its job and completed without being executed.
+            CHECK(job_completed(never));
+            CHECK_EQ(never->status, 0);
+            job_deallocate(never);
+            CHECK_EQ(never, nullptr);
+        }
+
+        job_deallocate(first);
+        job_deallocate(second);
+        job_deallocate(third);
+    }
+
+    TEST_CASE("Continuations")
+    {
+        static atomic32_t count;
+        atomic_store32(&count, 0, memory_order_release);
+
+        // Continuations added while their job runs on any thread are scheduled once it completes.
+        job_t* jobs[100];
+        job_t* continuations[ARRAY_COUNT(jobs)];
+        for (unsigned i = 0; i < ARRAY_COUNT(jobs); ++i)
+        {
+            jobs[i] = job_execute([](payload_t* payload) { return 1; });
+            continuations[i] = job_then(jobs[i], [](payload_t* payload)
+            {
+                // The continuation is executed after its job completed.
+                job_t* job = (job_t*)payload;
+                atomic_incr32(&count, memory_order_relaxed);
+                return job_completed(job) ? job->status + 1 : 0;
+            }, jobs[i]);
+        }
+
+        for (unsigned i = 0; i < ARRAY_COUNT(jobs); ++i)
+        {
+            job_wait(continuations[i]);
+            CHECK_EQ(continuations[i]->status, 2);
+            job_deallocate(continuations[i]);
+            job_deallocate(jobs[i]);
+        }
+        CHECK_EQ(atomic_load32(&count, memory_order_acquire), 100);
+    }
+
+    TEST_CASE("Stealing")
+    {
+        static atomic32_t count;
+        atomic_store32(&count, 0, memory_order_release);
+
+        // The parent job pushes its children in the deque of its worker and never executes them itself,
+        // so every child gets stolen by another worker or by the waiting thread.
+        job_t* parent = job_execute([](payload_t* payload)
+        {
+            job_group_t group{};
+            for (int i = 0; i < 1000; ++i)
+            {
+                job_group_execute(group, [](payload_t* payload)
+                {
+                    atomic_incr32(&count, memory_order_relaxed);
+                    return 0;
+                });
+            }
+
+            const tick_t timeout = time_current();
+            while (!job_group_completed(group) && time_elapsed(timeout) < 10.0)
+                thread_sleep(1);
+            job_group_wait(group);
+            return atomic_load32(&count, memory_order_acquire);
+        });
+
+        job_wait(parent);
+        CHECK_EQ(parent->status, 1000);
+        job_deallocate(parent);
+    }
+
+    TEST_CASE("Nested Submission")
+    {
+        static atomic32_t count;
+        atomic_store32(&count, 0, memory_order_release);
+
+        // Each job submits two child jobs until the tree is 10 levels deep.
+        static job_handler_t spawn = [](payload_t* payload)
+        {
+            atomic_incr32(&count, memory_order_relaxed);
+            const uint32_t depth = *(uint32_t*)payload;
+            if (depth > 0)
+            {
+                uint32_t child_depth = depth - 1;
+                job_submit(spawn, &child_depth, sizeof(child_depth));
+                job_submit(spawn, &child_depth, sizeof(child_depth));
+            }
+            return 0;
+        };
+
+        uint32_t depth = 10;
+        job_submit(spawn, &depth, sizeof(depth));
+
+        const tick_t timeout = time_current();
+        while (atomic_load32(&count, memory_order_acquire) != 2047 && time_elapsed(timeout) < 10.0)
+            thread_yield();
+        CHECK_EQ(atomic_load32(&count, memory_order_acquire), 2047);
+    }
+
+    TEST_CASE("Group")
+    {
+        static atomic32_t count;
+        atomic_store32(&count, 0, memory_order_release);
+
+        job_group_t group{};
+        for (int i = 0; i < 100; ++i)
+        {
+            job_group_execute(group, [](payload_t* payload)
+            {
+                atomic_incr32(&count, memory_order_relaxed);
+                return 0;
+            });
+        }
+
+        job_group_wait(group);
+        CHECK(job_group_completed(group));
+        CHECK_EQ(atomic_load32(&count, memory_order_acquire), 100);
+    }
+
+    TEST_CASE("Parallel For")
+    {
+        SUBCASE("Default")
+        {
+            uint32_t values[1000] = { 0 };
+            job_parallel_for(0, ARRAY_COUNT(values), 0, [&values](uint32_t begin, uint32_t end)
+            {
+                for (uint32_t i = begin; i < end; ++i)
+                    values[i] += i;
+            });
+
+            for (uint32_t i = 0; i < ARRAY_COUNT(values); ++i)
+                CHECK_EQ(values[i], i);
+        }
+
+        SUBCASE("Grain")
+        {
+            atomic32_t count{ 0 };
+            job_parallel_for(10, 1000, 7, [&count](uint32_t begin, uint32_t end)
+            {
+                CHECK_LE(end - begin, 7);
+                atomic_add32(&count, (int32_t)(end - begin), memory_order_relaxed);
+            });
+            CHECK_EQ(atomic_load32(&count, memory_order_acquire), 990);
+        }
+
+        SUBCASE("Empty")
+        {
+            bool called = false;
+            job_parallel_for(5, 5, 0, [&called](uint32_t begin, uint32_t end) { called = true; });
+            CHECK_FALSE(called);
+        }
+
+        SUBCASE("Nested")
+        {
+            static atomic32_t count;
+            atomic_store32(&count, 0, memory_order_release);
+
+            job_group_t group{};
+            for (int i = 0; i < 8; ++i)
+            {
+                job_group_execute(group, [](payload_t* payload)
+                {
+                    // Jobs help executing other jobs while they wait for theirs
+                    job_parallel_for(0, 100, 3, [](uint32_t begin, uint32_t end)
+                    {
+                        atomic_add32(&count, (int32_t)(end - begin), memory_order_relaxed);
+                    });
+                    return 0;
+                });
+            }
+
+            job_group_wait(group);
+            CHECK_EQ(atomic_load32(&count, memory_order_acquire), 800);
+        }
+    }
+}
+
+#endif // BUILD_TESTS
@@ -0,0 +1,759 @@
+/*
+ * License: https://wiimag.com/LICENSE
+ * Copyright 2023 Wiimag inc. All rights reserved.
+ */
+
+#include <foundation/platform.h>
+
+#if BUILD_TESTS
+
+#include "test_utils.h"
+
+#include <framework/search_database.h>
+#include <framework/jobs.h>
+#include <framework/array.h>
+
+#include <foundation/fs.h>
+#include <foundation/path.h>
+#include <foundation/stream.h>
+#include <foundation/thread.h>
+
+#include <algorithm>
+
+#include <doctest/doctest.h>
+
+constexpr const char* SEARCH_DATABASE_TEST_SECTORS[] = { "mango", "melon", "peach", "plum" };
+
+/*! Returns the name of the test document #index, i.e. doc42. */
+FOUNDATION_STATIC string_const_t search_database_test_document_name(unsigned index)
+{
+    return string_format_static(STRING_CONST("doc%u"), index);
+}
+
+/*! Index a test document, its words and properties are derived from its #index, see #search_database_test_expect. */
+FOUNDATION_STATIC search_document_handle_t search_database_test_add_document(search_database_t* db, unsigned index)
+{
+    string_const_t name = search_database_test_document_name(index);
+    search_document_handle_t doc = search_database_add_document(db, STRING_ARGS(name));
+
+    string_const_t text = string_format_static(STRING_CONST("%s%s%s number%u"),
+        index % 2 == 0 ? "even" : "odd",
+        index % 3 == 0 ? " three" : "",
+        index % 5 == 0 ? " five" : "", index);
+    search_database_index_text(db, doc, STRING_ARGS(text));
+    search_database_index_property(db, doc, STRING_CONST("price"), (double)(index % 100));
+
+    const char* sector = SEARCH_DATABASE_TEST_SECTORS[index % ARRAY_COUNT(SEARCH_DATABASE_TEST_SECTORS)];
+    search_database_index_property(db, doc, STRING_CONST("sector"), sector, string_length(sector));
+    return doc;
+}
+
+FOUNDATION_STATIC search_document_handle_t* search_database_test_add_documents(search_database_t* db, unsigned begin, unsigned end, search_document_handle_t* docs = nullptr)
+{
+    for (unsigned i = begin; i < end; ++i)
+        array_push(docs, search_database_test_add_document(db, i));
+    return docs;
+}
+
+/*! Returns the sorted document handles matching #query. */
+FOUNDATION_STATIC search_document_handle_t* search_database_test_query(search_database_t* db, const char* query)
+{
+    search_query_handle_t handle = search_database_query(db, query, string_length(query));
+    REQUIRE_NE(handle, SEARCH_QUERY_INVALID_ID);
+
+    search_document_handle_t* ids = nullptr;
+    const search_result_t* results = search_database_query_results(db, handle);
+    for (unsigned i = 0, end = array_size(results); i < end; ++i)
+        array_push(ids, (search_document_handle_t)results[i].id);
+    search_database_query_dispose(db, handle);
+    return ids;
+}
+
+/*! Returns the handles of the valid documents in #docs that satisfy #predicate. */
+template<typename Predicate>
+FOUNDATION_STATIC search_document_handle_t* search_database_test_expect(search_database_t* db, const search_document_handle_t* docs, const Predicate& predicate)
+{
+    search_document_handle_t* ids = nullptr;
+    for (unsigned i = 0, end = array_size(docs); i < end; ++i)
+    {
+        if (search_database_is_document_valid(db, docs[i]) && predicate(i))
+            array_push(ids, docs[i]);
+    }
+    return ids;
+}
+
+FOUNDATION_STATIC bool search_database_test_equal(const search_document_handle_t* a, const search_document_handle_t* b)
+{
+    if (array_size(a) != array_size(b))
+        return false;
+    for (unsigned i = 0, end = array_size(a); i < end; ++i)
+    {
+        if (a[i] != b[i])
+            return false;
+    }
+    return true;
+}
+
+FOUNDATION_STATIC bool search_database_test_is_sorted(const search_document_handle_t* ids)
+{
+    for (unsigned i = 1, end = array_size(ids); i < end; ++i)
+    {
+        if (ids[i - 1] >= ids[i])
+            return false;
+    }
+    return true;
+}
+
+/*! Checks that #query matches the documents selected by #predicate. */
+template<typename Predicate>
+FOUNDATION_STATIC void search_database_test_check_query(search_database_t* db, const search_document_handle_t* docs, const char* query, const Predicate& predicate)
+{
+    INFO(string_to_const(query));
+    search_document_handle_t* results = search_database_test_query(db, query);
+    search_document_handle_t* expected = search_database_test_expect(db, docs, predicate);
+    CHECK(search_database_test_is_sorted(results));
+    CHECK_EQ(array_size(results), array_size(expected));
+    CHECK(search_database_test_equal(results, expected));
+    array_deallocate(expected);
+    array_deallocate(results);
+}
+
+/*! Checks that both databases return the same results for a set of queries. */
+FOUNDATION_STATIC void search_database_test_check_same_results(search_database_t* a, search_database_t* b)
+{
+    static const char* queries[] = {
+        "even", "three five", "even -three", "three or five", "(three or five) -even",
+        "price>50", "price<=10 five", "sector=plum", "sector:mel", "number42", "zzz" };
+
+    for (const char* query : queries)
+    {
+        INFO(string_to_const(query));
+        search_document_handle_t* ra = search_database_test_query(a, query);
+        search_document_handle_t* rb = search_database_test_query(b, query);
+        CHECK(search_database_test_equal(ra, rb));
+        array_deallocate(rb);
+        array_deallocate(ra);
+    }
+}
+
+FOUNDATION_STATIC string_t search_database_test_temporary_path(char* buffer, size_t capacity)
+{
+    string_t path = path_make_temporary(buffer, capacity);
+    string_const_t dir = path_directory_name(STRING_ARGS(path));
+    fs_make_directory(STRING_ARGS(dir));
+    return path;
+}
+
+FOUNDATION_STATIC bool search_database_test_save(search_database_t* db, string_t path)
+{
+    stream_t* stream = fs_open_file(STRING_ARGS(path), STREAM_CREATE | STREAM_OUT | STREAM_BINARY | STREAM_TRUNCATE);
+    REQUIRE_NE(stream, nullptr);
+    const bool saved = search_database_save(db, stream);
+    stream_deallocate(stream);
+    return saved;
+}
+
+FOUNDATION_STATIC bool search_database_test_load(search_database_t* db, string_t path)
+{
+    stream_t* stream = fs_open_file(STRING_ARGS(path), STREAM_IN | STREAM_BINARY);
+    REQUIRE_NE(stream, nullptr);
+    const bool loaded = search_database_load(db, stream);
+    stream_deallocate(stream);
+    return loaded;
+}
+
+TEST_SUITE("SearchDatabase")
+{
+    TEST_CASE("Batch Commit")
+    {
+        search_database_t* db = search_database_allocate();
+        search_database_t* reference = search_database_allocate();
+
+        search_database_begin_batch(db);
+        search_document_handle_t* docs = search_database_test_add_documents(db, 0, 300);
+
+        // Staged entries are not visible until the batch gets committed.
+        search_document_handle_t* results = search_database_test_query(db, "even");
+        CHECK_EQ(array_size(results), 0);
+        array_deallocate(results);
+
+        // Only the outer most batch merges the staged entries.
+        search_database_begin_batch(db);
+        CHECK_FALSE(search_database_commit_batch(db));
+
+        // Staged entries of documents removed during the batch are dropped.
+        CHECK(search_database_remove_document(db, docs[10]));
+        CHECK(search_database_remove_document(db, docs[11]));
+        CHECK(search_database_commit_batch(db));
+
+        search_document_handle_t* reference_docs = search_database_test_add_documents(reference, 0, 300);
+        CHECK(search_database_remove_document(reference, reference_docs[10]));
+        CHECK(search_database_remove_document(reference, reference_docs[11]));
+
+        CHECK_EQ(search_database_document_count(db), 298);
+        CHECK_EQ(search_database_word_count(db), search_database_word_count(reference));
+        search_database_test_check_same_results(db, reference);
+        search_database_test_check_query(db, docs, "even", [](unsigned i) { return i % 2 == 0; });
+        CHECK_EQ(search_database_word_document_count(db, STRING_CONST("number10"), false), 0);
+
+        array_deallocate(reference_docs);
+        array_deallocate(docs);
+        search_database_deallocate(reference);
+        search_database_deallocate(db);
+    }
+
+    TEST_CASE("Sorted Set Algebra")
+    {
+        search_database_t* db = search_database_allocate();
+        search_document_handle_t* docs = search_database_test_add_documents(db, 0, 500);
+        for (unsigned i = 0; i < 500; i += 7)
+            search_database_remove_document(db, docs[i]);
+
+        search_database_test_check_query(db, docs, "even", [](unsigned i) { return i % 2 == 0; });
+        search_database_test_check_query(db, docs, "even three", [](unsigned i) { return i % 2 == 0 && i % 3 == 0; });
+        search_database_test_check_query(db, docs, "three or five", [](unsigned i) { return i % 3 == 0 || i % 5 == 0; });
+        search_database_test_check_query(db, docs, "even -three", [](unsigned i) { return i % 2 == 0 && i % 3 != 0; });
+        search_database_test_check_query(db, docs, "-even", [](unsigned i) { return i % 2 != 0; });
+        search_database_test_check_query(db, docs, "(three or five) -even", [](unsigned i) { return (i % 3 == 0 || i % 5 == 0) && i % 2 != 0; });
+        search_database_test_check_query(db, docs, "odd three five", [](unsigned i) { return i % 2 != 0 && i % 15 == 0; });
+        search_database_test_check_query(db, docs, "zzz or five", [](unsigned i) { return i % 5 == 0; });
+        search_database_test_check_query(db, docs, "zzz five", [](unsigned) { return false; });
+
+        array_deallocate(docs);
+        search_database_deallocate(db);
+    }
+
+    TEST_CASE("Compressed Posting Lists")
+    {
+        char path_buffer[BUILD_MAX_PATHLEN];
+        string_t path = search_database_test_temporary_path(STRING_BUFFER(path_buffer));
+
+        search_database_t* db = search_database_allocate(SearchDatabaseFlags::CompressPostingLists);
+        search_database_t* reference = search_database_allocate();
+        search_document_handle_t* docs = search_database_test_add_documents(db, 0, 2000);
+        search_document_handle_t* reference_docs = search_database_test_add_documents(reference, 0, 2000);
+        for (unsigned i = 0; i < 2000; i += 11)
+        {
+            search_database_remove_document(db, docs[i]);
+            search_database_remove_document(reference, reference_docs[i]);
+        }
+
+        search_database_test_check_same_results(db, reference);
+        search_database_test_check_query(db, docs, "even three", [](unsigned i) { return i % 6 == 0 && i % 11 != 0; });
+
+        // Saved posting lists are always compressed, whether they are compressed in memory or not.
+        REQUIRE(search_database_test_save(reference, path));
+        search_database_t* loaded = search_database_allocate(SearchDatabaseFlags::CompressPostingLists);
+        REQUIRE(search_database_test_load(loaded, path));
+        CHECK_EQ(search_database_document_count(loaded), search_database_document_count(reference));
+        search_database_test_check_same_results(loaded, reference);
+
+        // Loaded lists can still be modified.
+        search_database_test_add_documents(loaded, 2000, 2100);
+        search_database_test_add_documents(reference, 2000, 2100);
+        search_database_test_check_same_results(loaded, reference);
+
+        search_database_deallocate(loaded);
+        fs_remove_file(STRING_ARGS(path));
+        array_deallocate(reference_docs);
+        array_deallocate(docs);
+        search_database_deallocate(reference);
+        search_database_deallocate(db);
+    }
+
+    TEST_CASE("Mapped File")
+    {
+        char path_buffer[BUILD_MAX_PATHLEN];
+        string_t path = search_database_test_temporary_path(STRING_BUFFER(path_buffer));
+
+        search_database_t* reference = search_database_allocate();
+        search_document_handle_t* docs = search_database_test_add_documents(reference, 0, 1000);
+        for (unsigned i = 0; i < 1000; i += 9)
+            search_database_remove_document(reference, docs[i]);
+        REQUIRE(search_database_test_save(reference, path));
+
+        search_database_t* db = search_database_allocate();
+        REQUIRE(search_database_map_file(db, STRING_ARGS(path)));
+        CHECK(search_database_is_mapped(db));
+        CHECK_EQ(search_database_document_count(db), search_database_document_count(reference));
+        search_database_test_check_same_results(db, reference);
+
+        // The first modification promotes the mapped data to the heap.
+        search_database_test_add_documents(db, 1000, 1100);
+        search_database_remove_document(db, docs[1]);
+        CHECK_FALSE(search_database_is_mapped(db));
+
+        search_database_test_add_documents(reference, 1000, 1100);
+        search_database_remove_document(reference, docs[1]);
+        search_database_test_check_same_results(db, reference);
+
+        search_database_deallocate(db);
+        fs_remove_file(STRING_ARGS(path));
+        array_deallocate(docs);
+        search_database_deallocate(reference);
+    }
+
+    TEST_CASE("Mapped Shards")
+    {
+        char path_buffer[BUILD_MAX_PATHLEN];
+        string_t path = search_database_test_temporary_path(STRING_BUFFER(path_buffer));
+
+        search_database_t* reference = search_database_allocate(SearchDatabaseFlags::None, 16);
+        search_document_handle_t* docs = search_database_test_add_documents(reference, 0, 1000);
+        REQUIRE(search_database_test_save(reference, path));
+
+        search_database_t* db = search_database_allocate(SearchDatabaseFlags::None, 16);
+        REQUIRE(search_database_map_file(db, STRING_ARGS(path)));
+        REQUIRE(search_database_is_mapped(db));
+
+        // Removing a document only promotes the few shards indexing it, the other shards stay mapped.
+        search_database_remove_document(db, docs[1]);
+        search_database_remove_document(reference, docs[1]);
+        CHECK(search_database_is_mapped(db));
+        search_database_test_check_same_results(db, reference);
+
+        search_database_deallocate(db);
+        fs_remove_file(STRING_ARGS(path));
+        array_deallocate(docs);
+        search_database_deallocate(reference);
+    }
+
+    TEST_CASE("Shards")
+    {
+        static search_database_t* db = nullptr;
+        db = search_database_allocate(SearchDatabaseFlags::None, 4);
+        search_database_t* reference = search_database_allocate();
+
+        // Documents are added first, so their handles do not depend on the indexing order.
+        search_document_handle_t* docs = nullptr;
+        for (unsigned i = 0; i < 1000; ++i)
+        {
+            string_const_t name = search_database_test_document_name(i);
+            array_push(docs, search_database_add_document(db, STRING_ARGS(name)));
+        }
+
+        static search_document_handle_t* shard_docs = nullptr;
+        shard_docs = docs;
+        job_parallel_for(0, 1000, 50, [](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t i = begin; i < end; ++i)
+            {
+                string_const_t text = string_format_static(STRING_CONST("%s%s number%u"), i % 2 == 0 ? "even" : "odd", i % 3 == 0 ? " three" : "", i);
+                search_database_index_text(db, shard_docs[i], STRING_ARGS(text));
+                search_database_index_property(db, shard_docs[i], STRING_CONST("price"), (double)(i % 100));
+            }
+        });
+
+        search_document_handle_t* reference_docs = nullptr;
+        for (unsigned i = 0; i < 1000; ++i)
+        {
+            string_const_t name = search_database_test_document_name(i);
+            search_document_handle_t doc = search_database_add_document(reference, STRING_ARGS(name));
+            string_const_t text = string_format_static(STRING_CONST("%s%s number%u"), i % 2 == 0 ? "even" : "odd", i % 3 == 0 ? " three" : "", i);
+            search_database_index_text(reference, doc, STRING_ARGS(text));
+            search_database_index_property(reference, doc, STRING_CONST("price"), (double)(i % 100));
+            array_push(reference_docs, doc);
+        }
+
+        CHECK_EQ(search_database_word_count(db), search_database_word_count(reference));
+        search_database_test_check_query(db, docs, "even three", [](unsigned i) { return i % 6 == 0; });
+        search_database_test_check_query(db, docs, "odd -three price<10", [](unsigned i) { return i % 2 != 0 && i % 3 != 0 && i % 100 < 10; });
+        search_database_test_check_same_results(db, reference);
+
+        shard_docs = nullptr;
+        array_deallocate(reference_docs);
+        array_deallocate(docs);
+        search_database_deallocate(reference);
+        search_database_deallocate(db);
+    }
+
+    TEST_CASE("Many Shards")
+    {
+        // More shards than a thread can track shared locks on, shards must be locked one at a time.
+        search_database_t* db = search_database_allocate(SearchDatabaseFlags::None, 16);
+        search_document_handle_t* docs = search_database_test_add_documents(db, 0, 200);
+
+        search_database_remove_document(db, docs[6]);
+        search_database_print_stats(db);
+        search_database_test_check_query(db, docs, "even three", [](unsigned i) { return i % 6 == 0; });
+
+        array_deallocate(docs);
+        search_database_deallocate(db);
+    }
+
+    TEST_CASE("Lexicon")
+    {
+        search_database_t* db = search_database_allocate();
+        search_document_handle_t apple = search_database_add_document(db, STRING_CONST("apple"));
+        search_document_handle_t apricot = search_database_add_document(db, STRING_CONST("apricot"));
+        search_document_handle_t banana = search_database_add_document(db, STRING_CONST("banana"));
+        search_document_handle_t exact = search_database_add_document(db, STRING_CONST("exact"));
+        search_database_index_word(db, apple, STRING_CONST("apple"));
+        search_database_index_word(db, apricot, STRING_CONST("apricot"));
+        search_database_index_word(db, banana, STRING_CONST("banana"));
+        search_database_index_word(db, exact, STRING_CONST("application"), false);
+        search_database_index_word(db, banana, STRING_CONST("applesauce"));
+
+        CHECK(search_database_contains_word(db, STRING_CONST("apple")));
+        CHECK(search_database_contains_word(db, STRING_CONST("application")));
+        CHECK_FALSE(search_database_contains_word(db, STRING_CONST("appl")));
+
+        // Variations of the indexed words are found by walking the lexicon, words indexed without variations are not.
+        search_document_handle_t* results = search_database_test_query(db, "appl");
+        CHECK_EQ(array_size(results), 2);
+        CHECK(array_contains(results, apple));
+        CHECK(array_contains(results, banana));
+        array_deallocate(results);
+
+        results = search_database_test_query(db, "apr");
+        CHECK_EQ(array_size(results), 1);
+        CHECK(array_contains(results, apricot));
+        array_deallocate(results);
+
+        // Variations need at least 3 characters.
+        results = search_database_test_query(db, "ap");
+        CHECK_EQ(array_size(results), 0);
+        array_deallocate(results);
+
+        results = search_database_test_query(db, "application");
+        CHECK_EQ(array_size(results), 1);
+        CHECK(array_contains(results, exact));
+        array_deallocate(results);
+
+        results = search_database_test_query(db, "cherry");
+        CHECK_EQ(array_size(results), 0);
+        array_deallocate(results);
+
+        search_database_deallocate(db);
+    }
+
+    TEST_CASE("Ranking")
+    {
+        search_database_t* db = search_database_allocate(SearchDatabaseFlags::RankResults);
+        search_document_handle_t focused = search_database_add_document(db, STRING_CONST("focused"));
+        search_document_handle_t mentioned = search_database_add_document(db, STRING_CONST("mentioned"));
+        search_document_handle_t unrelated = search_database_add_document(db, STRING_CONST("unrelated"));
+        search_database_index_text(db, focused, STRING_CONST("zebra zebra zebra stripes"));
+        search_database_index_text(db, mentioned, STRING_CONST("zebra lion tiger giraffe elephant hippo rhino"));
+        search_database_index_text(db, unrelated, STRING_CONST("lion tiger"));
+
+        search_query_handle_t query = search_database_query(db, STRING_CONST("zebra"));
+        const search_result_t* results = search_database_query_results(db, query);
+        REQUIRE_EQ(array_size(results), 2);
+        int32_t focused_score = 0, mentioned_score = 0;
+        for (unsigned i = 0; i < 2; ++i)
+        {
+            if (results[i].id == focused)
+                focused_score = results[i].score;
+            else if (results[i].id == mentioned)
+                mentioned_score = results[i].score;
+        }
+        // Best results have the lowest scores.
+        CHECK_LT(mentioned_score, 0);
+        CHECK_LT(focused_score, mentioned_score);
+        search_database_query_dispose(db, query);
+
+        // Top-k results are sorted by score, best first.
+        query = search_database_query_top_k(db, STRING_CONST("zebra"), 1);
+        results = search_database_query_results(db, query);
+        REQUIRE_EQ(array_size(results), 1);
+        CHECK_EQ(results[0].id, focused);
+        search_database_query_dispose(db, query);
+
+        // Top-k keeps the same best results as a full query.
+        search_document_handle_t* docs = search_database_test_add_documents(db, 0, 500);
+        query = search_database_query(db, STRING_CONST("even three"));
+        const search_result_t* all = search_database_query_results(db, query);
+        search_query_handle_t top_query = search_database_query_top_k(db, STRING_CONST("even three"), 10);
+        const search_result_t* top = search_database_query_results(db, top_query);
+        REQUIRE_EQ(array_size(top), 10);
+        for (unsigned i = 1; i < array_size(top); ++i)
+            CHECK_LE(top[i - 1].score, top[i].score);
+
+        unsigned better = 0;
+        for (unsigned i = 0, end = array_size(all); i < end; ++i)
+        {
+            if (all[i].score < top[9].score)
+                better++;
+        }
+        CHECK_LE(better, 9U);
+        search_database_query_dispose(db, top_query);
+        search_database_query_dispose(db, query);
+
+        // The best results kept while scoring are the best results of the full query, including word variations matched many times.
+        const char* queries[] = { "even three", "number1", "odd number2", "three five", "five or three", "price>=90" };
+        for (const char* q : queries)
+        {
+            query = search_database_query(db, q, string_length(q));
+            top_query = search_database_query_top_k(db, q, string_length(q), 7);
+
+            search_result_t* expected = nullptr;
+            const search_result_t* full = search_database_query_results(db, query);
+            array_resize(expected, array_size(full));
+            memcpy(expected, full, sizeof(search_result_t) * array_size(full));
+            std::sort(expected, expected + array_size(expected), [](const search_result_t& a, const search_result_t& b)
+            {
+                return a.score < b.score || (a.score == b.score && a.id < b.id);
+            });
+
+            top = search_database_query_results(db, top_query);
+            REQUIRE_EQ(array_size(top), min(array_size(expected), 7U));
+            for (unsigned i = 0, end = array_size(top); i < end; ++i)
+            {
+                CHECK_EQ(top[i].id, expected[i].id);
+                CHECK_EQ(top[i].score, expected[i].score);
+            }
+
+            array_deallocate(expected);
+            search_database_query_dispose(db, top_query);
+            search_database_query_dispose(db, query);
+        }
+
+        array_deallocate(docs);
+        search_database_deallocate(db);
+    }
+
+    TEST_CASE("Batch Term Frequencies")
+    {
+        static const char* texts[] = {
+            "zebra zebra zebra stripes",
+            "zebra lion tiger giraffe elephant hippo rhino",
+            "lion lion tiger zebra zebra" };
+
+        search_database_t* db = search_database_allocate(SearchDatabaseFlags::RankResults);
+        search_database_t* reference = search_database_allocate(SearchDatabaseFlags::RankResults);
+        for (const char* text : texts)
+        {
+            search_document_handle_t ref = search_database_add_document(reference, STRING_CONST("doc"));
+            search_database_index_text(reference, ref, text, string_length(text));
+            search_database_index_text(reference, ref, STRING_CONST("lion zebra"));
+        }
+
+        // Index the repeated words in a first batch and then again with the words already indexed.
+        search_document_handle_t docs[ARRAY_COUNT(texts)];
+        search_database_begin_batch(db);
+        for (unsigned i = 0; i < ARRAY_COUNT(texts); ++i)
+        {
+            docs[i] = search_database_add_document(db, STRING_CONST("doc"));
+            search_database_index_text(db, docs[i], texts[i], string_length(texts[i]));
+        }
+        CHECK(search_database_commit_batch(db));
+        search_database_begin_batch(db);
+        for (unsigned i = 0; i < ARRAY_COUNT(texts); ++i)
+            search_database_index_text(db, docs[i], STRING_CONST("lion zebra"));
+        CHECK(search_database_commit_batch(db));
+
+        for (const char* word : { "zebra", "lion", "tiger" })
+        {
+            INFO(string_to_const(word));
+            search_query_handle_t query = search_database_query(db, word, string_length(word));
+            search_query_handle_t reference_query = search_database_query(reference, word, string_length(word));
+            const search_result_t* results = search_database_query_results(db, query);
+            const search_result_t* reference_results = search_database_query_results(reference, reference_query);
+            REQUIRE_EQ(array_size(results), array_size(reference_results));
+            for (unsigned i = 0, end = array_size(results); i < end; ++i)
+            {
+                CHECK_EQ(results[i].id, reference_results[i].id);
+                CHECK_EQ(results[i].score, reference_results[i].score);
+            }
+            search_database_query_dispose(reference, reference_query);
+            search_database_query_dispose(db, query);
+        }
+
+        search_database_deallocate(reference);
+        search_database_deallocate(db);
+    }
+
+    TEST_CASE("Numeric Ranges")
+    {
+        search_database_t* db = search_database_allocate();
+        search_document_handle_t* docs = search_database_test_add_documents(db, 0, 1000);
+        for (unsigned i = 0; i < 1000; i += 13)
+            search_database_remove_document(db, docs[i]);
+
+        search_database_test_check_query(db, docs, "price>50", [](unsigned i) { return i % 100 > 50; });
+        search_database_test_check_query(db, docs, "price>=50", [](unsigned i) { return i % 100 >= 50; });
+        search_database_test_check_query(db, docs, "price<10", [](unsigned i) { return i % 100 < 10; });
+        search_database_test_check_query(db, docs, "price<=10", [](unsigned i) { return i % 100 <= 10; });
+        search_database_test_check_query(db, docs, "price>98", [](unsigned i) { return i % 100 > 98; });
+        search_database_test_check_query(db, docs, "price>99", [](unsigned) { return false; });
+        search_database_test_check_query(db, docs, "price>=0", [](unsigned) { return true; });
+        search_database_test_check_query(db, docs, "price<=10 five", [](unsigned i) { return i % 100 <= 10 && i % 5 == 0; });
+        search_database_test_check_query(db, docs, "price>90 -even", [](unsigned i) { return i % 100 > 90 && i % 2 != 0; });
+
+        // Values indexed after the first range query are found too.
+        docs = search_database_test_add_documents(db, 1000, 1100, docs);
+        search_database_test_check_query(db, docs, "price>=95", [](unsigned i) { return i % 100 >= 95 && (i >= 1000 || i % 13 != 0); });
+
+        array_deallocate(docs);
+        search_database_deallocate(db);
+    }
+
+    TEST_CASE("Async Queries" * doctest::timeout(30))
+    {
+        static atomic32_t completed_count;
+        atomic_store32(&completed_count, 0, memory_order_release);
+
+        search_database_t* db = search_database_allocate();
+        search_document_handle_t* docs = search_database_test_add_documents(db, 0, 1000);
+
+        search_query_handle_t query = search_database_query_async(db, STRING_CONST("even three"), [](search_database_t*, search_query_handle_t)
+        {
+            atomic_incr32(&completed_count, memory_order_release);
+        });
+        REQUIRE_NE(query, SEARCH_QUERY_INVALID_ID);
+
+        const tick_t start = time_current();
+        while (!search_database_query_is_completed(db, query) && time_elapsed(start) < 10.0)
+            thread_sleep(1);
+        REQUIRE(search_database_query_is_completed(db, query));
+
+        const search_result_t* results = search_database_query_results(db, query);
+        search_document_handle_t* expected = search_database_test_expect(db, docs, [](unsigned i) { return i % 6 == 0; });
+        REQUIRE_EQ(array_size(results), array_size(expected));
+        for (unsigned i = 0, end = array_size(results); i < end; ++i)
+            CHECK_EQ(results[i].id, expected[i]);
+        array_deallocate(expected);
+        CHECK(search_database_query_dispose(db, query));
+        CHECK_EQ(search_database_query_results(db, query), nullptr);
+
+        while (atomic_load32(&completed_count, memory_order_acquire) == 0 && time_elapsed(start) < 10.0)
+            thread_sleep(1);
+        CHECK_EQ(atomic_load32(&completed_count, memory_order_acquire), 1);
+
+        // Superseded queries get cancelled, only the last one is kept.
+        search_query_handle_t last = SEARCH_QUERY_INVALID_ID;
+        search_query_handle_t handles[16];
+        for (unsigned i = 0; i < ARRAY_COUNT(handles); ++i)
+        {
+            handles[i] = search_database_query_async(db, STRING_CONST("odd or five"), nullptr, last);
+            last = handles[i];
+        }
+
+        while (!search_database_query_is_completed(db, last) && time_elapsed(start) < 20.0)
+            thread_sleep(1);
+        REQUIRE(search_database_query_is_completed(db, last));
+        for (unsigned i = 0; i < ARRAY_COUNT(handles) - 1; ++i)
+            CHECK_FALSE(search_database_query_is_completed(db, handles[i]));
+
+        search_document_handle_t* last_results = nullptr;
+        results = search_database_query_results(db, last);
+        for (unsigned i = 0, end = array_size(results); i < end; ++i)
+            array_push(last_results, (search_document_handle_t)results[i].id);
+        expected = search_database_test_expect(db, docs, [](unsigned i) { return i % 2 != 0 || i % 5 == 0; });
+        CHECK(search_database_test_equal(last_results, expected));
+        array_deallocate(expected);
+        array_deallocate(last_results);
+
+        // Queries still running when the database gets deallocated are cancelled and waited for.
+        for (unsigned i = 0; i < 8; ++i)
+            search_database_query_async(db, STRING_CONST("even or three or five"));
+
+        array_deallocate(docs);
+        search_database_deallocate(db);
+        CHECK_EQ(db, nullptr);
+    }
+
+    TEST_CASE("Journal" * doctest::timeout(30))
+    {
+        char snapshot_buffer[BUILD_MAX_PATHLEN];
+        char journal_buffer[BUILD_MAX_PATHLEN];
+        string_t snapshot_path = search_database_test_temporary_path(STRING_BUFFER(snapshot_buffer));
+        string_t journal_path = search_database_test_temporary_path(STRING_BUFFER(journal_buffer));
+
+        auto open = [&](bool load_snapshot)
+        {
+            search_database_t* db = search_database_allocate();
+            if (load_snapshot)
+                REQUIRE(search_database_test_load(db, snapshot_path));
+            REQUIRE(search_database_open_journal(db, STRING_ARGS(journal_path)));
+            return db;
+        };
+
+        auto remove_documents = [](search_database_t* db, unsigned begin, unsigned end, unsigned step)
+        {
+            for (unsigned i = begin; i < end; i += step)
+            {
+                string_const_t name = search_database_test_document_name(i);
+                search_document_handle_t doc = search_database_find_document(db, STRING_ARGS(name));
+                if (doc != SEARCH_DOCUMENT_INVALID_ID)
+                    search_database_remove_document(db, doc);
+            }
+        };
+
+        // Replay a journal without snapshot
+        search_database_t* db = open(false);
+        search_database_test_add_documents(db, 0, 100);
+        remove_documents(db, 0, 100, 7);
+        search_database_test_add_documents(db, 100, 120);
+        const size_t journal_size = search_database_journal_size(db);
+        CHECK_GT(journal_size, 0);
+
+        search_database_t* reference = search_database_allocate();
+        search_database_test_add_documents(reference, 0, 100);
+        remove_documents(reference, 0, 100, 7);
+        search_database_test_add_documents(reference, 100, 120);
+        search_database_deallocate(db);
+
+        db = open(false);
+        CHECK_EQ(search_database_journal_size(db), journal_size);
+        CHECK_EQ(search_database_document_count(db), search_database_document_count(reference));
+        search_database_test_check_same_results(db, reference);
+
+        // Replay the journal records not included in a snapshot
+        REQUIRE(search_database_test_save(db, snapshot_path));
+        search_database_test_add_documents(db, 120, 150);
+        remove_documents(db, 0, 150, 5);
+        search_database_test_add_documents(reference, 120, 150);
+        remove_documents(reference, 0, 150, 5);
+        search_database_deallocate(db);
+
+        db = open(true);
+        search_database_test_check_same_results(db, reference);
+
+        // Compaction saves a new snapshot and drops the journal records it includes
+        const size_t size_before_compaction = search_database_journal_size(db);
+        REQUIRE(search_database_compact_journal(db, STRING_ARGS(snapshot_path)));
+        search_database_test_add_documents(db, 150, 160);
+        search_database_test_add_documents(reference, 150, 160);
+        const tick_t start = time_current();
+        while (search_database_is_compacting_journal(db) && time_elapsed(start) < 10.0)
+            thread_sleep(1);
+        REQUIRE_FALSE(search_database_is_compacting_journal(db));
+        CHECK_LT(search_database_journal_size(db), size_before_compaction);
+        search_database_deallocate(db);
+
+        db = open(true);
+        search_database_test_check_same_results(db, reference);
+
+        // A torn journal record is dropped and the journal keeps working after it
+        search_database_test_add_documents(db, 160, 170);
+        search_database_test_add_documents(reference, 160, 170);
+        CHECK(search_database_remove_document(db, search_database_find_document(db, STRING_CONST("doc169"))));
+        const size_t full_size = search_database_journal_size(db);
+        search_database_deallocate(db);
+
+        stream_t* journal = fs_open_file(STRING_ARGS(journal_path), STREAM_IN | STREAM_OUT | STREAM_BINARY);
+        REQUIRE_NE(journal, nullptr);
+        stream_truncate(journal, full_size - 3);
+        stream_deallocate(journal);
+
+        db = open(true);
+        CHECK(search_database_is_document_valid(db, search_database_find_document(db, STRING_CONST("doc169"))));
+        search_database_test_check_same_results(db, reference);
+        search_database_test_add_documents(db, 200, 210);
+        search_database_test_add_documents(reference, 200, 210);
+        search_database_deallocate(db);
+
+        db = open(true);
+        CHECK_NE(search_database_find_document(db, STRING_CONST("doc205")), SEARCH_DOCUMENT_INVALID_ID);
+        search_database_test_check_same_results(db, reference);
+
+        search_database_deallocate(db);
+        search_database_deallocate(reference);
+        fs_remove_file(STRING_ARGS(journal_path));
+        fs_remove_file(STRING_ARGS(snapshot_path));
+    }
+}
+
+#endif // BUILD_TESTS
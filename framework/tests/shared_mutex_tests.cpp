@@ -0,0 +1,150 @@
+/*
+ * Copyright 2022-2023 - All rights reserved.
+ * License: https://wiimag.com/LICENSE
+ */
+
+#include <foundation/platform.h>
+
+#if BUILD_TESTS
+
+#include "test_utils.h"
+
+#include <framework/shared_mutex.h>
+
+#include <foundation/thread.h>
+
+#include <doctest/doctest.h>
+
+TEST_SUITE("SharedMutex")
+{
+    TEST_CASE("Lock")
+    {
+        shared_mutex mutex("Test");
+        CHECK_FALSE(mutex.locked());
+        CHECK(string_equal(mutex.name(), string_length(mutex.name()), STRING_CONST("Test")));
+
+        REQUIRE(mutex.shared_lock());
+        REQUIRE(mutex.shared_lock());
+        CHECK(mutex.locked());
+        CHECK(mutex.shared_unlock());
+        CHECK(mutex.shared_unlock());
+        CHECK_FALSE(mutex.locked());
+
+        REQUIRE(mutex.exclusive_lock());
+        CHECK(mutex.locked());
+        CHECK(mutex.exclusive_unlock());
+        CHECK_FALSE(mutex.locked());
+
+        CHECK_EQ(mutex.stats().contentions, 0);
+    }
+
+    TEST_CASE("Readers And Writers")
+    {
+        static shared_mutex mutex;
+        static volatile int32_t value = 0;
+        static volatile int32_t copy = 0;
+        static atomic32_t mismatches;
+        atomic_store32(&mismatches, 0, memory_order_release);
+
+        auto writer = [](void*)->void*
+        {
+            for (int i = 0; i < 1000; ++i)
+            {
+                SHARED_WRITE_LOCK(mutex);
+                value = value + 1;
+                thread_yield();
+                copy = value;
+            }
+            return nullptr;
+        };
+
+        auto reader = [](void*)->void*
+        {
+            for (int i = 0; i < 1000; ++i)
+            {
+                SHARED_READ_LOCK(mutex);
+                if (value != copy)
+                    atomic_incr32(&mismatches, memory_order_relaxed);
+
+                // Nested shared locks must not wait for pending writers
+                SHARED_READ_LOCK(mutex);
+                thread_yield();
+            }
+            return nullptr;
+        };
+
+        thread_t* threads[4];
+        threads[0] = thread_allocate(writer, nullptr, STRING_CONST("Writer 1"), THREAD_PRIORITY_NORMAL, 0);
+        threads[1] = thread_allocate(writer, nullptr, STRING_CONST("Writer 2"), THREAD_PRIORITY_NORMAL, 0);
+        threads[2] = thread_allocate(reader, nullptr, STRING_CONST("Reader 1"), THREAD_PRIORITY_NORMAL, 0);
+        threads[3] = thread_allocate(reader, nullptr, STRING_CONST("Reader 2"), THREAD_PRIORITY_NORMAL, 0);
+        for (auto t : threads)
+            REQUIRE(thread_start(t));
+
+        for (auto t : threads)
+        {
+            thread_join(t);
+            thread_deallocate(t);
+        }
+
+        CHECK_EQ(value, 2000);
+        CHECK_EQ(atomic_load32(&mismatches, memory_order_acquire), 0);
+        CHECK_FALSE(mutex.locked());
+
+        shared_mutex_stats_t stats = mutex.stats();
+        CHECK_LE(stats.waits, stats.contentions);
+    }
+
+    TEST_CASE("Writer Preference")
+    {
+        static shared_mutex held;
+        static shared_mutex contended;
+        static volatile bool written = false;
+        static volatile bool written_before_read = false;
+        written = false;
+        written_before_read = false;
+
+        auto writer = [](void*)->void*
+        {
+            SHARED_WRITE_LOCK(contended);
+            written = true;
+            return nullptr;
+        };
+
+        // Holding a shared lock on another mutex must not bypass the writer waiting on this one.
+        auto reader = [](void*)->void*
+        {
+            SHARED_READ_LOCK(held);
+            SHARED_READ_LOCK(contended);
+            written_before_read = written;
+            return nullptr;
+        };
+
+        REQUIRE(contended.shared_lock());
+        thread_t* writer_thread = thread_allocate(writer, nullptr, STRING_CONST("Writer"), THREAD_PRIORITY_NORMAL, 0);
+        REQUIRE(thread_start(writer_thread));
+        while (contended.stats().contentions == 0)
+            thread_yield();
+
+        thread_t* reader_thread = thread_allocate(reader, nullptr, STRING_CONST("Reader"), THREAD_PRIORITY_NORMAL, 0);
+        REQUIRE(thread_start(reader_thread));
+        thread_sleep(50);
+
+        // Nested shared locks on the same mutex still bypass the waiting writer.
+        REQUIRE(contended.shared_lock());
+        CHECK(contended.shared_unlock());
+        CHECK(contended.shared_unlock());
+
+        thread_join(writer_thread);
+        thread_join(reader_thread);
+        thread_deallocate(writer_thread);
+        thread_deallocate(reader_thread);
+
+        CHECK(written);
+        CHECK(written_before_read);
+        CHECK_FALSE(contended.locked());
+        CHECK_FALSE(held.locked());
+    }
+}
+
+#endif // BUILD_TESTS